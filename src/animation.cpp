@@ -0,0 +1,440 @@
+#include "animation.h"
+#include "stb_image.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+
+static const uint32_t MIN_SLOTS = 6; // on screen, a couple waiting out the frames in flight, the rest decode ahead
+static const uint32_t MAX_SLOTS = 64;
+static const uint32_t MAX_SKIP = 8; // GIF frames thrown away in a row before a late one goes up anyway
+
+// Walks the blocks without decoding anything, for the frame count and delays
+static bool scanGIF(const uint8_t *data, size_t size, std::vector<double> &delays)
+{
+	if (size < 13 || memcmp(data, "GIF8", 4))
+		return false;
+
+	size_t pos = 13;
+	if (data[10] & 0x80)
+		pos += 3 * (2 << (data[10] & 7));
+
+	auto skipSubBlocks = [&]() {
+		while (pos < size && data[pos])
+			pos += data[pos] + 1;
+		pos++;
+	};
+
+	double delay = 0.0; // stb keeps the last one for frames without their own
+	while (pos < size) {
+		uint8_t tag = data[pos++];
+		if (tag == 0x21 && pos < size) {
+			uint8_t label = data[pos++];
+			if (label == 0xF9 && pos + 5 <= size && data[pos] == 4)
+				delay = (data[pos + 2] | data[pos + 3] << 8) / 100.0;
+			skipSubBlocks();
+		} else if (tag == 0x2C && pos + 10 <= size) {
+			uint8_t flags = data[pos + 8];
+			pos += 9;
+			if (flags & 0x80)
+				pos += 3 * (2 << (flags & 7));
+			pos++; // LZW code size
+			skipSubBlocks();
+
+			if (pos > size)
+				break; // cut off, stb fails on it too
+
+			// Browsers show frames with no delay for 100 ms, so files are made for that
+			delays.push_back(delay > 0.01 ? delay : 0.1);
+		} else {
+			break; // trailer or garbage
+		}
+	}
+
+	return !delays.empty();
+}
+
+// frame2.png before frame10.png
+static bool numericLess(const std::string &a, const std::string &b)
+{
+	size_t i = 0, j = 0;
+	while (i < a.size() && j < b.size()) {
+		if (isdigit(static_cast<unsigned char>(a[i])) && isdigit(static_cast<unsigned char>(b[j]))) {
+			size_t endA = i, endB = j;
+			while (endA < a.size() && isdigit(static_cast<unsigned char>(a[endA])))
+				endA++;
+			while (endB < b.size() && isdigit(static_cast<unsigned char>(b[endB])))
+				endB++;
+
+			unsigned long long x = strtoull(a.c_str() + i, nullptr, 10), y = strtoull(b.c_str() + j, nullptr, 10);
+			if (x != y)
+				return x < y;
+
+			i = endA;
+			j = endB;
+		} else {
+			if (a[i] != b[j])
+				return a[i] < b[j];
+
+			i++;
+			j++;
+		}
+	}
+
+	return a.size() - i < b.size() - j;
+}
+
+// One %d, optionally zero padded like %04d, and no other conversions
+static bool isFramePattern(const char *path)
+{
+	const char *percent = strchr(path, '%');
+	if (!percent)
+		return false;
+
+	const char *c = percent + 1;
+	while (isdigit(static_cast<unsigned char>(*c)))
+		c++;
+
+	return *c == 'd' && !strchr(c, '%');
+}
+
+bool Animation::OpenGIF(const char *path)
+{
+	Release();
+
+	std::vector<double> delays;
+	if (!file.Open(path, MappedFile::ACCESS_SEQUENTIAL) || !scanGIF(file.getData(), file.getSize(), delays) || delays.size() < 2) {
+		file.Close();
+		return false;
+	}
+
+	int x, y;
+	stream = stbi_gif_stream_open(file.getData(), static_cast<int>(std::min<size_t>(file.getSize(), INT32_MAX)), &x, &y);
+	if (!stream) {
+		file.Close();
+		return false;
+	}
+
+	width = x;
+	height = y;
+
+	for (double delay : delays) {
+		frameStart.push_back(loopLength);
+		loopLength += delay;
+	}
+
+	return true;
+}
+
+bool Animation::OpenSequence(const char *path, double fps)
+{
+	Release();
+
+	if (isFramePattern(path)) {
+		// Numbering starts anywhere from 0 to 4 and runs until the first gap
+		char name[4096];
+		int number = 0;
+		std::error_code ec;
+
+		for (; number < 5; number++) {
+			snprintf(name, sizeof(name), path, number);
+			if (std::filesystem::is_regular_file(name, ec))
+				break;
+		}
+
+		for (;; number++) {
+			snprintf(name, sizeof(name), path, number);
+			if (!std::filesystem::is_regular_file(name, ec))
+				break;
+
+			paths.push_back(name);
+		}
+	} else if (ListImages(path, paths)) {
+		std::sort(paths.begin(), paths.end(), numericLess);
+	}
+
+	int x, y;
+	if (paths.empty() || !decoder.Info(paths[0].c_str(), x, y)) {
+		paths.clear();
+		return false;
+	}
+
+	width = x;
+	height = y;
+
+	fps = fps > 0.0 ? fps : 24.0;
+	for (size_t i = 0; i < paths.size(); i++)
+		frameStart.push_back(i / fps);
+	loopLength = paths.size() / fps;
+
+	return true;
+}
+
+void Animation::Setup(VulkanCTX *ctx, JobSystem *jobs, size_t memoryBudget)
+{
+	this->ctx = ctx;
+	this->jobs = jobs;
+
+	if (!isOpen())
+		return;
+
+	// Every slot holds a texture and, while it's on its way up, a staging buffer as big.
+	// Frames go up as plain RGBA, block compressing each one would never keep up.
+	decoder.SetRGBA8(true);
+	size_t slotBytes = 2 * static_cast<size_t>(width) * height * 4;
+	size_t slots = std::max<size_t>(MIN_SLOTS, std::min<size_t>(MAX_SLOTS, memoryBudget / slotBytes));
+
+	for (size_t i = 0; i < slots; i++)
+		ring.emplace_back(new Slot);
+
+	started = false;
+	streamFrame = nextFrame = 0;
+	Schedule();
+}
+
+void Animation::Release()
+{
+	// Workers still fill their slots, wait for them but not for everyone else's jobs
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		idle.wait(lock, [this] { return !running; });
+	}
+
+	// The frame on screen goes along with the rest, the ring only retires once nothing samples it
+	for (auto &slot : ring) {
+		if (slot->state == SLOT_DECODED || slot->state == SLOT_UPLOADING)
+			ctx->CancelUpload(slot->upload);
+		if (slot->texture.image != VK_NULL_HANDLE)
+			ctx->RetireTexture(slot->texture);
+	}
+
+	ring.clear();
+	shown = nullptr;
+	started = false;
+
+	stbi_gif_stream_close(stream);
+	stream = nullptr;
+	streamBusy = streamBroken = false;
+	file.Close();
+
+	paths.clear();
+	frameStart.clear();
+	loopLength = 0.0;
+	width = height = 0;
+	lastLate = ~uint64_t(0);
+}
+
+void Animation::Update()
+{
+	if (ring.empty())
+		return;
+
+	// Hand decoded frames to the transfer queue and collect the finished ones
+	for (auto &slot : ring) {
+		if (slot->state == SLOT_DECODED) {
+			if (slot->texture.image != VK_NULL_HANDLE) {
+				ctx->SubmitUpload(slot->upload, slot->texture);
+			} else if (!ctx->SubmitUpload(slot->upload)) {
+				// No device memory left even after evicting, this frame gets skipped
+				ctx->CancelUpload(slot->upload);
+				slot->state = SLOT_FREE;
+				continue;
+			}
+			slot->state = SLOT_UPLOADING;
+		} else if (slot->state == SLOT_UPLOADING && ctx->PollUpload(slot->upload)) {
+			if (slot->texture.image == VK_NULL_HANDLE)
+				slot->texture = slot->upload.texture;
+			slot->upload = VulkanUpload();
+			slot->state = SLOT_READY;
+		}
+	}
+
+	// The newest ready frame that's due, playback starts with whichever frame is ready first
+	Slot *next = nullptr;
+	uint64_t due = 0;
+
+	if (!started) {
+		for (auto &slot : ring) {
+			if (slot->state == SLOT_READY && (!next || slot->frame < next->frame))
+				next = slot.get();
+		}
+
+		if (next) {
+			startTime = Clock::now() - std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(getStart(next->frame)));
+			started = true;
+			due = next->frame;
+		}
+	} else {
+		due = FrameAt(getPlayTime());
+		for (auto &slot : ring) {
+			if (slot->state == SLOT_READY && slot->frame <= due && slot->frame > shown->frame && (!next || slot->frame > next->frame))
+				next = slot.get();
+		}
+	}
+
+	// Anything older that's ready never makes it to the screen
+	uint64_t oldest = next ? next->frame : shown ? shown->frame + 1 : 0;
+	for (auto &slot : ring) {
+		if (slot->state == SLOT_READY && slot->frame < oldest) {
+			slot->state = SLOT_FREE;
+			droppedCount++;
+		}
+	}
+
+	if (next) {
+		if (shown) {
+			shown->retiredFrame = ctx->getFrameCount();
+			shown->state = SLOT_FREE;
+		}
+
+		ctx->ShowTexture(next->texture);
+		next->state = SLOT_SHOWN;
+		shown = next;
+		shownCount++;
+	} else if (started && shown->frame < due && lastLate != due) {
+		lateCount++;
+		lastLate = due;
+	}
+
+	Schedule();
+}
+
+void Animation::Schedule()
+{
+	uint64_t due = started ? FrameAt(getPlayTime()) : 0;
+
+	for (auto &slot : ring) {
+		if (slot->state != SLOT_FREE || (slot->retiredFrame && !ctx->isFrameRetired(slot->retiredFrame)))
+			continue;
+
+		// GIFs have no paths, the stream itself belongs to the job while it runs
+		if (paths.empty()) {
+			if (streamBusy || streamBroken)
+				return;
+
+			streamBusy = true;
+			slot->state = SLOT_DECODING;
+			Slot *target = slot.get();
+			Submit([this, target]() { DecodeGIF(target); });
+			return;
+		}
+
+		// Frames that are already late aren't worth decoding
+		if (nextFrame < due) {
+			droppedCount += due - nextFrame;
+			nextFrame = due;
+		}
+
+		slot->frame = nextFrame++;
+		slot->state = SLOT_DECODING;
+		Slot *target = slot.get();
+		Submit([this, target]() { DecodeSequence(target); });
+	}
+}
+
+void Animation::Submit(std::function<void()> job)
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		running++;
+	}
+
+	jobs->Submit([this, job]() {
+		job();
+
+		std::lock_guard<std::mutex> lock(mutex);
+		if (--running == 0)
+			idle.notify_all();
+	});
+}
+
+void Animation::DecodeGIF(Slot *slot)
+{
+	for (uint32_t skipped = 0;; skipped++) {
+		uint64_t frame = streamFrame++;
+
+		// Back to the start for the next loop
+		if (frame % frameStart.size() == 0 && frame) {
+			stbi_gif_stream_close(stream);
+			int x, y;
+			stream = stbi_gif_stream_open(file.getData(), static_cast<int>(std::min<size_t>(file.getSize(), INT32_MAX)), &x, &y);
+		}
+
+		uint8_t *pixels = stream ? stbi_gif_stream_next(stream, nullptr) : nullptr;
+		if (!pixels) {
+			// Corrupt or cut short, the last good frame stays up until the next loop starts over.
+			// Nothing left to play if not even the first frame decodes.
+			if (frame % frameStart.size() == 0)
+				streamBroken = true;
+
+			streamFrame = (frame / frameStart.size() + 1) * frameStart.size();
+			slot->state = SLOT_FREE;
+			break;
+		}
+
+		// The frame after this one is due already, no point uploading it. Every GIF frame
+		// builds on the last one though, so the decode can't be skipped.
+		if (started && skipped < MAX_SKIP && getStart(frame + 1) <= getPlayTime()) {
+			droppedCount++;
+			continue;
+		}
+
+		if (!ctx->PrepareRawUpload(pixels, VK_FORMAT_R8G8B8A8_SRGB, width, height, slot->upload)) {
+			slot->state = SLOT_FREE;
+			break;
+		}
+
+		slot->frame = frame;
+		slot->state = SLOT_DECODED;
+		break;
+	}
+
+	streamBusy = false;
+}
+
+void Animation::DecodeSequence(Slot *slot)
+{
+	const std::string &path = paths[slot->frame % paths.size()];
+
+	Image image;
+	bool prepared = decoder.Load(path.c_str(), image);
+	if (prepared && (static_cast<uint32_t>(image.width) != width || static_cast<uint32_t>(image.height) != height)) {
+		std::cout << path << " is " << image.width << "x" << image.height << ", the sequence is " << width << "x" << height << ", skipping :(" << std::endl;
+		prepared = false;
+	}
+
+	prepared = prepared && ctx->PrepareRawUpload(image.data, VK_FORMAT_R8G8B8A8_SRGB, width, height, slot->upload);
+	FreeImage(image);
+
+	if (!prepared) {
+		droppedCount++;
+		slot->state = SLOT_FREE;
+		return;
+	}
+
+	slot->state = SLOT_DECODED;
+}
+
+uint64_t Animation::FrameAt(double seconds)
+{
+	uint64_t loops = static_cast<uint64_t>(seconds / loopLength);
+	double offset = seconds - loops * loopLength;
+	size_t index = std::upper_bound(frameStart.begin(), frameStart.end(), offset) - frameStart.begin();
+
+	return loops * frameStart.size() + (index ? index - 1 : 0);
+}
+
+double Animation::getStart(uint64_t frame)
+{
+	return (frame / frameStart.size()) * loopLength + frameStart[frame % frameStart.size()];
+}
+
+void Animation::PrintStats()
+{
+	if (!shownCount)
+		return;
+
+	std::cout << "Animation frames: " << shownCount << " shown, " << droppedCount << " dropped, "
+		<< lateCount << " times late with nothing new to show" << std::endl;
+}
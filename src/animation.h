@@ -0,0 +1,99 @@
+#pragma once
+
+#include "fileutil.h"
+#include "image.h"
+#include "jobs.h"
+#include "vulkanctx.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+struct stbi_gif_stream;
+
+// Plays an animated GIF or a numbered image sequence. Frames are decoded ahead on the job
+// system into a fixed ring of textures sized by a memory budget, and each one goes up when
+// its delay comes around. Frames that are late get skipped, the render loop never waits.
+class Animation {
+public:
+	Animation() {}
+	virtual ~Animation() {}
+
+	bool OpenGIF(const char *path); // false unless it's a GIF with more than one frame
+	bool OpenSequence(const char *path, double fps); // every image in a directory in numeric order, or a pattern like frames/%04d.png
+	void Setup(VulkanCTX *ctx, JobSystem *jobs, size_t memoryBudget); // after Open*(), the first frame goes up as soon as it's decoded
+	void Release(); // safe without anything open
+
+	void Update(); // call once per frame after VulkanCTX::Update() or WaitFrame()
+
+	void PrintStats();
+
+	inline bool isOpen() { return !frameStart.empty(); }
+	inline size_t getFrameCount() { return frameStart.size(); }
+	inline const std::string &getFramePath(size_t index) { return paths[index]; } // sequences only
+
+protected:
+	typedef std::chrono::steady_clock Clock;
+
+	enum SlotState {
+		SLOT_FREE, // reusable once no frame samples its texture anymore
+		SLOT_DECODING, // on a worker
+		SLOT_DECODED, // staging buffer filled, waiting for SubmitUpload()
+		SLOT_UPLOADING, // on the transfer queue
+		SLOT_READY,
+		SLOT_SHOWN
+	};
+
+	struct Slot {
+		std::atomic<int> state{SLOT_FREE};
+		uint64_t frame = 0; // playback position, keeps counting up across loops
+		VulkanUpload upload;
+		VulkanTexture texture; // made by the slot's first upload and reused after that
+		uint64_t retiredFrame = 0; // VulkanCTX frame it went off screen, 0 if it never made it up
+	};
+
+	void Schedule();
+	void Submit(std::function<void()> job); // Release() only waits on these, not on the whole job system
+	void DecodeGIF(Slot *slot);
+	void DecodeSequence(Slot *slot);
+	uint64_t FrameAt(double seconds); // playback position that's due this far into playback
+	double getStart(uint64_t frame); // seconds into playback
+	inline double getPlayTime() { return std::chrono::duration<double>(Clock::now() - startTime).count(); }
+
+	VulkanCTX *ctx = nullptr;
+	JobSystem *jobs = nullptr;
+
+	std::vector<double> frameStart; // seconds into a loop, one per frame
+	double loopLength = 0.0;
+	uint32_t width = 0, height = 0;
+
+	// GIFs decode in order, one frame after the other, only one job at a time touches the stream
+	MappedFile file;
+	stbi_gif_stream *stream = nullptr;
+	uint64_t streamFrame = 0; // playback position of the next frame out of the stream
+	std::atomic<bool> streamBusy{false};
+	std::atomic<bool> streamBroken{false};
+
+	// Sequence frames are independent, every free slot can decode one
+	std::vector<std::string> paths;
+	Decoder decoder;
+	uint64_t nextFrame = 0;
+
+	std::vector<std::unique_ptr<Slot>> ring;
+	Slot *shown = nullptr;
+
+	Clock::time_point startTime; // set once the first frame is up, workers only read it after started
+	std::atomic<bool> started{false};
+
+	std::mutex mutex;
+	std::condition_variable idle;
+	uint32_t running = 0;
+
+	std::atomic<uint64_t> shownCount{0};
+	std::atomic<uint64_t> droppedCount{0}; // decoded or skipped, never on screen
+	uint64_t lateCount = 0; // frames that were due with nothing new to show
+	uint64_t lastLate = ~uint64_t(0);
+};
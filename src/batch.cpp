@@ -0,0 +1,231 @@
+#include "batch.h"
+#include "bufferpool.h"
+#include "fileutil.h"
+#include "pngencode.h"
+
+#include <deque>
+#include <filesystem>
+#include <thread>
+
+bool BatchFilter::AddPath(const char *path)
+{
+	return ListImages(path, paths);
+}
+
+bool BatchFilter::Run(VulkanCTX *ctx, const char *outDir, uint32_t decodeThreads, uint32_t encodeThreads, uint32_t readDepth)
+{
+	std::error_code ec;
+	std::filesystem::create_directories(outDir, ec);
+	if (!std::filesystem::is_directory(outDir, ec)) {
+		std::cout << "Can't create output directory " << outDir << " :(" << std::endl;
+		return false;
+	}
+
+	this->ctx = ctx;
+	this->outDir = outDir;
+	this->decodeThreads = decodeThreads ? decodeThreads : 1;
+	this->encodeThreads = encodeThreads ? encodeThreads : 1;
+	decoder.SetRGBA8(true);
+
+	// Enough decoded images to refill every slot, and one filtered image per encoder
+	// waiting so the GPU loop rarely blocks handing results over
+	uint32_t slotCount = ctx->getOffscreenSlotCount();
+	decoded.Reset(slotCount);
+	filtered.Reset(this->encodeThreads);
+
+	decodersLeft = this->decodeThreads;
+
+	Clock::time_point start = Clock::now();
+
+	// Every read is queued up front, the reader keeps readDepth of them in flight and stalls
+	// once as many files wait for a decoder
+	reader.Setup(readDepth);
+	files.Reset(reader.getDepth());
+	readsLeft = paths.size();
+	if (paths.empty())
+		files.Close();
+
+	for (size_t i = 0; i < paths.size(); i++) {
+		reader.Read(paths[i], [this, i](uint8_t *data, size_t size) {
+			files.Push({ i, data, size });
+			if (--readsLeft == 0)
+				files.Close();
+		});
+	}
+
+	std::vector<std::thread> threads;
+	for (uint32_t i = 0; i < this->decodeThreads; i++)
+		threads.emplace_back(&BatchFilter::DecodeLoop, this);
+	for (uint32_t i = 0; i < this->encodeThreads; i++)
+		threads.emplace_back(&BatchFilter::EncodeLoop, this);
+
+	// Only this thread touches the graphics queue
+	GPULoop();
+
+	for (auto &thread : threads)
+		thread.join();
+
+	reader.Release();
+	wallTime = Seconds(start);
+
+	return failed == 0;
+}
+
+void BatchFilter::DecodeLoop()
+{
+	for (;;) {
+		Clock::time_point waitStart = Clock::now();
+		File file;
+		if (!files.Pop(file))
+			break;
+
+		Clock::time_point start = Clock::now();
+		readStallNs += std::chrono::duration_cast<std::chrono::nanoseconds>(start - waitStart).count();
+
+		Image image;
+		bool loaded = file.data && decoder.Load(file.data, file.size, image);
+		bufferPool.Free(file.data);
+
+		Decoded item;
+		item.index = file.index;
+		bool prepared = loaded && ctx->PrepareUpload(image.data, image.width, image.height, item.upload);
+		FreeImage(image);
+
+		decodeBusyNs += Nanoseconds(start);
+
+		if (!prepared) {
+			const char *reason = !file.data ? "read failed" : loaded ? "upload failed" : decoder.getError();
+			std::cout << "Failed to load " << paths[file.index] << " (" << reason << ") :(" << std::endl;
+			failed++;
+			continue;
+		}
+
+		decoded.Push(std::move(item));
+	}
+
+	// Last one out lets the GPU loop know nothing else is coming
+	if (--decodersLeft == 0)
+		decoded.Close();
+}
+
+void BatchFilter::GPULoop()
+{
+	struct InFlight {
+		uint32_t slot;
+		size_t index;
+		uint32_t readback;
+	};
+
+	std::deque<InFlight> inFlight; // in submission order, the graphics queue finishes them in order too
+	std::vector<uint32_t> freeSlots;
+	for (uint32_t i = 0; i < ctx->getOffscreenSlotCount(); i++)
+		freeSlots.push_back(i);
+
+	Clock::time_point busySince;
+	bool inputDone = false;
+
+	while (!inputDone || !inFlight.empty()) {
+		// Fill every idle slot we have input for. Only block on the decoders when the GPU has nothing to do.
+		while (!inputDone && !freeSlots.empty()) {
+			Decoded item;
+
+			if (inFlight.empty()) {
+				Clock::time_point waitStart = Clock::now();
+				bool popped = decoded.Pop(item);
+				decodeStall += Seconds(waitStart);
+
+				if (!popped) {
+					inputDone = true;
+					break;
+				}
+			} else if (!decoded.TryPop(item)) {
+				inputDone = decoded.Drained();
+				break;
+			}
+
+			InFlight job;
+			job.slot = freeSlots.back();
+			job.index = item.index;
+			freeSlots.pop_back();
+
+			if (inFlight.empty())
+				busySince = Clock::now();
+
+			job.readback = ctx->SubmitOffscreen(job.slot, item.upload);
+			inFlight.push_back(job);
+		}
+
+		if (inFlight.empty())
+			continue;
+
+		// With idle slots left, only wait a little so new input gets submitted quickly
+		InFlight &job = inFlight.front();
+		if (!ctx->PollOffscreen(job.slot, freeSlots.empty() ? UINT64_MAX : 1000000))
+			continue;
+
+		// The slot can take the next image right away, its result lives on in the readback ring
+		Filtered result;
+		result.index = job.index;
+		result.readback = job.readback;
+
+		// The readback's event is set before the fence signals, so this never actually spins
+		while (!ctx->PollReadback(job.readback))
+			std::this_thread::yield();
+
+		freeSlots.push_back(job.slot);
+		inFlight.pop_front();
+
+		if (inFlight.empty())
+			gpuBusy += Seconds(busySince);
+
+		Clock::time_point waitStart = Clock::now();
+		filtered.Push(result);
+		encodeStall += Seconds(waitStart);
+	}
+
+	filtered.Close();
+}
+
+void BatchFilter::EncodeLoop()
+{
+	Filtered item;
+
+	while (filtered.Pop(item)) {
+		Clock::time_point start = Clock::now();
+
+		// Keeps the source extension, a.jpg and a.png next to each other would write the same file otherwise
+		std::filesystem::path path = std::filesystem::path(outDir) / std::filesystem::path(paths[item.index]).filename();
+		path += ".png";
+
+		uint32_t width = ctx->getReadbackWidth(item.readback);
+		uint32_t height = ctx->getReadbackHeight(item.readback);
+
+		if (WritePNG(path.string().c_str(), ctx->getReadbackData(item.readback), width, height, width * 4)) {
+			written++;
+		} else {
+			std::cout << "Failed to write " << path.string() << " :(" << std::endl;
+			failed++;
+		}
+
+		ctx->FreeReadback(item.readback);
+		encodeBusyNs += Nanoseconds(start);
+	}
+}
+
+void BatchFilter::PrintStats()
+{
+	if (wallTime <= 0.0)
+		return;
+
+	double decodeBusy = decodeBusyNs * 1e-9;
+	double encodeBusy = encodeBusyNs * 1e-9;
+
+	std::cout << "Filtered " << written << " of " << paths.size() << " images in " << wallTime << " s, "
+		<< written / wallTime << " images/s" << std::endl;
+	std::cout << "  read:   " << reader.getDepth() << (reader.usingIOUring() ? " in flight on io_uring" : " threads") << std::endl;
+	std::cout << "  decode: " << decodeThreads << " threads, " << 100.0 * decodeBusy / (decodeThreads * wallTime) << "% busy"
+		<< ", waited on reads " << readStallNs * 1e-9 << " s" << std::endl;
+	std::cout << "  gpu:    " << ctx->getOffscreenSlotCount() << " slots, " << 100.0 * gpuBusy / wallTime << "% busy"
+		<< ", starved " << decodeStall << " s, blocked on encode " << encodeStall << " s" << std::endl;
+	std::cout << "  encode: " << encodeThreads << " threads, " << 100.0 * encodeBusy / (encodeThreads * wallTime) << "% busy" << std::endl;
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include "filereader.h"
+#include "image.h"
+#include "jobs.h"
+#include "vulkanctx.h"
+#include <atomic>
+#include <chrono>
+#include <string>
+
+// Runs the filter over a list of images and writes the results as <name>.<ext>.png. The file
+// reader, decode threads, the GPU and encode threads form a pipeline with bounded
+// queues in between, and every offscreen slot can hold an image in flight on the GPU.
+class BatchFilter {
+public:
+	BatchFilter() {}
+	virtual ~BatchFilter() {}
+
+	bool AddPath(const char *path);
+	bool Run(VulkanCTX *ctx, const char *outDir, uint32_t decodeThreads, uint32_t encodeThreads, uint32_t readDepth); // ctx needs SetupOffscreen() and SetupReadback() first
+	static inline uint32_t getReadbackCount(uint32_t slots, uint32_t encodeThreads) { return slots + 2 * encodeThreads + 1; } // in flight + queued + encoding
+
+	void PrintStats();
+
+	inline size_t getCount() { return paths.size(); }
+
+protected:
+	typedef std::chrono::steady_clock Clock;
+
+	struct File {
+		size_t index;
+		uint8_t *data; // bufferPool block, nullptr if the read failed
+		size_t size;
+	};
+
+	struct Decoded {
+		size_t index;
+		VulkanUpload upload;
+	};
+
+	struct Filtered {
+		size_t index;
+		uint32_t readback; // encoded straight from mapped memory, freed by the encoder
+	};
+
+	void DecodeLoop();
+	void GPULoop();
+	void EncodeLoop();
+
+	static inline double Seconds(Clock::time_point start) { return std::chrono::duration<double>(Clock::now() - start).count(); }
+	static inline uint64_t Nanoseconds(Clock::time_point start) { return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count(); }
+
+	VulkanCTX *ctx = nullptr;
+	Decoder decoder; // shared by the decode threads
+	std::string outDir;
+	std::vector<std::string> paths;
+	std::atomic<size_t> readsLeft{0};
+	std::atomic<uint32_t> decodersLeft{0};
+
+	FileReader reader;
+	BoundedQueue<File> files;
+	BoundedQueue<Decoded> decoded;
+	BoundedQueue<Filtered> filtered;
+
+	// Per stage busy time, summed over the stage's threads
+	uint32_t decodeThreads = 0, encodeThreads = 0;
+	std::atomic<uint64_t> decodeBusyNs{0};
+	std::atomic<uint64_t> readStallNs{0}; // decode threads waiting on the reader
+	std::atomic<uint64_t> encodeBusyNs{0};
+	double gpuBusy = 0.0; // seconds with any slot in flight
+	double decodeStall = 0.0; // GPU loop waiting on decoded images with idle slots
+	double encodeStall = 0.0; // GPU loop blocked on a full encode queue
+	double wallTime = 0.0;
+
+	std::atomic<uint32_t> written{0};
+	std::atomic<uint32_t> failed{0};
+};
@@ -0,0 +1,460 @@
+#include "bcenc.h"
+#include "jobs.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <emmintrin.h>
+
+// Blocks are worked on as 16 pixels per channel in float, four SSE registers each
+
+struct BlockSoA {
+	__m128 c[4][4]; // channel, group of 4 pixels
+};
+
+static inline void loadBlock(BlockSoA &block, const uint8_t *rgba)
+{
+	for (int g = 0; g < 4; g++) {
+		const uint8_t *p = rgba + g * 16;
+		for (int ch = 0; ch < 4; ch++)
+			block.c[ch][g] = _mm_setr_ps(p[ch], p[4 + ch], p[8 + ch], p[12 + ch]);
+	}
+}
+
+// Principal axis through the mean of the block, by power iteration on the covariance
+static void principalAxis(const uint8_t *rgba, int channels, float mean[4], float axis[4])
+{
+	float cov[4][4] = {};
+
+	for (int ch = 0; ch < channels; ch++) {
+		float sum = 0.0f;
+		for (int i = 0; i < 16; i++)
+			sum += rgba[i * 4 + ch];
+		mean[ch] = sum / 16.0f;
+	}
+
+	for (int i = 0; i < 16; i++) {
+		float d[4];
+		for (int ch = 0; ch < channels; ch++)
+			d[ch] = rgba[i * 4 + ch] - mean[ch];
+
+		for (int a = 0; a < channels; a++)
+			for (int b = a; b < channels; b++)
+				cov[a][b] += d[a] * d[b];
+	}
+
+	for (int a = 0; a < channels; a++)
+		for (int b = 0; b < a; b++)
+			cov[a][b] = cov[b][a];
+
+	// Start on the axis with the largest spread, it converges in a few steps from there
+	int widest = 0;
+	for (int ch = 1; ch < channels; ch++)
+		if (cov[ch][ch] > cov[widest][widest])
+			widest = ch;
+
+	float v[4] = {};
+	for (int ch = 0; ch < channels; ch++)
+		v[ch] = cov[widest][ch];
+
+	for (int iter = 0; iter < 8; iter++) {
+		float n[4] = {};
+		for (int a = 0; a < channels; a++)
+			for (int b = 0; b < channels; b++)
+				n[a] += cov[a][b] * v[b];
+
+		float length = 0.0f;
+		for (int ch = 0; ch < channels; ch++)
+			length = std::max(length, std::fabs(n[ch]));
+
+		if (length < 1e-6f)
+			break;
+
+		for (int ch = 0; ch < channels; ch++)
+			v[ch] = n[ch] / length;
+	}
+
+	float length = 0.0f;
+	for (int ch = 0; ch < channels; ch++)
+		length += v[ch] * v[ch];
+	length = std::sqrt(length);
+
+	for (int ch = 0; ch < 4; ch++)
+		axis[ch] = (ch < channels && length > 0.0f) ? v[ch] / length : 0.0f;
+}
+
+// Picks the closest palette entry for all 16 pixels, returns the summed squared error
+template <int CHANNELS, int ENTRIES>
+static float selectIndices(const BlockSoA &block, const float palette[ENTRIES][4], uint8_t indices[16])
+{
+	__m128 total = _mm_setzero_ps();
+
+	for (int g = 0; g < 4; g++) {
+		__m128 best = _mm_set1_ps(1e30f);
+		__m128 bestIndex = _mm_setzero_ps();
+
+		for (int e = 0; e < ENTRIES; e++) {
+			__m128 err = _mm_setzero_ps();
+			for (int ch = 0; ch < CHANNELS; ch++) {
+				__m128 d = _mm_sub_ps(block.c[ch][g], _mm_set1_ps(palette[e][ch]));
+				err = _mm_add_ps(err, _mm_mul_ps(d, d));
+			}
+
+			__m128 better = _mm_cmplt_ps(err, best);
+			best = _mm_min_ps(err, best);
+			bestIndex = _mm_or_ps(_mm_and_ps(better, _mm_set1_ps(static_cast<float>(e))), _mm_andnot_ps(better, bestIndex));
+		}
+
+		total = _mm_add_ps(total, best);
+
+		alignas(16) float out[4];
+		_mm_store_ps(out, bestIndex);
+		for (int i = 0; i < 4; i++)
+			indices[g * 4 + i] = static_cast<uint8_t>(out[i]);
+	}
+
+	alignas(16) float sum[4];
+	_mm_store_ps(sum, total);
+	return sum[0] + sum[1] + sum[2] + sum[3];
+}
+
+// Least squares endpoints for fixed indices, weights[i] is how far along e0 -> e1 pixel i sits
+static bool fitEndpoints(const uint8_t *rgba, int channels, const float weights[16], float e0[4], float e1[4])
+{
+	float aa = 0.0f, ab = 0.0f, bb = 0.0f;
+	float ax[4] = {}, bx[4] = {};
+
+	for (int i = 0; i < 16; i++) {
+		float b = weights[i];
+		float a = 1.0f - b;
+		aa += a * a;
+		ab += a * b;
+		bb += b * b;
+
+		for (int ch = 0; ch < channels; ch++) {
+			ax[ch] += a * rgba[i * 4 + ch];
+			bx[ch] += b * rgba[i * 4 + ch];
+		}
+	}
+
+	float det = aa * bb - ab * ab;
+	if (std::fabs(det) < 1e-6f)
+		return false;
+
+	for (int ch = 0; ch < channels; ch++) {
+		e0[ch] = std::min(255.0f, std::max(0.0f, (bb * ax[ch] - ab * bx[ch]) / det));
+		e1[ch] = std::min(255.0f, std::max(0.0f, (aa * bx[ch] - ab * ax[ch]) / det));
+	}
+
+	return true;
+}
+
+// BC1 {
+
+static inline uint16_t to565(const float c[4])
+{
+	int r = std::min(31, std::max(0, static_cast<int>(c[0] * (31.0f / 255.0f) + 0.5f)));
+	int g = std::min(63, std::max(0, static_cast<int>(c[1] * (63.0f / 255.0f) + 0.5f)));
+	int b = std::min(31, std::max(0, static_cast<int>(c[2] * (31.0f / 255.0f) + 0.5f)));
+	return static_cast<uint16_t>((r << 11) | (g << 5) | b);
+}
+
+static inline void from565(uint16_t c, float out[4])
+{
+	int r = (c >> 11) & 31, g = (c >> 5) & 63, b = c & 31;
+	out[0] = static_cast<float>((r << 3) | (r >> 2));
+	out[1] = static_cast<float>((g << 2) | (g >> 4));
+	out[2] = static_cast<float>((b << 3) | (b >> 2));
+	out[3] = 255.0f;
+}
+
+// Four colour palette of a 565 pair, as decoders build it
+static void bc1Palette(uint16_t c0, uint16_t c1, float palette[4][4])
+{
+	from565(c0, palette[0]);
+	from565(c1, palette[1]);
+	for (int ch = 0; ch < 4; ch++) {
+		palette[2][ch] = std::floor((2.0f * palette[0][ch] + palette[1][ch]) / 3.0f);
+		palette[3][ch] = std::floor((palette[0][ch] + 2.0f * palette[1][ch]) / 3.0f);
+	}
+}
+
+static float bc1Try(const BlockSoA &block, uint16_t c0, uint16_t c1, uint8_t indices[16])
+{
+	float palette[4][4];
+	bc1Palette(c0, c1, palette);
+	return selectIndices<3, 4>(block, palette, indices);
+}
+
+void EncodeBC1Block(uint8_t *dst, const uint8_t *rgba)
+{
+	BlockSoA block;
+	loadBlock(block, rgba);
+
+	float mean[4], axis[4];
+	principalAxis(rgba, 3, mean, axis);
+
+	// Endpoints at the pixels furthest out along the axis
+	float tMin = 1e30f, tMax = -1e30f;
+	int iMin = 0, iMax = 0;
+	for (int i = 0; i < 16; i++) {
+		float t = 0.0f;
+		for (int ch = 0; ch < 3; ch++)
+			t += (rgba[i * 4 + ch] - mean[ch]) * axis[ch];
+
+		if (t < tMin) { tMin = t; iMin = i; }
+		if (t > tMax) { tMax = t; iMax = i; }
+	}
+
+	float e0[4], e1[4];
+	for (int ch = 0; ch < 4; ch++) {
+		e0[ch] = rgba[iMax * 4 + ch];
+		e1[ch] = rgba[iMin * 4 + ch];
+	}
+
+	uint16_t c0 = to565(e0), c1 = to565(e1);
+	uint8_t indices[16];
+	float error = bc1Try(block, c0, c1, indices);
+
+	// Refit to the chosen indices, keep it if it helps
+	static const float bc1Weights[4] = { 0.0f, 1.0f, 1.0f / 3.0f, 2.0f / 3.0f };
+	for (int iter = 0; iter < 2 && error > 0.0f; iter++) {
+		float weights[16];
+		for (int i = 0; i < 16; i++)
+			weights[i] = bc1Weights[indices[i]];
+
+		if (!fitEndpoints(rgba, 3, weights, e0, e1))
+			break;
+
+		uint16_t n0 = to565(e0), n1 = to565(e1);
+		uint8_t newIndices[16];
+		float newError = bc1Try(block, n0, n1, newIndices);
+		if (newError >= error)
+			break;
+
+		c0 = n0;
+		c1 = n1;
+		error = newError;
+		memcpy(indices, newIndices, 16);
+	}
+
+	// c0 > c1 selects the four colour mode, swapping the endpoints swaps 0<->1 and 2<->3
+	if (c0 < c1) {
+		std::swap(c0, c1);
+		for (int i = 0; i < 16; i++)
+			indices[i] ^= 1;
+	} else if (c0 == c1) {
+		memset(indices, 0, 16);
+	}
+
+	uint32_t bits = 0;
+	for (int i = 0; i < 16; i++)
+		bits |= uint32_t(indices[i]) << (i * 2);
+
+	dst[0] = c0 & 0xff;
+	dst[1] = c0 >> 8;
+	dst[2] = c1 & 0xff;
+	dst[3] = c1 >> 8;
+	memcpy(dst + 4, &bits, 4);
+}
+
+// }
+
+// BC7 mode 6 {
+
+static const int bc7Weights[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+// 7 bits per channel plus a p-bit shared by the endpoint, try both p-bits
+static void bc7Quantize(const float e[4], uint8_t q[4], uint8_t &p)
+{
+	float bestError = 1e30f;
+
+	for (int pbit = 0; pbit < 2; pbit++) {
+		uint8_t candidate[4];
+		float error = 0.0f;
+
+		for (int ch = 0; ch < 4; ch++) {
+			int v = static_cast<int>(std::floor((e[ch] - pbit) / 2.0f + 0.5f));
+			v = std::min(127, std::max(0, v));
+			candidate[ch] = static_cast<uint8_t>(v);
+
+			float d = static_cast<float>((v << 1) | pbit) - e[ch];
+			error += d * d;
+		}
+
+		if (error < bestError) {
+			bestError = error;
+			memcpy(q, candidate, 4);
+			p = static_cast<uint8_t>(pbit);
+		}
+	}
+}
+
+static float bc7Try(const BlockSoA &block, const uint8_t q0[4], uint8_t p0, const uint8_t q1[4], uint8_t p1, uint8_t indices[16])
+{
+	float palette[16][4];
+
+	for (int ch = 0; ch < 4; ch++) {
+		int a = (q0[ch] << 1) | p0;
+		int b = (q1[ch] << 1) | p1;
+		for (int i = 0; i < 16; i++)
+			palette[i][ch] = static_cast<float>(((64 - bc7Weights[i]) * a + bc7Weights[i] * b + 32) >> 6);
+	}
+
+	return selectIndices<4, 16>(block, palette, indices);
+}
+
+struct BitPacker {
+	uint64_t bits[2] = {};
+	int position = 0;
+
+	inline void Put(uint32_t value, int count)
+	{
+		for (int i = 0; i < count; i++, position++)
+			bits[position >> 6] |= uint64_t((value >> i) & 1) << (position & 63);
+	}
+};
+
+void EncodeBC7Block(uint8_t *dst, const uint8_t *rgba)
+{
+	BlockSoA block;
+	loadBlock(block, rgba);
+
+	float mean[4], axis[4];
+	principalAxis(rgba, 4, mean, axis);
+
+	// Endpoints where the pixels' projections onto the axis end
+	float tMin = 0.0f, tMax = 0.0f;
+	for (int i = 0; i < 16; i++) {
+		float t = 0.0f;
+		for (int ch = 0; ch < 4; ch++)
+			t += (rgba[i * 4 + ch] - mean[ch]) * axis[ch];
+
+		tMin = std::min(tMin, t);
+		tMax = std::max(tMax, t);
+	}
+
+	float e0[4], e1[4];
+	for (int ch = 0; ch < 4; ch++) {
+		e0[ch] = std::min(255.0f, std::max(0.0f, mean[ch] + tMin * axis[ch]));
+		e1[ch] = std::min(255.0f, std::max(0.0f, mean[ch] + tMax * axis[ch]));
+	}
+
+	uint8_t q0[4], q1[4], p0, p1;
+	bc7Quantize(e0, q0, p0);
+	bc7Quantize(e1, q1, p1);
+
+	uint8_t indices[16];
+	float error = bc7Try(block, q0, p0, q1, p1, indices);
+
+	for (int iter = 0; iter < 2 && error > 0.0f; iter++) {
+		float weights[16];
+		for (int i = 0; i < 16; i++)
+			weights[i] = bc7Weights[indices[i]] / 64.0f;
+
+		if (!fitEndpoints(rgba, 4, weights, e0, e1))
+			break;
+
+		uint8_t n0[4], n1[4], np0, np1;
+		bc7Quantize(e0, n0, np0);
+		bc7Quantize(e1, n1, np1);
+
+		uint8_t newIndices[16];
+		float newError = bc7Try(block, n0, np0, n1, np1, newIndices);
+		if (newError >= error)
+			break;
+
+		memcpy(q0, n0, 4);
+		memcpy(q1, n1, 4);
+		p0 = np0;
+		p1 = np1;
+		error = newError;
+		memcpy(indices, newIndices, 16);
+	}
+
+	// The first index only has room for 3 bits, flip the block around if its top bit is set
+	if (indices[0] & 8) {
+		for (int ch = 0; ch < 4; ch++)
+			std::swap(q0[ch], q1[ch]);
+		std::swap(p0, p1);
+		for (int i = 0; i < 16; i++)
+			indices[i] = 15 - indices[i];
+	}
+
+	BitPacker packer;
+	packer.Put(1 << 6, 7); // mode 6
+	for (int ch = 0; ch < 4; ch++) {
+		packer.Put(q0[ch], 7);
+		packer.Put(q1[ch], 7);
+	}
+	packer.Put(p0, 1);
+	packer.Put(p1, 1);
+	packer.Put(indices[0], 3);
+	for (int i = 1; i < 16; i++)
+		packer.Put(indices[i], 4);
+
+	memcpy(dst, packer.bits, 16);
+}
+
+// }
+
+size_t getBCSize(uint32_t width, uint32_t height, BCFormat format)
+{
+	size_t blocks = size_t((width + 3) / 4) * ((height + 3) / 4);
+	return blocks * (format == BC1 ? 8 : 16);
+}
+
+bool isOpaque(const uint8_t *src, uint32_t width, uint32_t height, uint32_t channels)
+{
+	if (channels != 2 && channels != 4)
+		return true;
+
+	size_t pixels = size_t(width) * height;
+	for (size_t i = 0; i < pixels; i++) {
+		if (src[i * channels + channels - 1] != 255)
+			return false;
+	}
+
+	return true;
+}
+
+void EncodeBC(uint8_t *dst, const uint8_t *src, uint32_t width, uint32_t height, uint32_t channels, BCFormat format, JobSystem *jobs)
+{
+	uint32_t blocksX = (width + 3) / 4;
+	uint32_t blocksY = (height + 3) / 4;
+	size_t blockSize = format == BC1 ? 8 : 16;
+
+	auto encodeRow = [=](size_t by) {
+		uint8_t *out = dst + by * blocksX * blockSize;
+
+		for (uint32_t bx = 0; bx < blocksX; bx++, out += blockSize) {
+			// Gather the block as RGBA, clamping at the image edges
+			alignas(16) uint8_t rgba[64];
+			for (uint32_t y = 0; y < 4; y++) {
+				uint32_t sy = std::min(uint32_t(by) * 4 + y, height - 1);
+				for (uint32_t x = 0; x < 4; x++) {
+					uint32_t sx = std::min(bx * 4 + x, width - 1);
+					const uint8_t *p = src + (size_t(sy) * width + sx) * channels;
+					uint8_t *q = rgba + (y * 4 + x) * 4;
+
+					q[0] = p[0];
+					q[1] = p[channels >= 3 ? 1 : 0];
+					q[2] = p[channels >= 3 ? 2 : 0];
+					q[3] = channels == 2 ? p[1] : channels == 4 ? p[3] : 255;
+				}
+			}
+
+			if (format == BC1)
+				EncodeBC1Block(out, rgba);
+			else
+				EncodeBC7Block(out, rgba);
+		}
+	};
+
+	if (jobs) {
+		jobs->ParallelFor(blocksY, encodeRow);
+	} else {
+		for (uint32_t by = 0; by < blocksY; by++)
+			encodeRow(by);
+	}
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+class JobSystem;
+
+enum BCFormat {
+	BC_NONE,
+	BC1, // 4 bpp, RGB only - used for opaque images
+	BC7 // 8 bpp, RGBA, mode 6 only
+};
+
+// Block compresses 8-bit pixels (1 to 4 channels, gray is replicated to RGB) in 4x4 blocks.
+// Edge blocks are padded by repeating the last row/column. dst needs getBCSize() bytes.
+// Rows of blocks are spread over jobs when given, the caller helps out.
+void EncodeBC(uint8_t *dst, const uint8_t *src, uint32_t width, uint32_t height, uint32_t channels, BCFormat format, JobSystem *jobs = nullptr);
+size_t getBCSize(uint32_t width, uint32_t height, BCFormat format);
+bool isOpaque(const uint8_t *src, uint32_t width, uint32_t height, uint32_t channels);
+
+void EncodeBC1Block(uint8_t *dst, const uint8_t *rgba); // rgba is 16 pixels, row major
+void EncodeBC7Block(uint8_t *dst, const uint8_t *rgba);
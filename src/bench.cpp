@@ -0,0 +1,241 @@
+#include "bench.h"
+#include "fileutil.h"
+#include "image.h"
+#include "jobs.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <thread>
+
+static bool sameImage(const Image &a, const Image &b)
+{
+	return a.width == b.width && a.height == b.height && a.channels == b.channels && a.type == b.type
+		&& !memcmp(a.data, b.data, getImageSize(a));
+}
+
+static std::string getExtension(const std::string &path)
+{
+	std::string ext = std::filesystem::path(path).extension().string();
+	std::transform(ext.begin(), ext.end(), ext.begin(), [](unsigned char c) { return std::tolower(c); });
+	return ext;
+}
+
+bool DecodeBench::AddPath(const char *path)
+{
+	return ListImages(path, paths);
+}
+
+bool DecodeBench::Run(uint32_t runs, JobSystem *jobs)
+{
+	typedef std::chrono::steady_clock Clock;
+	static const char *modeNames[BENCH_MODE_COUNT] = {"scalar", "simd", "threaded"};
+
+	std::map<std::string, Result> results; // by extension
+	bool ok = true;
+	runs = std::max(runs, 1u);
+
+	Decoder decoders[BENCH_MODE_COUNT];
+	decoders[BENCH_SCALAR].SetSIMD(false);
+	decoders[BENCH_THREADED].SetJobs(jobs);
+
+	Decoder stdioDecoder;
+	stdioDecoder.SetMapFiles(false);
+
+	for (auto &path : paths) {
+		MappedFile file;
+		if (!file.Open(path.c_str())) {
+			std::cout << "Failed to open " << path << " :(" << std::endl;
+			ok = false;
+			continue;
+		}
+
+		// Warm the page cache and keep a reference decode from the plain C paths
+		Image reference;
+		if (!decoders[BENCH_SCALAR].Load(file.getData(), file.getSize(), reference)) {
+			// KTX2 and DDS files are listed too, but aren't for stb
+			continue;
+		}
+
+		Result &result = results[getExtension(path)];
+		result.images++;
+		result.pixels += uint64_t(reference.width) * reference.height * runs;
+
+		for (int mode = 0; mode < (jobs ? BENCH_MODE_COUNT : BENCH_THREADED); mode++) {
+			auto start = Clock::now();
+			for (uint32_t run = 0; run < runs; run++) {
+				Image image;
+				if (!decoders[mode].Load(file.getData(), file.getSize(), image) || !sameImage(image, reference)) {
+					std::cout << path << " decodes differently on the " << modeNames[mode] << " path :(" << std::endl;
+					ok = false;
+				}
+
+				FreeImage(image);
+			}
+
+			double ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+			result.ms[mode] += ms;
+		}
+
+		// The page cache is warm, so this is only the cost of getting the bytes to stb
+		for (int mapped = 0; mapped < 2; mapped++) {
+			auto start = Clock::now();
+			for (uint32_t run = 0; run < runs; run++) {
+				Image image;
+				if (!(mapped ? decoders[BENCH_SIMD] : stdioDecoder).Load(path.c_str(), image) || !sameImage(image, reference)) {
+					std::cout << path << " decodes differently when read " << (mapped ? "from a mapping" : "with stdio") << " :(" << std::endl;
+					ok = false;
+				}
+
+				FreeImage(image);
+			}
+
+			double ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+			(mapped ? result.mappedMs : result.stdioMs) += ms;
+		}
+
+		FreeImage(reference);
+	}
+
+	for (auto &it : results) {
+		Result &result = it.second;
+		double mp = result.pixels / 1e6;
+
+		std::cout << it.first << ": " << result.images << " images x " << runs << " runs";
+		for (int mode = 0; mode < (jobs ? BENCH_MODE_COUNT : BENCH_THREADED); mode++) {
+			std::cout << ", " << modeNames[mode] << " " << result.ms[mode] << " ms (" << mp / result.ms[mode] * 1e3 << " MP/s";
+			if (mode != BENCH_SCALAR)
+				std::cout << ", " << result.ms[BENCH_SCALAR] / result.ms[mode] << "x";
+			std::cout << ")";
+		}
+		std::cout << std::endl;
+
+		std::cout << it.first << ": from file, stdio " << result.stdioMs << " ms, mapped " << result.mappedMs << " ms ("
+			<< result.stdioMs / result.mappedMs << "x)" << std::endl;
+	}
+
+	return ok;
+}
+
+bool DecodeBench::Verify(JobSystem *jobs, uint32_t rounds)
+{
+	// Serial reference decodes, upright and flipped
+	std::vector<std::unique_ptr<MappedFile>> files;
+	std::vector<const std::string *> names;
+	std::vector<Image> references;
+
+	for (auto &path : paths) {
+		std::unique_ptr<MappedFile> file = std::make_unique<MappedFile>();
+		if (!file->Open(path.c_str()))
+			continue;
+
+		Image upright, flipped;
+		Decoder decoder;
+		if (!decoder.Load(file->getData(), file->getSize(), upright))
+			continue;
+
+		decoder.SetFlip(true);
+		if (!decoder.Load(file->getData(), file->getSize(), flipped)) {
+			FreeImage(upright);
+			continue;
+		}
+
+		files.push_back(std::move(file));
+		names.push_back(&path);
+		references.push_back(upright);
+		references.push_back(flipped);
+	}
+
+	if (files.empty())
+		return false;
+
+	// Every round decodes the whole corpus at once, each decode picks its flip, SIMD and
+	// threading from its index so neighbouring decodes on other threads use other settings
+	std::atomic<uint32_t> mismatches{0};
+	size_t count = files.size() * std::max(rounds, 1u);
+
+	jobs->ParallelFor(count, [&](size_t i) {
+		size_t index = i % files.size();
+		uint32_t variant = static_cast<uint32_t>(i / files.size() + index);
+
+		Decoder decoder;
+		decoder.SetFlip(variant & 1);
+		decoder.SetSIMD(variant & 2);
+		decoder.SetJobs(variant & 4 ? jobs : nullptr);
+
+		Image image;
+		if (!decoder.Load(files[index]->getData(), files[index]->getSize(), image) || !sameImage(image, references[index * 2 + (variant & 1)])) {
+			std::cout << *names[index] << " decodes differently with " << jobs->getThreadCount() + 1 << " threads decoding at once :(" << std::endl;
+			mismatches++;
+		}
+
+		FreeImage(image);
+	});
+
+	for (Image &image : references)
+		FreeImage(image);
+
+	std::cout << "Verified " << count << " concurrent decodes of " << files.size() << " images, "
+		<< mismatches << " mismatches" << std::endl;
+
+	return mismatches == 0;
+}
+
+void DecodeBench::Scale(uint32_t runs)
+{
+	typedef std::chrono::steady_clock Clock;
+	runs = std::max(runs, 1u);
+
+	// Nothing but JPEGs is split over threads
+	std::vector<std::unique_ptr<MappedFile>> files;
+	for (auto &path : paths) {
+		std::string ext = getExtension(path);
+		std::unique_ptr<MappedFile> file = std::make_unique<MappedFile>();
+		if ((ext == ".jpg" || ext == ".jpeg") && file->Open(path.c_str()))
+			files.push_back(std::move(file));
+	}
+
+	if (files.empty())
+		return;
+
+	uint32_t cores = std::max(std::thread::hardware_concurrency(), 1u);
+	double singleMs = 0.0;
+
+	for (uint32_t threads = 1;; threads = std::min(threads * 2, cores)) {
+		// The caller decodes too, so one thread is no job system at all
+		JobSystem scaleJobs;
+		if (threads > 1)
+			scaleJobs.Setup(threads - 1);
+
+		Decoder decoder;
+		decoder.SetJobs(threads > 1 ? &scaleJobs : nullptr);
+
+		uint64_t pixels = 0;
+		auto start = Clock::now();
+		for (uint32_t run = 0; run < runs; run++) {
+			for (auto &file : files) {
+				Image image;
+				if (decoder.Load(file->getData(), file->getSize(), image))
+					pixels += uint64_t(image.width) * image.height;
+				FreeImage(image);
+			}
+		}
+
+		double ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+		if (threads == 1)
+			singleMs = ms;
+
+		std::cout << "jpeg on " << threads << (threads == 1 ? " thread: " : " threads: ") << ms << " ms (" << pixels / 1e3 / ms << " MP/s, "
+			<< singleMs / ms << "x)" << std::endl;
+
+		scaleJobs.Release();
+		if (threads == cores)
+			break;
+	}
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+class JobSystem;
+
+// Decodes a corpus from memory with stb_image's SIMD paths off and on, then with the
+// JPEG decoder spread over the job system, and checks all of them give the same pixels.
+// File reads are kept out of those timings and compared on their own, stb's stdio
+// reader against a mapping, and the threaded JPEG decode is timed again with more and
+// more threads to see how it scales. No Vulkan needed.
+class DecodeBench {
+public:
+	DecodeBench() {}
+	virtual ~DecodeBench() {}
+
+	bool AddPath(const char *path); // same as Slideshow::AddPath()
+	bool Run(uint32_t runs, JobSystem *jobs = nullptr); // false if any image fails to decode or the paths disagree, no threaded column without jobs
+	bool Verify(JobSystem *jobs, uint32_t rounds);
+	void Scale(uint32_t runs); // JPEGs only, 1, 2, 4... threads up to every core, each count on a job system of its own // decodes everything on all cores at once with mixed settings per thread, false unless every decode matches a serial one
+
+	inline size_t getCount() { return paths.size(); }
+
+protected:
+	enum BenchMode {
+		BENCH_SCALAR,
+		BENCH_SIMD,
+		BENCH_THREADED, // SIMD and the job system
+		BENCH_MODE_COUNT
+	};
+
+	struct Result {
+		double ms[BENCH_MODE_COUNT] = {};
+		double stdioMs = 0.0, mappedMs = 0.0; // whole loads from the file, SIMD on
+		uint64_t pixels = 0;
+		uint32_t images = 0;
+	};
+
+	std::vector<std::string> paths;
+};
@@ -0,0 +1,173 @@
+#include "bufferpool.h"
+
+#include <cstdlib>
+#include <cstring>
+
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+
+BufferPool bufferPool;
+
+// Every block starts with a header, padded so the payload stays 64 byte aligned
+struct BlockHeader {
+	uint32_t sizeClass;
+	size_t size;
+};
+
+static const size_t HEADER_SIZE = 64;
+
+// Blocks are 4 KiB or more in powers of two, always a multiple of the alignment aligned_alloc wants
+static inline void *allocBlock(size_t size)
+{
+#ifdef _WIN32
+	return _aligned_malloc(size, HEADER_SIZE);
+#else
+	return std::aligned_alloc(HEADER_SIZE, size);
+#endif
+}
+
+static inline void freeBlock(void *block)
+{
+#ifdef _WIN32
+	_aligned_free(block);
+#else
+	std::free(block);
+#endif
+}
+
+static inline BlockHeader *blockHeader(void *ptr)
+{
+	return reinterpret_cast<BlockHeader *>(static_cast<uint8_t *>(ptr) - HEADER_SIZE);
+}
+
+static inline uint32_t sizeClass(size_t size, uint32_t minClass)
+{
+	uint32_t c = minClass;
+	while ((size_t(1) << c) < size)
+		c++;
+
+	return c;
+}
+
+void *BufferPool::Alloc(size_t size)
+{
+	uint32_t c = sizeClass(size + HEADER_SIZE, MIN_CLASS);
+	if (c > MAX_CLASS)
+		return nullptr;
+
+	size_t blockSize = size_t(1) << c;
+	void *block = nullptr;
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if (!freeLists[c].empty()) {
+			block = freeLists[c].back();
+			freeLists[c].pop_back();
+			cached -= blockSize;
+		}
+		used += blockSize;
+	}
+
+	if (!block) {
+		block = allocBlock(blockSize);
+		if (!block) {
+			std::lock_guard<std::mutex> lock(mutex);
+			used -= blockSize;
+			return nullptr;
+		}
+	}
+
+	BlockHeader *header = static_cast<BlockHeader *>(block);
+	header->sizeClass = c;
+	header->size = size;
+
+	return static_cast<uint8_t *>(block) + HEADER_SIZE;
+}
+
+void *BufferPool::Realloc(void *ptr, size_t size)
+{
+	if (!ptr)
+		return Alloc(size);
+
+	// Growing inside the same class is free, which is most of stb_image's reallocs
+	BlockHeader *header = blockHeader(ptr);
+	if (size + HEADER_SIZE <= (size_t(1) << header->sizeClass)) {
+		header->size = size;
+		return ptr;
+	}
+
+	void *newPtr = Alloc(size);
+	if (!newPtr)
+		return nullptr;
+
+	memcpy(newPtr, ptr, header->size);
+	Free(ptr);
+
+	return newPtr;
+}
+
+void BufferPool::Free(void *ptr)
+{
+	if (!ptr)
+		return;
+
+	BlockHeader *header = blockHeader(ptr);
+	uint32_t c = header->sizeClass;
+	size_t blockSize = size_t(1) << c;
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		used -= blockSize;
+
+		if (cached + blockSize <= limit) {
+			freeLists[c].push_back(header);
+			cached += blockSize;
+			return;
+		}
+	}
+
+	freeBlock(header);
+}
+
+void BufferPool::SetLimit(size_t bytes)
+{
+	bool trim;
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		limit = bytes;
+		trim = cached > bytes;
+	}
+
+	if (trim)
+		Trim();
+}
+
+void BufferPool::Trim()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	for (auto &list : freeLists) {
+		for (void *block : list)
+			freeBlock(block);
+		list.clear();
+	}
+
+	cached = 0;
+}
+
+void *bufferPoolAlloc(size_t size)
+{
+	return bufferPool.Alloc(size);
+}
+
+void *bufferPoolRealloc(void *ptr, size_t size)
+{
+	return bufferPool.Realloc(ptr, size);
+}
+
+void bufferPoolFree(void *ptr)
+{
+	bufferPool.Free(ptr);
+}
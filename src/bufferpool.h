@@ -0,0 +1,51 @@
+#pragma once
+
+#include <stddef.h>
+
+// C entry points so stb_image.c can route its allocations through the pool
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void *bufferPoolAlloc(size_t size);
+void *bufferPoolRealloc(void *ptr, size_t size);
+void bufferPoolFree(void *ptr);
+
+#ifdef __cplusplus
+}
+
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+// Recycles large blocks in power-of-two size classes, so decoding image after
+// image reuses the same few buffers instead of going back to malloc/free.
+class BufferPool {
+public:
+	BufferPool() {}
+	virtual ~BufferPool() { Trim(); }
+
+	void *Alloc(size_t size);
+	void *Realloc(void *ptr, size_t size);
+	void Free(void *ptr);
+
+	void SetLimit(size_t bytes); // max bytes kept on the free lists
+	void Trim(); // returns every free block to the system
+
+	inline size_t getUsed() { return used; } // bytes handed out right now
+	inline size_t getCached() { return cached; } // bytes waiting on the free lists
+
+protected:
+	static const uint32_t MIN_CLASS = 12; // 4 KiB
+	static const uint32_t MAX_CLASS = 40;
+
+	std::mutex mutex;
+	std::vector<void *> freeLists[MAX_CLASS + 1];
+	size_t used = 0;
+	size_t cached = 0;
+	size_t limit = size_t(512) << 20;
+};
+
+extern BufferPool bufferPool;
+
+#endif
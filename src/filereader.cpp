@@ -0,0 +1,469 @@
+#include "filereader.h"
+#include "bufferpool.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#if defined(__linux__)
+#include <linux/io_uring.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#if defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter) && defined(__NR_io_uring_register)
+#define FILEREADER_IO_URING
+#endif
+#endif
+
+// Reads run in chunks of at most this, a single read returns an int
+static const size_t MAX_READ = size_t(1) << 30;
+
+uint8_t *ReadFile(const char *path, size_t &size)
+{
+	uint8_t *data = nullptr;
+	size = 0;
+
+#ifdef _WIN32
+	FILE *file = fopen(path, "rb");
+	if (!file)
+		return nullptr;
+
+	if (!_fseeki64(file, 0, SEEK_END)) {
+		long long length = _ftelli64(file);
+		if (length > 0 && !_fseeki64(file, 0, SEEK_SET)) {
+			data = static_cast<uint8_t *>(bufferPool.Alloc(static_cast<size_t>(length)));
+			if (data && fread(data, 1, static_cast<size_t>(length), file) == static_cast<size_t>(length)) {
+				size = static_cast<size_t>(length);
+			} else {
+				bufferPool.Free(data);
+				data = nullptr;
+			}
+		}
+	}
+
+	fclose(file);
+#else
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return nullptr;
+
+	struct stat st;
+	if (!fstat(fd, &st) && st.st_size > 0)
+		data = static_cast<uint8_t *>(bufferPool.Alloc(st.st_size));
+
+	size_t offset = 0;
+	while (data && offset < static_cast<size_t>(st.st_size)) {
+		size_t chunk = std::min(static_cast<size_t>(st.st_size) - offset, MAX_READ);
+		ssize_t got = pread(fd, data + offset, chunk, offset);
+		if (got < 0 && errno == EINTR)
+			continue;
+
+		// Error, or the file shrank under us
+		if (got <= 0) {
+			bufferPool.Free(data);
+			data = nullptr;
+			break;
+		}
+
+		offset += got;
+	}
+
+	close(fd);
+	size = data ? offset : 0;
+#endif
+
+	return data;
+}
+
+#ifdef FILEREADER_IO_URING
+struct FileReader::Ring {
+	int fd = -1;
+	int eventFd = -1; // Read() and Release() poke this, a poll on it wakes the ring thread
+	uint64_t eventValue = 0;
+
+	void *sqMap = nullptr, *cqMap = nullptr;
+	size_t sqMapSize = 0, cqMapSize = 0;
+	io_uring_sqe *sqes = nullptr;
+	size_t sqesSize = 0;
+
+	uint32_t *sqHead, *sqTail, *sqMask, *sqArray;
+	uint32_t *cqHead, *cqTail, *cqMask;
+	io_uring_cqe *cqes;
+	uint32_t sqEntries = 0;
+	uint32_t toSubmit = 0;
+
+	io_uring_sqe *GetSQE() // there's always room, only depth reads and the poll are ever in flight
+	{
+		uint32_t tail = *sqTail;
+		uint32_t index = tail & *sqMask;
+		sqArray[index] = index;
+		__atomic_store_n(sqTail, tail + 1, __ATOMIC_RELEASE);
+		toSubmit++;
+
+		io_uring_sqe *sqe = &sqes[index];
+		memset(sqe, 0, sizeof(*sqe));
+		return sqe;
+	}
+
+	void PollEvent()
+	{
+		io_uring_sqe *sqe = GetSQE();
+		sqe->opcode = IORING_OP_POLL_ADD;
+		sqe->fd = eventFd;
+		sqe->poll32_events = POLLIN;
+		sqe->user_data = 0;
+	}
+
+	void Read(int file, uint8_t *data, size_t size, size_t offset, void *userData)
+	{
+		io_uring_sqe *sqe = GetSQE();
+		sqe->opcode = IORING_OP_READ;
+		sqe->fd = file;
+		sqe->addr = reinterpret_cast<uint64_t>(data + offset);
+		sqe->len = static_cast<uint32_t>(std::min(size - offset, MAX_READ));
+		sqe->off = offset;
+		sqe->user_data = reinterpret_cast<uint64_t>(userData);
+	}
+};
+
+struct FileReader::RingRead {
+	Request request;
+	int fd = -1; // still opening while negative
+	uint8_t *data = nullptr;
+	size_t size = 0;
+	size_t offset = 0;
+};
+
+static int ringSetup(uint32_t entries, io_uring_params *params)
+{
+	return static_cast<int>(syscall(__NR_io_uring_setup, entries, params));
+}
+
+static int ringEnter(int fd, uint32_t submit, uint32_t wait, uint32_t flags)
+{
+	return static_cast<int>(syscall(__NR_io_uring_enter, fd, submit, wait, flags, nullptr, 0));
+}
+
+#else
+struct FileReader::Ring {};
+struct FileReader::RingRead {};
+#endif
+
+void FileReader::Setup(uint32_t depth, bool ioUring)
+{
+	this->depth = depth ? depth : 1;
+	quit = false;
+
+	if (ioUring && SetupRing()) {
+		threads.emplace_back(&FileReader::RingLoop, this);
+		return;
+	}
+
+	for (uint32_t i = 0; i < this->depth; i++)
+		threads.emplace_back(&FileReader::ThreadLoop, this);
+}
+
+void FileReader::Release()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		quit = true;
+	}
+	wake.notify_all();
+
+#ifdef FILEREADER_IO_URING
+	if (ring) {
+		uint64_t one = 1;
+		while (write(ring->eventFd, &one, sizeof(one)) < 0 && errno == EINTR)
+			;
+	}
+#endif
+
+	for (auto &thread : threads)
+		thread.join();
+
+	threads.clear();
+	ReleaseRing();
+}
+
+void FileReader::Read(const std::string &path, Callback done)
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		queue.push_back({ path, std::move(done) });
+		pending++;
+	}
+
+#ifdef FILEREADER_IO_URING
+	if (ring) {
+		uint64_t one = 1;
+		while (write(ring->eventFd, &one, sizeof(one)) < 0 && errno == EINTR)
+			;
+		return;
+	}
+#endif
+
+	wake.notify_one();
+}
+
+void FileReader::Wait()
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	idle.wait(lock, [this] { return !pending; });
+}
+
+void FileReader::Finish(Callback &done, uint8_t *data, size_t size)
+{
+	done(data, size);
+
+	std::lock_guard<std::mutex> lock(mutex);
+	if (--pending == 0)
+		idle.notify_all();
+}
+
+void FileReader::ThreadLoop()
+{
+	for (;;) {
+		Request request;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			wake.wait(lock, [this] { return quit || !queue.empty(); });
+			if (queue.empty())
+				return;
+
+			request = std::move(queue.front());
+			queue.pop_front();
+		}
+
+		size_t size;
+		uint8_t *data = ReadFile(request.path.c_str(), size);
+		Finish(request.done, data, size);
+	}
+}
+
+#ifdef FILEREADER_IO_URING
+bool FileReader::SetupRing()
+{
+	ring = new Ring;
+
+	// One entry per read plus the wakeup poll, completions get twice that
+	io_uring_params params = {};
+	ring->fd = ringSetup(depth + 1, &params);
+	if (ring->fd < 0) {
+		// Old kernel, or turned off (kernel.io_uring_disabled, container seccomp profiles)
+		ReleaseRing();
+		return false;
+	}
+
+	// Needs 5.6 for open and plain read
+	std::vector<uint8_t> probeBytes(sizeof(io_uring_probe) + 256 * sizeof(io_uring_probe_op));
+	io_uring_probe *probe = reinterpret_cast<io_uring_probe *>(probeBytes.data());
+	if (syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_PROBE, probe, 256) < 0) {
+		ReleaseRing();
+		return false;
+	}
+
+	for (uint8_t op : { IORING_OP_OPENAT, IORING_OP_READ, IORING_OP_POLL_ADD }) {
+		if (op > probe->last_op || !(probe->ops[op].flags & IO_URING_OP_SUPPORTED)) {
+			ReleaseRing();
+			return false;
+		}
+	}
+
+	ring->sqMapSize = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+	ring->cqMapSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+	if (params.features & IORING_FEAT_SINGLE_MMAP)
+		ring->sqMapSize = ring->cqMapSize = std::max(ring->sqMapSize, ring->cqMapSize);
+
+	ring->sqMap = mmap(nullptr, ring->sqMapSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+	if (ring->sqMap == MAP_FAILED) {
+		ring->sqMap = nullptr;
+		ReleaseRing();
+		return false;
+	}
+
+	if (params.features & IORING_FEAT_SINGLE_MMAP) {
+		ring->cqMap = ring->sqMap;
+	} else {
+		ring->cqMap = mmap(nullptr, ring->cqMapSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+		if (ring->cqMap == MAP_FAILED) {
+			ring->cqMap = nullptr;
+			ReleaseRing();
+			return false;
+		}
+	}
+
+	ring->sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+	void *sqes = mmap(nullptr, ring->sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+	if (sqes == MAP_FAILED) {
+		ReleaseRing();
+		return false;
+	}
+
+	ring->sqes = static_cast<io_uring_sqe *>(sqes);
+
+	uint8_t *sq = static_cast<uint8_t *>(ring->sqMap);
+	ring->sqHead = reinterpret_cast<uint32_t *>(sq + params.sq_off.head);
+	ring->sqTail = reinterpret_cast<uint32_t *>(sq + params.sq_off.tail);
+	ring->sqMask = reinterpret_cast<uint32_t *>(sq + params.sq_off.ring_mask);
+	ring->sqArray = reinterpret_cast<uint32_t *>(sq + params.sq_off.array);
+	ring->sqEntries = params.sq_entries;
+
+	uint8_t *cq = static_cast<uint8_t *>(ring->cqMap);
+	ring->cqHead = reinterpret_cast<uint32_t *>(cq + params.cq_off.head);
+	ring->cqTail = reinterpret_cast<uint32_t *>(cq + params.cq_off.tail);
+	ring->cqMask = reinterpret_cast<uint32_t *>(cq + params.cq_off.ring_mask);
+	ring->cqes = reinterpret_cast<io_uring_cqe *>(cq + params.cq_off.cqes);
+
+	ring->eventFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (ring->eventFd < 0) {
+		ReleaseRing();
+		return false;
+	}
+
+	return true;
+}
+
+void FileReader::ReleaseRing()
+{
+	if (!ring)
+		return;
+
+	if (ring->sqes)
+		munmap(ring->sqes, ring->sqesSize);
+	if (ring->cqMap && ring->cqMap != ring->sqMap)
+		munmap(ring->cqMap, ring->cqMapSize);
+	if (ring->sqMap)
+		munmap(ring->sqMap, ring->sqMapSize);
+	if (ring->eventFd >= 0)
+		close(ring->eventFd);
+	if (ring->fd >= 0)
+		close(ring->fd);
+
+	delete ring;
+	ring = nullptr;
+}
+
+void FileReader::RingLoop()
+{
+	// Every read goes open -> read (again on a short read) -> close, the open and reads on the
+	// ring. The size comes from fstat() on this thread, the inode is cached right after the open.
+	auto advance = [this](RingRead *read, int32_t result) {
+		if (read->fd < 0) {
+			if (result < 0)
+				return false;
+
+			read->fd = result;
+
+			struct stat st;
+			if (fstat(read->fd, &st) || st.st_size <= 0)
+				return false;
+
+			read->size = st.st_size;
+			read->data = static_cast<uint8_t *>(bufferPool.Alloc(read->size));
+			if (!read->data)
+				return false;
+		} else if (result == -EINTR || result == -EAGAIN) {
+			// Try the same chunk again
+		} else if (result <= 0) {
+			// Error, or the file shrank under us
+			bufferPool.Free(read->data);
+			read->data = nullptr;
+			return false;
+		} else {
+			read->offset += result;
+		}
+
+		if (read->offset == read->size)
+			return false;
+
+		ring->Read(read->fd, read->data, read->size, read->offset, read);
+		return true;
+	};
+
+	uint32_t active = 0;
+	ring->PollEvent();
+
+	for (;;) {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			while (active < depth && !queue.empty()) {
+				RingRead *read = new RingRead;
+				read->request = std::move(queue.front());
+				queue.pop_front();
+
+				io_uring_sqe *sqe = ring->GetSQE();
+				sqe->opcode = IORING_OP_OPENAT;
+				sqe->fd = AT_FDCWD;
+				sqe->addr = reinterpret_cast<uint64_t>(read->request.path.c_str());
+				sqe->open_flags = O_RDONLY | O_CLOEXEC;
+				sqe->user_data = reinterpret_cast<uint64_t>(read);
+				active++;
+			}
+
+			if (quit && queue.empty() && !active)
+				break;
+		}
+
+		// Submits everything new and sleeps until something completes. EINTR, or EAGAIN and
+		// EBUSY while the kernel is short on memory, just go around again.
+		int submitted = ringEnter(ring->fd, ring->toSubmit, 1, IORING_ENTER_GETEVENTS);
+		if (submitted < 0)
+			continue;
+
+		ring->toSubmit -= submitted;
+
+		uint32_t head = *ring->cqHead;
+		uint32_t tail = __atomic_load_n(ring->cqTail, __ATOMIC_ACQUIRE);
+		for (; head != tail; head++) {
+			io_uring_cqe &cqe = ring->cqes[head & *ring->cqMask];
+			uint64_t userData = cqe.user_data;
+			int32_t result = cqe.res;
+
+			// New reads or shutdown, the eventfd stays readable until we drain it
+			if (!userData) {
+				while (::read(ring->eventFd, &ring->eventValue, sizeof(ring->eventValue)) > 0)
+					;
+				ring->PollEvent();
+				continue;
+			}
+
+			RingRead *read = reinterpret_cast<RingRead *>(userData);
+			if (advance(read, result))
+				continue;
+
+			if (read->fd >= 0)
+				close(read->fd);
+
+			// Hand the slot back before the callback, it may take a while
+			__atomic_store_n(ring->cqHead, head + 1, __ATOMIC_RELEASE);
+			Finish(read->request.done, read->data, read->data ? read->size : 0);
+			delete read;
+			active--;
+		}
+
+		__atomic_store_n(ring->cqHead, head, __ATOMIC_RELEASE);
+	}
+}
+#else
+bool FileReader::SetupRing()
+{
+	return false;
+}
+
+void FileReader::ReleaseRing()
+{
+}
+
+void FileReader::RingLoop()
+{
+}
+#endif
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Whole file into a bufferPool block with plain reads, nullptr if it can't be read. A copy,
+// unlike a mapping it can't fault when another program truncates the file while it's used.
+uint8_t *ReadFile(const char *path, size_t &size);
+
+// Reads whole files with a fixed number of reads in flight and hands the bytes to a callback, so
+// decode threads never sit in open() or read(). On Linux one thread drives everything through
+// io_uring, elsewhere (or when the kernel won't give us a ring) a pool of threads does blocking
+// reads instead. Files land in buffer pool blocks.
+class FileReader {
+public:
+	// data is a bufferPool block the callback now owns, nullptr if the file couldn't be read.
+	// Runs on one of the reader's threads, blocking in it holds up further reads.
+	typedef std::function<void(uint8_t *data, size_t size)> Callback;
+
+	FileReader() {}
+	virtual ~FileReader() { Release(); }
+	FileReader(const FileReader &) = delete;
+	FileReader &operator=(const FileReader &) = delete;
+
+	void Setup(uint32_t depth, bool ioUring = true); // depth = reads in flight, false forces the thread pool
+	void Release(); // finishes queued reads and joins the threads
+
+	void Read(const std::string &path, Callback done); // queues the read, never blocks
+	void Wait(); // blocks until every queued read's callback has returned
+
+	inline bool usingIOUring() { return ring != nullptr; }
+	inline uint32_t getDepth() { return depth; }
+
+protected:
+	struct Request {
+		std::string path;
+		Callback done;
+	};
+
+	struct Ring; // io_uring state, Linux only
+	struct RingRead;
+
+	void ThreadLoop();
+	bool SetupRing();
+	void RingLoop();
+	void ReleaseRing();
+	void Finish(Callback &done, uint8_t *data, size_t size);
+
+	std::deque<Request> queue;
+	std::mutex mutex;
+	std::condition_variable wake; // pool threads, signalled on new reads or shutdown
+	std::condition_variable idle; // signalled when the last read's callback returns
+	uint32_t pending = 0; // queued or in flight
+	bool quit = false;
+
+	std::vector<std::thread> threads;
+	Ring *ring = nullptr;
+	uint32_t depth = 0;
+};
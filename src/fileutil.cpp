@@ -0,0 +1,197 @@
+#include "fileutil.h"
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <functional>
+#include <thread>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+static bool isImage(const std::filesystem::path &path)
+{
+	static const char *extensions[] = { ".jpg", ".jpeg", ".png", ".bmp", ".tga", ".hdr", ".pic", ".gif", ".ktx2", ".dds" };
+
+	std::string ext = path.extension().string();
+	std::transform(ext.begin(), ext.end(), ext.begin(), [](unsigned char c) { return std::tolower(c); });
+
+	for (auto &i : extensions) {
+		if (ext == i)
+			return true;
+	}
+
+	return false;
+}
+
+bool ListImages(const char *path, std::vector<std::string> &paths)
+{
+	std::error_code ec;
+
+	if (std::filesystem::is_directory(path, ec)) {
+		std::vector<std::string> found;
+
+		for (auto &entry : std::filesystem::directory_iterator(path, ec)) {
+			if (entry.is_regular_file(ec) && isImage(entry.path()))
+				found.push_back(entry.path().string());
+		}
+
+		std::sort(found.begin(), found.end());
+		paths.insert(paths.end(), found.begin(), found.end());
+
+		return !found.empty();
+	}
+
+	if (!std::filesystem::is_regular_file(path, ec))
+		return false;
+
+	paths.push_back(path);
+	return true;
+}
+
+std::string TempPath(const std::string &path)
+{
+#ifdef _WIN32
+	unsigned long pid = GetCurrentProcessId();
+#else
+	unsigned long pid = static_cast<unsigned long>(getpid());
+#endif
+	size_t thread = std::hash<std::thread::id>()(std::this_thread::get_id());
+	return path + "." + std::to_string(pid) + "." + std::to_string(thread) + ".tmp";
+}
+
+bool MappedFile::Open(const char *path, Access access)
+{
+	Close();
+
+#ifdef _WIN32
+	DWORD flags = access == ACCESS_SEQUENTIAL ? FILE_FLAG_SEQUENTIAL_SCAN : FILE_ATTRIBUTE_NORMAL;
+	HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, flags, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+		return false;
+
+	LARGE_INTEGER fileSize;
+	if (!GetFileSizeEx(file, &fileSize) || !fileSize.QuadPart) {
+		CloseHandle(file);
+		return false;
+	}
+
+	// The mapping keeps the file open
+	mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	CloseHandle(file);
+	if (!mapping)
+		return false;
+
+	data = static_cast<const uint8_t *>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+	if (!data) {
+		CloseHandle(mapping);
+		mapping = nullptr;
+		return false;
+	}
+
+	size = static_cast<size_t>(fileSize.QuadPart);
+#else
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return false;
+
+	struct stat st;
+	if (fstat(fd, &st) || !st.st_size) {
+		close(fd);
+		return false;
+	}
+
+	// The mapping keeps the file open
+	void *mapped = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (mapped == MAP_FAILED)
+		return false;
+
+	// Bigger read ahead that starts right away, so slow disks and network mounts stream
+	// the file in while the decoder works through the first pages
+	if (access == ACCESS_SEQUENTIAL) {
+		madvise(mapped, st.st_size, MADV_SEQUENTIAL);
+		madvise(mapped, st.st_size, MADV_WILLNEED);
+	}
+
+	data = static_cast<const uint8_t *>(mapped);
+	size = st.st_size;
+#endif
+
+	return true;
+}
+
+void MappedFile::Close()
+{
+	if (!data)
+		return;
+
+#ifdef _WIN32
+	UnmapViewOfFile(data);
+	CloseHandle(mapping);
+	mapping = nullptr;
+#else
+	munmap(const_cast<uint8_t *>(data), size);
+#endif
+
+	data = nullptr;
+	size = 0;
+}
+
+// Four independent lanes of multiply and rotate, the same shape as xxHash64
+static const uint64_t PRIME1 = 0x9E3779B185EBCA87ull;
+static const uint64_t PRIME2 = 0xC2B2AE3D27D4EB4Full;
+static const uint64_t PRIME3 = 0x165667B19E3779F9ull;
+static const uint64_t PRIME4 = 0x85EBCA77C2B2AE63ull;
+
+static inline uint64_t rotl64(uint64_t x, int r)
+{
+	return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t hashRound(uint64_t acc, uint64_t value)
+{
+	return rotl64(acc + value * PRIME2, 31) * PRIME1;
+}
+
+uint64_t HashBytes(const void *data, size_t size, uint64_t seed)
+{
+	const uint8_t *p = static_cast<const uint8_t *>(data);
+	uint64_t lanes[4] = { seed + PRIME1 + PRIME2, seed + PRIME2, seed, seed - PRIME1 };
+	size_t i = 0;
+
+	for (; i + 32 <= size; i += 32) {
+		for (int l = 0; l < 4; l++) {
+			uint64_t value;
+			memcpy(&value, p + i + l * 8, 8);
+			lanes[l] = hashRound(lanes[l], value);
+		}
+	}
+
+	uint64_t hash = size >= 32 ? rotl64(lanes[0], 1) + rotl64(lanes[1], 7) + rotl64(lanes[2], 12) + rotl64(lanes[3], 18) : seed + PRIME3;
+	hash += size;
+
+	for (; i + 8 <= size; i += 8) {
+		uint64_t value;
+		memcpy(&value, p + i, 8);
+		hash = rotl64(hash ^ hashRound(0, value), 27) * PRIME1 + PRIME4;
+	}
+
+	for (; i < size; i++)
+		hash = rotl64(hash ^ (p[i] * PRIME3), 11) * PRIME1;
+
+	hash ^= hash >> 33;
+	hash *= PRIME2;
+	hash ^= hash >> 29;
+	hash *= PRIME3;
+	hash ^= hash >> 32;
+
+	return hash;
+}
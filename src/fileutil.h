@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Appends path if it is an image file, or every image directly inside it (sorted) if it is a directory.
+// false if nothing was found.
+bool ListImages(const char *path, std::vector<std::string> &paths);
+
+// A name next to path to write to before renaming over it, unique to this process and thread so
+// two instances sharing a directory never write into each other's file
+std::string TempPath(const std::string &path);
+
+// Read-only mapping of a whole file, unmapped by Close() or the destructor
+class MappedFile {
+public:
+	MappedFile() {}
+	virtual ~MappedFile() { Close(); }
+	MappedFile(const MappedFile &) = delete;
+	MappedFile &operator=(const MappedFile &) = delete;
+
+	enum Access {
+		ACCESS_NORMAL,
+		ACCESS_SEQUENTIAL // read front to back, the whole file gets read ahead
+	};
+
+	bool Open(const char *path, Access access = ACCESS_NORMAL); // false if the file can't be opened or is empty
+	void Close();
+
+	inline const uint8_t *getData() { return data; }
+	inline size_t getSize() { return size; }
+
+protected:
+	const uint8_t *data = nullptr;
+	size_t size = 0;
+#ifdef _WIN32
+	void *mapping = nullptr;
+#endif
+};
+
+uint64_t HashBytes(const void *data, size_t size, uint64_t seed = 0); // fast 64-bit hash, not cryptographic
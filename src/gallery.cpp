@@ -0,0 +1,382 @@
+#include "gallery.h"
+#include "bufferpool.h"
+#include "fileutil.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+static const uint32_t MARGIN = 4; // pixels around each thumbnail
+static const uint32_t MAX_THUMBS = 2048; // every texture is its own allocation, drivers often stop at 4096 of them
+
+// Box filter, every source pixel lands in exactly one destination pixel
+static void shrink(uint8_t *dst, uint32_t dstWidth, uint32_t dstHeight, const uint8_t *src, uint32_t width, uint32_t height)
+{
+	std::vector<uint32_t> sums(size_t(dstWidth) * 4);
+
+	for (uint32_t dy = 0; dy < dstHeight; dy++) {
+		uint32_t y0 = uint64_t(dy) * height / dstHeight, y1 = uint64_t(dy + 1) * height / dstHeight;
+		std::fill(sums.begin(), sums.end(), 0);
+
+		for (uint32_t y = y0; y < y1; y++) {
+			const uint8_t *row = src + size_t(y) * width * 4;
+			for (uint32_t dx = 0; dx < dstWidth; dx++) {
+				uint32_t x0 = uint64_t(dx) * width / dstWidth, x1 = uint64_t(dx + 1) * width / dstWidth;
+				for (uint32_t x = x0; x < x1; x++) {
+					for (uint32_t c = 0; c < 4; c++)
+						sums[dx * 4 + c] += row[x * 4 + c];
+				}
+			}
+		}
+
+		for (uint32_t dx = 0; dx < dstWidth; dx++) {
+			uint32_t x0 = uint64_t(dx) * width / dstWidth, x1 = uint64_t(dx + 1) * width / dstWidth;
+			uint32_t count = (x1 - x0) * (y1 - y0);
+			for (uint32_t c = 0; c < 4; c++)
+				dst[(size_t(dy) * dstWidth + dx) * 4 + c] = static_cast<uint8_t>((sums[dx * 4 + c] + count / 2) / count);
+		}
+	}
+}
+
+bool Gallery::AddPath(const char *path)
+{
+	return ListImages(path, paths);
+}
+
+bool Gallery::Setup(VulkanCTX *ctx, JobSystem *jobs, FileReader *reader, uint32_t thumbSize, size_t memoryCap)
+{
+	this->ctx = ctx;
+	this->jobs = jobs;
+	this->reader = reader;
+	this->thumbSize = std::max(thumbSize, 16u);
+
+	// A quarter of the bindless array stays free for evicted thumbnails waiting on their last frame
+	size_t thumbBytes = size_t(this->thumbSize) * this->thumbSize * 4;
+	capacity = static_cast<uint32_t>(std::min<size_t>({memoryCap / thumbBytes, ctx->getTextureCapacity() * 3 / 4, MAX_THUMBS}));
+	capacity = std::max(capacity, 1u);
+	maxCapacity = capacity;
+	maxLoads = std::max(4u, jobs->getThreadCount() * 2);
+
+	// Only thumbnails that are up get drawn, so that's as many tiles as a frame can have
+	if (!ctx->SetupGallery(capacity))
+		return false;
+
+	thumbs.assign(paths.size(), nullptr);
+	failed.assign(paths.size(), false);
+	scroll = 0.0;
+
+	Layout();
+	return true;
+}
+
+void Gallery::Release()
+{
+	// Reads and workers still hold references to their thumbnails, the reader goes first
+	if (reader)
+		reader->Wait();
+	if (jobs)
+		jobs->Wait();
+
+	for (size_t index : requested)
+		Drop(index);
+	requested.clear();
+}
+
+void Gallery::Scroll(double rows)
+{
+	if (rows == 0.0)
+		return;
+
+	scroll += rows * (thumbSize + 2 * MARGIN);
+	scrollDirection = rows > 0.0 ? 1.0 : -1.0;
+}
+
+void Gallery::ScrollPage(double pages)
+{
+	Scroll(pages * windowHeight / (thumbSize + 2 * MARGIN));
+}
+
+void Gallery::Layout()
+{
+	int width, height;
+	glfwGetFramebufferSize(ctx->getWindow(), &width, &height);
+
+	uint32_t cell = thumbSize + 2 * MARGIN;
+	windowWidth = std::max(width, 0);
+	windowHeight = std::max(height, 0);
+	columns = std::max(1u, windowWidth / cell);
+	rows = static_cast<uint32_t>((paths.size() + columns - 1) / columns);
+
+	double maxScroll = std::max(0.0, double(rows) * cell - windowHeight);
+	scroll = std::min(std::max(scroll, 0.0), maxScroll);
+}
+
+void Gallery::Update()
+{
+	if (paths.empty())
+		return;
+
+	Layout();
+	if (!windowWidth || !windowHeight)
+		return;
+
+	// Hand decoded thumbnails to the transfer queue and collect the finished ones
+	pending = 0;
+	for (size_t i = 0; i < requested.size();) {
+		size_t index = requested[i];
+		Thumb &thumb = *thumbs[index];
+		int state = thumb.state;
+
+		if (state == THUMB_DECODED) {
+			if (ctx->SubmitUpload(thumb.upload)) {
+				thumb.state = THUMB_UPLOADING;
+			} else {
+				// Out of device memory with nothing left to evict, keep fewer and try again later
+				ctx->CancelUpload(thumb.upload);
+				thumb.state = THUMB_DROPPED;
+				capacity = static_cast<uint32_t>(std::max<size_t>(requested.size(), 2) - 1);
+			}
+		} else if (state == THUMB_UPLOADING && ctx->PollUpload(thumb.upload)) {
+			ctx->TransitionTexture(thumb.upload.texture);
+			thumb.state = THUMB_READY;
+			loadCount++;
+
+			// The pressure that lowered the cap may be gone, every upload that goes through wins one back
+			capacity = std::min(capacity + 1, maxCapacity);
+			Evictable(index);
+		} else if (state == THUMB_READY && thumb.upload.texture.index == NO_TEXTURE_INDEX) {
+			ctx->BindTexture(thumb.upload.texture); // the array was full, evicted slots free up a few frames later
+			Evictable(index);
+		}
+
+		state = thumb.state;
+		if (state == THUMB_FAILED || state == THUMB_DROPPED || state == THUMB_EVICTED) {
+			failed[index] = state == THUMB_FAILED;
+			failedCount += state == THUMB_FAILED;
+			droppedCount += state == THUMB_DROPPED;
+			evictCount += state == THUMB_EVICTED;
+			thumbs[index].reset();
+			requested[i] = requested.back();
+			requested.pop_back();
+		} else {
+			pending += state != THUMB_READY;
+			i++;
+		}
+	}
+
+	// Cull on the CPU, only the rows on screen go into the tile buffer
+	uint32_t cell = thumbSize + 2 * MARGIN;
+	uint32_t firstRow = static_cast<uint32_t>(scroll / cell);
+	uint32_t lastRow = std::min(rows, static_cast<uint32_t>((scroll + windowHeight + cell - 1) / cell));
+	size_t first = size_t(firstRow) * columns;
+	size_t last = std::min(paths.size(), size_t(lastRow) * columns);
+	double originX = (double(windowWidth) - double(columns) * cell) / 2.0;
+
+	tiles.clear();
+	for (size_t index = first; index < last; index++) {
+		Thumb *thumb = thumbs[index].get();
+		if (!thumb || thumb->state != THUMB_READY || thumb->upload.texture.index == NO_TEXTURE_INDEX)
+			continue;
+
+		// Fit the thumbnail inside its cell, centered
+		const VulkanTexture &texture = thumb->upload.texture;
+		double scale = double(thumbSize) / std::max(texture.width, texture.height);
+		double width = texture.width * scale, height = texture.height * scale;
+		double x = originX + double(index % columns) * cell + MARGIN + (thumbSize - width) / 2.0;
+		double y = double(index / columns) * cell - scroll + MARGIN + (thumbSize - height) / 2.0;
+
+		VulkanTile tile = {};
+		tile.x = static_cast<float>(x / windowWidth * 2.0 - 1.0);
+		tile.y = static_cast<float>(y / windowHeight * 2.0 - 1.0);
+		tile.width = static_cast<float>(width / windowWidth * 2.0);
+		tile.height = static_cast<float>(height / windowHeight * 2.0);
+		tile.textureIndex = texture.index;
+		tiles.push_back(tile);
+	}
+
+	ctx->SetGalleryTiles(tiles.data(), static_cast<uint32_t>(tiles.size()));
+
+	// Scrolled, resized or a thumbnail came in, on demand nothing else wakes the window
+	if (tiles.size() != drawnTiles.size() || memcmp(tiles.data(), drawnTiles.data(), tiles.size() * sizeof(VulkanTile))) {
+		drawnTiles = tiles;
+		ctx->RequestRedraw();
+	}
+
+	frames++;
+	visibleTotal += last - first;
+	drawnTotal += tiles.size();
+
+	Evict(first, last);
+	Stream(first, last);
+}
+
+void Gallery::Stream(size_t first, size_t last)
+{
+	size_t screen = std::max<size_t>(last - first, columns);
+	size_t loads = 0;
+
+	// Loads far from the window aren't worth a decode anymore, the worker skips them
+	size_t keepFirst = first > 2 * screen ? first - 2 * screen : 0;
+	size_t keepLast = std::min(paths.size(), last + 2 * screen);
+
+	for (size_t index : requested) {
+		Thumb &thumb = *thumbs[index];
+		if (thumb.state == THUMB_LOADING && (index < keepFirst || index >= keepLast))
+			thumb.wanted = false;
+		loads += thumb.state == THUMB_LOADING || thumb.state == THUMB_DECODED || thumb.state == THUMB_UPLOADING;
+	}
+
+	// What's on screen from the middle out, then a screen ahead and half a screen behind
+	std::vector<size_t> order;
+	size_t middle = (first + last) / 2;
+	for (size_t d = 0; middle + d < last || middle >= first + d; d++) {
+		if (middle + d < last)
+			order.push_back(middle + d);
+		if (d && middle >= first + d)
+			order.push_back(middle - d);
+	}
+
+	size_t aheadFirst = scrollDirection > 0.0 ? last : first;
+	size_t behindFirst = scrollDirection > 0.0 ? first : last;
+	for (size_t d = 0; d < screen; d++) {
+		if (scrollDirection > 0.0 && aheadFirst + d < paths.size())
+			order.push_back(aheadFirst + d);
+		else if (scrollDirection < 0.0 && aheadFirst > d)
+			order.push_back(aheadFirst - d - 1);
+	}
+	for (size_t d = 0; d < screen / 2; d++) {
+		if (scrollDirection > 0.0 && behindFirst > d)
+			order.push_back(behindFirst - d - 1);
+		else if (scrollDirection < 0.0 && behindFirst + d < paths.size())
+			order.push_back(behindFirst + d);
+	}
+
+	for (size_t index : order) {
+		if (loads >= maxLoads || requested.size() >= capacity)
+			break;
+
+		if (thumbs[index] || failed[index])
+			continue;
+
+		Load(index);
+		loads++;
+	}
+}
+
+void Gallery::Evict(size_t first, size_t last)
+{
+	// Leave room for the loads coming in
+	if (requested.size() + maxLoads <= capacity)
+		return;
+
+	std::vector<size_t> ready;
+	for (size_t index : requested) {
+		if ((index < first || index >= last) && thumbs[index]->state == THUMB_READY)
+			ready.push_back(index);
+	}
+
+	// Farthest from the window first
+	size_t middle = (first + last) / 2;
+	std::sort(ready.begin(), ready.end(), [middle](size_t a, size_t b) {
+		size_t da = a > middle ? a - middle : middle - a;
+		size_t db = b > middle ? b - middle : middle - b;
+		return da > db;
+	});
+
+	size_t excess = requested.size() + maxLoads - capacity;
+	for (size_t i = 0; i < ready.size() && i < excess; i++) {
+		Drop(ready[i]);
+		requested.erase(std::find(requested.begin(), requested.end(), ready[i]));
+		evictCount++;
+	}
+}
+
+void Gallery::Evictable(size_t index)
+{
+	// Runs inside a later SubmitUpload(), the loop in Update() forgets the thumbnail
+	std::shared_ptr<Thumb> thumb = thumbs[index];
+	ctx->SetEvictable(thumb->upload.texture, [this, thumb]() {
+		ctx->RetireTexture(thumb->upload.texture);
+		thumb->state = THUMB_EVICTED;
+		capacity = static_cast<uint32_t>(std::max<size_t>(requested.size(), 2) - 1);
+	});
+}
+
+void Gallery::Drop(size_t index)
+{
+	Thumb &thumb = *thumbs[index];
+
+	// Frames in flight may still sample it, its slot comes free once they're done
+	if (thumb.state == THUMB_READY)
+		ctx->RetireTexture(thumb.upload.texture);
+	else
+		ctx->CancelUpload(thumb.upload);
+
+	thumbs[index].reset();
+}
+
+void Gallery::Load(size_t index)
+{
+	std::shared_ptr<Thumb> thumb = std::make_shared<Thumb>();
+	thumbs[index] = thumb;
+	requested.push_back(index);
+
+	reader->Read(paths[index], [this, thumb](uint8_t *data, size_t size) {
+		jobs->Submit([this, thumb, data, size]() {
+			if (!thumb->wanted) {
+				bufferPool.Free(data);
+				thumb->state = THUMB_DROPPED;
+				return;
+			}
+
+			Clock::time_point start = Clock::now();
+
+			// Thumbnails are always 8-bit RGBA, whatever the file holds
+			Decoder decoder;
+			decoder.SetRGBA8(true);
+
+			Image image;
+			bool decoded = data && decoder.Load(data, size, image);
+			bufferPool.Free(data);
+
+			if (!decoded) {
+				thumb->state = THUMB_FAILED;
+				return;
+			}
+
+			uint32_t width = image.width, height = image.height;
+			double scale = std::min(1.0, double(thumbSize) / std::max(width, height));
+			uint32_t thumbWidth = std::max(1u, static_cast<uint32_t>(std::lround(width * scale)));
+			uint32_t thumbHeight = std::max(1u, static_cast<uint32_t>(std::lround(height * scale)));
+
+			bool prepared;
+			if (thumbWidth == width && thumbHeight == height) {
+				prepared = ctx->PrepareUpload(image.data, width, height, thumb->upload);
+			} else {
+				uint8_t *pixels = static_cast<uint8_t *>(bufferPool.Alloc(size_t(thumbWidth) * thumbHeight * 4));
+				shrink(pixels, thumbWidth, thumbHeight, static_cast<const uint8_t *>(image.data), width, height);
+				prepared = ctx->PrepareUpload(pixels, thumbWidth, thumbHeight, thumb->upload);
+				bufferPool.Free(pixels);
+			}
+
+			FreeImage(image);
+
+			decodeNs += std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count();
+			decodeCount++;
+			thumb->state = prepared ? THUMB_DECODED : THUMB_FAILED;
+		});
+	});
+}
+
+void Gallery::PrintStats()
+{
+	if (!frames)
+		return;
+
+	std::cout << "Gallery: " << loadCount << " thumbnails loaded, " << evictCount << " evicted, "
+		<< droppedCount << " dropped before decode, " << failedCount << " failed" << std::endl;
+	std::cout << "Gallery: avg " << double(drawnTotal) / frames << " of " << double(visibleTotal) / frames << " visible tiles drawn per frame";
+	if (decodeCount)
+		std::cout << ", " << decodeNs / 1e6 / decodeCount << " ms per thumbnail decode";
+	std::cout << std::endl;
+}
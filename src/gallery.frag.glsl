@@ -0,0 +1,18 @@
+// Compiled by the build into galleryfrag.h with:
+// glslangValidator -V --spirv-val --vn galleryFsSpv -o galleryfrag.h gallery.frag.glsl
+
+#version 450
+#extension GL_EXT_nonuniform_qualifier : require
+
+layout (set = 1, binding = 0) uniform sampler2D textures[];
+
+layout (location = 0) in vec2 texCoordIn;
+layout (location = 1) flat in uint textureIndexIn;
+
+layout (location = 0) out vec4 fragmentOut;
+
+void main()
+{
+	// Neighbouring pixels can belong to different thumbnails
+	fragmentOut = texture(textures[nonuniformEXT(textureIndexIn)], texCoordIn);
+}
@@ -0,0 +1,92 @@
+#pragma once
+
+#include "filereader.h"
+#include "image.h"
+#include "jobs.h"
+#include "vulkanctx.h"
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+
+// A scrolling grid of thumbnails, drawn with one instanced draw that only gets the tiles on
+// screen. Thumbnails are read by the file reader, decoded and shrunk on the job system and
+// uploaded on the transfer queue, the ones nearest the middle of the window first and then a
+// screen ahead in the scroll direction. Only a few loads are queued at a time, so the order
+// follows the scrolling. Thumbnails far off screen give their textures back when the cap is hit,
+// and the cap comes down whenever the device runs short on memory before that.
+class Gallery {
+public:
+	Gallery() {}
+	virtual ~Gallery() {}
+
+	bool AddPath(const char *path); // adds an image, or every image inside a directory - false if nothing was found
+	bool Setup(VulkanCTX *ctx, JobSystem *jobs, FileReader *reader, uint32_t thumbSize, size_t memoryCap); // false if the context can't draw a gallery
+	void Release();
+
+	void Scroll(double rows); // positive scrolls down
+	void ScrollPage(double pages);
+	void Update(); // call once per frame between VulkanCTX::Update() or WaitFrame() and DrawGraphics(), asks for a redraw when the tiles change
+
+	void PrintStats();
+
+	inline size_t getCount() { return paths.size(); }
+	inline bool isBusy() { return pending > 0; } // thumbnails are still on their way in
+
+protected:
+	typedef std::chrono::steady_clock Clock;
+
+	enum ThumbState {
+		THUMB_LOADING, // being read, or on a worker
+		THUMB_DECODED, // staging buffer filled, waiting for SubmitUpload()
+		THUMB_UPLOADING, // on the transfer queue
+		THUMB_READY,
+		THUMB_FAILED,
+		THUMB_DROPPED, // scrolled too far away before a worker got to it
+		THUMB_EVICTED // the device wanted the memory back
+	};
+
+	struct Thumb {
+		std::atomic<int> state{THUMB_LOADING};
+		std::atomic<bool> wanted{true}; // cleared once it's far off screen, the worker skips the decode
+		VulkanUpload upload;
+	};
+
+	void Layout(); // grid and scroll limits for the window's current size
+	void Load(size_t index);
+	void Stream(size_t first, size_t last); // queues loads for the visible range [first, last) and what's around it
+	void Evict(size_t first, size_t last);
+	void Evictable(size_t index); // the context may take it back when uploads run short on device memory
+	void Drop(size_t index);
+
+	VulkanCTX *ctx = nullptr;
+	JobSystem *jobs = nullptr;
+	FileReader *reader = nullptr;
+
+	std::vector<std::string> paths;
+	std::vector<std::shared_ptr<Thumb>> thumbs; // by path index, empty until requested
+	std::vector<size_t> requested; // indices with a thumb, whatever its state
+	std::vector<bool> failed; // never tried again
+	std::vector<VulkanTile> tiles; // this frame's, reused
+	std::vector<VulkanTile> drawnTiles; // what the last redraw asked for
+	size_t pending = 0; // loading, decoded or uploading
+
+	uint32_t thumbSize = 0;
+	uint32_t capacity = 0; // thumbnails kept on the device, lowered when the device evicts some
+	uint32_t maxCapacity = 0; // what the memory cap allows, capacity grows back to it one upload at a time
+	uint32_t maxLoads = 0; // loads in flight
+
+	// Grid, in framebuffer pixels
+	uint32_t windowWidth = 0, windowHeight = 0;
+	uint32_t columns = 1, rows = 0;
+	double scroll = 0.0; // top of the window inside the grid
+	double scrollDirection = 1.0; // of the last scroll, the prefetch leans that way
+
+	// Stats
+	uint64_t frames = 0;
+	uint64_t visibleTotal = 0, drawnTotal = 0;
+	uint32_t loadCount = 0, evictCount = 0, droppedCount = 0, failedCount = 0;
+	std::atomic<uint64_t> decodeNs{0};
+	std::atomic<uint32_t> decodeCount{0};
+};
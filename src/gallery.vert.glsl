@@ -0,0 +1,39 @@
+// Compiled by the build into galleryvert.h with:
+// glslangValidator -V --spirv-val --vn galleryVsSpv -o galleryvert.h gallery.vert.glsl
+
+// One quad per instance, the gallery writes every visible thumbnail's
+// rectangle and texture into the storage buffer each frame.
+
+#version 450
+
+struct Tile {
+	vec4 rect; // top left corner and size in clip space
+	uint textureIndex;
+};
+
+layout (set = 0, binding = 0) readonly buffer Tiles {
+	Tile tiles[];
+};
+
+layout (location = 0) out vec2 texCoord;
+layout (location = 1) flat out uint textureIndex;
+
+vec2 corners[6] = vec2[](
+	vec2(0.0, 0.0),
+	vec2(1.0, 0.0),
+	vec2(1.0, 1.0),
+
+	vec2(1.0, 1.0),
+	vec2(0.0, 1.0),
+	vec2(0.0, 0.0)
+);
+
+void main()
+{
+	vec4 rect = tiles[gl_InstanceIndex].rect;
+	vec2 corner = corners[gl_VertexIndex];
+
+	gl_Position = vec4(rect.xy + corner * rect.zw, 0.0, 1.0);
+	texCoord = corner;
+	textureIndex = tiles[gl_InstanceIndex].textureIndex;
+}
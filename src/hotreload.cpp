@@ -0,0 +1,288 @@
+#include "hotreload.h"
+#include "bufferpool.h"
+#include "filereader.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+#if defined(__linux__)
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+static const uint32_t TILE_SIZE = 64;
+static const double SETTLE_MS = 50.0; // writers that touch the file more than once get to finish
+static const double POLL_MS = 250.0; // modification time checks without inotify
+
+bool HotReload::Setup(VulkanCTX *ctx, JobSystem *jobs, TextureCache *cache, const char *path)
+{
+	Release();
+
+	this->ctx = ctx;
+	this->jobs = jobs;
+	this->cache = cache;
+	this->path = path;
+	decoder.SetJobs(jobs);
+
+	std::error_code error;
+	std::filesystem::path file(path);
+	name = file.filename().string();
+	lastWrite = std::filesystem::last_write_time(file, error);
+	lastCheck = Clock::now();
+
+#if defined(__linux__)
+	// The directory, not the file, the file's inode goes away when something renames a new one over it
+	std::string dir = file.has_parent_path() ? file.parent_path().string() : ".";
+
+	watchFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (watchFd < 0 || inotify_add_watch(watchFd, dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+		std::cout << "Can't watch " << dir << " for changes :(" << std::endl;
+		Release();
+		return false;
+	}
+#else
+	if (error) {
+		std::cout << "Can't watch " << path << " for changes :(" << std::endl;
+		Release();
+		return false;
+	}
+#endif
+
+	// Decode what's on screen now in the background, so the first reload can already send only what changed
+	state = RELOAD_DECODING;
+	jobs->Submit([this]() {
+		size_t size;
+		uint8_t *data = ReadFile(this->path.c_str(), size);
+		if (!data || !decoder.Load(data, size, previous))
+			previous = Image();
+		bufferPool.Free(data);
+		state = RELOAD_IDLE;
+	});
+
+	return true;
+}
+
+void HotReload::Release()
+{
+	if (jobs)
+		jobs->Wait();
+
+	if (state == RELOAD_PREPARED || state == RELOAD_UPLOADING)
+		ctx->CancelUpload(upload);
+
+#if defined(__linux__)
+	if (watchFd >= 0)
+		close(watchFd);
+#endif
+	watchFd = -1;
+
+	FreeImage(previous);
+	regions.clear();
+	state = RELOAD_IDLE;
+	pending = false;
+	jobs = nullptr;
+}
+
+bool HotReload::Changed()
+{
+	bool changed = false;
+
+#if defined(__linux__)
+	alignas(struct inotify_event) char buffer[4096];
+	ssize_t got;
+
+	while ((got = read(watchFd, buffer, sizeof(buffer))) > 0) {
+		for (char *p = buffer; p < buffer + got;) {
+			const struct inotify_event *event = reinterpret_cast<const struct inotify_event *>(p);
+			if (event->len && name == event->name)
+				changed = true;
+			p += sizeof(struct inotify_event) + event->len;
+		}
+	}
+#else
+	if (std::chrono::duration<double, std::milli>(Clock::now() - lastCheck).count() < POLL_MS)
+		return false;
+
+	std::error_code error;
+	std::filesystem::file_time_type write = std::filesystem::last_write_time(path, error);
+	lastCheck = Clock::now();
+
+	if (!error && write != lastWrite) {
+		lastWrite = write;
+		changed = true;
+	}
+#endif
+
+	return changed;
+}
+
+void HotReload::Update()
+{
+	if (!jobs)
+		return;
+
+	if (Changed()) {
+		if (!pending)
+			firstChangeTime = Clock::now();
+		changeTime = Clock::now();
+		pending = true;
+	}
+
+	int current = state;
+	bool shown = false;
+
+	if (current == RELOAD_REGIONS) {
+		// All of them or none, the texture turns down every region for the same reasons
+		bool updated = true;
+		size_t pixelSize = getImageSize(previous) / (size_t(previous.width) * previous.height);
+		size_t stride = size_t(previous.width) * pixelSize;
+		const uint8_t *pixels = static_cast<const uint8_t *>(previous.data);
+
+		for (const Region &region : regions) {
+			const uint8_t *start = pixels + region.y * stride + region.x * pixelSize;
+			if (!ctx->UpdateTextureRegion(region.x, region.y, region.width, region.height, start, stride, previous.channels, previous.type)) {
+				updated = false;
+				break;
+			}
+		}
+
+		if (updated) {
+			regionReloads++;
+			shown = true;
+		} else {
+			// Go again with a whole new texture, right away
+			regionsUsable = false;
+			if (!pending)
+				firstChangeTime = Clock::now();
+			changeTime = Clock::time_point();
+			pending = true;
+		}
+
+		state = RELOAD_IDLE;
+	} else if (current == RELOAD_PREPARED) {
+		if (ctx->SubmitUpload(upload)) {
+			state = RELOAD_UPLOADING;
+		} else {
+			ctx->CancelUpload(upload);
+			state = RELOAD_FAILED;
+		}
+	} else if (current == RELOAD_UPLOADING && ctx->PollUpload(upload)) {
+		// The old texture is retired once no frame in flight samples it, nothing waits on the device
+		ctx->SwapTexture(upload.texture);
+		shown = true;
+		state = RELOAD_IDLE;
+	} else if (current == RELOAD_FAILED) {
+		std::cout << "Failed to reload " << path << ", keeping what's up :(" << std::endl;
+		failedCount++;
+		state = RELOAD_IDLE;
+	}
+
+	if (shown) {
+		reloadCount++;
+		reloadTotalMs += std::chrono::duration<double, std::milli>(Clock::now() - reloadStart).count();
+	}
+
+	if (state == RELOAD_IDLE && pending && std::chrono::duration<double, std::milli>(Clock::now() - changeTime).count() >= SETTLE_MS) {
+		pending = false;
+		reloadStart = firstChangeTime;
+		state = RELOAD_DECODING;
+		jobs->Submit([this]() { Decode(); });
+	}
+}
+
+void HotReload::Decode()
+{
+	// Read into memory rather than mapped, a writer that truncates or rewrites the file in
+	// place while this runs would fault the mapping and take the viewer down
+	size_t size;
+	uint8_t *data = ReadFile(path.c_str(), size);
+	if (!data) {
+		state = RELOAD_FAILED;
+		return;
+	}
+
+	// Files stb can't decode, like KTX2 and DDS, take the same way in as at startup
+	Image image;
+	bool decoded = decoder.Load(data, size, image);
+	bool packed = !decoded && cache->PrepareUpload(path.c_str(), data, size, upload);
+	bufferPool.Free(data);
+
+	if (decoded && regionsUsable && previous.data && image.width == previous.width && image.height == previous.height &&
+		image.channels == previous.channels && image.type == previous.type) {
+		FindChanges(image);
+		FreeImage(previous);
+		previous = image;
+		state = RELOAD_REGIONS;
+		return;
+	}
+
+	// New size or format: the whole image goes up as a new texture
+	bool prepared = decoded ? ctx->PrepareUpload(image.data, image.width, image.height, upload, image.channels, image.type) : packed;
+
+	// Nothing changed on screen if it failed, the old pixels stay what the texture holds
+	if (prepared) {
+		FreeImage(previous);
+		if (decoded)
+			previous = image;
+	} else {
+		FreeImage(image);
+	}
+
+	state = prepared ? RELOAD_PREPARED : RELOAD_FAILED;
+}
+
+void HotReload::FindChanges(const Image &image)
+{
+	regions.clear();
+
+	size_t pixelSize = getImageSize(image) / (size_t(image.width) * image.height);
+	size_t stride = size_t(image.width) * pixelSize;
+	uint32_t width = image.width, height = image.height;
+	uint32_t tilesX = (width + TILE_SIZE - 1) / TILE_SIZE, tilesY = (height + TILE_SIZE - 1) / TILE_SIZE;
+
+	const uint8_t *a = static_cast<const uint8_t *>(image.data);
+	const uint8_t *b = static_cast<const uint8_t *>(previous.data);
+
+	// Runs of changed tiles in a row become one region
+	for (uint32_t ty = 0; ty < tilesY; ty++) {
+		uint32_t y = ty * TILE_SIZE, rows = std::min(TILE_SIZE, height - y);
+		uint32_t runStart = UINT32_MAX;
+
+		for (uint32_t tx = 0; tx <= tilesX; tx++) {
+			bool changed = false;
+			if (tx < tilesX) {
+				uint32_t x = tx * TILE_SIZE, columns = std::min(TILE_SIZE, width - x);
+				for (uint32_t row = y; row < y + rows && !changed; row++) {
+					size_t offset = row * stride + x * pixelSize;
+					changed = memcmp(a + offset, b + offset, columns * pixelSize) != 0;
+				}
+			}
+
+			if (changed) {
+				tilesSent++;
+				if (runStart == UINT32_MAX)
+					runStart = tx;
+			} else if (runStart != UINT32_MAX) {
+				uint32_t x = runStart * TILE_SIZE;
+				regions.push_back({x, y, std::min(tx * TILE_SIZE, width) - x, rows});
+				runStart = UINT32_MAX;
+			}
+		}
+	}
+
+	tilesTotal += uint64_t(tilesX) * tilesY;
+}
+
+void HotReload::PrintStats()
+{
+	if (!reloadCount && !failedCount)
+		return;
+
+	std::cout << "Reloads: " << reloadCount << ", " << regionReloads << " in place";
+	if (tilesTotal)
+		std::cout << " (" << tilesSent << " of " << tilesTotal << " tiles sent)";
+	if (reloadCount)
+		std::cout << ", avg " << reloadTotalMs / reloadCount << " ms from write to screen";
+	std::cout << ", " << failedCount << " failed" << std::endl;
+}
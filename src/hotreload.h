@@ -0,0 +1,75 @@
+#pragma once
+
+#include "image.h"
+#include "jobs.h"
+#include "texcache.h"
+#include "vulkanctx.h"
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+// Reloads the displayed image whenever another program rewrites it. The file's directory is
+// watched with inotify, so tools that write a temporary and rename it over are caught too
+// (other systems check the modification time a few times a second). Reloads decode on the job
+// system. An image that keeps its size and format only sends the tiles that changed into the
+// texture on screen, anything else goes up as a new texture that replaces the old one.
+class HotReload {
+public:
+	HotReload() {}
+	virtual ~HotReload() {}
+
+	bool Setup(VulkanCTX *ctx, JobSystem *jobs, TextureCache *cache, const char *path); // path is what's displayed now - false if it can't be watched
+	void Release(); // safe without Setup()
+
+	void Update(); // call once per frame between VulkanCTX::Update() or WaitFrame() and DrawGraphics()
+	inline bool isBusy() { return pending || state != RELOAD_IDLE; } // a reload is on its way
+
+	void PrintStats();
+
+protected:
+	typedef std::chrono::steady_clock Clock;
+
+	enum ReloadState {
+		RELOAD_IDLE,
+		RELOAD_DECODING, // on a worker
+		RELOAD_REGIONS, // decoded, changed tiles waiting for UpdateTextureRegion()
+		RELOAD_PREPARED, // staging buffer filled, waiting for SubmitUpload()
+		RELOAD_UPLOADING, // new texture on the transfer queue
+		RELOAD_FAILED
+	};
+
+	struct Region {
+		uint32_t x, y, width, height;
+	};
+
+	bool Changed(); // drains the watch, true if the file was written or replaced since the last call
+	void Decode();
+	void FindChanges(const Image &image); // tiles where image differs from previous
+
+	VulkanCTX *ctx = nullptr;
+	JobSystem *jobs = nullptr;
+	TextureCache *cache = nullptr;
+	Decoder decoder;
+
+	std::string path;
+	std::string name; // file name inside the watched directory
+	int watchFd = -1;
+	std::filesystem::file_time_type lastWrite; // without inotify
+	Clock::time_point lastCheck;
+
+	std::atomic<int> state{RELOAD_IDLE};
+	std::atomic<bool> regionsUsable{true}; // cleared for good once the texture turns down a region, like BC textures do
+	bool pending = false; // changed, waiting for the writes to settle or for the last reload to finish
+	Clock::time_point changeTime, firstChangeTime, reloadStart;
+
+	// Only the job touches these while it runs
+	Image previous; // last decode, what the texture holds
+	std::vector<Region> regions;
+	VulkanUpload upload;
+
+	uint32_t reloadCount = 0, regionReloads = 0, failedCount = 0;
+	uint64_t tilesSent = 0, tilesTotal = 0;
+	double reloadTotalMs = 0.0;
+};
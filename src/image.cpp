@@ -0,0 +1,111 @@
+#include "image.h"
+#include "stb_image.h"
+#include "fileutil.h"
+#include "jobs.h"
+#include "texfile.h"
+
+#include <climits>
+
+static void decoderParallelFor(void *user, int count, void (*task)(void *arg, int index), void *arg)
+{
+	static_cast<JobSystem *>(user)->ParallelFor(count, [task, arg](size_t i) { task(arg, static_cast<int>(i)); });
+}
+
+void Decoder::Apply()
+{
+	stbi_set_flip_vertically_on_load_thread(flip);
+	stbi_set_png_simd_thread(simd);
+	stbi_set_parallel_for_thread(jobs ? decoderParallelFor : nullptr, jobs);
+
+	// stb's defaults, pinned so the process-wide setters can't reach into a decode
+	stbi_set_unpremultiply_on_load_thread(0);
+	stbi_convert_iphone_png_to_rgb_thread(0);
+	stbi_hdr_to_ldr_thread(2.2f, 1.0f);
+}
+
+bool Decoder::Load(const char *path, Image &image)
+{
+	// stb's stdio reader goes through a 128 byte buffer and a callback per refill, decoding
+	// from a mapping skips that and the copy. Pipes and empty files can't be mapped, stdio
+	// handles those and leaves a failure reason.
+	if (mapFiles) {
+		MappedFile file;
+		if (file.Open(path, MappedFile::ACCESS_SEQUENTIAL))
+			return Load(file.getData(), file.getSize(), image);
+	}
+
+	FreeImage(image);
+	Apply();
+
+	if (rgba8) {
+		image.data = stbi_load(path, &image.width, &image.height, &image.channels, 4);
+		image.channels = 4;
+	} else if (stbi_is_hdr(path)) {
+		image.data = stbi_loadf(path, &image.width, &image.height, &image.channels, 4);
+		image.type = PIXEL_F32;
+		image.channels = 4;
+	} else if (stbi_is_16_bit(path)) {
+		image.data = stbi_load_16(path, &image.width, &image.height, &image.channels, 4);
+		image.type = PIXEL_U16;
+		image.channels = 4;
+	} else {
+		image.data = stbi_load(path, &image.width, &image.height, &image.channels, 0);
+	}
+
+	return image.data != nullptr;
+}
+
+bool Decoder::Load(const uint8_t *data, size_t size, Image &image)
+{
+	FreeImage(image);
+	if (size > INT_MAX)
+		return false;
+
+	Apply();
+	int len = static_cast<int>(size);
+
+	if (rgba8) {
+		image.data = stbi_load_from_memory(data, len, &image.width, &image.height, &image.channels, 4);
+		image.channels = 4;
+	} else if (stbi_is_hdr_from_memory(data, len)) {
+		image.data = stbi_loadf_from_memory(data, len, &image.width, &image.height, &image.channels, 4);
+		image.type = PIXEL_F32;
+		image.channels = 4;
+	} else if (stbi_is_16_bit_from_memory(data, len)) {
+		image.data = stbi_load_16_from_memory(data, len, &image.width, &image.height, &image.channels, 4);
+		image.type = PIXEL_U16;
+		image.channels = 4;
+	} else {
+		image.data = stbi_load_from_memory(data, len, &image.width, &image.height, &image.channels, 0);
+	}
+
+	return image.data != nullptr;
+}
+
+bool Decoder::Info(const char *path, int &width, int &height)
+{
+	int channels;
+	if (stbi_info(path, &width, &height, &channels))
+		return true;
+
+	MappedFile file;
+	TextureFileInfo info;
+	if (!file.Open(path) || !ParseTextureFile(file.getData(), file.getSize(), info))
+		return false;
+
+	width = info.width;
+	height = info.height;
+	return true;
+}
+
+const char *Decoder::getError()
+{
+	const char *reason = stbi_failure_reason();
+	return reason ? reason : "unknown error";
+}
+
+void FreeImage(Image &image)
+{
+	stbi_image_free(image.data);
+	image = Image();
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include "pixelconv.h"
+
+class JobSystem;
+
+// A decoded image at its native depth. 8-bit images keep their channel count,
+// 16-bit and HDR ones always come back as RGBA.
+struct Image {
+	void *data = nullptr; // from stb, release with FreeImage()
+	int width = 0, height = 0, channels = 0;
+	PixelType type = PIXEL_U8;
+};
+
+// Front end to stb_image. The decoder's settings are copied into the calling thread's stb
+// state before every call and stb keeps its failure reason per thread, so any number of
+// threads can decode at once, each with its own decoder or sharing one that isn't changed.
+class Decoder {
+public:
+	Decoder() {}
+	virtual ~Decoder() {}
+
+	bool Load(const char *path, Image &image); // false if stb couldn't decode it
+	bool Load(const uint8_t *data, size_t size, Image &image);
+	bool Info(const char *path, int &width, int &height); // size from the header, KTX2 and DDS files included
+
+	inline void SetRGBA8(bool rgba8) { this->rgba8 = rgba8; } // everything comes back as 8-bit RGBA, 16-bit and HDR images too
+	inline void SetFlip(bool flip) { this->flip = flip; } // bottom row first
+	inline void SetSIMD(bool simd) { this->simd = simd; } // SSE2/NEON PNG defiltering, on by default
+	inline void SetJobs(JobSystem *jobs) { this->jobs = jobs; } // big JPEGs decode on the workers, nullptr for the calling thread only
+	inline void SetMapFiles(bool mapFiles) { this->mapFiles = mapFiles; } // Load(path) decodes from a mapping (default) or stb's stdio reader
+
+	const char *getError(); // why the last decode on this thread failed
+
+protected:
+	void Apply();
+
+	bool rgba8 = false;
+	bool flip = false;
+	bool simd = true;
+	JobSystem *jobs = nullptr;
+	bool mapFiles = true;
+};
+
+void FreeImage(Image &image);
+
+inline size_t getImageSize(const Image &image)
+{
+	size_t channelSize = image.type == PIXEL_F32 ? 4 : image.type == PIXEL_U16 ? 2 : 1;
+	return static_cast<size_t>(image.width) * image.height * image.channels * channelSize;
+}
@@ -0,0 +1,108 @@
+#include "jobs.h"
+
+#include <algorithm>
+#include <memory>
+
+void JobSystem::Setup(uint32_t threadCount)
+{
+	if (!threadCount) {
+		threadCount = std::thread::hardware_concurrency();
+		threadCount = threadCount > 1 ? threadCount - 1 : 1;
+	}
+
+	quit = false;
+	for (uint32_t i = 0; i < threadCount; i++)
+		workers.emplace_back(&JobSystem::WorkerLoop, this);
+}
+
+void JobSystem::Release()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		quit = true;
+	}
+	wake.notify_all();
+
+	for (auto &worker : workers)
+		worker.join();
+
+	workers.clear();
+}
+
+void JobSystem::Submit(std::function<void()> job)
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		queue.push_back(std::move(job));
+	}
+	wake.notify_one();
+}
+
+void JobSystem::Wait()
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	idle.wait(lock, [this] { return queue.empty() && !running; });
+}
+
+void JobSystem::ParallelFor(size_t count, const std::function<void(size_t)> &fn)
+{
+	if (!count)
+		return;
+
+	struct Batch {
+		std::atomic<size_t> next{0};
+		std::atomic<size_t> done{0};
+		std::mutex mutex;
+		std::condition_variable finished;
+	};
+
+	std::shared_ptr<Batch> batch = std::make_shared<Batch>();
+
+	// Helpers that only get to run after every index was taken return right away, so they
+	// never touch fn once we've returned. The caller works too, which keeps this from
+	// deadlocking when it's called from a job while every worker is busy.
+	auto work = [batch, &fn, count]() {
+		size_t ran = 0;
+		for (size_t i = batch->next++; i < count; i = batch->next++, ran++)
+			fn(i);
+
+		if (ran && (batch->done += ran) == count) {
+			std::lock_guard<std::mutex> lock(batch->mutex);
+			batch->finished.notify_all();
+		}
+	};
+
+	size_t helpers = std::min(workers.size(), count - 1);
+	for (size_t i = 0; i < helpers; i++)
+		Submit(work);
+
+	work();
+
+	std::unique_lock<std::mutex> lock(batch->mutex);
+	batch->finished.wait(lock, [&batch, count] { return batch->done == count; });
+}
+
+void JobSystem::WorkerLoop()
+{
+	std::unique_lock<std::mutex> lock(mutex);
+
+	for (;;) {
+		wake.wait(lock, [this] { return quit || !queue.empty(); });
+
+		// Drain the queue before quitting so nobody waits on a job that never runs
+		if (queue.empty())
+			return;
+
+		std::function<void()> job = std::move(queue.front());
+		queue.pop_front();
+		running++;
+
+		lock.unlock();
+		job();
+		lock.lock();
+
+		running--;
+		if (queue.empty() && !running)
+			idle.notify_all();
+	}
+}
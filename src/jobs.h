@@ -0,0 +1,109 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class JobSystem {
+public:
+	JobSystem() {}
+	virtual ~JobSystem() { Release(); }
+
+	void Setup(uint32_t threadCount = 0); // 0 = one worker per core, minus one for the render thread
+	void Release(); // finishes queued jobs and joins the workers
+
+	void Submit(std::function<void()> job);
+	void Wait(); // blocks until every submitted job has finished
+	void ParallelFor(size_t count, const std::function<void(size_t)> &fn); // runs fn(0..count-1) on the workers and the caller - fine to call from inside a job
+
+	inline uint32_t getThreadCount() { return static_cast<uint32_t>(workers.size()); }
+
+protected:
+	void WorkerLoop();
+
+	std::vector<std::thread> workers;
+	std::deque<std::function<void()>> queue;
+	std::mutex mutex;
+	std::condition_variable wake; // signalled on new work or shutdown
+	std::condition_variable idle; // signalled when the last running job finishes
+	uint32_t running = 0;
+	bool quit = false;
+};
+
+// Blocking FIFO with a fixed capacity, the glue between pipeline stages
+template <typename T>
+class BoundedQueue {
+public:
+	BoundedQueue(size_t capacity = 1) : capacity(capacity) {}
+
+	void Reset(size_t capacity) // empties and reopens the queue, nobody may be waiting on it
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		items.clear();
+		closed = false;
+		this->capacity = capacity ? capacity : 1;
+	}
+
+	bool Push(T item) // blocks while full - false once closed
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		notFull.wait(lock, [this] { return closed || items.size() < capacity; });
+		if (closed)
+			return false;
+
+		items.push_back(std::move(item));
+		notEmpty.notify_one();
+		return true;
+	}
+
+	bool Pop(T &item) // blocks while empty - false once closed and drained
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		notEmpty.wait(lock, [this] { return closed || !items.empty(); });
+		return PopLocked(item);
+	}
+
+	bool TryPop(T &item)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		return PopLocked(item);
+	}
+
+	void Close() // wakes everyone up, remaining items can still be popped
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		closed = true;
+		notEmpty.notify_all();
+		notFull.notify_all();
+	}
+
+	inline bool Drained()
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		return closed && items.empty();
+	}
+
+protected:
+	bool PopLocked(T &item)
+	{
+		if (items.empty())
+			return false;
+
+		item = std::move(items.front());
+		items.pop_front();
+		notFull.notify_one();
+		return true;
+	}
+
+	std::deque<T> items;
+	std::mutex mutex;
+	std::condition_variable notEmpty;
+	std::condition_variable notFull;
+	size_t capacity;
+	bool closed = false;
+};
@@ -1,49 +1,786 @@
 #include "stb_image.h"
+#include "animation.h"
+#include "batch.h"
+#include "bench.h"
+#include "bufferpool.h"
+#include "filereader.h"
+#include "gallery.h"
+#include "hotreload.h"
+#include "image.h"
+#include "jobs.h"
+#include "pngencode.h"
+#include "slideshow.h"
+#include "stream.h"
+#include "texcache.h"
+#include "virtualtex.h"
 #include "vulkanctx.h"
+#include <cmath>
+#include <cstring>
+#include <string>
 
 VulkanCTX ctx;
+JobSystem jobs;
+FileReader reader;
+Slideshow slideshow;
+Gallery gallery;
+Animation sequence;
+HotReload hotReload;
+TextureCache cache;
+BatchFilter batch;
+VirtualTexture virtualTexture;
+uint32_t screenshotCount = 0;
+
+static const double IDLE_WAIT = 0.25; // seconds --on-demand sleeps with nothing going on, slideshow timers and the file watch get checked this often
+
+// Sleeps until input, the next frame of whatever plays, or the next look at timers - false while the frame cap holds it back
+static bool waitFrame(bool busy, double frameInterval, double &nextFrame)
+{
+	double wait = busy ? nextFrame - glfwGetTime() : IDLE_WAIT;
+	if (wait > 0.0)
+		ctx.WaitEvents(wait);
+	else
+		ctx.PollEvents();
+
+	// Input can wake it early, the cap holds anyway
+	double now = glfwGetTime();
+	if (now < nextFrame)
+		return false;
+	nextFrame = now + frameInterval;
+	return true;
+}
 
 void usage()
 {
-	std::cout << "Usage: vkwaifu [path to image here]\n" << std::endl;
+	std::cout << "Usage: vkwaifu [options] [paths to images or directories here]\n"
+		"       vkwaifu --sequence <dir|pattern> [--fps <rate>] [options]\n"
+		"       vkwaifu --gallery [--thumb-size <px>] [paths to images or directories here]\n"
+		"       vkwaifu --virtual <path> [--cache-dir <dir>] [--vram-mb <mb>]\n"
+		"       vkwaifu --batch <in_dir> <out_dir> [batch options]\n"
+		"       vkwaifu --stream <width>x<height|y4m> [stream options] < video_in > rgba_out\n"
+		"       vkwaifu --bench [--runs <count>] [--verify] [paths to images or directories here]\n\n"
+		"Options:\n"
+		"  --prefetch <count>   slides decoded ahead of the current one (default 2)\n"
+		"  --prefetch-mb <mb>   memory cap for prefetched slides and animation frames (default 512)\n"
+		"  --vram-mb <mb>       device memory for textures, prefetched ones are evicted past it (default what the driver allows)\n"
+		"  --interval <sec>     switch slides automatically\n"
+		"  --sequence <path>    play every image in a directory in numeric order, or a pattern like frames/%04d.png\n"
+		"  --fps <rate>         sequence frame rate (default 24), GIFs bring their own\n"
+		"  --watch              reload the image whenever it changes on disk\n"
+		"  --frame-budget <ms>  draw the image at a lower resolution whenever the GPU takes longer than this\n"
+		"  --on-demand          only draw when something changed, without the fade - also in the gallery and --virtual\n"
+		"  --max-fps <rate>     frame rate cap, also for GIFs and sequences (default none, 60 with --on-demand)\n"
+		"  --compare <path>     show another image right of the mouse cursor\n"
+		"  --hdr-f32            keep HDR images as 32-bit float instead of half float\n"
+		"  --compress <bc1|bc7> block compress textures on the CPU, bc1 still uses BC7 for images with alpha\n"
+		"  --cache              keep decoded textures in " << TextureCache::getDefaultDir() << "\n"
+		"  --cache-dir <dir>    same, in dir\n"
+		"  --io-depth <count>   file reads in flight, also for batch (default 16)\n"
+		"  mouse wheel and +/- zoom, dragging pans, Home shows all of it\n"
+		"  F12 saves a screenshot to vkwaifu-<n>.png\n\n"
+		"Gallery options:\n"
+		"  --thumb-size <px>    longest side of a thumbnail (default 192), --prefetch-mb caps what stays on the GPU\n"
+		"  mouse wheel, arrow keys, Page Up/Down, Home and End scroll\n\n"
+		"Virtual texture options:\n"
+		"  --virtual <path>     show an image of any size, cut into pages in the cache dir the first time\n"
+		"  mouse wheel and +/- zoom, dragging and arrow keys pan, Home fits the window\n\n"
+		"Bench options:\n"
+		"  --runs <count>       times every image is decoded on each path (default 3)\n"
+		"  --verify             also decode everything on all cores at once, <count> times, and compare with serial decodes\n\n"
+		"Batch and stream options:\n"
+		"  --slots <count>            images in flight on the GPU (default 3)\n"
+		"  --decode-threads <count>   (default half the cores)\n"
+		"  --encode-threads <count>   (default half the cores)\n"
+		"  --pix-fmt <rgba|i420|nv12> raw stream input format, YUV is converted on the GPU (default rgba)\n" << std::endl;
+}
+
+int runBatch(const char *outDir, uint32_t slots, uint32_t decodeThreads, uint32_t encodeThreads, uint32_t ioDepth)
+{
+	if (!ctx.Setup(0, 0, true)) {
+		std::cout << "Failed to initialize Vulkan! :(" << std::endl;
+		return -1;
+	}
+
+	uint32_t cores = std::thread::hardware_concurrency();
+	cores = cores > 1 ? cores : 2;
+	if (!decodeThreads)
+		decodeThreads = cores / 2;
+	if (!encodeThreads)
+		encodeThreads = cores / 2;
+
+	slots = slots ? slots : 1;
+	ctx.SetupReadback(BatchFilter::getReadbackCount(slots, encodeThreads));
+	ctx.SetupOffscreen(slots);
+
+	// Freeze the shader's fade at full brightness
+	VulkanUBO ubo;
+	ubo.time = 1.5707963f;
+	ctx.UpdateUniform(ubo);
+
+	bool ok = batch.Run(&ctx, outDir, decodeThreads, encodeThreads, ioDepth);
+	batch.PrintStats();
+
+	ctx.Release();
+
+	return ok ? 0 : -1;
+}
+
+void keyCallback(GLFWwindow *window, int key, int scancode, int action, int mods)
+{
+	if (action == GLFW_RELEASE)
+		return;
+
+	if (key == GLFW_KEY_RIGHT || key == GLFW_KEY_SPACE || key == GLFW_KEY_PAGE_DOWN)
+		slideshow.Next();
+	else if (key == GLFW_KEY_LEFT || key == GLFW_KEY_BACKSPACE || key == GLFW_KEY_PAGE_UP)
+		slideshow.Previous();
+	else if (key == GLFW_KEY_EQUAL || key == GLFW_KEY_KP_ADD || key == GLFW_KEY_MINUS || key == GLFW_KEY_KP_SUBTRACT) {
+		int width, height;
+		glfwGetFramebufferSize(window, &width, &height);
+		bool in = key == GLFW_KEY_EQUAL || key == GLFW_KEY_KP_ADD;
+		ctx.ZoomView(in ? 1.25f : 0.8f, width * 0.5f, height * 0.5f);
+	} else if (key == GLFW_KEY_HOME)
+		ctx.ResetView();
+	else if (key == GLFW_KEY_F12 && action == GLFW_PRESS)
+		ctx.RequestScreenshot();
+}
+
+void galleryKeyCallback(GLFWwindow *window, int key, int scancode, int action, int mods)
+{
+	if (action == GLFW_RELEASE)
+		return;
+
+	if (key == GLFW_KEY_DOWN)
+		gallery.Scroll(1.0);
+	else if (key == GLFW_KEY_UP)
+		gallery.Scroll(-1.0);
+	else if (key == GLFW_KEY_PAGE_DOWN || key == GLFW_KEY_SPACE)
+		gallery.ScrollPage(1.0);
+	else if (key == GLFW_KEY_PAGE_UP)
+		gallery.ScrollPage(-1.0);
+	else if (key == GLFW_KEY_HOME)
+		gallery.Scroll(-double(gallery.getCount()));
+	else if (key == GLFW_KEY_END)
+		gallery.Scroll(double(gallery.getCount()));
+	else if (key == GLFW_KEY_F12 && action == GLFW_PRESS)
+		ctx.RequestScreenshot();
+}
+
+void galleryScrollCallback(GLFWwindow *window, double x, double y)
+{
+	gallery.Scroll(-y * 0.5);
+}
+
+// Cursor positions come in window coordinates, the view works in framebuffer pixels
+void getCursorPixels(GLFWwindow *window, double &x, double &y)
+{
+	int windowWidth, windowHeight, width, height;
+	glfwGetWindowSize(window, &windowWidth, &windowHeight);
+	glfwGetFramebufferSize(window, &width, &height);
+	glfwGetCursorPos(window, &x, &y);
+
+	if (windowWidth > 0 && windowHeight > 0) {
+		x *= double(width) / windowWidth;
+		y *= double(height) / windowHeight;
+	}
+}
+
+void scrollCallback(GLFWwindow *window, double x, double y)
+{
+	double cursorX, cursorY;
+	getCursorPixels(window, cursorX, cursorY);
+	ctx.ZoomView(float(std::pow(1.25, y)), float(cursorX), float(cursorY));
+}
+
+void cursorCallback(GLFWwindow *window, double x, double y)
+{
+	static double lastX = 0.0, lastY = 0.0;
+
+	double cursorX, cursorY;
+	getCursorPixels(window, cursorX, cursorY);
+	if (glfwGetMouseButton(window, GLFW_MOUSE_BUTTON_LEFT) == GLFW_PRESS)
+		ctx.PanView(float(cursorX - lastX), float(cursorY - lastY));
+
+	lastX = cursorX;
+	lastY = cursorY;
+}
+
+// Damaged or resized, on demand nothing else would draw it again
+void refreshCallback(GLFWwindow *window)
+{
+	ctx.RequestRedraw();
+}
+
+void framebufferSizeCallback(GLFWwindow *window, int width, int height)
+{
+	ctx.RequestRedraw();
+}
+
+void virtualKeyCallback(GLFWwindow *window, int key, int scancode, int action, int mods)
+{
+	if (action == GLFW_RELEASE)
+		return;
+
+	int width, height;
+	glfwGetFramebufferSize(window, &width, &height);
+
+	if (key == GLFW_KEY_LEFT)
+		virtualTexture.Pan(width * 0.1, 0.0);
+	else if (key == GLFW_KEY_RIGHT)
+		virtualTexture.Pan(-width * 0.1, 0.0);
+	else if (key == GLFW_KEY_UP)
+		virtualTexture.Pan(0.0, height * 0.1);
+	else if (key == GLFW_KEY_DOWN)
+		virtualTexture.Pan(0.0, -height * 0.1);
+	else if (key == GLFW_KEY_EQUAL || key == GLFW_KEY_KP_ADD)
+		virtualTexture.Zoom(1.25, width * 0.5, height * 0.5);
+	else if (key == GLFW_KEY_MINUS || key == GLFW_KEY_KP_SUBTRACT)
+		virtualTexture.Zoom(0.8, width * 0.5, height * 0.5);
+	else if (key == GLFW_KEY_HOME)
+		virtualTexture.Fit();
+	else if (key == GLFW_KEY_F12 && action == GLFW_PRESS)
+		ctx.RequestScreenshot();
+}
+
+void virtualScrollCallback(GLFWwindow *window, double x, double y)
+{
+	double cursorX, cursorY;
+	getCursorPixels(window, cursorX, cursorY);
+	virtualTexture.Zoom(std::pow(1.25, y), cursorX, cursorY);
+}
+
+void virtualCursorCallback(GLFWwindow *window, double x, double y)
+{
+	static double lastX = 0.0, lastY = 0.0;
+
+	double cursorX, cursorY;
+	getCursorPixels(window, cursorX, cursorY);
+	if (glfwGetMouseButton(window, GLFW_MOUSE_BUTTON_LEFT) == GLFW_PRESS)
+		virtualTexture.Pan(cursorX - lastX, cursorY - lastY);
+
+	lastX = cursorX;
+	lastY = cursorY;
+}
+
+void saveScreenshot(uint32_t readback, std::string path)
+{
+	uint32_t width = ctx.getReadbackWidth(readback);
+	uint32_t height = ctx.getReadbackHeight(readback);
+	const uint8_t *pixels = ctx.getReadbackData(readback);
+	uint8_t *rgba = nullptr;
+
+	// The swapchain is usually BGRA
+	if (ctx.getReadbackFormat(readback) == VK_FORMAT_B8G8R8A8_SRGB || ctx.getReadbackFormat(readback) == VK_FORMAT_B8G8R8A8_UNORM) {
+		size_t size = size_t(width) * height * 4;
+		rgba = static_cast<uint8_t *>(bufferPool.Alloc(size));
+
+		for (size_t i = 0; i < size; i += 4) {
+			rgba[i + 0] = pixels[i + 2];
+			rgba[i + 1] = pixels[i + 1];
+			rgba[i + 2] = pixels[i + 0];
+			rgba[i + 3] = pixels[i + 3];
+		}
+
+		ctx.FreeReadback(readback);
+		pixels = rgba;
+	}
+
+	if (WritePNG(path.c_str(), pixels, width, height, width * 4))
+		std::cout << "Saved " << path << std::endl;
+	else
+		std::cout << "Failed to save " << path << " :(" << std::endl;
+
+	if (rgba)
+		bufferPool.Free(rgba);
+	else
+		ctx.FreeReadback(readback);
+}
+
+int runStream(uint32_t width, uint32_t height, VkFormat format, uint32_t slots)
+{
+	// stdout is the video, everything else goes to stderr
+	bool y4m = !width;
+	if (y4m && !StreamFilter::ReadY4MHeader(stdin, width, height, format))
+		return -1;
+
+	// 4:2:0 images need even sizes, chroma covers 2x2 luma samples
+	if (format != VK_FORMAT_R8G8B8A8_SRGB && (width % 2 || height % 2)) {
+		std::cerr << "YUV input must have an even width and height, got " << width << "x" << height << " :(" << std::endl;
+		return -1;
+	}
+
+	if (!ctx.Setup(0, 0, true)) {
+		std::cerr << "Failed to initialize Vulkan! :(" << std::endl;
+		return -1;
+	}
+
+	if (format != VK_FORMAT_R8G8B8A8_SRGB && !ctx.hasYcbcrSupport()) {
+		std::cerr << "This device can't convert YUV, use --pix-fmt rgba :(" << std::endl;
+		ctx.Release();
+		return -1;
+	}
+
+	// Same guess players make for untagged video, BT.601 for SD and BT.709 for HD
+	VkSamplerYcbcrModelConversion model = height >= 720 ? VK_SAMPLER_YCBCR_MODEL_CONVERSION_YCBCR_709 : VK_SAMPLER_YCBCR_MODEL_CONVERSION_YCBCR_601;
+
+	slots = slots ? slots : 1;
+	ctx.SetupReadback(StreamFilter::getReadbackCount(slots));
+	ctx.SetupOffscreen(slots, format, model);
+
+	VulkanUBO ubo;
+	ubo.time = 1.5707963f;
+	ctx.UpdateUniform(ubo);
+
+	StreamFilter stream;
+	bool ok = stream.Run(&ctx, width, height, format, y4m, stdin, stdout);
+	stream.PrintStats();
+
+	ctx.Release();
+
+	return ok ? 0 : -1;
+}
+
+int runGallery(uint32_t thumbSize, size_t memoryCap, size_t memoryBudget, uint32_t ioDepth, bool onDemand, double maxFps)
+{
+	if (!ctx.Setup(1280, 800)) {
+		std::cout << "Failed to initialize Vulkan! :(" << std::endl;
+		return -1;
+	}
+
+	ctx.SetMemoryBudget(memoryBudget);
+
+	jobs.Setup();
+	reader.Setup(ioDepth);
+	bufferPool.SetLimit(64 << 20); // thumbnails only need a few big decode buffers at a time
+	ctx.SetupReadback(2); // screenshots
+	ctx.Resize();
+
+	if (!gallery.Setup(&ctx, &jobs, &reader, thumbSize, memoryCap)) {
+		reader.Release();
+		jobs.Release();
+		ctx.Release();
+		return -1;
+	}
+
+	glfwSetKeyCallback(ctx.getWindow(), galleryKeyCallback);
+	glfwSetScrollCallback(ctx.getWindow(), galleryScrollCallback);
+
+	double frameInterval = maxFps > 0.0 ? 1.0 / maxFps : 0.0;
+	double nextFrame = 0.0;
+
+	while (!ctx.ShouldClose()) {
+		if (!waitFrame(!onDemand || ctx.NeedsRedraw() || gallery.isBusy(), frameInterval, nextFrame))
+			continue;
+
+		ctx.WaitFrame();
+		gallery.Update();
+
+		int32_t screenshot = ctx.PollScreenshot();
+		if (screenshot >= 0) {
+			std::string path = "vkwaifu-" + std::to_string(screenshotCount++) + ".png";
+			jobs.Submit([screenshot, path]() { saveScreenshot(screenshot, path); });
+		}
+
+		if (onDemand && !ctx.NeedsRedraw())
+			continue;
+
+		ctx.Update();
+		ctx.DrawGraphics();
+		ctx.Present();
+	}
+
+	gallery.PrintStats();
+	ctx.PrintResidencyStats();
+	gallery.Release();
+	reader.Release();
+	jobs.Release();
+	ctx.Release();
+
+	return 0;
+}
+
+int runVirtual(const char *path, const std::string &cacheDir, size_t memoryBudget, bool onDemand, double maxFps)
+{
+	jobs.Setup();
+
+	if (!virtualTexture.Open(path, cacheDir.c_str(), &jobs)) {
+		jobs.Release();
+		return -1;
+	}
+
+	if (!ctx.Setup(1280, 800)) {
+		std::cout << "Failed to initialize Vulkan! :(" << std::endl;
+		virtualTexture.Release();
+		jobs.Release();
+		return -1;
+	}
+
+	ctx.SetMemoryBudget(memoryBudget);
+	ctx.SetupReadback(2); // screenshots
+	ctx.Resize();
+
+	if (!virtualTexture.Setup(&ctx, &jobs)) {
+		virtualTexture.Release();
+		jobs.Release();
+		ctx.Release();
+		return -1;
+	}
+
+	glfwSetKeyCallback(ctx.getWindow(), virtualKeyCallback);
+	glfwSetScrollCallback(ctx.getWindow(), virtualScrollCallback);
+	glfwSetCursorPosCallback(ctx.getWindow(), virtualCursorCallback);
+
+	double frameInterval = maxFps > 0.0 ? 1.0 / maxFps : 0.0;
+	double nextFrame = 0.0;
+
+	while (!ctx.ShouldClose()) {
+		if (!waitFrame(!onDemand || ctx.NeedsRedraw() || virtualTexture.isBusy(), frameInterval, nextFrame))
+			continue;
+
+		ctx.WaitFrame();
+		virtualTexture.Update();
+
+		int32_t screenshot = ctx.PollScreenshot();
+		if (screenshot >= 0) {
+			std::string path = "vkwaifu-" + std::to_string(screenshotCount++) + ".png";
+			jobs.Submit([screenshot, path]() { saveScreenshot(screenshot, path); });
+		}
+
+		if (onDemand && !ctx.NeedsRedraw())
+			continue;
+
+		ctx.Update();
+		ctx.DrawGraphics();
+		ctx.Present();
+	}
+
+	virtualTexture.PrintStats();
+	virtualTexture.Release();
+	jobs.Release();
+	ctx.Release();
+
+	return 0;
 }
 
 int main(int argc, char **argv)
 {
-	if (argc != 2) {
+	uint32_t prefetch = 2;
+	size_t prefetchMB = 512;
+	size_t vramMB = 0;
+	uint32_t ioDepth = 16;
+	double interval = 0.0;
+	double frameBudget = 0.0;
+	bool onDemand = false;
+	double maxFps = 0.0;
+	const char *sequencePath = nullptr;
+	double fps = 24.0;
+	bool fullFloat = false;
+	bool watch = false;
+	bool showGallery = false;
+	const char *virtualPath = nullptr;
+	uint32_t thumbSize = 192;
+	const char *comparePath = nullptr;
+	BCFormat compression = BC_NONE;
+	std::string cacheDir;
+	const char *batchOut = nullptr;
+	uint32_t slots = 3, decodeThreads = 0, encodeThreads = 0;
+	uint32_t streamWidth = 0, streamHeight = 0;
+	bool stream = false;
+	bool bench = false, verify = false;
+	uint32_t benchRuns = 3;
+	VkFormat streamFormat = VK_FORMAT_R8G8B8A8_SRGB;
+
+	for (int i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "--batch") && i + 2 < argc) {
+			if (!batch.AddPath(argv[++i]))
+				std::cout << "No images found at " << argv[i] << " :(" << std::endl;
+			batchOut = argv[++i];
+		} else if (!strcmp(argv[i], "--stream") && i + 1 < argc) {
+			// y4m carries its own size and format
+			stream = true;
+			if (strcmp(argv[++i], "y4m") && (sscanf(argv[i], "%ux%u", &streamWidth, &streamHeight) != 2 || !streamWidth || !streamHeight)) {
+				usage();
+				return -1;
+			}
+		} else if (!strcmp(argv[i], "--pix-fmt") && i + 1 < argc) {
+			i++;
+			if (!strcmp(argv[i], "i420")) {
+				streamFormat = VK_FORMAT_G8_B8_R8_3PLANE_420_UNORM;
+			} else if (!strcmp(argv[i], "nv12")) {
+				streamFormat = VK_FORMAT_G8_B8R8_2PLANE_420_UNORM;
+			} else if (strcmp(argv[i], "rgba")) {
+				usage();
+				return -1;
+			}
+		} else if (!strcmp(argv[i], "--bench")) {
+			bench = true;
+		} else if (!strcmp(argv[i], "--verify")) {
+			verify = true;
+		} else if (!strcmp(argv[i], "--runs") && i + 1 < argc) {
+			benchRuns = atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "--slots") && i + 1 < argc) {
+			slots = atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "--decode-threads") && i + 1 < argc) {
+			decodeThreads = atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "--encode-threads") && i + 1 < argc) {
+			encodeThreads = atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "--prefetch") && i + 1 < argc) {
+			prefetch = atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "--prefetch-mb") && i + 1 < argc) {
+			prefetchMB = atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "--vram-mb") && i + 1 < argc) {
+			vramMB = atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "--io-depth") && i + 1 < argc) {
+			ioDepth = atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "--sequence") && i + 1 < argc) {
+			sequencePath = argv[++i];
+		} else if (!strcmp(argv[i], "--fps") && i + 1 < argc) {
+			fps = atof(argv[++i]);
+		} else if (!strcmp(argv[i], "--gallery")) {
+			showGallery = true;
+		} else if (!strcmp(argv[i], "--virtual") && i + 1 < argc) {
+			virtualPath = argv[++i];
+		} else if (!strcmp(argv[i], "--thumb-size") && i + 1 < argc) {
+			thumbSize = atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "--watch")) {
+			watch = true;
+		} else if (!strcmp(argv[i], "--compare") && i + 1 < argc) {
+			comparePath = argv[++i];
+		} else if (!strcmp(argv[i], "--interval") && i + 1 < argc) {
+			interval = atof(argv[++i]);
+		} else if (!strcmp(argv[i], "--frame-budget") && i + 1 < argc) {
+			frameBudget = atof(argv[++i]);
+		} else if (!strcmp(argv[i], "--on-demand")) {
+			onDemand = true;
+		} else if (!strcmp(argv[i], "--max-fps") && i + 1 < argc) {
+			maxFps = atof(argv[++i]);
+		} else if (!strcmp(argv[i], "--hdr-f32")) {
+			fullFloat = true;
+		} else if (!strcmp(argv[i], "--cache")) {
+			cacheDir = TextureCache::getDefaultDir();
+		} else if (!strcmp(argv[i], "--cache-dir") && i + 1 < argc) {
+			cacheDir = argv[++i];
+		} else if (!strcmp(argv[i], "--compress") && i + 1 < argc) {
+			i++;
+			if (!strcmp(argv[i], "bc1")) {
+				compression = BC1;
+			} else if (!strcmp(argv[i], "bc7")) {
+				compression = BC7;
+			} else {
+				usage();
+				return -1;
+			}
+		} else if (argv[i][0] == '-') {
+			usage();
+			return -1;
+		} else if (!slideshow.AddPath(argv[i])) {
+			std::cout << "No images found at " << argv[i] << " :(" << std::endl;
+		}
+	}
+
+	if (onDemand && maxFps <= 0.0)
+		maxFps = 60.0;
+
+	if (virtualPath)
+		return runVirtual(virtualPath, cacheDir.empty() ? TextureCache::getDefaultDir() : cacheDir, vramMB << 20, onDemand, maxFps);
+
+	if (showGallery) {
+		// The paths were listed already, the gallery takes them over
+		for (size_t i = 0; i < slideshow.getCount(); i++)
+			gallery.AddPath(slideshow.getPath(i).c_str());
+
+		if (!gallery.getCount()) {
+			usage();
+			return -1;
+		}
+
+		return runGallery(thumbSize, prefetchMB << 20, vramMB << 20, ioDepth, onDemand, maxFps);
+	}
+
+	if (bench) {
+		// Decode only, times stb's scalar paths against the SIMD and threaded ones
+		DecodeBench decodeBench;
+		for (size_t i = 0; i < slideshow.getCount(); i++)
+			decodeBench.AddPath(slideshow.getPath(i).c_str());
+
+		jobs.Setup();
+		bool ok = decodeBench.Run(benchRuns, &jobs);
+		if (verify)
+			ok &= decodeBench.Verify(&jobs, benchRuns);
+		jobs.Release();
+		decodeBench.Scale(benchRuns);
+		return ok ? 0 : -1;
+	}
+
+	if (stream)
+		return runStream(streamWidth, streamHeight, streamFormat, slots);
+
+	if (batchOut) {
+		if (!batch.getCount())
+			return -1;
+
+		return runBatch(batchOut, slots, decodeThreads, encodeThreads, ioDepth);
+	}
+
+	// The first frame goes up like a lone slide, the animation takes over from there
+	if (sequencePath) {
+		if (slideshow.getCount()) {
+			std::cout << "--sequence plays on its own, without other images :(" << std::endl;
+			return -1;
+		}
+
+		if (!sequence.OpenSequence(sequencePath, fps)) {
+			std::cout << "No frames found at " << sequencePath << " :(" << std::endl;
+			return -1;
+		}
+
+		slideshow.AddPath(sequence.getFramePath(0).c_str());
+	}
+
+	if (!slideshow.getCount()) {
 		usage();
 		return -1;
 	}
 
-	// Load image first.
-	int w, h, channels;
-	uint8_t *img_data = stbi_load(argv[1], &w, &h, &channels, 4);
+	if (watch && (slideshow.getCount() > 1 || sequencePath)) {
+		std::cout << "--watch follows a single image :(" << std::endl;
+		return -1;
+	}
+
+	if (comparePath && (slideshow.getCount() > 1 || sequencePath)) {
+		std::cout << "--compare takes a single image to compare with :(" << std::endl;
+		return -1;
+	}
+
+	// The header is enough to size the window, the pixels may come from the cache
+	Decoder decoder;
+	int width, height;
 
-	if (!img_data) {
+	if (!decoder.Info(slideshow.getPath(0).c_str(), width, height)) {
 		std::cout << "File does not exist! :(" << std::endl;
 		return -1;
 	}
 
-	if (!ctx.Setup(w, h)) {
+	if (!ctx.Setup(width, height)) {
 		std::cout << "Failed to initialize Vulkan! :(" << std::endl;
 		return -1;
 	}
 
-	ctx.SetupTexture(img_data, w, h);
-	stbi_image_free(img_data);
+	// The encoder and the JPEG decoder spread each image over the workers
+	jobs.Setup();
+
+	ctx.SetMemoryBudget(vramMB << 20);
+	ctx.SetFrameBudget(float(frameBudget));
+	ctx.SetFullFloat(fullFloat);
+	ctx.SetCompression(compression, &jobs);
+	cache.Setup(&ctx, &jobs, cacheDir.empty() ? nullptr : cacheDir.c_str());
+
+	VulkanUpload upload;
+	if (!cache.PrepareUpload(slideshow.getPath(0).c_str(), upload)) {
+		std::cout << "Failed to load " << slideshow.getPath(0) << " :(" << std::endl;
+		ctx.Release();
+		return -1;
+	}
+
+	ctx.SetupTexture(upload);
+	ctx.SetupReadback(2); // screenshots
+
+	// Both images sit in the bindless array, the shader picks one per pixel
+	VulkanUpload compareUpload;
+	bool compareUploading = comparePath && cache.PrepareUpload(comparePath, compareUpload);
+	if (comparePath && !compareUploading)
+		std::cout << "Failed to load " << comparePath << ", not comparing :(" << std::endl;
+	if (compareUploading && !ctx.SubmitUpload(compareUpload)) {
+		std::cout << "Out of device memory for " << comparePath << ", not comparing :(" << std::endl;
+		ctx.CancelUpload(compareUpload);
+		compareUploading = false;
+	}
 	ctx.Resize();
 
+	// Decoded pixels are recycled through the pool, keep about as much around as we prefetch
+	bufferPool.SetLimit(prefetchMB << 20);
+	reader.Setup(ioDepth);
+	slideshow.Setup(&ctx, &jobs, &reader, &cache, prefetch, prefetchMB << 20, interval);
+	sequence.Setup(&ctx, &jobs, prefetchMB << 20);
+	if (watch)
+		hotReload.Setup(&ctx, &jobs, &cache, slideshow.getPath(0).c_str());
+	glfwSetKeyCallback(ctx.getWindow(), keyCallback);
+	glfwSetScrollCallback(ctx.getWindow(), scrollCallback);
+	glfwSetCursorPosCallback(ctx.getWindow(), cursorCallback);
+	glfwSetWindowRefreshCallback(ctx.getWindow(), refreshCallback);
+	glfwSetFramebufferSizeCallback(ctx.getWindow(), framebufferSizeCallback);
+
+	// On demand the fade would never let the window sit still, it stays at full brightness like in batch mode
 	VulkanUBO ubo;
+	ubo.time = onDemand ? 1.5707963f : 0.0f;
+
+	double frameInterval = maxFps > 0.0 ? 1.0 / maxFps : 0.0;
+	double nextFrame = 0.0, startTime = glfwGetTime();
+	uint64_t framesDrawn = 0;
 
 	while (!ctx.ShouldClose()) {
-		ctx.PollEvents();
+		bool busy = !onDemand || ctx.NeedsRedraw() || slideshow.isBusy() || sequence.isOpen() || hotReload.isBusy() || compareUploading;
+		if (!waitFrame(busy, frameInterval, nextFrame))
+			continue;
 
-		ubo.time += 0.002f;
+		if (!onDemand)
+			ubo.time += 0.002f;
 
 		ctx.UpdateUniform(ubo);
+		ctx.WaitFrame();
+		slideshow.Update();
+		sequence.Update();
+		hotReload.Update();
+
+		if (compareUploading && ctx.PollUpload(compareUpload)) {
+			ctx.SetCompareTexture(compareUpload.texture);
+			compareUploading = false;
+		}
+
+		if (comparePath) {
+			double cursorX, cursorY;
+			int windowWidth, windowHeight;
+			glfwGetCursorPos(ctx.getWindow(), &cursorX, &cursorY);
+			glfwGetWindowSize(ctx.getWindow(), &windowWidth, &windowHeight);
+			if (windowWidth > 0)
+				ctx.SetCompareSplit(float(cursorX / windowWidth));
+		}
+
+		int32_t screenshot = ctx.PollScreenshot();
+		if (screenshot >= 0) {
+			std::string path = "vkwaifu-" + std::to_string(screenshotCount++) + ".png";
+			jobs.Submit([screenshot, path]() { saveScreenshot(screenshot, path); });
+		}
+
+		if (onDemand && !ctx.NeedsRedraw())
+			continue;
+
 		ctx.Update();
 		ctx.DrawGraphics();
 		ctx.Present();
+		framesDrawn++;
+	}
+
+	if (onDemand)
+		std::cout << "On demand: " << framesDrawn << " frames in " << glfwGetTime() - startTime << " s" << std::endl;
+	slideshow.PrintStats();
+	sequence.PrintStats();
+	hotReload.PrintStats();
+	ctx.PrintCompressionStats();
+	ctx.PrintResidencyStats();
+	ctx.PrintFilterStats();
+	ctx.PrintScaleStats();
+	cache.PrintStats();
+	slideshow.Release();
+	sequence.Release();
+	hotReload.Release();
+	reader.Release();
+	jobs.Release();
+
+	if (compareUploading) {
+		ctx.CancelUpload(compareUpload);
+	} else if (comparePath && compareUpload.texture.image != VK_NULL_HANDLE) {
+		ctx.SetCompareTexture(VulkanTexture());
+		ctx.RetireTexture(compareUpload.texture);
 	}
 
 	ctx.Release();
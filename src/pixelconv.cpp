@@ -0,0 +1,99 @@
+#include "pixelconv.h"
+
+#include <cmath>
+#include <cstring>
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define PIXELCONV_F16C
+#endif
+
+static inline uint16_t halfFromFloat(float value)
+{
+	uint32_t f;
+	memcpy(&f, &value, 4);
+
+	uint32_t sign = (f >> 16) & 0x8000;
+	uint32_t exponent = (f >> 23) & 0xff;
+	uint32_t mantissa = f & 0x7fffff;
+
+	if (exponent == 0xff) // inf and nan, keep nan quiet
+		return static_cast<uint16_t>(sign | 0x7c00 | (mantissa ? 0x200 | (mantissa >> 13) : 0));
+
+	int32_t e = static_cast<int32_t>(exponent) - 127 + 15;
+	if (e >= 31) // overflow
+		return static_cast<uint16_t>(sign | 0x7c00);
+
+	if (e <= 0) { // denormal or zero
+		if (e < -10)
+			return static_cast<uint16_t>(sign);
+
+		mantissa |= 0x800000;
+		uint32_t shift = 14 - e;
+		uint32_t half = mantissa >> shift;
+		uint32_t rest = mantissa & ((1u << shift) - 1);
+		uint32_t halfway = 1u << (shift - 1);
+		half += (rest > halfway) || (rest == halfway && (half & 1));
+		return static_cast<uint16_t>(sign | half);
+	}
+
+	// Rounding may carry into the exponent, which is exactly what we want
+	uint32_t half = (static_cast<uint32_t>(e) << 10) | (mantissa >> 13);
+	uint32_t rest = mantissa & 0x1fff;
+	half += (rest > 0x1000) || (rest == 0x1000 && (half & 1));
+	return static_cast<uint16_t>(sign | half);
+}
+
+#ifdef PIXELCONV_F16C
+__attribute__((target("avx,f16c")))
+static size_t convertF32ToF16_F16C(uint16_t *dst, const float *src, size_t count)
+{
+	size_t i = 0;
+	for (; i + 16 <= count; i += 16) {
+		__m128i a = _mm256_cvtps_ph(_mm256_loadu_ps(src + i), _MM_FROUND_TO_NEAREST_INT);
+		__m128i b = _mm256_cvtps_ph(_mm256_loadu_ps(src + i + 8), _MM_FROUND_TO_NEAREST_INT);
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i), a);
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i + 8), b);
+	}
+
+	return i;
+}
+#endif
+
+void convertF32ToF16(uint16_t *dst, const float *src, size_t count)
+{
+	size_t i = 0;
+
+#ifdef PIXELCONV_F16C
+	static const bool hasF16C = __builtin_cpu_supports("avx") && __builtin_cpu_supports("f16c");
+	if (hasF16C)
+		i = convertF32ToF16_F16C(dst, src, count);
+#endif
+
+	for (; i < count; i++)
+		dst[i] = halfFromFloat(src[i]);
+}
+
+void convertSRGB16ToLinear(uint16_t *dst, const uint16_t *src, size_t pixels)
+{
+	// 128 KiB, built once by whichever decode thread gets here first
+	static const struct Table {
+		uint16_t values[65536];
+
+		Table()
+		{
+			for (uint32_t i = 0; i < 65536; i++) {
+				double c = i / 65535.0;
+				double linear = c <= 0.04045 ? c / 12.92 : pow((c + 0.055) / 1.055, 2.4);
+				values[i] = static_cast<uint16_t>(linear * 65535.0 + 0.5);
+			}
+		}
+	} table;
+
+	for (size_t i = 0; i < pixels; i++, dst += 4, src += 4) {
+		dst[0] = table.values[src[0]];
+		dst[1] = table.values[src[1]];
+		dst[2] = table.values[src[2]];
+		dst[3] = src[3];
+	}
+}
@@ -0,0 +1,17 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// What a decoded image stores per channel
+enum PixelType {
+	PIXEL_U8,
+	PIXEL_U16, // 16-bit PNG, still sRGB encoded
+	PIXEL_F32 // Radiance HDR, linear
+};
+
+// F32 -> F16 with round to nearest even, uses F16C when the CPU has it
+void convertF32ToF16(uint16_t *dst, const float *src, size_t count);
+
+// Decodes the sRGB curve of 16-bit RGBA pixels, alpha stays as it is. There is no 16-bit sRGB format to do it for us.
+void convertSRGB16ToLinear(uint16_t *dst, const uint16_t *src, size_t pixels);
@@ -0,0 +1,347 @@
+#include "pngencode.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+// Lookup tables shared by every encoder, built once on first use
+struct DeflateTables {
+	uint32_t crc[256];
+	uint16_t litCode[288]; // fixed Huffman codes, already bit reversed
+	uint8_t litLength[288];
+	uint8_t lengthCode[259]; // match length -> length symbol - 257
+	uint8_t distCode[512]; // see distanceSymbol()
+
+	DeflateTables();
+};
+
+static const uint16_t lengthBase[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+static const uint8_t lengthExtra[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+static const uint16_t distBase[30] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+static const uint8_t distExtra[30] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+
+static uint32_t reverseBits(uint32_t code, uint32_t length)
+{
+	uint32_t reversed = 0;
+	while (length--) {
+		reversed = (reversed << 1) | (code & 1);
+		code >>= 1;
+	}
+
+	return reversed;
+}
+
+DeflateTables::DeflateTables()
+{
+	for (uint32_t i = 0; i < 256; i++) {
+		uint32_t c = i;
+		for (int k = 0; k < 8; k++)
+			c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+		crc[i] = c;
+	}
+
+	for (uint32_t i = 0; i < 288; i++) {
+		uint32_t code, length;
+
+		if (i < 144) {
+			code = 0x30 + i;
+			length = 8;
+		} else if (i < 256) {
+			code = 0x190 + i - 144;
+			length = 9;
+		} else if (i < 280) {
+			code = i - 256;
+			length = 7;
+		} else {
+			code = 0xC0 + i - 280;
+			length = 8;
+		}
+
+		litCode[i] = static_cast<uint16_t>(reverseBits(code, length));
+		litLength[i] = static_cast<uint8_t>(length);
+	}
+
+	for (uint32_t i = 0; i < 29; i++) {
+		uint32_t end = (i == 28) ? 259 : lengthBase[i] + (1u << lengthExtra[i]);
+		for (uint32_t len = lengthBase[i]; len < end && len < 259; len++)
+			lengthCode[len] = static_cast<uint8_t>(i);
+	}
+
+	// Like zlib: distances up to 256 index directly, larger ones by (d - 1) >> 7
+	for (uint32_t i = 0; i < 30; i++) {
+		for (uint32_t d = distBase[i]; d < distBase[i] + (1u << distExtra[i]); d++) {
+			if (d <= 256)
+				distCode[d - 1] = static_cast<uint8_t>(i);
+			else
+				distCode[256 + ((d - 1) >> 7)] = static_cast<uint8_t>(i);
+		}
+	}
+}
+
+static const DeflateTables &tables()
+{
+	static DeflateTables t;
+	return t;
+}
+
+static inline uint32_t distanceSymbol(const DeflateTables &t, uint32_t distance)
+{
+	return distance <= 256 ? t.distCode[distance - 1] : t.distCode[256 + ((distance - 1) >> 7)];
+}
+
+// Writes into a buffer sized for the worst case up front, flushing 32 bits at a time
+struct BitWriter {
+	uint8_t *out;
+	uint64_t bits = 0;
+	uint32_t count = 0;
+
+	BitWriter(uint8_t *out) : out(out) {}
+
+	inline void Put(uint32_t value, uint32_t length)
+	{
+		bits |= uint64_t(value) << count;
+		count += length;
+		if (count >= 32) {
+			for (int k = 0; k < 4; k++)
+				*out++ = static_cast<uint8_t>(bits >> (8 * k));
+			bits >>= 32;
+			count -= 32;
+		}
+	}
+
+	inline void Flush()
+	{
+		while (count > 0) {
+			*out++ = static_cast<uint8_t>(bits);
+			bits >>= 8;
+			count = count > 8 ? count - 8 : 0;
+		}
+	}
+};
+
+// zlib stream made of a single fixed Huffman block
+static void deflate(std::vector<uint8_t> &out, const uint8_t *data, size_t size)
+{
+	const DeflateTables &t = tables();
+	const uint32_t WINDOW = 32768, HASH_BITS = 15, MAX_CHAIN = 8, GOOD_MATCH = 32, MIN_MATCH = 3, MAX_MATCH = 258;
+
+	std::vector<int32_t> head(1 << HASH_BITS, -1);
+	std::vector<int32_t> prev(WINDOW, -1);
+
+	// Fixed Huffman never spends more than 9 bits on a byte
+	size_t start = out.size();
+	out.resize(start + 2 + size + size / 8 + 16);
+	out[start] = 0x78;
+	out[start + 1] = 0x01;
+
+	BitWriter bw(out.data() + start + 2);
+	bw.Put(1, 1); // BFINAL
+	bw.Put(1, 2); // BTYPE = fixed Huffman
+
+	auto hash = [&](size_t i) {
+		return ((data[i] << 10) ^ (data[i + 1] << 5) ^ data[i + 2]) & ((1 << HASH_BITS) - 1);
+	};
+
+	auto insert = [&](size_t i) {
+		if (i + MIN_MATCH > size)
+			return;
+		uint32_t h = hash(i);
+		prev[i & (WINDOW - 1)] = head[h];
+		head[h] = static_cast<int32_t>(i);
+	};
+
+	size_t i = 0;
+	while (i < size) {
+		uint32_t bestLength = 0, bestDistance = 0;
+
+		if (i + MIN_MATCH <= size) {
+			int32_t candidate = head[hash(i)];
+			uint32_t maxLength = static_cast<uint32_t>(size - i < MAX_MATCH ? size - i : MAX_MATCH);
+
+			for (uint32_t chain = 0; candidate >= 0 && chain < MAX_CHAIN; chain++) {
+				size_t distance = i - candidate;
+				if (distance > WINDOW - 1)
+					break;
+
+				// Can't beat the best match unless this byte agrees too
+				if (data[candidate + bestLength] != data[i + bestLength]) {
+					candidate = prev[candidate & (WINDOW - 1)];
+					continue;
+				}
+
+				uint32_t length = 0;
+				while (length < maxLength && data[candidate + length] == data[i + length])
+					length++;
+
+				if (length > bestLength) {
+					bestLength = length;
+					bestDistance = static_cast<uint32_t>(distance);
+					if (length >= GOOD_MATCH || length == maxLength)
+						break;
+				}
+
+				candidate = prev[candidate & (WINDOW - 1)];
+			}
+		}
+
+		if (bestLength >= MIN_MATCH) {
+			uint32_t ls = t.lengthCode[bestLength];
+			bw.Put(t.litCode[257 + ls], t.litLength[257 + ls]);
+			bw.Put(bestLength - lengthBase[ls], lengthExtra[ls]);
+
+			uint32_t ds = distanceSymbol(t, bestDistance);
+			bw.Put(reverseBits(ds, 5), 5);
+			bw.Put(bestDistance - distBase[ds], distExtra[ds]);
+
+			for (uint32_t k = 0; k < bestLength; k++)
+				insert(i + k);
+			i += bestLength;
+		} else {
+			bw.Put(t.litCode[data[i]], t.litLength[data[i]]);
+			insert(i);
+			i++;
+		}
+	}
+
+	bw.Put(t.litCode[256], t.litLength[256]); // end of block
+	bw.Flush();
+	out.resize(bw.out - out.data());
+
+	// Adler-32, reducing every 5552 bytes like zlib so the sums can't overflow
+	uint32_t a = 1, b = 0;
+	for (size_t k = 0; k < size;) {
+		size_t end = k + 5552 < size ? k + 5552 : size;
+		for (; k < end; k++) {
+			a += data[k];
+			b += a;
+		}
+		a %= 65521;
+		b %= 65521;
+	}
+
+	uint32_t adler = (b << 16) | a;
+	for (int shift = 24; shift >= 0; shift -= 8)
+		out.push_back(static_cast<uint8_t>(adler >> shift));
+}
+
+static inline uint8_t paeth(int a, int b, int c)
+{
+	// Same as p = a + b - c with distances |p - a|, |p - b|, |p - c|, minus the redundant adds
+	int pa = abs(b - c), pb = abs(a - c), pc = abs(a + b - 2 * c);
+	int ab = pb < pa ? b : a;
+	return static_cast<uint8_t>(pc < (pa < pb ? pa : pb) ? c : ab);
+}
+
+// Filter residuals are scored by their magnitude as signed bytes
+static inline uint32_t residual(int v)
+{
+	int8_t r = static_cast<int8_t>(v);
+	return r < 0 ? -r : r;
+}
+
+static void putChunk(std::vector<uint8_t> &out, const char *type, const uint8_t *data, uint32_t size)
+{
+	const DeflateTables &t = tables();
+
+	for (int shift = 24; shift >= 0; shift -= 8)
+		out.push_back(static_cast<uint8_t>(size >> shift));
+
+	size_t start = out.size();
+	out.insert(out.end(), type, type + 4);
+	out.insert(out.end(), data, data + size);
+
+	uint32_t crc = 0xFFFFFFFFu;
+	for (size_t i = start; i < out.size(); i++)
+		crc = t.crc[(crc ^ out[i]) & 0xFF] ^ (crc >> 8);
+	crc ^= 0xFFFFFFFFu;
+
+	for (int shift = 24; shift >= 0; shift -= 8)
+		out.push_back(static_cast<uint8_t>(crc >> shift));
+}
+
+bool EncodePNG(std::vector<uint8_t> &out, const uint8_t *rgba, uint32_t width, uint32_t height, uint32_t stride)
+{
+	if (!rgba || !width || !height)
+		return false;
+
+	// Filter each row with whichever PNG filter gives the smallest sum of residuals.
+	// All five are scored in one pass, then only the winner gets written out.
+	size_t rowSize = size_t(width) * 4;
+	std::vector<uint8_t> filtered((rowSize + 1) * height);
+	std::vector<uint8_t> zeroRow(rowSize + 4, 0);
+
+	for (uint32_t y = 0; y < height; y++) {
+		const uint8_t *row = rgba + size_t(y) * stride;
+		const uint8_t *up = y ? rgba + size_t(y - 1) * stride : zeroRow.data();
+		uint8_t *dst = &filtered[y * (rowSize + 1)];
+
+		uint32_t sums[5] = {};
+		for (size_t x = 0; x < rowSize; x++) {
+			int a = x >= 4 ? row[x - 4] : 0;
+			int b = up[x];
+			int c = x >= 4 ? up[x - 4] : 0;
+			uint8_t v = row[x];
+
+			sums[0] += residual(v);
+			sums[1] += residual(v - a);
+			sums[2] += residual(v - b);
+			sums[3] += residual(v - ((a + b) >> 1));
+			sums[4] += residual(v - paeth(a, b, c));
+		}
+
+		uint8_t filter = 0;
+		for (uint8_t i = 1; i < 5; i++) {
+			if (sums[i] < sums[filter])
+				filter = i;
+		}
+
+		dst[0] = filter;
+		for (size_t x = 0; x < rowSize; x++) {
+			int a = x >= 4 ? row[x - 4] : 0;
+			int b = up[x];
+			int c = x >= 4 ? up[x - 4] : 0;
+			uint8_t predicted = 0;
+
+			switch (filter) {
+			case 1: predicted = a; break;
+			case 2: predicted = b; break;
+			case 3: predicted = (a + b) >> 1; break;
+			case 4: predicted = paeth(a, b, c); break;
+			}
+
+			dst[x + 1] = row[x] - predicted;
+		}
+	}
+
+	static const uint8_t signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+	out.assign(signature, signature + 8);
+
+	uint8_t ihdr[13] = {
+		uint8_t(width >> 24), uint8_t(width >> 16), uint8_t(width >> 8), uint8_t(width),
+		uint8_t(height >> 24), uint8_t(height >> 16), uint8_t(height >> 8), uint8_t(height),
+		8, 6, 0, 0, 0 // 8 bit RGBA, deflate, adaptive filtering, no interlace
+	};
+	putChunk(out, "IHDR", ihdr, sizeof(ihdr));
+
+	std::vector<uint8_t> idat;
+	idat.reserve(filtered.size() / 2);
+	deflate(idat, filtered.data(), filtered.size());
+	putChunk(out, "IDAT", idat.data(), static_cast<uint32_t>(idat.size()));
+	putChunk(out, "IEND", nullptr, 0);
+
+	return true;
+}
+
+bool WritePNG(const char *path, const uint8_t *rgba, uint32_t width, uint32_t height, uint32_t stride)
+{
+	std::vector<uint8_t> png;
+	if (!EncodePNG(png, rgba, width, height, stride))
+		return false;
+
+	FILE *file = fopen(path, "wb");
+	if (!file)
+		return false;
+
+	bool written = fwrite(png.data(), 1, png.size(), file) == png.size();
+	return (fclose(file) == 0) && written;
+}
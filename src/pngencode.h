@@ -0,0 +1,9 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+// Small PNG writer for 8-bit RGBA, deflate with fixed Huffman codes and a hash chain matcher.
+// Thread safe, every call keeps its own state.
+bool EncodePNG(std::vector<uint8_t> &out, const uint8_t *rgba, uint32_t width, uint32_t height, uint32_t stride);
+bool WritePNG(const char *path, const uint8_t *rgba, uint32_t width, uint32_t height, uint32_t stride);
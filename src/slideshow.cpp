@@ -0,0 +1,257 @@
+#include "slideshow.h"
+#include "bufferpool.h"
+#include "fileutil.h"
+#include "image.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <filesystem>
+
+bool Slideshow::AddPath(const char *path)
+{
+	return ListImages(path, paths);
+}
+
+void Slideshow::Setup(VulkanCTX *ctx, JobSystem *jobs, FileReader *reader, TextureCache *cache, uint32_t prefetchDepth, size_t memoryCap, double interval)
+{
+	this->ctx = ctx;
+	this->jobs = jobs;
+	this->reader = reader;
+	this->cache = cache;
+	this->prefetchDepth = prefetchDepth;
+	this->memoryCap = memoryCap;
+	this->interval = interval;
+
+	current = target = 0;
+	shownTime = Clock::now();
+
+	Animate();
+	Prefetch();
+}
+
+void Slideshow::Release()
+{
+	// Reads and workers still hold references to their slides, let them finish first. Every
+	// read submits a job, so the reader goes first.
+	if (reader)
+		reader->Wait();
+	if (jobs)
+		jobs->Wait();
+
+	animation.Release();
+
+	while (!slides.empty()) {
+		auto it = slides.begin();
+		if (it->second->state == SLIDE_READY)
+			ctx->ReleaseTexture(it->second->upload.texture);
+		else
+			ctx->CancelUpload(it->second->upload);
+
+		slides.erase(it);
+	}
+
+	prefetchBytes = 0;
+}
+
+void Slideshow::Next()
+{
+	if (!paths.empty())
+		Request((target + 1) % paths.size());
+}
+
+void Slideshow::Previous()
+{
+	if (!paths.empty())
+		Request((target + paths.size() - 1) % paths.size());
+}
+
+void Slideshow::Request(size_t index)
+{
+	if (index == target)
+		return;
+
+	if (target == current)
+		requestTime = Clock::now();
+
+	auto it = slides.find(index);
+	requestReady = it != slides.end() && it->second->state == SLIDE_READY;
+	target = index;
+}
+
+void Slideshow::Update()
+{
+	animation.Update();
+
+	if (paths.size() < 2)
+		return;
+
+	// Hand decoded slides to the transfer queue and collect the finished ones
+	for (auto &it : slides) {
+		Slide &slide = *it.second;
+
+		if (slide.state == SLIDE_DECODED) {
+			if (ctx->SubmitUpload(slide.upload)) {
+				slide.state = SLIDE_UPLOADING;
+			} else {
+				ctx->CancelUpload(slide.upload);
+				prefetchBytes -= slide.bytes;
+				slide.bytes = 0;
+				slide.state = SLIDE_FAILED;
+			}
+		} else if (slide.state == SLIDE_UPLOADING && ctx->PollUpload(slide.upload)) {
+			slide.state = SLIDE_READY;
+
+			// Called from a later SubmitUpload(), the slide only goes away once it's out of the window
+			std::shared_ptr<Slide> evicted = it.second;
+			ctx->SetEvictable(slide.upload.texture, [this, evicted]() {
+				ctx->RetireTexture(evicted->upload.texture);
+				prefetchBytes -= evicted->bytes;
+				evicted->bytes = 0;
+				evicted->state = SLIDE_EVICTED;
+				evictCount++;
+			});
+		}
+	}
+
+	if (target != current) {
+		auto it = slides.find(target);
+
+		if (it != slides.end() && it->second->state == SLIDE_READY) {
+			ctx->SwapTexture(it->second->upload.texture);
+			prefetchBytes -= it->second->bytes;
+			slides.erase(it);
+			current = target;
+
+			shownTime = Clock::now();
+			double latency = std::chrono::duration<double, std::milli>(shownTime - requestTime).count();
+			switchCount++;
+			switchMisses += !requestReady;
+			switchTotalMs += latency;
+			switchMaxMs = std::max(switchMaxMs, latency);
+
+			// The GIF's first frame is up already, the animation takes over from there
+			animation.Release();
+			Animate();
+		} else if (it != slides.end() && it->second->state == SLIDE_FAILED) {
+			std::cout << "Failed to load " << paths[target] << ", skipping :(" << std::endl;
+			slides.erase(it);
+			target = (target + 1) % paths.size();
+		} else if (it != slides.end() && it->second->state == SLIDE_EVICTED) {
+			slides.erase(it); // Prefetch() loads it again
+		}
+	} else if (interval > 0.0 && std::chrono::duration<double>(Clock::now() - shownTime).count() >= interval) {
+		Next();
+	}
+
+	// Forget slides that fell out of the prefetch window. Ones still on a worker
+	// or the transfer queue are picked up on a later frame.
+	for (auto it = slides.begin(); it != slides.end();) {
+		size_t distance = (it->first + paths.size() - target) % paths.size();
+		int state = it->second->state;
+
+		if (distance > prefetchDepth && state != SLIDE_DECODING && state != SLIDE_UPLOADING) {
+			Drop(it->first);
+			it = slides.erase(it);
+		} else {
+			++it;
+		}
+	}
+
+	Prefetch();
+}
+
+void Slideshow::Animate()
+{
+	if (paths.empty())
+		return;
+
+	std::string ext = std::filesystem::path(paths[current]).extension().string();
+	std::transform(ext.begin(), ext.end(), ext.begin(), [](unsigned char c) { return std::tolower(c); });
+
+	if (ext == ".gif" && animation.OpenGIF(paths[current].c_str()))
+		animation.Setup(ctx, jobs, memoryCap);
+}
+
+void Slideshow::Drop(size_t index)
+{
+	Slide &slide = *slides[index];
+
+	if (slide.state == SLIDE_READY)
+		ctx->ReleaseTexture(slide.upload.texture);
+	else
+		ctx->CancelUpload(slide.upload);
+
+	prefetchBytes -= slide.bytes;
+}
+
+void Slideshow::Prefetch()
+{
+	for (size_t d = 0; d <= prefetchDepth && d < paths.size(); d++) {
+		size_t index = (target + d) % paths.size();
+
+		if (index == current || slides.count(index))
+			continue;
+
+		// Slides still on their way count too, with a guess until the decode knows. An empty cap
+		// always takes one, however big.
+		size_t estimate = Estimate(index);
+		if (prefetchBytes >= memoryCap || (prefetchBytes && prefetchBytes + estimate > memoryCap))
+			break;
+
+		std::shared_ptr<Slide> slide = std::make_shared<Slide>();
+		slide->state = SLIDE_DECODING;
+		slide->bytes = estimate;
+		prefetchBytes += estimate;
+		slides[index] = slide;
+
+		std::string path = paths[index];
+
+		// The reader only hands the bytes over, decoding on its thread would hold up the next reads
+		reader->Read(path, [this, slide, path](uint8_t *data, size_t size) {
+			jobs->Submit([this, slide, path, data, size]() {
+				// Decoded pixels go back to the buffer pool as soon as they sit in the staging buffer,
+				// cached textures and KTX2/DDS files are copied over. Gray images keep their channel
+				// count and 16-bit or HDR ones their depth all the way to the device.
+				bool prepared = data && cache->PrepareUpload(path.c_str(), data, size, slide->upload);
+				bufferPool.Free(data);
+
+				// Settle the guess
+				size_t bytes = prepared ? slide->upload.stagingSize : 0; // the texture takes about as much
+				prefetchBytes += bytes;
+				prefetchBytes -= slide->bytes;
+				slide->bytes = bytes;
+				slide->state = prepared ? SLIDE_DECODED : SLIDE_FAILED;
+			});
+		});
+	}
+}
+
+size_t Slideshow::Estimate(size_t index)
+{
+	if (estimates.size() != paths.size())
+		estimates.assign(paths.size(), SIZE_MAX);
+
+	// Only the header gets read, once per slide
+	if (estimates[index] == SIZE_MAX) {
+		int width, height;
+		estimates[index] = Decoder().Info(paths[index].c_str(), width, height) ? size_t(width) * height * 4 : 0;
+	}
+
+	return estimates[index];
+}
+
+void Slideshow::PrintStats()
+{
+	animation.PrintStats();
+
+	if (!switchCount)
+		return;
+
+	std::cout << "Slide switches: " << switchCount
+		<< ", latency avg " << switchTotalMs / switchCount << " ms"
+		<< ", max " << switchMaxMs << " ms"
+		<< ", " << switchMisses << " waited on decode";
+	if (evictCount)
+		std::cout << ", " << evictCount << " prefetched slides evicted";
+	std::cout << std::endl;
+}
@@ -0,0 +1,89 @@
+#pragma once
+
+#include "animation.h"
+#include "filereader.h"
+#include "jobs.h"
+#include "texcache.h"
+#include "vulkanctx.h"
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Cycles through a list of images. The next few slides are read by the file reader,
+// decoded on the job system and uploaded on the transfer queue while the current one
+// is shown, so switching only swaps descriptors and never waits on a decode. Animated
+// GIFs play while they're up.
+class Slideshow {
+public:
+	Slideshow() {}
+	virtual ~Slideshow() {}
+
+	bool AddPath(const char *path); // adds an image, or every image inside a directory - false if nothing was found
+	void Setup(VulkanCTX *ctx, JobSystem *jobs, FileReader *reader, TextureCache *cache, uint32_t prefetchDepth, size_t memoryCap, double interval);
+	void Release();
+
+	void Next();
+	void Previous();
+	void Update(); // call once per frame after VulkanCTX::Update() or WaitFrame()
+
+	void PrintStats();
+
+	inline bool isBusy() { return target != current || animation.isOpen(); } // a switch is waiting on its slide, or a GIF plays
+	inline size_t getCount() { return paths.size(); }
+	inline const std::string &getPath(size_t index) { return paths[index]; }
+
+protected:
+	typedef std::chrono::steady_clock Clock;
+
+	enum SlideState {
+		SLIDE_DECODING, // being read, or on a worker
+		SLIDE_DECODED, // staging buffer filled, waiting for SubmitUpload()
+		SLIDE_UPLOADING, // on the transfer queue
+		SLIDE_READY,
+		SLIDE_FAILED,
+		SLIDE_EVICTED // the device wanted the memory back, loaded again once it's the target
+	};
+
+	struct Slide {
+		std::atomic<int> state;
+		VulkanUpload upload;
+		size_t bytes = 0;
+	};
+
+	void Request(size_t index);
+	void Prefetch();
+	size_t Estimate(size_t index); // bytes the slide should take as RGBA8, from its header - 0 if that can't be read
+	void Animate(); // plays the current slide if it's an animated GIF
+	void Drop(size_t index);
+
+	VulkanCTX *ctx = nullptr;
+	JobSystem *jobs = nullptr;
+	FileReader *reader = nullptr;
+	TextureCache *cache = nullptr;
+
+	std::vector<std::string> paths;
+	std::map<size_t, std::shared_ptr<Slide>> slides; // prefetched slides keyed by index
+	size_t current = 0; // on screen
+	size_t target = 0; // requested
+
+	uint32_t prefetchDepth = 2;
+	size_t memoryCap = 0;
+	std::atomic<size_t> prefetchBytes{0}; // staging and texture memory held by prefetched slides, estimates for the ones still decoding
+	std::vector<size_t> estimates; // by path index, SIZE_MAX until Estimate() read the header
+	Animation animation; // the current slide's frames, gets the same memory cap
+
+	double interval = 0.0; // seconds between automatic switches, 0 = manual
+	Clock::time_point shownTime;
+	Clock::time_point requestTime;
+	bool requestReady = false; // target was already prefetched when requested
+
+	// Slide switch latency, from Next()/Previous() to the first frame that draws the new slide
+	uint32_t switchCount = 0;
+	uint32_t switchMisses = 0; // switches that had to wait on decode or upload
+	uint32_t evictCount = 0;
+	double switchTotalMs = 0.0;
+	double switchMaxMs = 0.0;
+};
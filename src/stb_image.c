@@ -1,7 +1,18 @@
+#include "bufferpool.h"
+
 #define STB_IMAGE_IMPLEMENTATION
 #define STBI_NO_PSD
-#define STBI_NO_GIF
 #define STBI_NO_PNM
+#define STBI_MALLOC(sz)       bufferPoolAlloc(sz)
+#define STBI_REALLOC(p, newsz) bufferPoolRealloc(p, newsz)
+#define STBI_REALLOC_SIZED(p, oldsz, newsz) ((void)(oldsz), bufferPoolRealloc(p, newsz))
+#define STBI_FREE(p)          bufferPoolFree(p)
 #include "stb_image.h"
 
+// Slides and batch images decode on several threads at once, the failure reason and the
+// per-thread settings Decoder uses only stay apart with thread locals
+#ifndef STBI_THREAD_LOCAL
+#error "stb_image needs thread local storage"
+#endif
+
 // STB Image will be built here...
@@ -400,6 +400,15 @@ STBIDEF stbi_uc *stbi_load_from_file  (FILE *f, int *x, int *y, int *channels_in
 
 #ifndef STBI_NO_GIF
 STBIDEF stbi_uc *stbi_load_gif_from_memory(stbi_uc const *buffer, int len, int **delays, int *x, int *y, int *z, int *comp, int req_comp);
+
+// Animated GIFs one frame at a time, so memory stays at a few frames however long the
+// animation is. buffer must outlive the stream. Frames are RGBA, x*y*4 bytes owned by the
+// stream and valid until the next call, NULL once the animation is over or on error (see
+// stbi_failure_reason). delay_ms is how long the frame stays up. Never flipped.
+typedef struct stbi_gif_stream stbi_gif_stream;
+STBIDEF stbi_gif_stream *stbi_gif_stream_open (stbi_uc const *buffer, int len, int *x, int *y);
+STBIDEF stbi_uc         *stbi_gif_stream_next (stbi_gif_stream *g, int *delay_ms);
+STBIDEF void             stbi_gif_stream_close(stbi_gif_stream *g);
 #endif
 
 #ifdef STBI_WINDOWS_UTF8
@@ -436,11 +445,13 @@ STBIDEF stbi_us *stbi_load_from_file_16(FILE *f, int *x, int *y, int *channels_i
 #ifndef STBI_NO_HDR
    STBIDEF void   stbi_hdr_to_ldr_gamma(float gamma);
    STBIDEF void   stbi_hdr_to_ldr_scale(float scale);
+   STBIDEF void   stbi_hdr_to_ldr_thread(float gamma, float scale); // both, for the calling thread only
 #endif // STBI_NO_HDR
 
 #ifndef STBI_NO_LINEAR
    STBIDEF void   stbi_ldr_to_hdr_gamma(float gamma);
    STBIDEF void   stbi_ldr_to_hdr_scale(float scale);
+   STBIDEF void   stbi_ldr_to_hdr_thread(float gamma, float scale); // both, for the calling thread only
 #endif // STBI_NO_LINEAR
 
 // stbi_is_hdr is always defined, but always returns false if STBI_NO_HDR
@@ -491,6 +502,24 @@ STBIDEF void stbi_set_flip_vertically_on_load(int flag_true_if_should_flip);
 // calling it will fail to link if your compiler doesn't
 STBIDEF void stbi_set_flip_vertically_on_load_thread(int flag_true_if_should_flip);
 
+// undo PNG scanline filters of 8-bit RGB and RGBA images with SSE2 or NEON where the CPU has it
+// (default on). meant for comparing the two paths.
+STBIDEF void stbi_set_png_simd(int flag_true_if_should_use_simd);
+
+// lets the JPEG decoder spread restart intervals and color conversion over threads. func has to
+// call task(arg, i) for every i in 0..count-1 and return once all of them are done, it may be
+// called from several threads at once. NULL (default) decodes everything on the calling thread.
+typedef void stbi_parallel_for(void *user, int count, void (*task)(void *arg, int index), void *arg);
+STBIDEF void stbi_set_parallel_for(stbi_parallel_for *func, void *user);
+
+// like the flip above, these only apply to the calling thread, which ignores the process-wide
+// setting from then on. with these and the thread local failure reason, threads decoding at the
+// same time can't see each other's settings.
+STBIDEF void stbi_set_unpremultiply_on_load_thread(int flag_true_if_should_unpremultiply);
+STBIDEF void stbi_convert_iphone_png_to_rgb_thread(int flag_true_if_should_convert);
+STBIDEF void stbi_set_png_simd_thread(int flag_true_if_should_use_simd);
+STBIDEF void stbi_set_parallel_for_thread(stbi_parallel_for *func, void *user);
+
 // ZLIB client - used by PNG, available for other purposes
 
 STBIDEF char *stbi_zlib_decode_malloc_guesssize(const char *buffer, int len, int initial_size, int *outlen);
@@ -717,7 +746,7 @@ static int stbi__cpuid3(void)
 
 #define STBI_SIMD_ALIGN(type, name) __declspec(align(16)) type name
 
-#if !defined(STBI_NO_JPEG) && defined(STBI_SSE2)
+#if (!defined(STBI_NO_JPEG) || !defined(STBI_NO_PNG)) && defined(STBI_SSE2)
 static int stbi__sse2_available(void)
 {
    int info3 = stbi__cpuid3();
@@ -728,7 +757,7 @@ static int stbi__sse2_available(void)
 #else // assume GCC-style if not VC++
 #define STBI_SIMD_ALIGN(type, name) type name __attribute__((aligned(16)))
 
-#if !defined(STBI_NO_JPEG) && defined(STBI_SSE2)
+#if (!defined(STBI_NO_JPEG) || !defined(STBI_NO_PNG)) && defined(STBI_SSE2)
 static int stbi__sse2_available(void)
 {
    // If we're even attempting to compile this on GCC/Clang, that means
@@ -1058,6 +1087,48 @@ static stbi_uc *stbi__hdr_to_ldr(float   *data, int x, int y, int comp);
 #endif
 
 static int stbi__vertically_flip_on_load_global = 0;
+static int stbi__png_simd_global = 1;
+static stbi_parallel_for *stbi__parallel_for_global = NULL;
+static void *stbi__parallel_for_user_global = NULL;
+
+STBIDEF void stbi_set_png_simd(int flag_true_if_should_use_simd)
+{
+   stbi__png_simd_global = flag_true_if_should_use_simd;
+}
+
+STBIDEF void stbi_set_parallel_for(stbi_parallel_for *func, void *user)
+{
+   stbi__parallel_for_global = func;
+   stbi__parallel_for_user_global = user;
+}
+
+#ifndef STBI_THREAD_LOCAL
+#define stbi__png_simd           stbi__png_simd_global
+#define stbi__parallel_for       stbi__parallel_for_global
+#define stbi__parallel_for_user  stbi__parallel_for_user_global
+#else
+static STBI_THREAD_LOCAL int stbi__png_simd_local, stbi__png_simd_set;
+static STBI_THREAD_LOCAL stbi_parallel_for *stbi__parallel_for_local;
+static STBI_THREAD_LOCAL void *stbi__parallel_for_user_local;
+static STBI_THREAD_LOCAL int stbi__parallel_for_set;
+
+STBIDEF void stbi_set_png_simd_thread(int flag_true_if_should_use_simd)
+{
+   stbi__png_simd_local = flag_true_if_should_use_simd;
+   stbi__png_simd_set = 1;
+}
+
+STBIDEF void stbi_set_parallel_for_thread(stbi_parallel_for *func, void *user)
+{
+   stbi__parallel_for_local = func;
+   stbi__parallel_for_user_local = user;
+   stbi__parallel_for_set = 1;
+}
+
+#define stbi__png_simd           (stbi__png_simd_set ? stbi__png_simd_local : stbi__png_simd_global)
+#define stbi__parallel_for       (stbi__parallel_for_set ? stbi__parallel_for_local : stbi__parallel_for_global)
+#define stbi__parallel_for_user  (stbi__parallel_for_set ? stbi__parallel_for_user_local : stbi__parallel_for_user_global)
+#endif // STBI_THREAD_LOCAL
 
 STBIDEF void stbi_set_flip_vertically_on_load(int flag_true_if_should_flip)
 {
@@ -1510,16 +1581,47 @@ STBIDEF int      stbi_is_hdr_from_callbacks(stbi_io_callbacks const *clbk, void
 }
 
 #ifndef STBI_NO_LINEAR
-static float stbi__l2h_gamma=2.2f, stbi__l2h_scale=1.0f;
+static float stbi__l2h_gamma_global=2.2f, stbi__l2h_scale_global=1.0f;
 
-STBIDEF void   stbi_ldr_to_hdr_gamma(float gamma) { stbi__l2h_gamma = gamma; }
-STBIDEF void   stbi_ldr_to_hdr_scale(float scale) { stbi__l2h_scale = scale; }
+STBIDEF void   stbi_ldr_to_hdr_gamma(float gamma) { stbi__l2h_gamma_global = gamma; }
+STBIDEF void   stbi_ldr_to_hdr_scale(float scale) { stbi__l2h_scale_global = scale; }
 #endif
 
-static float stbi__h2l_gamma_i=1.0f/2.2f, stbi__h2l_scale_i=1.0f;
+static float stbi__h2l_gamma_i_global=1.0f/2.2f, stbi__h2l_scale_i_global=1.0f;
+
+STBIDEF void   stbi_hdr_to_ldr_gamma(float gamma) { stbi__h2l_gamma_i_global = 1/gamma; }
+STBIDEF void   stbi_hdr_to_ldr_scale(float scale) { stbi__h2l_scale_i_global = 1/scale; }
+
+#ifndef STBI_THREAD_LOCAL
+#define stbi__l2h_gamma    stbi__l2h_gamma_global
+#define stbi__l2h_scale    stbi__l2h_scale_global
+#define stbi__h2l_gamma_i  stbi__h2l_gamma_i_global
+#define stbi__h2l_scale_i  stbi__h2l_scale_i_global
+#else
+static STBI_THREAD_LOCAL float stbi__l2h_gamma_local, stbi__l2h_scale_local, stbi__h2l_gamma_i_local, stbi__h2l_scale_i_local;
+static STBI_THREAD_LOCAL int stbi__l2h_set, stbi__h2l_set;
 
-STBIDEF void   stbi_hdr_to_ldr_gamma(float gamma) { stbi__h2l_gamma_i = 1/gamma; }
-STBIDEF void   stbi_hdr_to_ldr_scale(float scale) { stbi__h2l_scale_i = 1/scale; }
+#ifndef STBI_NO_LINEAR
+STBIDEF void   stbi_ldr_to_hdr_thread(float gamma, float scale)
+{
+   stbi__l2h_gamma_local = gamma;
+   stbi__l2h_scale_local = scale;
+   stbi__l2h_set = 1;
+}
+#endif
+
+STBIDEF void   stbi_hdr_to_ldr_thread(float gamma, float scale)
+{
+   stbi__h2l_gamma_i_local = 1/gamma;
+   stbi__h2l_scale_i_local = 1/scale;
+   stbi__h2l_set = 1;
+}
+
+#define stbi__l2h_gamma    (stbi__l2h_set ? stbi__l2h_gamma_local : stbi__l2h_gamma_global)
+#define stbi__l2h_scale    (stbi__l2h_set ? stbi__l2h_scale_local : stbi__l2h_scale_global)
+#define stbi__h2l_gamma_i  (stbi__h2l_set ? stbi__h2l_gamma_i_local : stbi__h2l_gamma_i_global)
+#define stbi__h2l_scale_i  (stbi__h2l_set ? stbi__h2l_scale_i_local : stbi__h2l_scale_i_global)
+#endif // STBI_THREAD_LOCAL
 
 
 //////////////////////////////////////////////////////////////////////////////
@@ -1932,6 +2034,7 @@ typedef struct
 
    int scan_n, order[4];
    int restart_interval, todo;
+   stbi_uc *rest; // rest of a callback stream, copied to memory for the parallel decoder
 
 // kernels
    void (*idct_block_kernel)(stbi_uc *out, int out_stride, short data[64]);
@@ -2872,10 +2975,179 @@ static void stbi__jpeg_reset(stbi__jpeg *j)
    // since we don't even allow 1<<30 pixels
 }
 
+// decodes count MCUs of a baseline scan starting at MCU number first, which has to be the
+// first one of a restart interval. for a single component scan every block is an MCU.
+static int stbi__jpeg_decode_interval(stbi__jpeg *z, int first, int count)
+{
+   STBI_SIMD_ALIGN(short, data[64]);
+   int k,x,y, n = z->order[0];
+   int w = z->scan_n == 1 ? (z->img_comp[n].x+7) >> 3 : z->img_mcu_x;
+   int i = first % w, j = first / w;
+
+   stbi__jpeg_reset(z);
+   for (; count > 0; --count) {
+      if (z->scan_n == 1) {
+         int ha = z->img_comp[n].ha;
+         if (!stbi__jpeg_decode_block(z, data, z->huff_dc+z->img_comp[n].hd, z->huff_ac+ha, z->fast_ac[ha], n, z->dequant[z->img_comp[n].tq])) return 0;
+         z->idct_block_kernel(z->img_comp[n].data+z->img_comp[n].w2*j*8+i*8, z->img_comp[n].w2, data);
+      } else {
+         for (k=0; k < z->scan_n; ++k) {
+            int c = z->order[k];
+            for (y=0; y < z->img_comp[c].v; ++y) {
+               for (x=0; x < z->img_comp[c].h; ++x) {
+                  int x2 = (i*z->img_comp[c].h + x)*8;
+                  int y2 = (j*z->img_comp[c].v + y)*8;
+                  int ha = z->img_comp[c].ha;
+                  if (!stbi__jpeg_decode_block(z, data, z->huff_dc+z->img_comp[c].hd, z->huff_ac+ha, z->fast_ac[ha], c, z->dequant[z->img_comp[c].tq])) return 0;
+                  z->idct_block_kernel(z->img_comp[c].data+z->img_comp[c].w2*y2+x2, z->img_comp[c].w2, data);
+               }
+            }
+         }
+      }
+      if (++i == w) {
+         i = 0;
+         ++j;
+      }
+   }
+   return 1;
+}
+
+#define STBI__JPEG_MAX_TASKS 64
+
+typedef struct
+{
+   stbi__jpeg *z;
+   stbi_uc **start; // entropy coded data of each restart interval
+   int intervals, mcus, tasks;
+   int ok[STBI__JPEG_MAX_TASKS];
+   const char *err[STBI__JPEG_MAX_TASKS]; // failure reasons are per thread, these go back to the caller's
+} stbi__jpeg_intervals;
+
+static void stbi__jpeg_decode_intervals(void *arg, int task)
+{
+   stbi__jpeg_intervals *p = (stbi__jpeg_intervals *) arg;
+   int first = task * p->intervals / p->tasks, last = (task + 1) * p->intervals / p->tasks, r;
+   int ri = p->z->restart_interval;
+   stbi__context s = *p->z->s;
+   // every task gets its own bit reader and dc predictions, the tables are only read
+   stbi__jpeg *t = (stbi__jpeg *) stbi__malloc(sizeof(stbi__jpeg));
+
+   p->ok[task] = 0;
+   p->err[task] = "outofmem";
+   if (!t) return;
+   memcpy(t, p->z, sizeof(stbi__jpeg));
+   t->s = &s;
+
+   for (r = first; r < last; ++r) {
+      int mcu = r * ri;
+      s.img_buffer = p->start[r];
+      if (!stbi__jpeg_decode_interval(t, mcu, p->mcus - mcu < ri ? p->mcus - mcu : ri)) break;
+   }
+
+   p->ok[task] = r == last;
+   p->err[task] = stbi__g_failure_reason;
+   STBI_FREE(t);
+}
+
+// pulls the rest of a callback stream into memory so it can be split up
+static int stbi__jpeg_buffer_rest(stbi__jpeg *z)
+{
+   stbi__context *s = z->s;
+   int len = (int) (s->img_buffer_end - s->img_buffer), cap = len + 65536, n;
+   stbi_uc *buf = (stbi_uc *) stbi__malloc(cap);
+   if (!buf) return 0;
+
+   memcpy(buf, s->img_buffer, len);
+   while ((n = (s->io.read)(s->io_user_data, (char *) buf + len, cap - len)) > 0) {
+      len += n;
+      if (len == cap) {
+         stbi_uc *grown = cap < (1 << 30) ? (stbi_uc *) STBI_REALLOC_SIZED(buf, cap, cap * 2) : NULL;
+         if (!grown) { STBI_FREE(buf); return 0; }
+         buf = grown;
+         cap *= 2;
+      }
+   }
+
+   s->callback_already_read += (int) (s->img_buffer - s->img_buffer_original);
+   s->read_from_callbacks = 0;
+   s->img_buffer = s->img_buffer_original = buf;
+   s->img_buffer_end = s->img_buffer_original_end = buf + len;
+   z->rest = buf;
+   return 1;
+}
+
+// baseline scans with restart markers can be decoded one interval per thread: the bit reader
+// and dc predictions start over at every RST marker, and every interval writes its own MCUs.
+// returns -1 when the scan doesn't qualify and the serial loop has to handle it.
+static int stbi__jpeg_decode_parallel(stbi__jpeg *z)
+{
+   stbi__jpeg_intervals p;
+   stbi_uc *c, *end;
+   int i, n = z->order[0], count = 1, marker = STBI__MARKER_none;
+
+   if (!stbi__parallel_for || z->progressive || !z->restart_interval) return -1;
+
+   p.z = z;
+   p.mcus = z->scan_n == 1 ? ((z->img_comp[n].x+7) >> 3) * ((z->img_comp[n].y+7) >> 3) : z->img_mcu_x * z->img_mcu_y;
+   p.intervals = (p.mcus + z->restart_interval - 1) / z->restart_interval;
+   if (p.intervals < 2) return -1;
+
+   if (z->s->read_from_callbacks && !z->rest && !stbi__jpeg_buffer_rest(z)) return -1;
+
+   p.start = (stbi_uc **) stbi__malloc_mad2(p.intervals, sizeof(stbi_uc *), 0);
+   if (!p.start) return -1;
+
+   // RST markers can't show up escaped, so a byte scan finds every interval. 0xff00 is a stuffed
+   // 0xff and runs of 0xff are fill bytes in front of a marker.
+   c = z->s->img_buffer;
+   end = z->s->img_buffer_end;
+   p.start[0] = c;
+   while (c + 1 < end) {
+      c = (stbi_uc *) memchr(c, 0xff, end - c - 1);
+      if (!c) break;
+      if (c[1] == 0x00) {
+         c += 2;
+      } else if (c[1] == 0xff) {
+         ++c;
+      } else if (STBI__RESTART(c[1]) && count < p.intervals) {
+         p.start[count++] = c + 2;
+         c += 2;
+      } else {
+         marker = c[1];
+         break;
+      }
+   }
+
+   // missing or extra intervals, or no marker after the scan, the serial loop copes with those
+   if (count != p.intervals || marker == STBI__MARKER_none || STBI__RESTART(marker)) {
+      STBI_FREE(p.start);
+      return -1;
+   }
+
+   p.tasks = p.intervals < STBI__JPEG_MAX_TASKS ? p.intervals : STBI__JPEG_MAX_TASKS;
+   stbi__parallel_for(stbi__parallel_for_user, p.tasks, stbi__jpeg_decode_intervals, &p);
+   STBI_FREE(p.start);
+
+   // a corrupt interval fails the whole image, the same as it does in the serial loop
+   for (i = 0; i < p.tasks; ++i) {
+      if (!p.ok[i]) {
+         stbi__g_failure_reason = p.err[i];
+         return 0;
+      }
+   }
+
+   // carry on after the marker that ended the scan, like the serial loop does
+   z->s->img_buffer = c + 2;
+   z->marker = (unsigned char) marker;
+   return 1;
+}
+
 static int stbi__parse_entropy_coded_data(stbi__jpeg *z)
 {
    stbi__jpeg_reset(z);
    if (!z->progressive) {
+      int r = stbi__jpeg_decode_parallel(z);
+      if (r >= 0) return r;
       if (z->scan_n == 1) {
          int i,j;
          STBI_SIMD_ALIGN(short, data[64]);
@@ -3761,6 +4033,151 @@ static stbi_uc stbi__blinn_8x8(stbi_uc x, stbi_uc y)
    return (stbi_uc) ((t + (t >>8)) >> 8);
 }
 
+typedef struct
+{
+   stbi__jpeg *z;
+   stbi__resample res_comp[4]; // at the first row
+   stbi_uc *output;
+   stbi_uc *linebuf; // lines and a scratch row per band when converting in parallel
+   int n, decode_n, is_rgb, bands;
+} stbi__jpeg_convert;
+
+// resamples and color converts output rows y0 to y1-1, linebuf holds an img_x+3 byte line per component.
+// with 3 components the row loops write a 4th byte past every pixel, so a band that isn't the last one
+// converts its final row in scratch and copies it over, instead of clobbering the next band's first pixel.
+static void stbi__jpeg_convert_rows(stbi__jpeg_convert *c, stbi_uc **linebuf, stbi_uc *scratch, unsigned int y0, unsigned int y1)
+{
+   stbi__jpeg *z = c->z;
+   int k, n = c->n, decode_n = c->decode_n, is_rgb = c->is_rgb;
+   unsigned int i,j;
+   stbi_uc *coutput[4] = { NULL, NULL, NULL, NULL };
+   stbi__resample res_comp[4];
+
+   // skip to y0, the rows in between only move the two source lines along
+   for (k=0; k < decode_n; ++k) {
+      stbi__resample *r = &res_comp[k];
+      int t, last = z->img_comp[k].y - 1;
+      *r = c->res_comp[k];
+      t = r->ystep + (int) y0;
+      r->ystep = t % r->vs;
+      r->ypos  = t / r->vs;
+      r->line0 = z->img_comp[k].data + (r->ypos ? (r->ypos - 1 < last ? r->ypos - 1 : last) : 0) * z->img_comp[k].w2;
+      r->line1 = z->img_comp[k].data + (r->ypos < last ? r->ypos : last) * z->img_comp[k].w2;
+   }
+
+   for (j=y0; j < y1; ++j) {
+      stbi_uc *row = c->output + n * z->s->img_x * j;
+      stbi_uc *out = scratch && j == y1 - 1 ? scratch : row;
+      stbi_uc *converted = out;
+      for (k=0; k < decode_n; ++k) {
+         stbi__resample *r = &res_comp[k];
+         int y_bot = r->ystep >= (r->vs >> 1);
+         coutput[k] = r->resample(linebuf[k],
+                                  y_bot ? r->line1 : r->line0,
+                                  y_bot ? r->line0 : r->line1,
+                                  r->w_lores, r->hs);
+         if (++r->ystep >= r->vs) {
+            r->ystep = 0;
+            r->line0 = r->line1;
+            if (++r->ypos < z->img_comp[k].y)
+               r->line1 += z->img_comp[k].w2;
+         }
+      }
+      if (n >= 3) {
+         stbi_uc *y = coutput[0];
+         if (z->s->img_n == 3) {
+            if (is_rgb) {
+               for (i=0; i < z->s->img_x; ++i) {
+                  out[0] = y[i];
+                  out[1] = coutput[1][i];
+                  out[2] = coutput[2][i];
+                  out[3] = 255;
+                  out += n;
+               }
+            } else {
+               z->YCbCr_to_RGB_kernel(out, y, coutput[1], coutput[2], z->s->img_x, n);
+            }
+         } else if (z->s->img_n == 4) {
+            if (z->app14_color_transform == 0) { // CMYK
+               for (i=0; i < z->s->img_x; ++i) {
+                  stbi_uc m = coutput[3][i];
+                  out[0] = stbi__blinn_8x8(coutput[0][i], m);
+                  out[1] = stbi__blinn_8x8(coutput[1][i], m);
+                  out[2] = stbi__blinn_8x8(coutput[2][i], m);
+                  out[3] = 255;
+                  out += n;
+               }
+            } else if (z->app14_color_transform == 2) { // YCCK
+               z->YCbCr_to_RGB_kernel(out, y, coutput[1], coutput[2], z->s->img_x, n);
+               for (i=0; i < z->s->img_x; ++i) {
+                  stbi_uc m = coutput[3][i];
+                  out[0] = stbi__blinn_8x8(255 - out[0], m);
+                  out[1] = stbi__blinn_8x8(255 - out[1], m);
+                  out[2] = stbi__blinn_8x8(255 - out[2], m);
+                  out += n;
+               }
+            } else { // YCbCr + alpha?  Ignore the fourth channel for now
+               z->YCbCr_to_RGB_kernel(out, y, coutput[1], coutput[2], z->s->img_x, n);
+            }
+         } else
+            for (i=0; i < z->s->img_x; ++i) {
+               out[0] = out[1] = out[2] = y[i];
+               out[3] = 255; // not used if n==3
+               out += n;
+            }
+      } else {
+         if (is_rgb) {
+            if (n == 1)
+               for (i=0; i < z->s->img_x; ++i)
+                  *out++ = stbi__compute_y(coutput[0][i], coutput[1][i], coutput[2][i]);
+            else {
+               for (i=0; i < z->s->img_x; ++i, out += 2) {
+                  out[0] = stbi__compute_y(coutput[0][i], coutput[1][i], coutput[2][i]);
+                  out[1] = 255;
+               }
+            }
+         } else if (z->s->img_n == 4 && z->app14_color_transform == 0) {
+            for (i=0; i < z->s->img_x; ++i) {
+               stbi_uc m = coutput[3][i];
+               stbi_uc r = stbi__blinn_8x8(coutput[0][i], m);
+               stbi_uc g = stbi__blinn_8x8(coutput[1][i], m);
+               stbi_uc b = stbi__blinn_8x8(coutput[2][i], m);
+               out[0] = stbi__compute_y(r, g, b);
+               out[1] = 255;
+               out += n;
+            }
+         } else if (z->s->img_n == 4 && z->app14_color_transform == 2) {
+            for (i=0; i < z->s->img_x; ++i) {
+               out[0] = stbi__blinn_8x8(255 - coutput[0][i], coutput[3][i]);
+               out[1] = 255;
+               out += n;
+            }
+         } else {
+            stbi_uc *y = coutput[0];
+            if (n == 1)
+               for (i=0; i < z->s->img_x; ++i) out[i] = y[i];
+            else
+               for (i=0; i < z->s->img_x; ++i) { *out++ = y[i]; *out++ = 255; }
+         }
+      }
+      if (converted != row)
+         memcpy(row, converted, n * z->s->img_x);
+   }
+}
+
+static void stbi__jpeg_convert_band(void *arg, int band)
+{
+   stbi__jpeg_convert *c = (stbi__jpeg_convert *) arg;
+   stbi_uc *linebuf[4], *lines = c->linebuf + (size_t) band * (c->decode_n + c->n) * (c->z->s->img_x + 3);
+   unsigned int h = c->z->s->img_y;
+   int k;
+
+   for (k=0; k < c->decode_n; ++k)
+      linebuf[k] = lines + (size_t) k * (c->z->s->img_x + 3);
+   stbi__jpeg_convert_rows(c, linebuf, band + 1 < c->bands && c->n == 3 ? linebuf[c->decode_n - 1] + c->z->s->img_x + 3 : NULL,
+                           band * h / c->bands, (band + 1) * h / c->bands);
+}
+
 static stbi_uc *load_jpeg_image(stbi__jpeg *z, int *out_x, int *out_y, int *comp, int req_comp)
 {
    int n, decode_n, is_rgb;
@@ -3785,9 +4202,8 @@ static stbi_uc *load_jpeg_image(stbi__jpeg *z, int *out_x, int *out_y, int *comp
    // resample and color-convert
    {
       int k;
-      unsigned int i,j;
       stbi_uc *output;
-      stbi_uc *coutput[4] = { NULL, NULL, NULL, NULL };
+      stbi__jpeg_convert conv;
 
       stbi__resample res_comp[4];
 
@@ -3817,100 +4233,26 @@ static stbi_uc *load_jpeg_image(stbi__jpeg *z, int *out_x, int *out_y, int *comp
       output = (stbi_uc *) stbi__malloc_mad3(n, z->s->img_x, z->s->img_y, 1);
       if (!output) { stbi__cleanup_jpeg(z); return stbi__errpuc("outofmem", "Out of memory"); }
 
-      // now go ahead and resample
-      for (j=0; j < z->s->img_y; ++j) {
-         stbi_uc *out = output + n * z->s->img_x * j;
-         for (k=0; k < decode_n; ++k) {
-            stbi__resample *r = &res_comp[k];
-            int y_bot = r->ystep >= (r->vs >> 1);
-            coutput[k] = r->resample(z->img_comp[k].linebuf,
-                                     y_bot ? r->line1 : r->line0,
-                                     y_bot ? r->line0 : r->line1,
-                                     r->w_lores, r->hs);
-            if (++r->ystep >= r->vs) {
-               r->ystep = 0;
-               r->line0 = r->line1;
-               if (++r->ypos < z->img_comp[k].y)
-                  r->line1 += z->img_comp[k].w2;
-            }
-         }
-         if (n >= 3) {
-            stbi_uc *y = coutput[0];
-            if (z->s->img_n == 3) {
-               if (is_rgb) {
-                  for (i=0; i < z->s->img_x; ++i) {
-                     out[0] = y[i];
-                     out[1] = coutput[1][i];
-                     out[2] = coutput[2][i];
-                     out[3] = 255;
-                     out += n;
-                  }
-               } else {
-                  z->YCbCr_to_RGB_kernel(out, y, coutput[1], coutput[2], z->s->img_x, n);
-               }
-            } else if (z->s->img_n == 4) {
-               if (z->app14_color_transform == 0) { // CMYK
-                  for (i=0; i < z->s->img_x; ++i) {
-                     stbi_uc m = coutput[3][i];
-                     out[0] = stbi__blinn_8x8(coutput[0][i], m);
-                     out[1] = stbi__blinn_8x8(coutput[1][i], m);
-                     out[2] = stbi__blinn_8x8(coutput[2][i], m);
-                     out[3] = 255;
-                     out += n;
-                  }
-               } else if (z->app14_color_transform == 2) { // YCCK
-                  z->YCbCr_to_RGB_kernel(out, y, coutput[1], coutput[2], z->s->img_x, n);
-                  for (i=0; i < z->s->img_x; ++i) {
-                     stbi_uc m = coutput[3][i];
-                     out[0] = stbi__blinn_8x8(255 - out[0], m);
-                     out[1] = stbi__blinn_8x8(255 - out[1], m);
-                     out[2] = stbi__blinn_8x8(255 - out[2], m);
-                     out += n;
-                  }
-               } else { // YCbCr + alpha?  Ignore the fourth channel for now
-                  z->YCbCr_to_RGB_kernel(out, y, coutput[1], coutput[2], z->s->img_x, n);
-               }
-            } else
-               for (i=0; i < z->s->img_x; ++i) {
-                  out[0] = out[1] = out[2] = y[i];
-                  out[3] = 255; // not used if n==3
-                  out += n;
-               }
-         } else {
-            if (is_rgb) {
-               if (n == 1)
-                  for (i=0; i < z->s->img_x; ++i)
-                     *out++ = stbi__compute_y(coutput[0][i], coutput[1][i], coutput[2][i]);
-               else {
-                  for (i=0; i < z->s->img_x; ++i, out += 2) {
-                     out[0] = stbi__compute_y(coutput[0][i], coutput[1][i], coutput[2][i]);
-                     out[1] = 255;
-                  }
-               }
-            } else if (z->s->img_n == 4 && z->app14_color_transform == 0) {
-               for (i=0; i < z->s->img_x; ++i) {
-                  stbi_uc m = coutput[3][i];
-                  stbi_uc r = stbi__blinn_8x8(coutput[0][i], m);
-                  stbi_uc g = stbi__blinn_8x8(coutput[1][i], m);
-                  stbi_uc b = stbi__blinn_8x8(coutput[2][i], m);
-                  out[0] = stbi__compute_y(r, g, b);
-                  out[1] = 255;
-                  out += n;
-               }
-            } else if (z->s->img_n == 4 && z->app14_color_transform == 2) {
-               for (i=0; i < z->s->img_x; ++i) {
-                  out[0] = stbi__blinn_8x8(255 - coutput[0][i], coutput[3][i]);
-                  out[1] = 255;
-                  out += n;
-               }
-            } else {
-               stbi_uc *y = coutput[0];
-               if (n == 1)
-                  for (i=0; i < z->s->img_x; ++i) out[i] = y[i];
-               else
-                  for (i=0; i < z->s->img_x; ++i) { *out++ = y[i]; *out++ = 255; }
-            }
-         }
+      // now go ahead and resample, in bands of rows on big images if there are threads to use
+      conv.z = z;
+      conv.output = output;
+      conv.n = n;
+      conv.decode_n = decode_n;
+      conv.is_rgb = is_rgb;
+      conv.bands = z->s->img_y / 64 < STBI__JPEG_MAX_TASKS ? z->s->img_y / 64 : STBI__JPEG_MAX_TASKS;
+      conv.linebuf = NULL;
+      memcpy(conv.res_comp, res_comp, sizeof(res_comp));
+      if (stbi__parallel_for && conv.bands > 1 && (size_t) z->s->img_x * z->s->img_y >= (1 << 20))
+         conv.linebuf = (stbi_uc *) stbi__malloc_mad3(conv.bands, decode_n + n, z->s->img_x + 3, 0);
+
+      if (conv.linebuf) {
+         stbi__parallel_for(stbi__parallel_for_user, conv.bands, stbi__jpeg_convert_band, &conv);
+         STBI_FREE(conv.linebuf);
+      } else {
+         stbi_uc *linebuf[4];
+         for (k=0; k < decode_n; ++k)
+            linebuf[k] = z->img_comp[k].linebuf;
+         stbi__jpeg_convert_rows(&conv, linebuf, NULL, 0, z->s->img_y);
       }
       stbi__cleanup_jpeg(z);
       *out_x = z->s->img_x;
@@ -3926,8 +4268,10 @@ static void *stbi__jpeg_load(stbi__context *s, int *x, int *y, int *comp, int re
    stbi__jpeg* j = (stbi__jpeg*) stbi__malloc(sizeof(stbi__jpeg));
    STBI_NOTUSED(ri);
    j->s = s;
+   j->rest = NULL;
    stbi__setup_jpeg(j);
    result = load_jpeg_image(j, x,y,comp,req_comp);
+   STBI_FREE(j->rest);
    STBI_FREE(j);
    return result;
 }
@@ -4533,6 +4877,170 @@ static int stbi__paeth(int a, int b, int c)
    return c;
 }
 
+// SIMD unfilter for 8-bit pixels of 3 or 4 bytes. sub, avg and paeth depend on the pixel to
+// the left, so these go one pixel per iteration but without stb's per-byte loop and branches.
+// cur, raw and prior point at the second pixel of the row, n is the number of pixels left.
+// pixels go through the low 32-bit lane, 3-byte ones never touch a 4th byte. they are put
+// together in a register, going through memory with a 3-byte memcpy stalls store forwarding.
+static stbi_inline stbi__uint32 stbi__png_get_px(const stbi_uc *p, int bpp)
+{
+   stbi__uint32 v;
+   if (bpp == 4) {
+      memcpy(&v, p, 4);
+      return v;
+   }
+   return p[0] | (p[1] << 8) | (p[2] << 16);
+}
+
+static stbi_inline void stbi__png_put_px(stbi_uc *p, stbi__uint32 v, int bpp)
+{
+   if (bpp == 4) {
+      memcpy(p, &v, 4);
+      return;
+   }
+   p[0] = (stbi_uc) v;
+   p[1] = (stbi_uc) (v >> 8);
+   p[2] = (stbi_uc) (v >> 16);
+}
+
+#if defined(STBI_SSE2)
+static stbi_inline __m128i stbi__png_load_px(const stbi_uc *p, int bpp)
+{
+   return _mm_cvtsi32_si128((int) stbi__png_get_px(p, bpp));
+}
+
+static stbi_inline void stbi__png_store_px(stbi_uc *p, __m128i x, int bpp)
+{
+   stbi__png_put_px(p, (stbi__uint32) _mm_cvtsi128_si32(x), bpp);
+}
+
+static stbi_inline void stbi__png_unfilter_simd(int filter, stbi_uc *cur, stbi_uc *raw, stbi_uc *prior, stbi__uint32 n, int bpp)
+{
+   __m128i zero = _mm_setzero_si128();
+   __m128i a = stbi__png_load_px(cur - bpp, bpp);
+   stbi__uint32 i, k, nk = n * bpp;
+
+   switch (filter) {
+      case STBI__F_sub:
+      case STBI__F_paeth_first: // paeth(a,0,0) is always a
+         for (i=0; i < n; ++i, cur+=bpp, raw+=bpp) {
+            a = _mm_add_epi8(stbi__png_load_px(raw, bpp), a);
+            stbi__png_store_px(cur, a, bpp);
+         }
+         break;
+      case STBI__F_up:
+         for (k=0; k + 16 <= nk; k += 16)
+            _mm_storeu_si128((__m128i *) (cur+k), _mm_add_epi8(_mm_loadu_si128((__m128i *) (raw+k)), _mm_loadu_si128((__m128i *) (prior+k))));
+         for (; k < nk; ++k)
+            cur[k] = STBI__BYTECAST(raw[k] + prior[k]);
+         break;
+      case STBI__F_avg:
+      case STBI__F_avg_first: {
+         // pavgb rounds up, take the low bit of a^b back off to get (a+b)>>1
+         __m128i one = _mm_set1_epi8(1);
+         for (i=0; i < n; ++i, cur+=bpp, raw+=bpp, prior+=bpp) {
+            __m128i b = filter == STBI__F_avg ? stbi__png_load_px(prior, bpp) : zero;
+            __m128i avg = _mm_sub_epi8(_mm_avg_epu8(a, b), _mm_and_si128(_mm_xor_si128(a, b), one));
+            a = _mm_add_epi8(stbi__png_load_px(raw, bpp), avg);
+            stbi__png_store_px(cur, a, bpp);
+         }
+         break;
+      }
+      case STBI__F_paeth: {
+         // predictors in 16-bit lanes: pa = |b-c|, pb = |a-c|, pc = |a+b-2c|, ties go to a, then b
+         __m128i a16 = _mm_unpacklo_epi8(a, zero);
+         __m128i c16 = _mm_unpacklo_epi8(stbi__png_load_px(prior - bpp, bpp), zero);
+         for (i=0; i < n; ++i, cur+=bpp, raw+=bpp, prior+=bpp) {
+            __m128i b16 = _mm_unpacklo_epi8(stbi__png_load_px(prior, bpp), zero);
+            __m128i pa = _mm_sub_epi16(b16, c16);
+            __m128i pb = _mm_sub_epi16(a16, c16);
+            __m128i pc = _mm_add_epi16(pa, pb);
+            __m128i smallest, nearest, use_b, use_a;
+            pa = _mm_max_epi16(pa, _mm_sub_epi16(zero, pa));
+            pb = _mm_max_epi16(pb, _mm_sub_epi16(zero, pb));
+            pc = _mm_max_epi16(pc, _mm_sub_epi16(zero, pc));
+            smallest = _mm_min_epi16(pc, _mm_min_epi16(pa, pb));
+            use_b = _mm_cmpeq_epi16(smallest, pb);
+            use_a = _mm_cmpeq_epi16(smallest, pa);
+            nearest = _mm_or_si128(_mm_and_si128(use_b, b16), _mm_andnot_si128(use_b, c16));
+            nearest = _mm_or_si128(_mm_and_si128(use_a, a16), _mm_andnot_si128(use_a, nearest));
+            a = _mm_add_epi8(stbi__png_load_px(raw, bpp), _mm_packus_epi16(nearest, nearest));
+            stbi__png_store_px(cur, a, bpp);
+            a16 = _mm_unpacklo_epi8(a, zero);
+            c16 = b16;
+         }
+         break;
+      }
+   }
+}
+#define STBI__PNG_SIMD_AVAILABLE() stbi__sse2_available()
+#elif defined(STBI_NEON)
+static stbi_inline uint8x8_t stbi__png_load_px(const stbi_uc *p, int bpp)
+{
+   return vreinterpret_u8_u32(vdup_n_u32(stbi__png_get_px(p, bpp)));
+}
+
+static stbi_inline void stbi__png_store_px(stbi_uc *p, uint8x8_t x, int bpp)
+{
+   stbi__png_put_px(p, vget_lane_u32(vreinterpret_u32_u8(x), 0), bpp);
+}
+
+static stbi_inline void stbi__png_unfilter_simd(int filter, stbi_uc *cur, stbi_uc *raw, stbi_uc *prior, stbi__uint32 n, int bpp)
+{
+   uint8x8_t zero = vdup_n_u8(0);
+   uint8x8_t a = stbi__png_load_px(cur - bpp, bpp);
+   stbi__uint32 i, k, nk = n * bpp;
+
+   switch (filter) {
+      case STBI__F_sub:
+      case STBI__F_paeth_first: // paeth(a,0,0) is always a
+         for (i=0; i < n; ++i, cur+=bpp, raw+=bpp) {
+            a = vadd_u8(stbi__png_load_px(raw, bpp), a);
+            stbi__png_store_px(cur, a, bpp);
+         }
+         break;
+      case STBI__F_up:
+         for (k=0; k + 16 <= nk; k += 16)
+            vst1q_u8(cur+k, vaddq_u8(vld1q_u8(raw+k), vld1q_u8(prior+k)));
+         for (; k < nk; ++k)
+            cur[k] = STBI__BYTECAST(raw[k] + prior[k]);
+         break;
+      case STBI__F_avg:
+      case STBI__F_avg_first:
+         // halving add truncates, exactly (a+b)>>1
+         for (i=0; i < n; ++i, cur+=bpp, raw+=bpp, prior+=bpp) {
+            uint8x8_t b = filter == STBI__F_avg ? stbi__png_load_px(prior, bpp) : zero;
+            a = vadd_u8(stbi__png_load_px(raw, bpp), vhadd_u8(a, b));
+            stbi__png_store_px(cur, a, bpp);
+         }
+         break;
+      case STBI__F_paeth: {
+         // predictors in 16-bit lanes: pa = |b-c|, pb = |a-c|, pc = |a+b-2c|, ties go to a, then b
+         int16x8_t a16 = vreinterpretq_s16_u16(vmovl_u8(a));
+         int16x8_t c16 = vreinterpretq_s16_u16(vmovl_u8(stbi__png_load_px(prior - bpp, bpp)));
+         for (i=0; i < n; ++i, cur+=bpp, raw+=bpp, prior+=bpp) {
+            int16x8_t b16 = vreinterpretq_s16_u16(vmovl_u8(stbi__png_load_px(prior, bpp)));
+            int16x8_t pa = vsubq_s16(b16, c16);
+            int16x8_t pb = vsubq_s16(a16, c16);
+            int16x8_t pc = vabsq_s16(vaddq_s16(pa, pb));
+            int16x8_t smallest, nearest;
+            pa = vabsq_s16(pa);
+            pb = vabsq_s16(pb);
+            smallest = vminq_s16(pc, vminq_s16(pa, pb));
+            nearest = vbslq_s16(vceqq_s16(smallest, pb), b16, c16);
+            nearest = vbslq_s16(vceqq_s16(smallest, pa), a16, nearest);
+            a = vadd_u8(stbi__png_load_px(raw, bpp), vmovn_u16(vreinterpretq_u16_s16(nearest)));
+            stbi__png_store_px(cur, a, bpp);
+            a16 = vreinterpretq_s16_u16(vmovl_u8(a));
+            c16 = b16;
+         }
+         break;
+      }
+   }
+}
+#define STBI__PNG_SIMD_AVAILABLE() 1
+#endif
+
 static const stbi_uc stbi__depth_scale_table[9] = { 0, 0xff, 0x55, 0, 0x11, 0,0,0, 0x01 };
 
 // create the png data from post-deflated data
@@ -4615,6 +5123,14 @@ static int stbi__create_png_image_raw(stbi__png *a, stbi_uc *raw, stbi__uint32 r
       }
 
       // this is a little gross, so that we don't switch per-pixel or per-component
+#if defined(STBI_SSE2) || defined(STBI_NEON)
+      if (depth == 8 && img_n == out_n && (img_n == 3 || img_n == 4) && filter != STBI__F_none && stbi__png_simd && STBI__PNG_SIMD_AVAILABLE()) {
+         // constant pixel sizes, so each copy gets its loads and stores inlined
+         if (img_n == 4) stbi__png_unfilter_simd(filter, cur, raw, prior, x - 1, 4);
+         else            stbi__png_unfilter_simd(filter, cur, raw, prior, x - 1, 3);
+         raw += (x - 1) * img_n;
+      } else
+#endif
       if (depth < 8 || img_n == out_n) {
          int nk = (width - 1)*filter_bytes;
          #define STBI__CASE(f) \
@@ -4879,19 +5395,46 @@ static int stbi__expand_png_palette(stbi__png *a, stbi_uc *palette, int len, int
    return 1;
 }
 
-static int stbi__unpremultiply_on_load = 0;
-static int stbi__de_iphone_flag = 0;
+static int stbi__unpremultiply_on_load_global = 0;
+static int stbi__de_iphone_flag_global = 0;
 
 STBIDEF void stbi_set_unpremultiply_on_load(int flag_true_if_should_unpremultiply)
 {
-   stbi__unpremultiply_on_load = flag_true_if_should_unpremultiply;
+   stbi__unpremultiply_on_load_global = flag_true_if_should_unpremultiply;
 }
 
 STBIDEF void stbi_convert_iphone_png_to_rgb(int flag_true_if_should_convert)
 {
-   stbi__de_iphone_flag = flag_true_if_should_convert;
+   stbi__de_iphone_flag_global = flag_true_if_should_convert;
+}
+
+#ifndef STBI_THREAD_LOCAL
+#define stbi__unpremultiply_on_load  stbi__unpremultiply_on_load_global
+#define stbi__de_iphone_flag  stbi__de_iphone_flag_global
+#else
+static STBI_THREAD_LOCAL int stbi__unpremultiply_on_load_local, stbi__unpremultiply_on_load_set;
+static STBI_THREAD_LOCAL int stbi__de_iphone_flag_local, stbi__de_iphone_flag_set;
+
+STBIDEF void stbi_set_unpremultiply_on_load_thread(int flag_true_if_should_unpremultiply)
+{
+   stbi__unpremultiply_on_load_local = flag_true_if_should_unpremultiply;
+   stbi__unpremultiply_on_load_set = 1;
+}
+
+STBIDEF void stbi_convert_iphone_png_to_rgb_thread(int flag_true_if_should_convert)
+{
+   stbi__de_iphone_flag_local = flag_true_if_should_convert;
+   stbi__de_iphone_flag_set = 1;
 }
 
+#define stbi__unpremultiply_on_load  (stbi__unpremultiply_on_load_set           \
+                                       ? stbi__unpremultiply_on_load_local       \
+                                       : stbi__unpremultiply_on_load_global)
+#define stbi__de_iphone_flag  (stbi__de_iphone_flag_set                         \
+                                ? stbi__de_iphone_flag_local                     \
+                                : stbi__de_iphone_flag_global)
+#endif // STBI_THREAD_LOCAL
+
 static void stbi__de_iphone(stbi__png *z)
 {
    stbi__context *s = z->s;
@@ -6819,7 +7362,7 @@ static void *stbi__load_gif_main(stbi__context *s, int **delays, int *x, int *y,
             }
             memcpy( out + ((layers - 1) * stride), u, stride );
             if (layers >= 2) {
-               two_back = out - 2 * stride;
+               two_back = out + (layers - 2) * stride;
             }
 
             if (delays) {
@@ -6877,6 +7420,75 @@ static int stbi__gif_info(stbi__context *s, int *x, int *y, int *comp)
 {
    return stbi__gif_info_raw(s,x,y,comp);
 }
+
+struct stbi_gif_stream
+{
+   stbi__context s;
+   stbi__gif g;
+   stbi_uc *back[2]; // copies of the last two frames, "restore to previous" reverts to the older one
+   int frames;
+};
+
+STBIDEF stbi_gif_stream *stbi_gif_stream_open(stbi_uc const *buffer, int len, int *x, int *y)
+{
+   int comp;
+   stbi_gif_stream *st = (stbi_gif_stream *) stbi__malloc(sizeof(stbi_gif_stream));
+   if (!st)
+      return (stbi_gif_stream *) stbi__errpuc("outofmem", "Out of memory");
+
+   memset(st, 0, sizeof(*st));
+   stbi__start_mem(&st->s, buffer, len);
+   if (!stbi__gif_info_raw(&st->s, x, y, &comp)) {
+      STBI_FREE(st);
+      return NULL;
+   }
+
+   if (!stbi__mad3sizes_valid(4, *x, *y, 0)) {
+      STBI_FREE(st);
+      return (stbi_gif_stream *) stbi__errpuc("too large", "GIF image is too large");
+   }
+
+   stbi__rewind(&st->s);
+   return st;
+}
+
+STBIDEF stbi_uc *stbi_gif_stream_next(stbi_gif_stream *st, int *delay_ms)
+{
+   int comp, stride;
+   stbi_uc *u, *t;
+
+   u = stbi__gif_load_next(&st->s, &st->g, &comp, 4, st->frames >= 2 ? st->back[1] : 0);
+   if (u == (stbi_uc *) &st->s) u = 0;  // end of animated gif marker
+   if (!u) return 0;
+
+   stride = st->g.w * st->g.h * 4;
+   if (!st->back[0]) {
+      st->back[0] = (stbi_uc *) stbi__malloc(stride);
+      st->back[1] = (stbi_uc *) stbi__malloc(stride);
+      if (!st->back[0] || !st->back[1])
+         return stbi__errpuc("outofmem", "Out of memory");
+   }
+
+   t = st->back[1];
+   st->back[1] = st->back[0];
+   st->back[0] = t;
+   memcpy(st->back[0], u, stride);
+   ++st->frames;
+
+   if (delay_ms) *delay_ms = st->g.delay;
+   return u;
+}
+
+STBIDEF void stbi_gif_stream_close(stbi_gif_stream *st)
+{
+   if (!st) return;
+   STBI_FREE(st->g.out);
+   STBI_FREE(st->g.history);
+   STBI_FREE(st->g.background);
+   STBI_FREE(st->back[0]);
+   STBI_FREE(st->back[1]);
+   STBI_FREE(st);
+}
 #endif
 
 // *************************************************************************************************
@@ -0,0 +1,224 @@
+#include "stream.h"
+
+#include <deque>
+#include <thread>
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#endif
+
+bool StreamFilter::Run(VulkanCTX *ctx, uint32_t width, uint32_t height, VkFormat format, bool y4m, FILE *input, FILE *output)
+{
+#ifdef _WIN32
+	_setmode(_fileno(input), _O_BINARY);
+	_setmode(_fileno(output), _O_BINARY);
+#endif
+
+	this->ctx = ctx;
+	this->input = input;
+	this->output = output;
+	this->width = width;
+	this->height = height;
+	this->y4m = y4m;
+	frameSize = static_cast<size_t>(VulkanCTX::getFrameSize(format, width, height));
+
+	uint32_t slotCount = ctx->getOffscreenSlotCount();
+	idleSlots.Reset(slotCount);
+	filledSlots.Reset(slotCount);
+	results.Reset(slotCount);
+
+	for (uint32_t i = 0; i < slotCount; i++)
+		idleSlots.Push(i);
+
+	Clock::time_point start = Clock::now();
+
+	std::thread reader(&StreamFilter::ReadLoop, this);
+	std::thread writer(&StreamFilter::WriteLoop, this);
+
+	GPULoop();
+
+	reader.join();
+	writer.join();
+
+	wallTime = Seconds(start);
+
+	return !writeFailed;
+}
+
+void StreamFilter::ReadLoop()
+{
+	uint32_t slot;
+	std::string line;
+
+	while (!writeFailed && idleSlots.Pop(slot)) {
+		Clock::time_point start = Clock::now();
+
+		if (y4m && (!ReadLine(input, line) || line.compare(0, 5, "FRAME"))) {
+			if (!line.empty())
+				std::cerr << "Expected a Y4M FRAME header, got \"" << line.substr(0, 32) << "\" :(" << std::endl;
+			break;
+		}
+
+		// Straight into mapped staging memory, no intermediate copy. YUV planes stay as they are,
+		// the sampler converts them on the GPU.
+		uint8_t *frame = ctx->MapOffscreenInput(slot, width, height);
+		size_t got = fread(frame, 1, frameSize, input);
+
+		readBusy += Seconds(start);
+
+		if (got != frameSize) {
+			if (got)
+				std::cerr << "Dropped a partial frame of " << got << " bytes at the end of the input :(" << std::endl;
+			break;
+		}
+
+		filledSlots.Push(slot);
+	}
+
+	filledSlots.Close();
+}
+
+bool StreamFilter::ReadLine(FILE *input, std::string &line)
+{
+	line.clear();
+
+	for (int c = fgetc(input); c != EOF; c = fgetc(input)) {
+		if (c == '\n')
+			return true;
+
+		line += static_cast<char>(c);
+		if (line.size() > 4096)
+			return false;
+	}
+
+	return false;
+}
+
+bool StreamFilter::ReadY4MHeader(FILE *input, uint32_t &width, uint32_t &height, VkFormat &format)
+{
+	std::string line;
+	if (!ReadLine(input, line) || line.compare(0, 10, "YUV4MPEG2 ")) {
+		std::cerr << "Input is not Y4M :(" << std::endl;
+		return false;
+	}
+
+	width = height = 0;
+	std::string colorspace = "420jpeg"; // the default when there's no C tag
+
+	for (size_t start = 10; start < line.size();) {
+		size_t end = line.find(' ', start);
+		if (end == std::string::npos)
+			end = line.size();
+
+		std::string token = line.substr(start, end - start);
+		if (token[0] == 'W')
+			width = atoi(token.c_str() + 1);
+		else if (token[0] == 'H')
+			height = atoi(token.c_str() + 1);
+		else if (token[0] == 'C')
+			colorspace = token.substr(1);
+
+		start = end + 1;
+	}
+
+	// Chroma siting differs between the 4:2:0 flavours, but not by enough to matter for an edge filter
+	if (colorspace.compare(0, 3, "420") || (colorspace.size() > 3 && colorspace != "420jpeg" && colorspace != "420mpeg2" && colorspace != "420paldv")) {
+		std::cerr << "Y4M colorspace C" << colorspace << " is not supported, only 4:2:0 is :(" << std::endl;
+		return false;
+	}
+
+	format = VK_FORMAT_G8_B8_R8_3PLANE_420_UNORM;
+	return width && height;
+}
+
+void StreamFilter::GPULoop()
+{
+	struct InFlight {
+		uint32_t slot;
+		uint32_t readback;
+	};
+
+	std::deque<InFlight> inFlight;
+	Clock::time_point busySince;
+	bool inputDone = false;
+
+	while (!inputDone || !inFlight.empty()) {
+		// Submit everything the reader has filled, only block on it when the GPU is idle
+		while (!inputDone) {
+			uint32_t slot;
+
+			if (inFlight.empty()) {
+				if (!filledSlots.Pop(slot)) {
+					inputDone = true;
+					break;
+				}
+			} else if (!filledSlots.TryPop(slot)) {
+				inputDone = filledSlots.Drained();
+				break;
+			}
+
+			if (inFlight.empty())
+				busySince = Clock::now();
+
+			InFlight job;
+			job.slot = slot;
+			job.readback = ctx->SubmitOffscreen(slot, width, height);
+			inFlight.push_back(job);
+		}
+
+		if (inFlight.empty())
+			continue;
+
+		// Short timeout while the reader might have more for us
+		InFlight &job = inFlight.front();
+		if (!ctx->PollOffscreen(job.slot, inFlight.size() == ctx->getOffscreenSlotCount() ? UINT64_MAX : 1000000))
+			continue;
+
+		while (!ctx->PollReadback(job.readback))
+			std::this_thread::yield();
+
+		idleSlots.Push(job.slot);
+		results.Push(job.readback);
+		inFlight.pop_front();
+		frames++;
+
+		if (inFlight.empty())
+			gpuBusy += Seconds(busySince);
+	}
+
+	idleSlots.Close();
+	results.Close();
+}
+
+void StreamFilter::WriteLoop()
+{
+	uint32_t readback;
+
+	while (results.Pop(readback)) {
+		Clock::time_point start = Clock::now();
+
+		// Keep draining after a failed write so the GPU loop never blocks on us
+		if (!writeFailed && fwrite(ctx->getReadbackData(readback), 1, frameSize, output) != frameSize) {
+			std::cerr << "Failed to write to the output, stopping :(" << std::endl;
+			writeFailed = true;
+		}
+
+		ctx->FreeReadback(readback);
+		writeBusy += Seconds(start);
+	}
+
+	fflush(output);
+}
+
+void StreamFilter::PrintStats()
+{
+	if (wallTime <= 0.0)
+		return;
+
+	std::cerr << "Filtered " << frames << " frames of " << width << "x" << height << " in " << wallTime << " s, "
+		<< frames / wallTime << " fps" << std::endl;
+	std::cerr << "  read:  " << 100.0 * readBusy / wallTime << "% busy" << std::endl;
+	std::cerr << "  gpu:   " << ctx->getOffscreenSlotCount() << " slots, " << 100.0 * gpuBusy / wallTime << "% busy" << std::endl;
+	std::cerr << "  write: " << 100.0 * writeBusy / wallTime << "% busy" << std::endl;
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include "jobs.h"
+#include "vulkanctx.h"
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <string>
+
+// Filters raw video frame by frame, e.g. piped from and to ffmpeg. A reader thread
+// fills the offscreen slots' staging memory straight from the input, the GPU loop runs
+// the filter and a writer thread streams the readbacks out, frames stay in order.
+// Input is RGBA, I420 or NV12 (optionally Y4M framed), output is always RGBA.
+class StreamFilter {
+public:
+	StreamFilter() {}
+	virtual ~StreamFilter() {}
+
+	bool Run(VulkanCTX *ctx, uint32_t width, uint32_t height, VkFormat format, bool y4m, FILE *input, FILE *output); // ctx needs SetupOffscreen(format) and SetupReadback() first
+	static inline uint32_t getReadbackCount(uint32_t slots) { return 2 * slots + 2; } // in flight + queued + writing
+	static bool ReadY4MHeader(FILE *input, uint32_t &width, uint32_t &height, VkFormat &format); // 4:2:0 only
+
+	void PrintStats(); // stdout carries the video, so this goes to stderr
+
+protected:
+	typedef std::chrono::steady_clock Clock;
+
+	void ReadLoop();
+	void GPULoop();
+	void WriteLoop();
+	static bool ReadLine(FILE *input, std::string &line);
+
+	static inline double Seconds(Clock::time_point start) { return std::chrono::duration<double>(Clock::now() - start).count(); }
+
+	VulkanCTX *ctx = nullptr;
+	FILE *input = nullptr;
+	FILE *output = nullptr;
+	uint32_t width = 0, height = 0;
+	size_t frameSize = 0;
+	bool y4m = false; // every frame starts with a FRAME line
+
+	BoundedQueue<uint32_t> idleSlots; // ready for the reader
+	BoundedQueue<uint32_t> filledSlots; // holding a frame for the GPU
+	BoundedQueue<uint32_t> results; // readbacks in frame order
+
+	double readBusy = 0.0, gpuBusy = 0.0, writeBusy = 0.0; // seconds, each stage is a single thread
+	double wallTime = 0.0;
+	uint32_t frames = 0;
+	std::atomic<bool> writeFailed{false};
+};
@@ -0,0 +1,169 @@
+#include "texcache.h"
+#include "bufferpool.h"
+#include "fileutil.h"
+#include "image.h"
+#include "texfile.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+
+std::string TextureCache::getDefaultDir()
+{
+#ifdef _WIN32
+	const char *base = getenv("LOCALAPPDATA");
+	return base ? std::string(base) + "\\vkwaifu" : std::string();
+#else
+	const char *base = getenv("XDG_CACHE_HOME");
+	if (base && *base)
+		return std::string(base) + "/vkwaifu";
+
+	base = getenv("HOME");
+	return base ? std::string(base) + "/.cache/vkwaifu" : std::string();
+#endif
+}
+
+void TextureCache::Setup(VulkanCTX *ctx, JobSystem *jobs, const char *dir)
+{
+	this->ctx = ctx;
+	this->dir.clear();
+	decoder.SetJobs(jobs);
+
+	if (!dir || !*dir)
+		return;
+
+	std::error_code ec;
+	std::filesystem::create_directories(dir, ec);
+	if (!std::filesystem::is_directory(dir, ec)) {
+		std::cout << "Can't use " << dir << " as texture cache :(" << std::endl;
+		return;
+	}
+
+	this->dir = dir;
+
+	// The same image becomes a different texture with other options or on another device
+	uint32_t settings[8] = {
+		ctx->getTextureFormat(1, PIXEL_U8), ctx->getTextureFormat(2, PIXEL_U8), ctx->getTextureFormat(3, PIXEL_U8), ctx->getTextureFormat(4, PIXEL_U8),
+		ctx->getTextureFormat(4, PIXEL_U16), ctx->getTextureFormat(4, PIXEL_F32), ctx->getCompression(), 1 // cache layout version
+	};
+	settingsKey = HashBytes(settings, sizeof(settings));
+}
+
+bool TextureCache::PrepareUpload(const char *path, VulkanUpload &upload)
+{
+	// Hashed, decoded or copied to staging straight from the mapping
+	MappedFile source;
+	if (!source.Open(path, MappedFile::ACCESS_SEQUENTIAL))
+		return false;
+
+	return PrepareUpload(path, source.getData(), source.getSize(), upload);
+}
+
+bool TextureCache::PrepareUpload(const char *path, const uint8_t *data, size_t size, VulkanUpload &upload)
+{
+	auto start = std::chrono::steady_clock::now();
+	Image image;
+
+	// KTX2 and DDS files are already in a device format, nothing to decode or cache
+	TextureFileInfo info;
+	if (ParseTextureFile(data, size, info)) {
+		if (!ctx->PrepareUpload(data, info, upload)) {
+			std::cout << path << " is in a format this device can't sample :(" << std::endl;
+			return false;
+		}
+
+		return true;
+	}
+
+	if (dir.empty()) {
+		bool prepared = decoder.Load(data, size, image) && ctx->PrepareUpload(image.data, image.width, image.height, upload, image.channels, image.type);
+		FreeImage(image);
+		return prepared;
+	}
+
+	std::error_code ec;
+	uint64_t stamp[3] = { size, static_cast<uint64_t>(std::filesystem::last_write_time(path, ec).time_since_epoch().count()), settingsKey };
+	uint64_t key = HashBytes(data, size, HashBytes(stamp, sizeof(stamp)));
+
+	char name[32];
+	snprintf(name, sizeof(name), "%016llx.ktx2", static_cast<unsigned long long>(key));
+	std::string cachePath = (std::filesystem::path(dir) / name).string();
+
+	if (Load(cachePath, upload)) {
+		hits++;
+		hitNs += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+		return true;
+	}
+
+	if (!decoder.Load(data, size, image))
+		return false;
+
+	// Convert once into plain memory, that goes to the cache and to staging. Reading back
+	// from staging could hit uncached memory.
+	uint32_t width = image.width, height = image.height;
+	VkFormat format = ctx->getUploadFormat(image.data, width, height, image.channels, image.type);
+	void *texels = bufferPool.Alloc(static_cast<size_t>(VulkanCTX::getTextureSize(format, width, height)));
+
+	ctx->ConvertTexels(texels, image.data, width, height, image.channels, image.type, format);
+	FreeImage(image);
+
+	if (!Store(cachePath, texels, format, width, height))
+		std::cout << "Failed to write " << cachePath << " :(" << std::endl;
+
+	bool prepared = ctx->PrepareRawUpload(texels, format, width, height, upload);
+	bufferPool.Free(texels);
+
+	misses++;
+	missNs += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+
+	return prepared;
+}
+
+bool TextureCache::Load(const std::string &cachePath, VulkanUpload &upload)
+{
+	MappedFile file;
+	if (!file.Open(cachePath.c_str(), MappedFile::ACCESS_SEQUENTIAL))
+		return false;
+
+	TextureFileInfo info;
+	if (!ParseKTX2(file.getData(), file.getSize(), info) || info.regions.size() != 1)
+		return false;
+
+	return ctx->PrepareRawUpload(file.getData() + info.regions[0].offset, info.format, info.width, info.height, upload);
+}
+
+bool TextureCache::Store(const std::string &cachePath, const void *texels, VkFormat format, uint32_t width, uint32_t height)
+{
+	// Written under a temporary name and renamed, so a reader never maps half a file
+	std::string tempPath = TempPath(cachePath);
+	size_t size = static_cast<size_t>(VulkanCTX::getTextureSize(format, width, height));
+
+	if (!WriteKTX2(tempPath.c_str(), format, width, height, texels, size)) {
+		std::remove(tempPath.c_str());
+		return false;
+	}
+
+	std::error_code ec;
+	std::filesystem::rename(tempPath, cachePath, ec);
+	if (ec) {
+		std::remove(tempPath.c_str());
+		return false;
+	}
+
+	return true;
+}
+
+void TextureCache::PrintStats()
+{
+	if (!hits && !misses)
+		return;
+
+	std::cout << "Texture cache: " << hits << " hits";
+	if (hits)
+		std::cout << " (avg " << hitNs / 1e6 / hits << " ms)";
+	std::cout << ", " << misses << " misses";
+	if (misses)
+		std::cout << " (avg " << missNs / 1e6 / misses << " ms)";
+	std::cout << std::endl;
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include "image.h"
+#include "vulkanctx.h"
+#include <atomic>
+#include <string>
+
+// Keeps textures exactly as they go into staging (converted, block compressed) in KTX2 files,
+// named by a hash of the source file's contents, size and mtime plus the texture format settings.
+// A hit maps the file and copies the level straight into staging with no decode at all.
+class TextureCache {
+public:
+	TextureCache() {}
+	virtual ~TextureCache() {}
+
+	void Setup(VulkanCTX *ctx, JobSystem *jobs, const char *dir); // jobs help decode big JPEGs, nullptr dir turns caching off, loads still go through PrepareUpload()
+	bool PrepareUpload(const char *path, VulkanUpload &upload); // decodes or maps path into a staging buffer - safe from any thread, false if it can't be loaded
+	bool PrepareUpload(const char *path, const uint8_t *data, size_t size, VulkanUpload &upload); // same with the file already read, path only feeds the cache key
+
+	void PrintStats();
+
+	static std::string getDefaultDir(); // $XDG_CACHE_HOME/vkwaifu, ~/.cache/vkwaifu or %LOCALAPPDATA%\vkwaifu
+
+protected:
+	bool Load(const std::string &cachePath, VulkanUpload &upload);
+	bool Store(const std::string &cachePath, const void *texels, VkFormat format, uint32_t width, uint32_t height);
+
+	VulkanCTX *ctx = nullptr;
+	Decoder decoder; // shared by every thread calling PrepareUpload(), only set up in Setup()
+	std::string dir;
+	uint64_t settingsKey = 0; // texture formats picked for this device and options
+
+	std::atomic<uint32_t> hits{0}, misses{0};
+	std::atomic<uint64_t> hitNs{0}, missNs{0};
+};
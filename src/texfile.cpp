@@ -0,0 +1,430 @@
+#include "texfile.h"
+
+#include <cstdio>
+#include <cstring>
+
+static const uint8_t KTX2_IDENTIFIER[12] = { 0xAB, 0x4B, 0x54, 0x58, 0x20, 0x32, 0x30, 0xBB, 0x0D, 0x0A, 0x1A, 0x0A };
+static const size_t KTX2_HEADER_SIZE = 80; // identifier, 9 words of header, then the index
+static const size_t KTX2_LEVEL_ALIGN = 4096;
+
+struct KTX2Header {
+	uint32_t vkFormat;
+	uint32_t typeSize;
+	uint32_t pixelWidth, pixelHeight, pixelDepth;
+	uint32_t layerCount, faceCount, levelCount;
+	uint32_t supercompressionScheme;
+	uint32_t dfdByteOffset, dfdByteLength;
+	uint32_t kvdByteOffset, kvdByteLength;
+	uint32_t sgdByteOffset[2], sgdByteLength[2]; // 64-bit, but only 4-byte aligned in the file
+};
+
+static_assert(sizeof(KTX2Header) + sizeof(KTX2_IDENTIFIER) == KTX2_HEADER_SIZE, "KTX2 header must be packed");
+
+bool getFormatBlock(VkFormat format, uint32_t &blockWidth, uint32_t &blockHeight, uint32_t &blockBytes)
+{
+	blockWidth = blockHeight = 1;
+
+	switch (format) {
+	case VK_FORMAT_R8_UNORM:
+	case VK_FORMAT_R8_SRGB:
+		blockBytes = 1;
+		return true;
+	case VK_FORMAT_R8G8_UNORM:
+	case VK_FORMAT_R8G8_SRGB:
+	case VK_FORMAT_R16_UNORM:
+	case VK_FORMAT_R16_SFLOAT:
+		blockBytes = 2;
+		return true;
+	case VK_FORMAT_R8G8B8A8_UNORM:
+	case VK_FORMAT_R8G8B8A8_SRGB:
+	case VK_FORMAT_B8G8R8A8_UNORM:
+	case VK_FORMAT_B8G8R8A8_SRGB:
+	case VK_FORMAT_A2B10G10R10_UNORM_PACK32:
+	case VK_FORMAT_B10G11R11_UFLOAT_PACK32:
+	case VK_FORMAT_E5B9G9R9_UFLOAT_PACK32:
+	case VK_FORMAT_R16G16_UNORM:
+	case VK_FORMAT_R16G16_SFLOAT:
+	case VK_FORMAT_R32_SFLOAT:
+		blockBytes = 4;
+		return true;
+	case VK_FORMAT_R16G16B16A16_UNORM:
+	case VK_FORMAT_R16G16B16A16_SFLOAT:
+	case VK_FORMAT_R32G32_SFLOAT:
+		blockBytes = 8;
+		return true;
+	case VK_FORMAT_R32G32B32A32_SFLOAT:
+		blockBytes = 16;
+		return true;
+	case VK_FORMAT_BC1_RGB_UNORM_BLOCK:
+	case VK_FORMAT_BC1_RGB_SRGB_BLOCK:
+	case VK_FORMAT_BC1_RGBA_UNORM_BLOCK:
+	case VK_FORMAT_BC1_RGBA_SRGB_BLOCK:
+	case VK_FORMAT_BC4_UNORM_BLOCK:
+	case VK_FORMAT_BC4_SNORM_BLOCK:
+		blockWidth = blockHeight = 4;
+		blockBytes = 8;
+		return true;
+	case VK_FORMAT_BC2_UNORM_BLOCK:
+	case VK_FORMAT_BC2_SRGB_BLOCK:
+	case VK_FORMAT_BC3_UNORM_BLOCK:
+	case VK_FORMAT_BC3_SRGB_BLOCK:
+	case VK_FORMAT_BC5_UNORM_BLOCK:
+	case VK_FORMAT_BC5_SNORM_BLOCK:
+	case VK_FORMAT_BC6H_UFLOAT_BLOCK:
+	case VK_FORMAT_BC6H_SFLOAT_BLOCK:
+	case VK_FORMAT_BC7_UNORM_BLOCK:
+	case VK_FORMAT_BC7_SRGB_BLOCK:
+		blockWidth = blockHeight = 4;
+		blockBytes = 16;
+		return true;
+	default:
+		return false;
+	}
+}
+
+uint64_t getLevelSize(VkFormat format, uint32_t width, uint32_t height)
+{
+	uint32_t blockWidth, blockHeight, blockBytes;
+	if (!getFormatBlock(format, blockWidth, blockHeight, blockBytes))
+		return 0;
+
+	return uint64_t((width + blockWidth - 1) / blockWidth) * ((height + blockHeight - 1) / blockHeight) * blockBytes;
+}
+
+// Mip chains stop at 1x1, more levels than that is a broken file
+static bool checkLevels(TextureFileInfo &info)
+{
+	uint32_t largest = info.width > info.height ? info.width : info.height;
+	uint32_t maxLevels = 1;
+	while (largest >>= 1)
+		maxLevels++;
+
+	return info.levels >= 1 && info.levels <= maxLevels && info.layers >= 1 && info.layers <= 2048 && getLevelSize(info.format, 1, 1);
+}
+
+bool ParseKTX2(const uint8_t *data, size_t size, TextureFileInfo &info)
+{
+	if (size < KTX2_HEADER_SIZE || memcmp(data, KTX2_IDENTIFIER, sizeof(KTX2_IDENTIFIER)))
+		return false;
+
+	KTX2Header header;
+	memcpy(&header, data + sizeof(KTX2_IDENTIFIER), sizeof(header));
+
+	if (header.pixelDepth > 1 || header.faceCount != 1 || header.supercompressionScheme || !header.pixelWidth || !header.pixelHeight)
+		return false;
+
+	info = TextureFileInfo();
+	info.format = static_cast<VkFormat>(header.vkFormat);
+	info.width = header.pixelWidth;
+	info.height = header.pixelHeight;
+	info.levels = header.levelCount ? header.levelCount : 1; // 0 asks the loader to make mips, we just show the one level
+	info.layers = header.layerCount ? header.layerCount : 1;
+
+	if (!checkLevels(info) || KTX2_HEADER_SIZE + size_t(info.levels) * 24 > size)
+		return false;
+
+	// Each level holds all of its layers back to back
+	for (uint32_t level = 0; level < info.levels; level++) {
+		uint64_t index[3]; // byteOffset, byteLength, uncompressedByteLength
+		memcpy(index, data + KTX2_HEADER_SIZE + level * 24, sizeof(index));
+
+		TextureRegion region;
+		region.level = level;
+		region.width = info.width >> level ? info.width >> level : 1;
+		region.height = info.height >> level ? info.height >> level : 1;
+		region.size = getLevelSize(info.format, region.width, region.height);
+
+		if (index[0] > size || index[1] > size - index[0] || index[1] != region.size * info.layers)
+			return false;
+
+		for (uint32_t layer = 0; layer < info.layers; layer++) {
+			region.layer = layer;
+			region.offset = index[0] + layer * region.size;
+			info.regions.push_back(region);
+		}
+	}
+
+	return true;
+}
+
+// DDS {
+
+struct DDSPixelFormat {
+	uint32_t size, flags, fourCC, rgbBitCount;
+	uint32_t rMask, gMask, bMask, aMask;
+};
+
+struct DDSHeader {
+	uint32_t size, flags, height, width, pitchOrLinearSize, depth, mipMapCount;
+	uint32_t reserved1[11];
+	DDSPixelFormat pixelFormat;
+	uint32_t caps, caps2, caps3, caps4, reserved2;
+};
+
+struct DDSHeaderDX10 {
+	uint32_t dxgiFormat, resourceDimension, miscFlag, arraySize, miscFlags2;
+};
+
+static_assert(sizeof(DDSHeader) == 124, "DDS header must be packed");
+
+static constexpr uint32_t fourCC(const char *code)
+{
+	return uint32_t(code[0]) | (uint32_t(code[1]) << 8) | (uint32_t(code[2]) << 16) | (uint32_t(code[3]) << 24);
+}
+
+static VkFormat dxgiToVulkan(uint32_t dxgi)
+{
+	switch (dxgi) {
+	case 2: return VK_FORMAT_R32G32B32A32_SFLOAT;
+	case 10: return VK_FORMAT_R16G16B16A16_SFLOAT;
+	case 11: return VK_FORMAT_R16G16B16A16_UNORM;
+	case 16: return VK_FORMAT_R32G32_SFLOAT;
+	case 24: return VK_FORMAT_A2B10G10R10_UNORM_PACK32;
+	case 26: return VK_FORMAT_B10G11R11_UFLOAT_PACK32;
+	case 28: return VK_FORMAT_R8G8B8A8_UNORM;
+	case 29: return VK_FORMAT_R8G8B8A8_SRGB;
+	case 34: return VK_FORMAT_R16G16_SFLOAT;
+	case 35: return VK_FORMAT_R16G16_UNORM;
+	case 41: return VK_FORMAT_R32_SFLOAT;
+	case 49: return VK_FORMAT_R8G8_UNORM;
+	case 54: return VK_FORMAT_R16_SFLOAT;
+	case 56: return VK_FORMAT_R16_UNORM;
+	case 61: return VK_FORMAT_R8_UNORM;
+	case 67: return VK_FORMAT_E5B9G9R9_UFLOAT_PACK32;
+	case 71: return VK_FORMAT_BC1_RGBA_UNORM_BLOCK;
+	case 72: return VK_FORMAT_BC1_RGBA_SRGB_BLOCK;
+	case 74: return VK_FORMAT_BC2_UNORM_BLOCK;
+	case 75: return VK_FORMAT_BC2_SRGB_BLOCK;
+	case 77: return VK_FORMAT_BC3_UNORM_BLOCK;
+	case 78: return VK_FORMAT_BC3_SRGB_BLOCK;
+	case 80: return VK_FORMAT_BC4_UNORM_BLOCK;
+	case 81: return VK_FORMAT_BC4_SNORM_BLOCK;
+	case 83: return VK_FORMAT_BC5_UNORM_BLOCK;
+	case 84: return VK_FORMAT_BC5_SNORM_BLOCK;
+	case 87: return VK_FORMAT_B8G8R8A8_UNORM;
+	case 91: return VK_FORMAT_B8G8R8A8_SRGB;
+	case 95: return VK_FORMAT_BC6H_UFLOAT_BLOCK;
+	case 96: return VK_FORMAT_BC6H_SFLOAT_BLOCK;
+	case 98: return VK_FORMAT_BC7_UNORM_BLOCK;
+	case 99: return VK_FORMAT_BC7_SRGB_BLOCK;
+	default: return VK_FORMAT_UNDEFINED;
+	}
+}
+
+// Legacy headers say nothing about colour space, colour textures are nearly always sRGB
+static VkFormat legacyToVulkan(const DDSPixelFormat &pf)
+{
+	const uint32_t DDPF_FOURCC = 0x4, DDPF_RGB = 0x40;
+
+	if (pf.flags & DDPF_FOURCC) {
+		switch (pf.fourCC) {
+		case fourCC("DXT1"): return VK_FORMAT_BC1_RGBA_SRGB_BLOCK;
+		case fourCC("DXT2"):
+		case fourCC("DXT3"): return VK_FORMAT_BC2_SRGB_BLOCK;
+		case fourCC("DXT4"):
+		case fourCC("DXT5"): return VK_FORMAT_BC3_SRGB_BLOCK;
+		case fourCC("ATI1"):
+		case fourCC("BC4U"): return VK_FORMAT_BC4_UNORM_BLOCK;
+		case fourCC("ATI2"):
+		case fourCC("BC5U"): return VK_FORMAT_BC5_UNORM_BLOCK;
+		case 113: return VK_FORMAT_R16G16B16A16_SFLOAT; // D3DFMT_A16B16G16R16F
+		case 116: return VK_FORMAT_R32G32B32A32_SFLOAT; // D3DFMT_A32B32G32R32F
+		default: return VK_FORMAT_UNDEFINED;
+		}
+	}
+
+	if ((pf.flags & DDPF_RGB) && pf.rgbBitCount == 32) {
+		if (pf.rMask == 0x000000ff && pf.gMask == 0x0000ff00 && pf.bMask == 0x00ff0000)
+			return VK_FORMAT_R8G8B8A8_SRGB;
+		if (pf.rMask == 0x00ff0000 && pf.gMask == 0x0000ff00 && pf.bMask == 0x000000ff)
+			return VK_FORMAT_B8G8R8A8_SRGB;
+	}
+
+	return VK_FORMAT_UNDEFINED;
+}
+
+bool ParseDDS(const uint8_t *data, size_t size, TextureFileInfo &info)
+{
+	const uint32_t DDSCAPS2_CUBEMAP = 0x200, DDSCAPS2_VOLUME = 0x200000;
+	const uint32_t DX10_TEXTURE2D = 3, DX10_TEXTURECUBE = 0x4;
+
+	if (size < 4 + sizeof(DDSHeader) || memcmp(data, "DDS ", 4))
+		return false;
+
+	DDSHeader header;
+	memcpy(&header, data + 4, sizeof(header));
+
+	if (header.size != sizeof(DDSHeader) || !header.width || !header.height || (header.caps2 & (DDSCAPS2_CUBEMAP | DDSCAPS2_VOLUME)))
+		return false;
+
+	info = TextureFileInfo();
+	info.width = header.width;
+	info.height = header.height;
+	info.levels = header.mipMapCount ? header.mipMapCount : 1;
+
+	size_t offset = 4 + sizeof(DDSHeader);
+
+	if (header.pixelFormat.fourCC == fourCC("DX10")) {
+		DDSHeaderDX10 dx10;
+		if (size < offset + sizeof(dx10))
+			return false;
+
+		memcpy(&dx10, data + offset, sizeof(dx10));
+		offset += sizeof(dx10);
+
+		if (dx10.resourceDimension != DX10_TEXTURE2D || (dx10.miscFlag & DX10_TEXTURECUBE))
+			return false;
+
+		info.format = dxgiToVulkan(dx10.dxgiFormat);
+		info.layers = dx10.arraySize ? dx10.arraySize : 1;
+	} else {
+		info.format = legacyToVulkan(header.pixelFormat);
+	}
+
+	if (!checkLevels(info))
+		return false;
+
+	// Unlike KTX2, each layer holds its whole mip chain
+	for (uint32_t layer = 0; layer < info.layers; layer++) {
+		for (uint32_t level = 0; level < info.levels; level++) {
+			TextureRegion region;
+			region.level = level;
+			region.layer = layer;
+			region.width = info.width >> level ? info.width >> level : 1;
+			region.height = info.height >> level ? info.height >> level : 1;
+			region.size = getLevelSize(info.format, region.width, region.height);
+			region.offset = offset;
+
+			if (region.size > size - offset)
+				return false;
+
+			offset += region.size;
+			info.regions.push_back(region);
+		}
+	}
+
+	return true;
+}
+
+// }
+
+bool ParseTextureFile(const uint8_t *data, size_t size, TextureFileInfo &info)
+{
+	return ParseKTX2(data, size, info) || ParseDDS(data, size, info);
+}
+
+// Basic data format descriptor, KHR_DF_VERSIONNUMBER_1_3
+static bool makeDFD(VkFormat format, std::vector<uint32_t> &dfd, uint32_t &typeSize)
+{
+	enum { MODEL_RGBSDA = 1, MODEL_BC1A = 128, MODEL_BC7 = 137 };
+	enum { TRANSFER_LINEAR = 1, TRANSFER_SRGB = 2 };
+	enum { SAMPLE_LINEAR = 0x10, SAMPLE_SIGNED = 0x40, SAMPLE_FLOAT = 0x80 };
+
+	uint32_t model = MODEL_RGBSDA, transfer = TRANSFER_SRGB;
+	uint32_t channels = 4, bits = 8, blockSize = 0;
+	bool isFloat = false;
+
+	switch (format) {
+	case VK_FORMAT_R8_SRGB: channels = 1; break;
+	case VK_FORMAT_R8G8_SRGB: channels = 2; break;
+	case VK_FORMAT_R8G8B8A8_SRGB: break;
+	case VK_FORMAT_R16G16B16A16_UNORM: bits = 16; transfer = TRANSFER_LINEAR; break;
+	case VK_FORMAT_R16G16B16A16_SFLOAT: bits = 16; transfer = TRANSFER_LINEAR; isFloat = true; break;
+	case VK_FORMAT_R32G32B32A32_SFLOAT: bits = 32; transfer = TRANSFER_LINEAR; isFloat = true; break;
+	case VK_FORMAT_BC1_RGB_SRGB_BLOCK: model = MODEL_BC1A; blockSize = 8; break;
+	case VK_FORMAT_BC7_SRGB_BLOCK: model = MODEL_BC7; blockSize = 16; break;
+	default: return false;
+	}
+
+	uint32_t samples = blockSize ? 1 : channels;
+	uint32_t blockBytes = 24 + 16 * samples;
+
+	dfd.clear();
+	dfd.push_back(4 + blockBytes); // dfdTotalSize
+	dfd.push_back(0); // vendor Khronos, basic descriptor
+	dfd.push_back(2 | (blockBytes << 16)); // version 1.3
+	dfd.push_back(model | (1 << 8) | (transfer << 16)); // BT.709 primaries, straight alpha
+
+	if (blockSize) {
+		dfd.push_back(3 | (3 << 8)); // 4x4 blocks
+		dfd.push_back(blockSize);
+		dfd.push_back(0);
+
+		// The whole block is one opaque sample
+		dfd.push_back(((blockSize * 8 - 1) << 16));
+		dfd.push_back(0);
+		dfd.push_back(0);
+		dfd.push_back(0xFFFFFFFF);
+
+		typeSize = 1;
+		return true;
+	}
+
+	dfd.push_back(0);
+	dfd.push_back(channels * bits / 8);
+	dfd.push_back(0);
+
+	static const uint32_t channelIds[4] = { 0, 1, 2, 15 }; // R, G, B, A
+	for (uint32_t i = 0; i < channels; i++) {
+		uint32_t type = channelIds[i];
+		if (isFloat)
+			type |= SAMPLE_FLOAT | SAMPLE_SIGNED;
+		if (i == 3 && transfer == TRANSFER_SRGB)
+			type |= SAMPLE_LINEAR; // alpha is never sRGB encoded
+
+		dfd.push_back((i * bits) | ((bits - 1) << 16) | (type << 24));
+		dfd.push_back(0);
+		dfd.push_back(isFloat ? 0xBF800000 : 0); // -1.0f
+		dfd.push_back(isFloat ? 0x3F800000 : uint32_t((uint64_t(1) << bits) - 1)); // 1.0f
+	}
+
+	typeSize = bits / 8;
+	return true;
+}
+
+bool WriteKTX2(const char *path, VkFormat format, uint32_t width, uint32_t height, const void *texels, size_t size)
+{
+	std::vector<uint32_t> dfd;
+	uint32_t typeSize;
+	if (!makeDFD(format, dfd, typeSize))
+		return false;
+
+	static const char writer[] = "KTXwriter\0vkwaifu"; // key and value, both NUL terminated
+	uint32_t kvdLength = sizeof(writer);
+	uint32_t kvdPadded = (4 + kvdLength + 3) & ~3u;
+
+	size_t dfdOffset = KTX2_HEADER_SIZE + 24;
+	size_t kvdOffset = dfdOffset + dfd.size() * 4;
+	size_t levelOffset = (kvdOffset + kvdPadded + KTX2_LEVEL_ALIGN - 1) & ~(KTX2_LEVEL_ALIGN - 1);
+
+	std::vector<uint8_t> head(levelOffset, 0);
+	memcpy(head.data(), KTX2_IDENTIFIER, sizeof(KTX2_IDENTIFIER));
+
+	KTX2Header header = {};
+	header.vkFormat = format;
+	header.typeSize = typeSize;
+	header.pixelWidth = width;
+	header.pixelHeight = height;
+	header.faceCount = 1;
+	header.levelCount = 1;
+	header.dfdByteOffset = static_cast<uint32_t>(dfdOffset);
+	header.dfdByteLength = static_cast<uint32_t>(dfd.size() * 4);
+	header.kvdByteOffset = static_cast<uint32_t>(kvdOffset);
+	header.kvdByteLength = kvdPadded;
+	memcpy(head.data() + sizeof(KTX2_IDENTIFIER), &header, sizeof(header));
+
+	uint64_t index[3] = { levelOffset, size, size };
+	memcpy(head.data() + KTX2_HEADER_SIZE, index, sizeof(index));
+	memcpy(head.data() + dfdOffset, dfd.data(), dfd.size() * 4);
+	memcpy(head.data() + kvdOffset, &kvdLength, 4);
+	memcpy(head.data() + kvdOffset + 4, writer, kvdLength);
+
+	FILE *file = fopen(path, "wb");
+	if (!file)
+		return false;
+
+	bool ok = fwrite(head.data(), 1, head.size(), file) == head.size() && fwrite(texels, 1, size, file) == size;
+	ok = fclose(file) == 0 && ok;
+
+	return ok;
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <vulkan/vulkan.h>
+
+// One mip level of one array layer inside a texture file, tightly packed
+struct TextureRegion {
+	uint32_t level = 0, layer = 0;
+	uint32_t width = 0, height = 0;
+	uint64_t offset = 0;
+	uint64_t size = 0;
+};
+
+// A GPU ready texture container, the texels go to the device as they are
+struct TextureFileInfo {
+	VkFormat format = VK_FORMAT_UNDEFINED;
+	uint32_t width = 0, height = 0;
+	uint32_t levels = 1, layers = 1;
+	std::vector<TextureRegion> regions; // every level of every layer, checked to lie inside the file
+};
+
+// Only 2D textures and arrays, no cube maps, volumes or supercompression.
+// false for anything else or formats getFormatBlock() doesn't know.
+bool ParseKTX2(const uint8_t *data, size_t size, TextureFileInfo &info);
+bool ParseDDS(const uint8_t *data, size_t size, TextureFileInfo &info);
+bool ParseTextureFile(const uint8_t *data, size_t size, TextureFileInfo &info); // either of the above, by magic
+
+bool getFormatBlock(VkFormat format, uint32_t &blockWidth, uint32_t &blockHeight, uint32_t &blockBytes); // false for unknown formats
+uint64_t getLevelSize(VkFormat format, uint32_t width, uint32_t height); // 0 for unknown formats
+
+// Single level 2D texture with its data descriptor, the level starts on a 4 KiB boundary
+// so a mapping of the file hands it out page aligned. false for formats we can't describe.
+bool WriteKTX2(const char *path, VkFormat format, uint32_t width, uint32_t height, const void *texels, size_t size);
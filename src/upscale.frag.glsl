@@ -0,0 +1,33 @@
+// Compiled by the build into upscalefrag.h with:
+// glslangValidator -V --spirv-val --vn upscaleFsSpv -o upscalefrag.h upscale.frag.glsl
+
+// Stretches the view over the window when it was drawn at a lower resolution. The
+// scaled target is the size of the window, the view only covers its top left part.
+
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+#extension GL_EXT_nonuniform_qualifier : require
+
+layout (set = 1, binding = 0) uniform sampler2D textures[];
+
+layout (push_constant) uniform PushConstants {
+	uint textureIndex; // the scaled target
+	uint compareIndex;
+	float split;
+	uint pageTable;
+	vec4 view; // width and height of the drawn part in texture coordinates
+	vec2 size; // of the scaled target in texels
+} pc;
+
+layout (location = 0) in vec4 fragmentIn;
+layout (location = 1) in vec2 texCoordIn;
+
+layout (location = 0) out vec4 fragmentOut;
+
+void main()
+{
+	// Bilinear, kept half a texel inside so nothing left over from a bigger scale bleeds in
+	vec2 halfTexel = 0.5 / pc.size;
+	vec2 uv = clamp(texCoordIn * pc.view.zw, halfTexel, pc.view.zw - halfTexel);
+	fragmentOut = textureLod(textures[pc.textureIndex], uv, 0.0);
+}
@@ -0,0 +1,82 @@
+// Compiled by the build into viewfrag.h with:
+// glslangValidator -V --spirv-val --vn viewFsSpv -o viewfrag.h view.frag.glsl
+
+// fs.frag.glsl for the window, textures come out of one bindless array and
+// the push constants say which. Batch and stream keep using fs.frag.glsl.
+// The window shows the view rectangle of the texture. The filter runs at
+// the mip level that matches the zoom, either right here or once per tile
+// into the filter cache, which the window then only has to look up.
+
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+#extension GL_EXT_nonuniform_qualifier : require
+
+layout (set = 1, binding = 0) uniform sampler2D textures[];
+
+layout (push_constant) uniform PushConstants {
+	uint textureIndex;
+	uint compareIndex; // 0xFFFFFFFF when not comparing
+	float split;
+	uint tileTable; // RGBA8, the cache slot of every tile in the window - 0xFFFFFFFF filters here
+	vec4 view; // x, y, width and height of the window in texture coordinates
+	vec2 size; // level 0 in texels
+	float level;
+	float tileTexels; // without the border
+	float cacheTexels;
+	uint cacheIndex; // filter output, cut into tiles
+	vec2 tileOrigin; // tile at the table's top left corner
+	float tint; // 0 while filling the cache, the vertex color goes on when it's shown
+} pc;
+
+layout (location = 0) in vec4 fragmentIn;
+layout (location = 1) in vec2 texCoordIn;
+
+layout (location = 0) out vec4 fragmentOut;
+
+const float sobelMin = 200.0;
+const float sobelMax = 300.0;
+const float tileBorder = 1.0;
+
+vec4 sobel(uint index, vec2 uv)
+{
+	vec4 top         = textureLod(textures[nonuniformEXT(index)], vec2(uv.x, uv.y + 1.0 / sobelMin), pc.level);
+	vec4 bottom      = textureLod(textures[nonuniformEXT(index)], vec2(uv.x, uv.y - 1.0 / sobelMin), pc.level);
+	vec4 left        = textureLod(textures[nonuniformEXT(index)], vec2(uv.x - 1.0 / sobelMax, uv.y), pc.level);
+	vec4 right       = textureLod(textures[nonuniformEXT(index)], vec2(uv.x + 1.0 / sobelMax, uv.y), pc.level);
+	vec4 topLeft     = textureLod(textures[nonuniformEXT(index)], vec2(uv.x - 1.0 / sobelMax, uv.y + 1.0 / sobelMin), pc.level);
+	vec4 topRight    = textureLod(textures[nonuniformEXT(index)], vec2(uv.x + 1.0 / sobelMax, uv.y + 1.0 / sobelMin), pc.level);
+	vec4 bottomLeft  = textureLod(textures[nonuniformEXT(index)], vec2(uv.x - 1.0 / sobelMax, uv.y - 1.0 / sobelMin), pc.level);
+	vec4 bottomRight = textureLod(textures[nonuniformEXT(index)], vec2(uv.x + 1.0 / sobelMax, uv.y - 1.0 / sobelMin), pc.level);
+	vec4 sx = -topLeft - 2 * left - bottomLeft + topRight   + 2 * right  + bottomRight;
+	vec4 sy = -topLeft - 2 * top  - topRight   + bottomLeft + 2 * bottom + bottomRight;
+	vec4 sobel = sqrt(sx * sx + sy * sy);
+	return sobel;
+}
+
+vec4 sampleTiles(vec2 uv)
+{
+	uv = clamp(uv, 0.0, 1.0);
+
+	vec2 levelSize = max(floor(pc.size * exp2(-pc.level)), 1.0);
+	vec2 texel = min(uv * levelSize, levelSize - 0.5);
+	vec2 tile = floor(texel / pc.tileTexels);
+	vec2 slot = floor(texelFetch(textures[pc.tileTable], ivec2(tile - pc.tileOrigin), 0).xy * 255.0 + 0.5);
+
+	vec2 cacheTexel = slot * (pc.tileTexels + 2.0 * tileBorder) + tileBorder + texel - tile * pc.tileTexels;
+	return textureLod(textures[pc.cacheIndex], cacheTexel / pc.cacheTexels, 0.0);
+}
+
+void main()
+{
+	vec2 uv = pc.view.xy + texCoordIn * pc.view.zw;
+
+	vec4 color;
+	if (pc.compareIndex != 0xFFFFFFFFu && texCoordIn.x > pc.split)
+		color = sobel(pc.compareIndex, uv);
+	else if (pc.tileTable != 0xFFFFFFFFu)
+		color = sampleTiles(uv);
+	else
+		color = sobel(pc.textureIndex, uv);
+
+	fragmentOut = color * mix(vec4(1.0), fragmentIn, pc.tint);
+}
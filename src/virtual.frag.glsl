@@ -0,0 +1,73 @@
+// Compiled by the build into virtualfrag.h with:
+// glslangValidator -V --spirv-val --vn virtualFsSpv -o virtualfrag.h virtual.frag.glsl
+
+// view.frag.glsl for virtual textures. The image is cut into pages that sit anywhere in
+// one cache texture, the page table has a texel per page and a mip level per image level
+// saying where. Pages that aren't in point at the closest coarser one that is.
+
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+#extension GL_EXT_nonuniform_qualifier : require
+
+layout (set = 1, binding = 0) uniform sampler2D textures[];
+
+layout (push_constant) uniform PushConstants {
+	uint textureIndex; // the page cache
+	uint compareIndex; // not comparing here
+	float split;
+	uint pageTable; // RGBA8, the page's x and y in the cache and the level it's from
+	vec4 view; // x, y, width and height of the window in texture coordinates
+	vec2 size; // level 0 in texels
+	float level;
+	float pageTexels; // without the border
+	float cacheTexels;
+} pc;
+
+layout (location = 0) in vec4 fragmentIn;
+layout (location = 1) in vec2 texCoordIn;
+
+layout (location = 0) out vec4 fragmentOut;
+
+const float sobelMin = 200.0;
+const float sobelMax = 300.0;
+const float pageBorder = 1.0;
+
+vec4 sampleVirtual(vec2 uv)
+{
+	uv = clamp(uv, 0.0, 1.0);
+
+	vec2 levelSize = max(floor(pc.size * exp2(-pc.level)), 1.0);
+	vec2 texel = min(uv * levelSize, levelSize - 0.5);
+	vec4 entry = floor(texelFetch(textures[pc.pageTable], ivec2(texel / pc.pageTexels), int(pc.level)) * 255.0 + 0.5);
+
+	// Where uv lands inside the page the entry points at, which may be from a coarser level
+	vec2 pageSize = max(floor(pc.size * exp2(-entry.z)), 1.0);
+	vec2 pageTexel = min(uv * pageSize, pageSize - 0.5);
+	vec2 inPage = pageTexel - floor(pageTexel / pc.pageTexels) * pc.pageTexels;
+
+	vec2 cacheTexel = entry.xy * (pc.pageTexels + 2.0 * pageBorder) + pageBorder + inPage;
+	return textureLod(textures[pc.textureIndex], cacheTexel / pc.cacheTexels, 0.0);
+}
+
+vec4 sobel(void)
+{
+	vec2 uv = pc.view.xy + texCoordIn * pc.view.zw;
+
+	vec4 top         = sampleVirtual(vec2(uv.x, uv.y + 1.0 / sobelMin));
+	vec4 bottom      = sampleVirtual(vec2(uv.x, uv.y - 1.0 / sobelMin));
+	vec4 left        = sampleVirtual(vec2(uv.x - 1.0 / sobelMax, uv.y));
+	vec4 right       = sampleVirtual(vec2(uv.x + 1.0 / sobelMax, uv.y));
+	vec4 topLeft     = sampleVirtual(vec2(uv.x - 1.0 / sobelMax, uv.y + 1.0 / sobelMin));
+	vec4 topRight    = sampleVirtual(vec2(uv.x + 1.0 / sobelMax, uv.y + 1.0 / sobelMin));
+	vec4 bottomLeft  = sampleVirtual(vec2(uv.x - 1.0 / sobelMax, uv.y - 1.0 / sobelMin));
+	vec4 bottomRight = sampleVirtual(vec2(uv.x + 1.0 / sobelMax, uv.y - 1.0 / sobelMin));
+	vec4 sx = -topLeft - 2 * left - bottomLeft + topRight   + 2 * right  + bottomRight;
+	vec4 sy = -topLeft - 2 * top  - topRight   + bottomLeft + 2 * bottom + bottomRight;
+	vec4 sobel = sqrt(sx * sx + sy * sy);
+	return sobel;
+}
+
+void main()
+{
+	fragmentOut = sobel() * fragmentIn;
+}
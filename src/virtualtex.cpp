@@ -0,0 +1,664 @@
+#include "virtualtex.h"
+#include "bufferpool.h"
+#include "fileutil.h"
+#include "image.h"
+#include "texfile.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+
+static const uint32_t PAGE_TEXELS = VIRTUAL_PAGE_SIZE - 2; // without the border
+static const size_t PAGE_BYTES = size_t(VIRTUAL_PAGE_SIZE) * VIRTUAL_PAGE_SIZE * 4;
+static const uint64_t PAGE_DATA_OFFSET = 4096;
+static const uint32_t MAX_LOADS = 32; // page reads in flight
+static const uint32_t MAX_UPLOADS = 16; // pages copied into the cache per frame, 4 MB of staging
+static const uint64_t NO_PAGE = ~uint64_t(0);
+static const double SOBEL_REACH_X = 1.0 / 300.0; // sobelMax and sobelMin in virtual.frag.glsl, the taps need pages too
+static const double SOBEL_REACH_Y = 1.0 / 200.0;
+
+// <key>.vtex is this header, then from PAGE_DATA_OFFSET on every page of every level, level 0
+// first and row by row. Pages are VIRTUAL_PAGE_SIZE squared RGBA8 with their border.
+struct PageFileHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t width, height;
+	uint32_t pageSize;
+	uint32_t levels;
+	uint32_t padding;
+};
+
+static const char PAGE_FILE_MAGIC[8] = { 'V', 'K', 'W', 'V', 'T', 'E', 'X', 0 };
+static const uint32_t PAGE_FILE_VERSION = 1;
+
+// Page table entries are RGBA8, the slot's column and row in the cache and the level of the page in it
+static inline uint32_t makeEntry(uint32_t slot, uint32_t level)
+{
+	return (slot % VIRTUAL_CACHE_PAGES) | (slot / VIRTUAL_CACHE_PAGES) << 8 | level << 16 | 0xFF000000u;
+}
+
+static inline uint32_t getEntryLevel(uint32_t entry)
+{
+	return (entry >> 16) & 0xFF;
+}
+
+static inline uint32_t clampTexel(int64_t i, uint32_t size)
+{
+	return static_cast<uint32_t>(std::min<int64_t>(std::max<int64_t>(i, 0), int64_t(size) - 1));
+}
+
+// One page of level 0 straight out of the image, the border repeats the edge
+static void cutPage(uint8_t *page, const uint8_t *texels, size_t stride, uint32_t width, uint32_t height, uint32_t px, uint32_t py)
+{
+	for (uint32_t row = 0; row < VIRTUAL_PAGE_SIZE; row++) {
+		const uint8_t *src = texels + size_t(clampTexel(int64_t(py) * PAGE_TEXELS + row - 1, height)) * stride;
+		uint8_t *dst = page + size_t(row) * VIRTUAL_PAGE_SIZE * 4;
+
+		for (uint32_t col = 0; col < VIRTUAL_PAGE_SIZE; col++)
+			memcpy(dst + col * 4, src + size_t(clampTexel(int64_t(px) * PAGE_TEXELS + col - 1, width)) * 4, 4);
+	}
+}
+
+// Texel x, y of a level that's in the page file already
+static inline const uint8_t *pageTexel(const uint8_t *level, uint32_t pagesX, uint32_t x, uint32_t y)
+{
+	size_t page = size_t(y / PAGE_TEXELS) * pagesX + x / PAGE_TEXELS;
+	return level + page * PAGE_BYTES + ((size_t(y % PAGE_TEXELS) + 1) * VIRTUAL_PAGE_SIZE + x % PAGE_TEXELS + 1) * 4;
+}
+
+// One page of a coarser level, every texel the average of 2x2 from the finer one
+static void shrinkPage(uint8_t *page, const uint8_t *finer, uint32_t finerPagesX, uint32_t finerWidth, uint32_t finerHeight, uint32_t width, uint32_t height, uint32_t px, uint32_t py)
+{
+	for (uint32_t row = 0; row < VIRTUAL_PAGE_SIZE; row++) {
+		uint32_t y = clampTexel(int64_t(py) * PAGE_TEXELS + row - 1, height);
+		uint32_t y0 = std::min(y * 2, finerHeight - 1), y1 = std::min(y * 2 + 1, finerHeight - 1);
+		uint8_t *dst = page + size_t(row) * VIRTUAL_PAGE_SIZE * 4;
+
+		for (uint32_t col = 0; col < VIRTUAL_PAGE_SIZE; col++) {
+			uint32_t x = clampTexel(int64_t(px) * PAGE_TEXELS + col - 1, width);
+			uint32_t x0 = std::min(x * 2, finerWidth - 1), x1 = std::min(x * 2 + 1, finerWidth - 1);
+
+			const uint8_t *a = pageTexel(finer, finerPagesX, x0, y0), *b = pageTexel(finer, finerPagesX, x1, y0);
+			const uint8_t *c = pageTexel(finer, finerPagesX, x0, y1), *d = pageTexel(finer, finerPagesX, x1, y1);
+			for (uint32_t i = 0; i < 4; i++)
+				dst[col * 4 + i] = static_cast<uint8_t>((a[i] + b[i] + c[i] + d[i] + 2) / 4);
+		}
+	}
+}
+
+bool VirtualTexture::Open(const char *path, const char *dir, JobSystem *jobs)
+{
+	this->path = path;
+	this->jobs = jobs;
+
+	std::error_code ec;
+	uint64_t size = std::filesystem::file_size(path, ec);
+	if (ec) {
+		std::cout << path << " does not exist :(" << std::endl;
+		return false;
+	}
+
+	std::filesystem::create_directories(dir, ec);
+
+	// Named after the image, a changed one gets cut again
+	uint64_t stamp[4] = { size, static_cast<uint64_t>(std::filesystem::last_write_time(path, ec).time_since_epoch().count()), VIRTUAL_PAGE_SIZE, PAGE_FILE_VERSION };
+	uint64_t key = HashBytes(path, strlen(path), HashBytes(stamp, sizeof(stamp)));
+
+	char name[32];
+	snprintf(name, sizeof(name), "%016llx.vtex", static_cast<unsigned long long>(key));
+	std::string pagePath = (std::filesystem::path(dir) / name).string();
+
+	if (pageFile.Open(pagePath.c_str()) && pageFile.getSize() >= PAGE_DATA_OFFSET) {
+		PageFileHeader header;
+		memcpy(&header, pageFile.getData(), sizeof(header));
+
+		if (!memcmp(header.magic, PAGE_FILE_MAGIC, sizeof(PAGE_FILE_MAGIC)) && header.version == PAGE_FILE_VERSION && header.pageSize == VIRTUAL_PAGE_SIZE && header.width && header.height) {
+			Layout(header.width, header.height);
+			const Level &top = levels.back();
+
+			if (header.levels == levels.size() && pageFile.getSize() >= PAGE_DATA_OFFSET + (top.firstPage + 1) * PAGE_BYTES)
+				return true;
+		}
+	}
+
+	pageFile.Close();
+
+	// Uncompressed KTX2 and DDS files are cut straight from the mapping, so they can be
+	// bigger than memory. Everything else is decoded first.
+	MappedFile source;
+	TextureFileInfo info;
+	Image image;
+	const uint8_t *texels = nullptr;
+	size_t stride = 0;
+
+	if (source.Open(path) && ParseTextureFile(source.getData(), source.getSize(), info) &&
+		(info.format == VK_FORMAT_R8G8B8A8_SRGB || info.format == VK_FORMAT_R8G8B8A8_UNORM)) {
+		for (auto &region : info.regions) {
+			if (region.level == 0 && region.layer == 0) {
+				texels = source.getData() + region.offset;
+				stride = size_t(info.width) * 4;
+				Layout(info.width, info.height);
+			}
+		}
+	}
+
+	if (!texels) {
+		source.Close();
+
+		Decoder decoder;
+		decoder.SetRGBA8(true);
+		decoder.SetJobs(jobs);
+
+		if (!decoder.Load(path, image)) {
+			std::cout << "Failed to load " << path << ": " << decoder.getError() << " :(" << std::endl;
+			return false;
+		}
+
+		texels = static_cast<const uint8_t *>(image.data);
+		stride = size_t(image.width) * 4;
+		Layout(image.width, image.height);
+	}
+
+	std::cout << "Cutting " << path << " into " << (levels.back().firstPage + 1) << " pages, only this once..." << std::endl;
+	bool built = Build(pagePath.c_str(), texels, stride);
+	FreeImage(image);
+
+	if (!built || !pageFile.Open(pagePath.c_str())) {
+		std::cout << "Failed to write the pages to " << pagePath << " :(" << std::endl;
+		return false;
+	}
+
+	return true;
+}
+
+void VirtualTexture::Layout(uint32_t width, uint32_t height)
+{
+	this->width = width;
+	this->height = height;
+	levels.clear();
+
+	// Halved until the whole level fits in one page
+	uint64_t firstPage = 0;
+	for (uint32_t index = 0; ; index++) {
+		Level level;
+		level.width = std::max(width >> index, 1u);
+		level.height = std::max(height >> index, 1u);
+		level.pagesX = (level.width + PAGE_TEXELS - 1) / PAGE_TEXELS;
+		level.pagesY = (level.height + PAGE_TEXELS - 1) / PAGE_TEXELS;
+		level.firstPage = firstPage;
+		firstPage += uint64_t(level.pagesX) * level.pagesY;
+		levels.push_back(level);
+
+		if (level.pagesX == 1 && level.pagesY == 1)
+			break;
+	}
+
+	// The table's mips halve from its own size, level k's pages have to fit in mip k
+	tableWidth = tableHeight = 1;
+	for (uint32_t index = 0; index < levels.size(); index++) {
+		tableWidth = std::max(tableWidth, levels[index].pagesX << index);
+		tableHeight = std::max(tableHeight, levels[index].pagesY << index);
+	}
+}
+
+bool VirtualTexture::Build(const char *pagePath, const uint8_t *texels, size_t stride)
+{
+	// Written next to the real name and renamed at the end, a crash never leaves half a pyramid
+	std::string tempPath = TempPath(pagePath);
+	FILE *file = fopen(tempPath.c_str(), "wb");
+	if (!file)
+		return false;
+
+	PageFileHeader header = {};
+	memcpy(header.magic, PAGE_FILE_MAGIC, sizeof(PAGE_FILE_MAGIC));
+	header.version = PAGE_FILE_VERSION;
+	header.width = width;
+	header.height = height;
+	header.pageSize = VIRTUAL_PAGE_SIZE;
+	header.levels = static_cast<uint32_t>(levels.size());
+
+	std::vector<uint8_t> row(PAGE_DATA_OFFSET);
+	memcpy(row.data(), &header, sizeof(header));
+	bool ok = fwrite(row.data(), 1, row.size(), file) == row.size();
+
+	// A row of pages at a time, so only the image and one row are ever in memory. Coarser
+	// levels are shrunk from the finer one, read back from what was written so far.
+	MappedFile written;
+
+	for (uint32_t index = 0; ok && index < levels.size(); index++) {
+		const Level &level = levels[index];
+		const uint8_t *finer = nullptr;
+
+		if (index) {
+			ok = fflush(file) == 0 && written.Open(tempPath.c_str());
+			if (!ok)
+				break;
+			finer = written.getData() + PAGE_DATA_OFFSET + levels[index - 1].firstPage * PAGE_BYTES;
+		}
+
+		row.resize(size_t(level.pagesX) * PAGE_BYTES);
+
+		for (uint32_t py = 0; ok && py < level.pagesY; py++) {
+			jobs->ParallelFor(level.pagesX, [&](size_t px) {
+				uint8_t *page = row.data() + px * PAGE_BYTES;
+				if (finer) {
+					const Level &finerLevel = levels[index - 1];
+					shrinkPage(page, finer, finerLevel.pagesX, finerLevel.width, finerLevel.height, level.width, level.height, uint32_t(px), py);
+				} else {
+					cutPage(page, texels, stride, level.width, level.height, uint32_t(px), py);
+				}
+			});
+
+			ok = fwrite(row.data(), 1, row.size(), file) == row.size();
+		}
+	}
+
+	written.Close();
+	ok = fclose(file) == 0 && ok;
+
+	std::error_code ec;
+	if (ok)
+		std::filesystem::rename(tempPath, pagePath, ec);
+	if (!ok || ec)
+		std::filesystem::remove(tempPath, ec);
+
+	return ok && !ec;
+}
+
+bool VirtualTexture::Setup(VulkanCTX *ctx, JobSystem *jobs)
+{
+	this->ctx = ctx;
+	this->jobs = jobs;
+
+	if (levels.empty() || !pageFile.getData())
+		return false;
+
+	// The page table and cache are looked up by bindless index
+	if (!ctx->hasBindless()) {
+		std::cout << "Virtual textures need bindless textures, this device has no descriptor indexing :(" << std::endl;
+		return false;
+	}
+
+	// Only the top level is in to begin with, in slot 0 for good, and everything points at it
+	uint32_t top = static_cast<uint32_t>(levels.size() - 1);
+	uint32_t topEntry = makeEntry(0, top);
+
+	for (auto &level : levels) {
+		level.table.assign(size_t(level.pagesX) * level.pagesY, topEntry);
+		std::fill(level.dirty, level.dirty + 4, 0);
+	}
+
+	// The page table goes up like a texture file, a tightly packed region per mip
+	TextureFileInfo info;
+	info.format = VK_FORMAT_R8G8B8A8_UNORM;
+	info.width = tableWidth;
+	info.height = tableHeight;
+	info.levels = static_cast<uint32_t>(levels.size());
+
+	std::vector<uint32_t> entries;
+	for (uint32_t index = 0; index < levels.size(); index++) {
+		TextureRegion region;
+		region.level = index;
+		region.width = std::max(tableWidth >> index, 1u);
+		region.height = std::max(tableHeight >> index, 1u);
+		region.offset = entries.size() * 4;
+		region.size = uint64_t(region.width) * region.height * 4;
+		info.regions.push_back(region);
+		entries.resize(entries.size() + size_t(region.width) * region.height, topEntry);
+	}
+
+	bool prepared = ctx->PrepareUpload(reinterpret_cast<const uint8_t *>(entries.data()), info, tableUpload);
+
+	// The cache starts out blank but for the top page
+	uint32_t cacheTexels = VIRTUAL_CACHE_PAGES * VIRTUAL_PAGE_SIZE;
+	std::vector<uint8_t> blank(size_t(cacheTexels) * cacheTexels * 4);
+	const uint8_t *topPage = pageFile.getData() + PAGE_DATA_OFFSET + levels[top].firstPage * PAGE_BYTES;
+
+	for (uint32_t row = 0; row < VIRTUAL_PAGE_SIZE; row++)
+		memcpy(blank.data() + size_t(row) * cacheTexels * 4, topPage + size_t(row) * VIRTUAL_PAGE_SIZE * 4, VIRTUAL_PAGE_SIZE * 4);
+
+	prepared = prepared && ctx->PrepareRawUpload(blank.data(), VK_FORMAT_R8G8B8A8_SRGB, cacheTexels, cacheTexels, cacheUpload);
+
+	if (!prepared || !ctx->SubmitUpload(tableUpload) || !ctx->SubmitUpload(cacheUpload)) {
+		std::cout << "No room on the device for the virtual texture :(" << std::endl;
+		ctx->CancelUpload(tableUpload);
+		ctx->CancelUpload(cacheUpload);
+		return false;
+	}
+
+	std::shared_ptr<Page> page = std::make_shared<Page>();
+	page->state = PAGE_RESIDENT;
+	page->level = top;
+	page->lastNeeded = ~uint64_t(0); // never goes
+
+	slots.assign(VIRTUAL_CACHE_PAGES * VIRTUAL_CACHE_PAGES, NO_PAGE);
+	slots[0] = getKey(top, 0, 0);
+	pages[slots[0]] = page;
+
+	uploading = true;
+	return true;
+}
+
+void VirtualTexture::Release()
+{
+	// Reads still write into their pages
+	if (jobs)
+		jobs->Wait();
+
+	for (auto &it : pages)
+		bufferPool.Free(it.second->data);
+
+	pages.clear();
+	slots.clear();
+	needed.clear();
+	loading = 0;
+
+	if (ctx) {
+		ctx->ShowVirtualTexture(VulkanTexture(), VulkanTexture(), 0, 0);
+
+		if (uploading) {
+			ctx->CancelUpload(tableUpload);
+			ctx->CancelUpload(cacheUpload);
+		} else {
+			ctx->RetireTexture(tableUpload.texture);
+			ctx->RetireTexture(cacheUpload.texture);
+		}
+	}
+
+	uploading = false;
+	pageFile.Close();
+}
+
+void VirtualTexture::Fit()
+{
+	scale = 0.0; // Update() knows the window size
+}
+
+void VirtualTexture::Zoom(double factor, double x, double y)
+{
+	if (scale <= 0.0 || factor <= 0.0)
+		return;
+
+	// The texel under x, y stays there
+	double texelX = centerX + (x - windowWidth * 0.5) * scale;
+	double texelY = centerY + (y - windowHeight * 0.5) * scale;
+
+	// From 32 pixels per texel to twice the size that fits
+	double fit = std::max(double(width) / windowWidth, double(height) / windowHeight);
+	scale = std::min(std::max(scale / factor, 1.0 / 32.0), fit * 2.0);
+
+	centerX = texelX - (x - windowWidth * 0.5) * scale;
+	centerY = texelY - (y - windowHeight * 0.5) * scale;
+	Pan(0.0, 0.0);
+}
+
+void VirtualTexture::Pan(double dx, double dy)
+{
+	// The center stays on the image
+	centerX = std::min(std::max(centerX - dx * scale, 0.0), double(width));
+	centerY = std::min(std::max(centerY - dy * scale, 0.0), double(height));
+}
+
+void VirtualTexture::Update()
+{
+	if (!ctx || slots.empty())
+		return;
+
+	// Shown once both textures are up
+	if (uploading) {
+		bool tableDone = tableUpload.fence == VK_NULL_HANDLE || ctx->PollUpload(tableUpload);
+		bool cacheDone = cacheUpload.fence == VK_NULL_HANDLE || ctx->PollUpload(cacheUpload);
+		if (!tableDone || !cacheDone)
+			return;
+
+		ctx->TransitionTexture(tableUpload.texture);
+		ctx->TransitionTexture(cacheUpload.texture);
+		ctx->ShowVirtualTexture(cacheUpload.texture, tableUpload.texture, width, height);
+		uploading = false;
+	}
+
+	glfwGetFramebufferSize(ctx->getWindow(), &windowWidth, &windowHeight);
+	if (windowWidth <= 0 || windowHeight <= 0)
+		return;
+
+	if (scale <= 0.0) {
+		scale = std::max(double(width) / windowWidth, double(height) / windowHeight);
+		centerX = width * 0.5;
+		centerY = height * 0.5;
+	}
+
+	// The level that has about a texel per pixel, finer when zoomed in further
+	uint32_t index = scale > 1.0 ? std::min(static_cast<uint32_t>(std::log2(scale)), static_cast<uint32_t>(levels.size() - 1)) : 0;
+	double left = (centerX - windowWidth * 0.5 * scale) / width, top = (centerY - windowHeight * 0.5 * scale) / height;
+	double viewWidth = windowWidth * scale / width, viewHeight = windowHeight * scale / height;
+	ctx->SetVirtualView(float(left), float(top), float(viewWidth), float(viewHeight), float(index));
+
+	// Every page the shader can land on this frame is worked out from the view, the quad covers the
+	// window and every pixel samples the same level. Closest to the center goes first.
+	const Level &level = levels[index];
+	double u0 = std::min(std::max(left - SOBEL_REACH_X, 0.0), 1.0), u1 = std::min(std::max(left + viewWidth + SOBEL_REACH_X, 0.0), 1.0);
+	double v0 = std::min(std::max(top - SOBEL_REACH_Y, 0.0), 1.0), v1 = std::min(std::max(top + viewHeight + SOBEL_REACH_Y, 0.0), 1.0);
+	uint32_t x0 = static_cast<uint32_t>(std::min(u0 * level.width, level.width - 0.5) / PAGE_TEXELS);
+	uint32_t x1 = static_cast<uint32_t>(std::min(u1 * level.width, level.width - 0.5) / PAGE_TEXELS);
+	uint32_t y0 = static_cast<uint32_t>(std::min(v0 * level.height, level.height - 0.5) / PAGE_TEXELS);
+	uint32_t y1 = static_cast<uint32_t>(std::min(v1 * level.height, level.height - 0.5) / PAGE_TEXELS);
+
+	double pageX = (left + viewWidth * 0.5) * level.width / PAGE_TEXELS - 0.5;
+	double pageY = (top + viewHeight * 0.5) * level.height / PAGE_TEXELS - 0.5;
+
+	needed.clear();
+	for (uint32_t y = y0; y <= y1; y++) {
+		for (uint32_t x = x0; x <= x1; x++)
+			needed.push_back(getKey(index, x, y));
+	}
+
+	std::sort(needed.begin(), needed.end(), [pageX, pageY](uint64_t a, uint64_t b) {
+		double ax = double(a & 0xFFFFFF) - pageX, ay = double((a >> 24) & 0xFFFFFF) - pageY;
+		double bx = double(b & 0xFFFFFF) - pageX, by = double((b >> 24) & 0xFFFFFF) - pageY;
+		return ax * ax + ay * ay < bx * bx + by * by;
+	});
+
+	// More than the cache holds would only push out pages this frame needs, the rest stays coarse
+	if (needed.size() >= slots.size())
+		needed.resize(slots.size() - 1);
+
+	uint64_t frame = ctx->getFrameCount();
+	for (uint64_t key : needed)
+		Request(index, key & 0xFFFFFF, (key >> 24) & 0xFFFFFF, frame);
+
+	// Finished reads go into the cache, in the same order
+	uint32_t uploads = 0;
+	bool coarse = false;
+
+	for (uint64_t key : needed) {
+		auto it = pages.find(key);
+		if (it != pages.end() && it->second->state == PAGE_LOADED && uploads < MAX_UPLOADS && Upload(*it->second, frame))
+			uploads++;
+
+		coarse |= it == pages.end() || it->second->state != PAGE_RESIDENT;
+	}
+
+	// Reads the view moved away from aren't worth a slot, failed ones are tried again
+	for (auto it = pages.begin(); it != pages.end();) {
+		Page &page = *it->second;
+		int state = page.state;
+
+		if ((state == PAGE_LOADED && page.lastNeeded < frame) || state == PAGE_FAILED) {
+			bufferPool.Free(page.data);
+			loading--;
+			it = pages.erase(it);
+		} else {
+			++it;
+		}
+	}
+
+	// New pages only show up in the table, on demand nothing else wakes the window
+	if (uploads)
+		ctx->RequestRedraw();
+	FlushTable();
+
+	frames++;
+	coarseFrames += coarse;
+}
+
+void VirtualTexture::Request(uint32_t index, uint32_t x, uint32_t y, uint64_t frame)
+{
+	uint64_t key = getKey(index, x, y);
+	auto it = pages.find(key);
+
+	if (it != pages.end()) {
+		it->second->lastNeeded = std::max(it->second->lastNeeded, frame);
+		return;
+	}
+
+	if (loading >= MAX_LOADS)
+		return;
+
+	std::shared_ptr<Page> page = std::make_shared<Page>();
+	page->level = index;
+	page->x = x;
+	page->y = y;
+	page->lastNeeded = frame;
+	pages[key] = page;
+	loading++;
+
+	const Level &level = levels[index];
+	const uint8_t *src = pageFile.getData() + PAGE_DATA_OFFSET + (level.firstPage + uint64_t(y) * level.pagesX + x) * PAGE_BYTES;
+
+	jobs->Submit([page, src]() {
+		// Touching the mapping is what reads the page off the disk, better here than on the render thread
+		page->data = static_cast<uint8_t *>(bufferPool.Alloc(PAGE_BYTES));
+		if (page->data)
+			memcpy(page->data, src, PAGE_BYTES);
+		page->state = page->data ? PAGE_LOADED : PAGE_FAILED;
+	});
+
+	readCount++;
+	readBytes += PAGE_BYTES;
+}
+
+bool VirtualTexture::Upload(Page &page, uint64_t frame)
+{
+	// A free slot, or the one whose page went unneeded the longest
+	uint32_t slot = static_cast<uint32_t>(slots.size());
+	uint64_t oldest = frame;
+
+	for (uint32_t i = 0; i < slots.size(); i++) {
+		if (slots[i] == NO_PAGE) {
+			slot = i;
+			break;
+		}
+
+		uint64_t lastNeeded = pages[slots[i]]->lastNeeded;
+		if (lastNeeded < oldest) {
+			oldest = lastNeeded;
+			slot = i;
+		}
+	}
+
+	if (slot == slots.size())
+		return false;
+
+	// The old page's screen falls back to its parent. Both changes land in the same frame
+	// as the new texels, so no frame ever samples a slot through a stale entry.
+	if (slots[slot] != NO_PAGE) {
+		auto it = pages.find(slots[slot]);
+		const Page &old = *it->second;
+		const Level &parent = levels[old.level + 1];
+		uint32_t parentX = std::min(old.x / 2, parent.pagesX - 1), parentY = std::min(old.y / 2, parent.pagesY - 1);
+
+		SetEntry(old.level, old.x, old.y, parent.table[size_t(parentY) * parent.pagesX + parentX]);
+		pages.erase(it);
+		slots[slot] = NO_PAGE;
+		evictCount++;
+	}
+
+	uint32_t x = slot % VIRTUAL_CACHE_PAGES * VIRTUAL_PAGE_SIZE, y = slot / VIRTUAL_CACHE_PAGES * VIRTUAL_PAGE_SIZE;
+	if (!ctx->CopyToTexture(cacheUpload.texture, 0, x, y, VIRTUAL_PAGE_SIZE, VIRTUAL_PAGE_SIZE, page.data))
+		return false;
+
+	bufferPool.Free(page.data);
+	page.data = nullptr;
+	page.slot = slot;
+	page.state = PAGE_RESIDENT;
+	slots[slot] = getKey(page.level, page.x, page.y);
+	loading--;
+
+	SetEntry(page.level, page.x, page.y, makeEntry(slot, page.level));
+	return true;
+}
+
+static inline void markDirty(uint32_t *dirty, uint32_t x0, uint32_t y0, uint32_t x1, uint32_t y1)
+{
+	if (dirty[0] >= dirty[2] || dirty[1] >= dirty[3]) {
+		dirty[0] = x0, dirty[1] = y0, dirty[2] = x1, dirty[3] = y1;
+	} else {
+		dirty[0] = std::min(dirty[0], x0), dirty[1] = std::min(dirty[1], y0);
+		dirty[2] = std::max(dirty[2], x1), dirty[3] = std::max(dirty[3], y1);
+	}
+}
+
+void VirtualTexture::SetEntry(uint32_t index, uint32_t x, uint32_t y, uint32_t entry)
+{
+	Level &level = levels[index];
+	level.table[size_t(y) * level.pagesX + x] = entry;
+	markDirty(level.dirty, x, y, x + 1, y + 1);
+
+	// Pages further down that aren't in themselves show whatever their parent shows. The last
+	// row and column of a level can have one more child each when its size was odd.
+	uint32_t x0 = x, y0 = y, x1 = x + 1, y1 = y + 1;
+
+	for (uint32_t k = index; k-- > 0;) {
+		Level &child = levels[k], &parent = levels[k + 1];
+		x1 = x1 == parent.pagesX ? child.pagesX : std::min(x1 * 2, child.pagesX);
+		y1 = y1 == parent.pagesY ? child.pagesY : std::min(y1 * 2, child.pagesY);
+		x0 *= 2;
+		y0 *= 2;
+		if (x0 >= x1 || y0 >= y1)
+			break;
+
+		for (uint32_t j = y0; j < y1; j++) {
+			const uint32_t *above = &parent.table[size_t(std::min(j / 2, parent.pagesY - 1)) * parent.pagesX];
+			uint32_t *row = &child.table[size_t(j) * child.pagesX];
+
+			for (uint32_t i = x0; i < x1; i++) {
+				if (getEntryLevel(row[i]) != k)
+					row[i] = above[std::min(i / 2, parent.pagesX - 1)];
+			}
+		}
+
+		markDirty(child.dirty, x0, y0, x1, y1);
+	}
+}
+
+void VirtualTexture::FlushTable()
+{
+	// One copy per level, the box around everything that changed
+	std::vector<uint32_t> rect;
+
+	for (uint32_t index = 0; index < levels.size(); index++) {
+		Level &level = levels[index];
+		uint32_t x0 = level.dirty[0], y0 = level.dirty[1], x1 = level.dirty[2], y1 = level.dirty[3];
+		if (x0 >= x1 || y0 >= y1)
+			continue;
+
+		rect.clear();
+		for (uint32_t y = y0; y < y1; y++)
+			rect.insert(rect.end(), level.table.begin() + size_t(y) * level.pagesX + x0, level.table.begin() + size_t(y) * level.pagesX + x1);
+
+		ctx->CopyToTexture(tableUpload.texture, index, x0, y0, x1 - x0, y1 - y0, rect.data());
+		std::fill(level.dirty, level.dirty + 4, 0);
+	}
+}
+
+void VirtualTexture::PrintStats()
+{
+	if (!frames)
+		return;
+
+	std::cout << "Virtual texture: " << width << "x" << height << " in " << levels.size() << " levels, "
+		<< readCount << " pages read (" << (readBytes >> 20) << " MB), " << evictCount << " evicted, "
+		<< coarseFrames << " of " << frames << " frames showed coarser pages" << std::endl;
+}
@@ -0,0 +1,100 @@
+#pragma once
+
+#include "fileutil.h"
+#include "jobs.h"
+#include "vulkanctx.h"
+#include <atomic>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#ifndef VIRTUAL_CACHE_PAGES
+#define VIRTUAL_CACHE_PAGES 16 // pages across the page cache texture, 64 MB of RGBA8
+#endif
+
+// Shows images too big for any texture, like gigapixel scans. The first time an image is
+// opened it's cut into a mip pyramid of fixed size pages in one file in the cache directory.
+// Only the pages the view needs get read, on the job system, and copied into one cache
+// texture where the least recently needed ones make room. The page table tells the shader
+// where each page sits, pages that aren't in yet show the closest coarser one meanwhile.
+class VirtualTexture {
+public:
+	VirtualTexture() {}
+	virtual ~VirtualTexture() {}
+
+	bool Open(const char *path, const char *dir, JobSystem *jobs); // cuts the pages into dir unless they're there already - false if the image can't be read or cut
+	bool Setup(VulkanCTX *ctx, JobSystem *jobs); // false if the device can't take the textures
+	void Release();
+
+	void Update(); // call once per frame after VulkanCTX::Update() or WaitFrame(), asks for a redraw when the view or the pages in it change
+	void Zoom(double factor, double x, double y); // > 1 zooms in, the point at window pixel x, y stays put
+	void Pan(double dx, double dy); // by window pixels
+	void Fit(); // the whole image in the window
+
+	void PrintStats();
+
+	inline uint32_t getWidth() { return width; }
+	inline uint32_t getHeight() { return height; }
+	inline bool isBusy() { return uploading || loading > 0; } // pages are still on their way in
+
+protected:
+	enum PageState {
+		PAGE_LOADING, // being read on a worker
+		PAGE_LOADED, // in data, waiting for a cache slot
+		PAGE_RESIDENT,
+		PAGE_FAILED
+	};
+
+	struct Page {
+		std::atomic<int> state{PAGE_LOADING};
+		uint8_t *data = nullptr; // bufferPool block, VIRTUAL_PAGE_SIZE squared RGBA8
+		uint32_t level = 0, x = 0, y = 0;
+		uint32_t slot = 0; // in the cache, once resident
+		uint64_t lastNeeded = 0; // frameCount of the last frame that wanted it
+	};
+
+	struct Level {
+		uint32_t width = 0, height = 0; // in texels
+		uint32_t pagesX = 0, pagesY = 0;
+		uint64_t firstPage = 0; // in the page file
+		std::vector<uint32_t> table; // page table entries, RGBA8 like the texture
+		uint32_t dirty[4] = {}; // x0, y0, x1, y1 of the entries the texture hasn't seen yet
+	};
+
+	static inline uint64_t getKey(uint32_t level, uint32_t x, uint32_t y) { return uint64_t(level) << 48 | uint64_t(y) << 24 | x; }
+
+	void Layout(uint32_t width, uint32_t height);
+	bool Build(const char *pagePath, const uint8_t *texels, size_t stride);
+	void Request(uint32_t level, uint32_t x, uint32_t y, uint64_t frame);
+	bool Upload(Page &page, uint64_t frame); // false when every slot holds a page this frame needs
+	void SetEntry(uint32_t level, uint32_t x, uint32_t y, uint32_t entry); // and every page below that isn't in itself
+	void FlushTable();
+
+	VulkanCTX *ctx = nullptr;
+	JobSystem *jobs = nullptr;
+
+	std::string path;
+	MappedFile pageFile;
+	uint32_t width = 0, height = 0;
+	std::vector<Level> levels; // level 0 first, the last one fits in a single page
+
+	VulkanUpload cacheUpload, tableUpload; // the textures once the uploads landed
+	bool uploading = false;
+	uint32_t tableWidth = 0, tableHeight = 0; // every level's pages fit in the matching mip
+
+	std::unordered_map<uint64_t, std::shared_ptr<Page>> pages; // loading, loaded and resident
+	std::vector<uint64_t> slots; // key of the page in each cache slot, ~0 when free
+	std::vector<uint64_t> needed; // this frame's pages, most important first
+	uint32_t loading = 0;
+
+	// View, in level 0 texels
+	double centerX = 0.0, centerY = 0.0;
+	double scale = 0.0; // texels per window pixel, 0 until the first Fit()
+	int windowWidth = 0, windowHeight = 0;
+
+	uint64_t readCount = 0, readBytes = 0;
+	uint64_t evictCount = 0;
+	uint64_t coarseFrames = 0; // frames that showed a coarser page somewhere
+	uint64_t frames = 0;
+};
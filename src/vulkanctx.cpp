@@ -4,8 +4,15 @@
 
 #include "vert.h"
 #include "frag.h"
+#include "viewfrag.h"
+#include "galleryvert.h"
+#include "galleryfrag.h"
+#include "virtualfrag.h"
+#include "upscalefrag.h"
 #include <cstring>
 #include <algorithm>
+#include <chrono>
+#include <cmath>
 
 #ifndef _DEBUG
 //#define _DEBUG
@@ -36,6 +43,21 @@ static uint32_t getQueueFamily(uint32_t starting_queue, int flags, std::vector<V
 	return VK_QUEUE_FAMILY_IGNORED;
 }
 
+static bool hasDeviceExtension(VkPhysicalDevice physicalDevice, const char *name)
+{
+	uint32_t count = 0;
+	vkEnumerateDeviceExtensionProperties(physicalDevice, nullptr, &count, nullptr);
+	std::vector<VkExtensionProperties> extensions(count);
+	vkEnumerateDeviceExtensionProperties(physicalDevice, nullptr, &count, extensions.data());
+
+	for (auto &extension : extensions) {
+		if (!strcmp(extension.extensionName, name))
+			return true;
+	}
+
+	return false;
+}
+
 VkShaderModule createShaderModule(VkDevice device, const uint32_t *spvCode, size_t spvSize)
 {
 	VkShaderModuleCreateInfo createInfo = {};
@@ -108,7 +130,8 @@ void copyBufferCmd(VkDeviceSize dataSize, VkBuffer src, VkBuffer dst, VkCommandB
 	vkEndCommandBuffer(commandBuffer);
 }
 
-void createImage(VkDevice device, VkPhysicalDevice physicalDevice, uint32_t width, uint32_t height, VkFormat format, VkImageTiling tiling, VkImageUsageFlags usageFlags, VkMemoryPropertyFlags memoryFlags, VkImage *image, VkDeviceMemory *imageMemory)
+// Just the image, memory is up to the caller
+VkImage createImageHandle(VkDevice device, uint32_t width, uint32_t height, VkFormat format, VkImageTiling tiling, VkImageUsageFlags usageFlags, uint32_t *queueFamilyIndices, uint32_t queueFamilyCount, uint32_t mipLevels, uint32_t arrayLayers)
 {
 	VkImageCreateInfo imageInfo = {};
 	imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
@@ -116,16 +139,32 @@ void createImage(VkDevice device, VkPhysicalDevice physicalDevice, uint32_t widt
 	imageInfo.extent.width = width;
 	imageInfo.extent.height = height;
 	imageInfo.extent.depth = 1;
-	imageInfo.mipLevels = 1;
-	imageInfo.arrayLayers = 1;
+	imageInfo.mipLevels = mipLevels;
+	imageInfo.arrayLayers = arrayLayers;
 	imageInfo.format = format;
 	imageInfo.tiling = tiling;
 	imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
 	imageInfo.usage = usageFlags;
 	imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
-	imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
 
-	VK_ASSERT(vkCreateImage(device, &imageInfo, nullptr, image), "Failed to create Texture2D!")
+	// Images written on the transfer queue and sampled on the graphics queue skip the ownership transfer
+	if (queueFamilyCount > 1 && queueFamilyIndices[0] != queueFamilyIndices[1]) {
+		imageInfo.sharingMode = VK_SHARING_MODE_CONCURRENT;
+		imageInfo.queueFamilyIndexCount = queueFamilyCount;
+		imageInfo.pQueueFamilyIndices = queueFamilyIndices;
+	} else {
+		imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+	}
+
+	VkImage image;
+	VK_ASSERT(vkCreateImage(device, &imageInfo, nullptr, &image), "Failed to create Texture2D!")
+
+	return image;
+}
+
+void createImage(VkDevice device, VkPhysicalDevice physicalDevice, uint32_t width, uint32_t height, VkFormat format, VkImageTiling tiling, VkImageUsageFlags usageFlags, VkMemoryPropertyFlags memoryFlags, VkImage *image, VkDeviceMemory *imageMemory, uint32_t *queueFamilyIndices = nullptr, uint32_t queueFamilyCount = 0, uint32_t mipLevels = 1, uint32_t arrayLayers = 1)
+{
+	*image = createImageHandle(device, width, height, format, tiling, usageFlags, queueFamilyIndices, queueFamilyCount, mipLevels, arrayLayers);
 
 	VkMemoryRequirements memoryRequirements;
 	vkGetImageMemoryRequirements(device, *image, &memoryRequirements);
@@ -140,6 +179,27 @@ void createImage(VkDevice device, VkPhysicalDevice physicalDevice, uint32_t widt
 	vkBindImageMemory(device, *image, *imageMemory, 0);
 }
 
+VkImageView createImageView(VkDevice device, VkImage image, VkFormat format, const void *next = nullptr, VkComponentMapping components = {})
+{
+	VkImageViewCreateInfo viewInfo = {};
+	viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+	viewInfo.pNext = next;
+	viewInfo.image = image;
+	viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+	viewInfo.format = format;
+	viewInfo.components = components;
+	viewInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	viewInfo.subresourceRange.baseMipLevel = 0;
+	viewInfo.subresourceRange.levelCount = VK_REMAINING_MIP_LEVELS;
+	viewInfo.subresourceRange.baseArrayLayer = 0;
+	viewInfo.subresourceRange.layerCount = 1;
+
+	VkImageView view;
+	VK_ASSERT(vkCreateImageView(device, &viewInfo, nullptr, &view), "Failed to create Texture2D view!");
+
+	return view;
+}
+
 void transitionImageLayoutCmd(VkImage image, VkFormat format, VkImageLayout oldLayout, VkImageLayout newLayout, VkCommandBuffer commandBuffer)
 {
 	VkImageMemoryBarrier imageBarrier = {};
@@ -151,9 +211,9 @@ void transitionImageLayoutCmd(VkImage image, VkFormat format, VkImageLayout oldL
 	imageBarrier.image = image;
 	imageBarrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
 	imageBarrier.subresourceRange.baseMipLevel = 0;
-	imageBarrier.subresourceRange.levelCount = 1;
+	imageBarrier.subresourceRange.levelCount = VK_REMAINING_MIP_LEVELS;
 	imageBarrier.subresourceRange.baseArrayLayer = 0;
-	imageBarrier.subresourceRange.layerCount = 1;
+	imageBarrier.subresourceRange.layerCount = VK_REMAINING_ARRAY_LAYERS;
 
 	VkPipelineStageFlags srcStage;
 	VkPipelineStageFlags dstStage;
@@ -170,6 +230,36 @@ void transitionImageLayoutCmd(VkImage image, VkFormat format, VkImageLayout oldL
 		
 		srcStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
 		dstStage = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+	} else if (oldLayout == VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL && newLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL) { // Rewrite part of a texture earlier frames sampled
+		imageBarrier.srcAccessMask = VK_ACCESS_SHADER_READ_BIT;
+		imageBarrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+
+		srcStage = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+		dstStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
+	} else if (oldLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL && newLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL) { // Copy over texels an earlier copy just wrote
+		imageBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		imageBarrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+
+		srcStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
+		dstStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
+	} else if (oldLayout == VK_IMAGE_LAYOUT_UNDEFINED && newLayout == VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL) { // Nothing written yet, parts get drawn or copied in before anything samples them
+		imageBarrier.srcAccessMask = 0;
+		imageBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+
+		srcStage = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+		dstStage = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+	} else if (oldLayout == VK_IMAGE_LAYOUT_PRESENT_SRC_KHR && newLayout == VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL) { // Read back a rendered swapchain image
+		imageBarrier.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+		imageBarrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+
+		srcStage = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+		dstStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
+	} else if (oldLayout == VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL && newLayout == VK_IMAGE_LAYOUT_PRESENT_SRC_KHR) { // ...and hand it back to the presentation engine
+		imageBarrier.srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+		imageBarrier.dstAccessMask = 0;
+
+		srcStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
+		dstStage = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
 	} else {
 		VK_FATAL(1, "Unsupported layout transition!")
 	}
@@ -190,18 +280,59 @@ void copyBufferToImageCmd(uint32_t width, uint32_t height, VkBuffer buffer, VkIm
 	vkCmdCopyBufferToImage(commandBuffer, buffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &regionCopy);
 }
 
-bool VulkanCTX::Setup(int width, int height)
+// Every level and layer of a texture file in one go
+void copyBufferToImageCmd(const std::vector<VkBufferImageCopy> &regions, VkBuffer buffer, VkImage image, VkCommandBuffer commandBuffer)
+{
+	vkCmdCopyBufferToImage(commandBuffer, buffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, static_cast<uint32_t>(regions.size()), regions.data());
+}
+
+// Same as copyBufferToImageCmd(), one region per plane for multi-planar formats
+void copyBufferToPlanesCmd(uint32_t width, uint32_t height, VkFormat format, VkBuffer buffer, VkImage image, VkCommandBuffer commandBuffer)
+{
+	uint32_t planeCount = format == VK_FORMAT_G8_B8_R8_3PLANE_420_UNORM ? 3 : format == VK_FORMAT_G8_B8R8_2PLANE_420_UNORM ? 2 : 1;
+	if (planeCount == 1) {
+		copyBufferToImageCmd(width, height, buffer, image, commandBuffer);
+		return;
+	}
+
+	VkImageAspectFlagBits aspects[3] = { VK_IMAGE_ASPECT_PLANE_0_BIT, VK_IMAGE_ASPECT_PLANE_1_BIT, VK_IMAGE_ASPECT_PLANE_2_BIT };
+	VkBufferImageCopy regionCopies[3] = {{}, {}, {}};
+	uint32_t chromaWidth = (width + 1) / 2;
+	uint32_t chromaHeight = (height + 1) / 2;
+	VkDeviceSize offset = 0;
+
+	for (uint32_t i = 0; i < planeCount; i++) {
+		regionCopies[i].bufferOffset = offset;
+		regionCopies[i].imageSubresource.aspectMask = aspects[i];
+		regionCopies[i].imageSubresource.layerCount = 1;
+		regionCopies[i].imageExtent.width = i ? chromaWidth : width;
+		regionCopies[i].imageExtent.height = i ? chromaHeight : height;
+		regionCopies[i].imageExtent.depth = 1;
+
+		// The interleaved UV plane of NV12 has two bytes per texel
+		offset += VkDeviceSize(regionCopies[i].imageExtent.width) * regionCopies[i].imageExtent.height * (planeCount == 2 && i ? 2 : 1);
+	}
+
+	vkCmdCopyBufferToImage(commandBuffer, buffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, planeCount, regionCopies);
+}
+
+bool VulkanCTX::Setup(int width, int height, bool headless)
 {
 	ResetCache();
+	this->headless = headless;
 
 	// Create Instance
-	glfwInit();
+	if (!headless)
+		glfwInit();
 	if (volkInitialize() != VK_SUCCESS) 
 		return false;
 
-	uint32_t extensionCount = 0;
-	const char **extensions = glfwGetRequiredInstanceExtensions(&extensionCount);
-	std::vector<const char *> requiredExtensions(extensions, extensions + extensionCount); 
+	std::vector<const char *> requiredExtensions;
+	if (!headless) {
+		uint32_t extensionCount = 0;
+		const char **extensions = glfwGetRequiredInstanceExtensions(&extensionCount);
+		requiredExtensions.assign(extensions, extensions + extensionCount);
+	}
 
 	VkApplicationInfo appInfo = {};
 	appInfo.sType = VK_STRUCTURE_TYPE_APPLICATION_INFO;
@@ -296,16 +427,75 @@ bool VulkanCTX::Setup(int width, int height)
 	queueCreateInfos[1].queueCount = 1;
 	queueCreateInfos[1].pQueuePriorities = &queuePriorities;
 	
-	std::vector<const char *> deviceExtensions = {
-		VK_KHR_SWAPCHAIN_EXTENSION_NAME
-	};
+	std::vector<const char *> deviceExtensions;
+	if (!headless)
+		deviceExtensions.push_back(VK_KHR_SWAPCHAIN_EXTENSION_NAME);
+
+	// Tells how much of the heap we can have before the driver starts paging textures out
+	memoryBudgetSupported = hasDeviceExtension(physicalDev, VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+	if (memoryBudgetSupported)
+		deviceExtensions.push_back(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+
+	VkPhysicalDeviceMemoryProperties memoryProps;
+	vkGetPhysicalDeviceMemoryProperties(physicalDev, &memoryProps);
+	// The biggest device local heap, heap 0 can be system memory bigger than any of them
+	bool localFound = false;
+	for (uint32_t i = 0; i < memoryProps.memoryHeapCount; i++) {
+		if (!(memoryProps.memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT))
+			continue;
+		if (!localFound || memoryProps.memoryHeaps[i].size > memoryProps.memoryHeaps[localHeap].size)
+			localHeap = i;
+		localFound = true;
+	}
+
+	VkPhysicalDeviceFeatures physDevFeatures = {};
+	vkGetPhysicalDeviceFeatures(physicalDev, &physDevFeatures);
 
 	VkPhysicalDeviceFeatures physDevEnabledFeatures = {};
 	physDevEnabledFeatures.samplerAnisotropy = VK_TRUE;
+	physDevEnabledFeatures.textureCompressionBC = physDevFeatures.textureCompressionBC; // desktop GPUs all have it
+
+	// YUV video is sampled through a Y'CbCr conversion, core since 1.1 but still optional
+	VkPhysicalDeviceSamplerYcbcrConversionFeatures ycbcrFeatures = {};
+	ycbcrFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SAMPLER_YCBCR_CONVERSION_FEATURES;
+
+	// The view picks its textures out of one bindless array, batch and stream runs never draw one
+	VkPhysicalDeviceDescriptorIndexingFeaturesEXT indexingFeatures = {};
+	indexingFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES_EXT;
+	ycbcrFeatures.pNext = &indexingFeatures;
+
+	VkPhysicalDeviceFeatures2 physDevFeatures2 = {};
+	physDevFeatures2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+	physDevFeatures2.pNext = &ycbcrFeatures;
+	vkGetPhysicalDeviceFeatures2(physicalDev, &physDevFeatures2);
+	ycbcrSupported = ycbcrFeatures.samplerYcbcrConversion == VK_TRUE;
+
+	VkPhysicalDeviceDescriptorIndexingFeaturesEXT indexingEnabled = {};
+	indexingEnabled.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES_EXT;
+
+	bindless = !headless && hasDeviceExtension(physicalDev, VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME) && indexingFeatures.runtimeDescriptorArray &&
+		indexingFeatures.descriptorBindingPartiallyBound && indexingFeatures.descriptorBindingSampledImageUpdateAfterBind &&
+		indexingFeatures.descriptorBindingUpdateUnusedWhilePending && indexingFeatures.shaderSampledImageArrayNonUniformIndexing;
+
+	// Without it the window still shows the image, just not through the view's shaders
+	if (!headless && !bindless)
+		std::cout << "Device can't do bindless textures, no zoom, compare, gallery or dynamic resolution :(" << std::endl;
+
+	if (bindless) {
+		deviceExtensions.push_back(VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME);
+		indexingEnabled.runtimeDescriptorArray = VK_TRUE;
+		indexingEnabled.descriptorBindingPartiallyBound = VK_TRUE;
+		indexingEnabled.descriptorBindingSampledImageUpdateAfterBind = VK_TRUE;
+		indexingEnabled.descriptorBindingUpdateUnusedWhilePending = VK_TRUE;
+		indexingEnabled.shaderSampledImageArrayNonUniformIndexing = VK_TRUE;
+	}
+
+	// Only ask for what we use, the query filled in everything the device has
+	ycbcrFeatures.pNext = bindless ? &indexingEnabled : nullptr;
 
 	VkDeviceCreateInfo devCreateInfo = {};
 	devCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
-	devCreateInfo.pNext = nullptr;
+	devCreateInfo.pNext = ycbcrSupported ? static_cast<void *>(&ycbcrFeatures) : bindless ? &indexingEnabled : nullptr;
 	devCreateInfo.flags = 0;
 	devCreateInfo.queueCreateInfoCount = 2;
 	devCreateInfo.pQueueCreateInfos = queueCreateInfos;
@@ -322,6 +512,11 @@ bool VulkanCTX::Setup(int width, int height)
 	}
 	graphicsQueueFamily = queueCreateInfos[0].queueFamilyIndex;
 
+	// Dynamic resolution needs to know how long the view took on the GPU
+	VkPhysicalDeviceProperties physDevProps;
+	vkGetPhysicalDeviceProperties(physicalDev, &physDevProps);
+	timestampPeriod = queueFamilyProps[graphicsQueueFamily].timestampValidBits ? physDevProps.limits.timestampPeriod : 0.0f;
+
 	for (uint32_t i = 0; i < queueCreateInfos[1].queueCount; i++) {
 		VkQueue transferQueue = VK_NULL_HANDLE;
 		vkGetDeviceQueue(device, queueCreateInfos[1].queueFamilyIndex, i, &transferQueue);
@@ -345,67 +540,50 @@ bool VulkanCTX::Setup(int width, int height)
 
 	// Now, lets setup the swapchain!
 
-	glfwWindowHint(GLFW_RESIZABLE, GLFW_TRUE);
-	glfwWindowHint(GLFW_VISIBLE, GLFW_TRUE);
-	glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
+	if (!headless) {
+		glfwWindowHint(GLFW_RESIZABLE, GLFW_TRUE);
+		glfwWindowHint(GLFW_VISIBLE, GLFW_TRUE);
+		glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
 
-	window = glfwCreateWindow(width, height, "vkwaifu: waifuing edition!", nullptr, nullptr);
-	VK_ASSERT(glfwCreateWindowSurface(instance, window, nullptr, &surface), "Failed to create window surface");
+		window = glfwCreateWindow(width, height, "vkwaifu: waifuing edition!", nullptr, nullptr);
+		VK_ASSERT(glfwCreateWindowSurface(instance, window, nullptr, &surface), "Failed to create window surface");
 
-	VkBool32 supported;
-	VK_ASSERT(vkGetPhysicalDeviceSurfaceSupportKHR(physicalDev, queueCreateInfos[0].queueFamilyIndex, surface, &supported), "surface got lost on its way to vkwaifu")
-	VK_FATAL(supported != VK_TRUE, "Device does not support presentation")
+		VkBool32 supported;
+		VK_ASSERT(vkGetPhysicalDeviceSurfaceSupportKHR(physicalDev, queueCreateInfos[0].queueFamilyIndex, surface, &supported), "surface got lost on its way to vkwaifu")
+		VK_FATAL(supported != VK_TRUE, "Device does not support presentation")
+	}
 
 	// Create Uniform Buffer Object
 	VkDeviceSize uboSize = sizeof(VulkanUBO);
 	createBuffer(device, physicalDev, uboSize, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &uniformBuffer, &uniformBufferMemory, nullptr, 0);
 
 	// Create Descriptor Set Layout first
-	VkDescriptorSetLayoutBinding layoutBindings[2] = {{}, {}};
-
-	layoutBindings[0].binding = 0;
-	layoutBindings[0].descriptorCount = 1;
-	layoutBindings[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-	layoutBindings[0].stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
-
-	layoutBindings[1].binding = 1;
-	layoutBindings[1].descriptorCount = 1;
-	layoutBindings[1].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-	layoutBindings[1].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+	VkDescriptorSetLayoutBinding layoutBinding = {};
+	layoutBinding.binding = 0;
+	layoutBinding.descriptorCount = 1;
+	layoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+	layoutBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
 
 	VkDescriptorSetLayoutCreateInfo layoutInfo = {};
 	layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
-	layoutInfo.bindingCount = 2;
-	layoutInfo.pBindings = layoutBindings;
+	layoutInfo.bindingCount = 1;
+	layoutInfo.pBindings = &layoutBinding;
 
 	VK_ASSERT(vkCreateDescriptorSetLayout(device, &layoutInfo, nullptr, &descriptorLayout), "Failed to create Descriptor Layout!")
 
-	// Create Pipeline Layout
-	VkPipelineLayoutCreateInfo pipelineLayoutInfo = {};
-	pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-	pipelineLayoutInfo.setLayoutCount = 1;
-	pipelineLayoutInfo.pSetLayouts = &descriptorLayout;
-
-	VK_ASSERT(vkCreatePipelineLayout(device, &pipelineLayoutInfo, nullptr, &pipelineLayout), "Failed to create Pipeline Layout")
-
-	// Setup descriptor pool and descriptor set
-	VkDescriptorPoolSize poolSizes[2]; // 1 descriptor per binding. 0 = ubo, 1 = sampler
-
-	poolSizes[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-	poolSizes[0].descriptorCount = 1;
-
-	poolSizes[1].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-	poolSizes[1].descriptorCount = 1;
+	// Setup descriptor pool and the uniform buffer's set, it never changes
+	VkDescriptorPoolSize poolSize = {};
+	poolSize.type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+	poolSize.descriptorCount = 1;
 
 	VkDescriptorPoolCreateInfo poolInfo = {};
 	poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
-	poolInfo.poolSizeCount = 2;
-	poolInfo.pPoolSizes = poolSizes;
-	poolInfo.maxSets = 1; // 1 set only
+	poolInfo.poolSizeCount = 1;
+	poolInfo.pPoolSizes = &poolSize;
+	poolInfo.maxSets = 1;
 
 	VK_ASSERT(vkCreateDescriptorPool(device, &poolInfo, nullptr, &descriptorPool), "Failed to create Descriptor Pool!")
 
-	// create descriptor sets
 	VkDescriptorSetAllocateInfo setAllocInfo = {};
 	setAllocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
 	setAllocInfo.descriptorPool = descriptorPool;
@@ -414,6 +592,168 @@ bool VulkanCTX::Setup(int width, int height)
 
 	VK_ASSERT(vkAllocateDescriptorSets(device, &setAllocInfo, &descriptorSet), "Failed to allocate Descriptor Set!")
 
+	VkDescriptorBufferInfo bufferInfo = {};
+	bufferInfo.buffer = uniformBuffer;
+	bufferInfo.offset = 0;
+	bufferInfo.range = sizeof(VulkanUBO);
+
+	VkWriteDescriptorSet descriptorWrite = {};
+	descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+	descriptorWrite.dstSet = descriptorSet;
+	descriptorWrite.dstBinding = 0;
+	descriptorWrite.descriptorCount = 1;
+	descriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+	descriptorWrite.pBufferInfo = &bufferInfo;
+
+	vkUpdateDescriptorSets(device, 1, &descriptorWrite, 0, nullptr);
+
+	// The bindless texture array, as big as the device lets a stage sample after bind
+	if (bindless) {
+		VkPhysicalDeviceDescriptorIndexingPropertiesEXT indexingProps = {};
+		indexingProps.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_PROPERTIES_EXT;
+
+		VkPhysicalDeviceProperties2 physDevProps2 = {};
+		physDevProps2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+		physDevProps2.pNext = &indexingProps;
+		vkGetPhysicalDeviceProperties2(physicalDev, &physDevProps2);
+
+		textureCapacity = std::min({uint32_t(MAX_TEXTURES), indexingProps.maxPerStageDescriptorUpdateAfterBindSamplers, indexingProps.maxPerStageDescriptorUpdateAfterBindSampledImages,
+			indexingProps.maxDescriptorSetUpdateAfterBindSamplers, indexingProps.maxDescriptorSetUpdateAfterBindSampledImages, indexingProps.maxPerStageUpdateAfterBindResources - 1});
+
+		VkDescriptorSetLayoutBinding textureBinding = {};
+		textureBinding.binding = 0;
+		textureBinding.descriptorCount = textureCapacity;
+		textureBinding.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+		textureBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+
+		VkDescriptorBindingFlagsEXT bindingFlags = VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT_EXT | VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT_EXT | VK_DESCRIPTOR_BINDING_UPDATE_UNUSED_WHILE_PENDING_BIT_EXT;
+
+		VkDescriptorSetLayoutBindingFlagsCreateInfoEXT bindingFlagsInfo = {};
+		bindingFlagsInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO_EXT;
+		bindingFlagsInfo.bindingCount = 1;
+		bindingFlagsInfo.pBindingFlags = &bindingFlags;
+
+		VkDescriptorSetLayoutCreateInfo textureLayoutInfo = {};
+		textureLayoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+		textureLayoutInfo.pNext = &bindingFlagsInfo;
+		textureLayoutInfo.flags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT_EXT;
+		textureLayoutInfo.bindingCount = 1;
+		textureLayoutInfo.pBindings = &textureBinding;
+
+		VK_ASSERT(vkCreateDescriptorSetLayout(device, &textureLayoutInfo, nullptr, &textureSetLayout), "Failed to create Texture Array Layout!")
+
+		VkDescriptorPoolSize texturePoolSize = {};
+		texturePoolSize.type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+		texturePoolSize.descriptorCount = textureCapacity;
+
+		VkDescriptorPoolCreateInfo texturePoolInfo = {};
+		texturePoolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+		texturePoolInfo.flags = VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT_EXT;
+		texturePoolInfo.poolSizeCount = 1;
+		texturePoolInfo.pPoolSizes = &texturePoolSize;
+		texturePoolInfo.maxSets = 1;
+
+		VK_ASSERT(vkCreateDescriptorPool(device, &texturePoolInfo, nullptr, &texturePool), "Failed to create Texture Array Pool!")
+
+		VkDescriptorSetAllocateInfo textureSetInfo = {};
+		textureSetInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+		textureSetInfo.descriptorPool = texturePool;
+		textureSetInfo.descriptorSetCount = 1;
+		textureSetInfo.pSetLayouts = &textureSetLayout;
+
+		VK_ASSERT(vkAllocateDescriptorSets(device, &textureSetInfo, &textureSet), "Failed to allocate Texture Array!")
+
+		// Low slots first
+		freeTextureIndices.resize(textureCapacity);
+		for (uint32_t i = 0; i < textureCapacity; i++)
+			freeTextureIndices[i] = textureCapacity - 1 - i;
+		residents.resize(textureCapacity);
+	}
+
+	// Create Pipeline Layout, the view's textures come by push constant
+	VkDescriptorSetLayout setLayouts[2] = { descriptorLayout, textureSetLayout };
+
+	VkPushConstantRange pushConstantRange = {};
+	pushConstantRange.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+	pushConstantRange.offset = 0;
+	pushConstantRange.size = sizeof(VulkanPushConstants);
+
+	VkPipelineLayoutCreateInfo pipelineLayoutInfo = {};
+	pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+	pipelineLayoutInfo.setLayoutCount = bindless ? 2 : 1;
+	pipelineLayoutInfo.pSetLayouts = setLayouts;
+	pipelineLayoutInfo.pushConstantRangeCount = bindless ? 1 : 0;
+	pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
+
+	VK_ASSERT(vkCreatePipelineLayout(device, &pipelineLayoutInfo, nullptr, &pipelineLayout), "Failed to create Pipeline Layout")
+
+	// Or the baseline's layout, the uniform and the displayed texture in one set
+	if (!headless && !bindless) {
+		VkDescriptorSetLayoutBinding singleBindings[2] = {{}, {}};
+		singleBindings[0].binding = 0;
+		singleBindings[0].descriptorCount = 1;
+		singleBindings[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+		singleBindings[0].stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+		singleBindings[1].binding = 1;
+		singleBindings[1].descriptorCount = 1;
+		singleBindings[1].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+		singleBindings[1].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+
+		VkDescriptorSetLayoutCreateInfo singleLayoutInfo = {};
+		singleLayoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+		singleLayoutInfo.bindingCount = 2;
+		singleLayoutInfo.pBindings = singleBindings;
+
+		VK_ASSERT(vkCreateDescriptorSetLayout(device, &singleLayoutInfo, nullptr, &singleLayout), "Failed to create Single Texture Layout!")
+
+		VkPipelineLayoutCreateInfo singlePipelineLayoutInfo = {};
+		singlePipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+		singlePipelineLayoutInfo.setLayoutCount = 1;
+		singlePipelineLayoutInfo.pSetLayouts = &singleLayout;
+
+		VK_ASSERT(vkCreatePipelineLayout(device, &singlePipelineLayoutInfo, nullptr, &singlePipelineLayout), "Failed to create Single Texture Pipeline Layout")
+	}
+
+	// Create Texture Sampler, shared by every texture we display
+
+	VkSamplerCreateInfo samplerInfo = {};
+	samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+	samplerInfo.magFilter = VK_FILTER_LINEAR;
+	samplerInfo.minFilter = VK_FILTER_LINEAR;
+	samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+	samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+	samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+	samplerInfo.anisotropyEnable = VK_TRUE;
+	samplerInfo.maxAnisotropy = 16.0f;
+	samplerInfo.borderColor = VK_BORDER_COLOR_INT_OPAQUE_BLACK;
+	samplerInfo.unnormalizedCoordinates = VK_FALSE;
+	samplerInfo.compareEnable = VK_FALSE;
+	samplerInfo.compareOp = VK_COMPARE_OP_ALWAYS;
+	samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
+	samplerInfo.maxLod = VK_LOD_CLAMP_NONE; // textures from KTX2 and DDS files bring their mips
+
+	VK_ASSERT(vkCreateSampler(device, &samplerInfo, nullptr, &textureSampler), "Failed to create Texture2D sampler!")
+
+	// Gray and gray+alpha images stay that small on the device if it can filter those formats,
+	// otherwise they get expanded to RGBA while filling the staging buffer
+	VkFormat channelFormats[4] = { VK_FORMAT_R8_SRGB, VK_FORMAT_R8G8_SRGB, VK_FORMAT_UNDEFINED, VK_FORMAT_R8G8B8A8_SRGB };
+	for (uint32_t i = 0; i < 4; i++) {
+		VkFormatProperties formatProps = {};
+		if (channelFormats[i] != VK_FORMAT_UNDEFINED)
+			vkGetPhysicalDeviceFormatProperties(physicalDev, channelFormats[i], &formatProps);
+
+		VkFormatFeatureFlags needed = VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT | VK_FORMAT_FEATURE_TRANSFER_DST_BIT;
+		textureFormats[i] = (formatProps.optimalTilingFeatures & needed) == needed ? channelFormats[i] : VK_FORMAT_R8G8B8A8_SRGB;
+	}
+
+	VkFormatProperties bcProps[2] = {};
+	vkGetPhysicalDeviceFormatProperties(physicalDev, VK_FORMAT_BC1_RGB_SRGB_BLOCK, &bcProps[0]);
+	vkGetPhysicalDeviceFormatProperties(physicalDev, VK_FORMAT_BC7_SRGB_BLOCK, &bcProps[1]);
+
+	VkFormatFeatureFlags bcNeeded = VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT | VK_FORMAT_FEATURE_TRANSFER_DST_BIT;
+	bc1Supported = physDevFeatures.textureCompressionBC && (bcProps[0].optimalTilingFeatures & bcNeeded) == bcNeeded;
+	bc7Supported = physDevFeatures.textureCompressionBC && (bcProps[1].optimalTilingFeatures & bcNeeded) == bcNeeded;
+
 	return true;
 }
 
@@ -484,7 +824,7 @@ bool VulkanCTX::Resize() // resizes swapchain
 	swapchainCreateInfo.imageColorSpace = surfaceFormat.colorSpace;
 	swapchainCreateInfo.imageExtent = extent;
 	swapchainCreateInfo.imageArrayLayers = 1;
-	swapchainCreateInfo.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+	swapchainCreateInfo.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT; // source for screenshots
 	swapchainCreateInfo.imageSharingMode = VK_SHARING_MODE_EXCLUSIVE;
 	swapchainCreateInfo.preTransform = VK_SURFACE_TRANSFORM_IDENTITY_BIT_KHR;
 	swapchainCreateInfo.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
@@ -508,6 +848,12 @@ bool VulkanCTX::Resize() // resizes swapchain
 
 		vkDestroyRenderPass(device, renderPass, nullptr);
 		vkDestroyPipeline(device, pipeline, nullptr);
+		vkDestroyPipeline(device, virtualPipeline, nullptr);
+		vkDestroyPipeline(device, upscalePipeline, nullptr);
+		vkDestroyPipeline(device, galleryPipeline, nullptr);
+		vkDestroyPipeline(device, singlePipeline, nullptr);
+		galleryPipeline = VK_NULL_HANDLE;
+		singlePipeline = VK_NULL_HANDLE;
 
 		// Don't free textures or uniforms
 
@@ -629,6 +975,7 @@ bool VulkanCTX::Resize() // resizes swapchain
 
 	SetupGraphics(extent.width, extent.height);
 	swapExtent = extent;
+	RequestRedraw();
 
 	return true;
 }
@@ -637,7 +984,8 @@ void VulkanCTX::Release() // destroys vulkanctx
 {
 	vkDeviceWaitIdle(device);
 
-	vkFreeCommandBuffers(device, graphicsPool, static_cast<uint32_t>(presentCommandBuffer.size()), presentCommandBuffer.data());
+	if (!presentCommandBuffer.empty())
+		vkFreeCommandBuffers(device, graphicsPool, static_cast<uint32_t>(presentCommandBuffer.size()), presentCommandBuffer.data());
 
 	for (uint32_t i = 0; i < swapchainImageViews.size(); i++) {
 		vkDestroyFramebuffer(device, framebuffers[i], nullptr);
@@ -649,18 +997,35 @@ void VulkanCTX::Release() // destroys vulkanctx
 
 	vkDestroyDescriptorSetLayout(device, descriptorLayout, nullptr);
 	vkDestroyDescriptorPool(device, descriptorPool, nullptr);
+	vkDestroyDescriptorSetLayout(device, textureSetLayout, nullptr);
+	vkDestroyDescriptorPool(device, texturePool, nullptr);
+	ReleaseSingleSets();
+	vkDestroyDescriptorSetLayout(device, singleLayout, nullptr);
 
 	vkDestroyBuffer(device, uniformBuffer, nullptr);
 	vkFreeMemory(device, uniformBufferMemory, nullptr);
 
+	ReleaseOffscreen();
+	ReleaseReadback();
+	ReleaseRegions();
+	ReleaseGallery();
+	ReleaseScaledTarget();
+	ReleaseFilterCache();
 	ReleaseTexture();
+	vkDestroySampler(device, textureSampler, nullptr);
 
 	vkDestroyPipeline(device, pipeline, nullptr);
+	vkDestroyPipeline(device, virtualPipeline, nullptr);
+	vkDestroyPipeline(device, upscalePipeline, nullptr);
+	vkDestroyPipeline(device, singlePipeline, nullptr);
 	vkDestroyPipelineLayout(device, pipelineLayout, nullptr);
+	vkDestroyPipelineLayout(device, singlePipelineLayout, nullptr);
 	vkDestroyRenderPass(device, renderPass, nullptr);
 
-	vkDestroySwapchainKHR(device, swapchain, nullptr);
-	vkDestroySurfaceKHR(instance, surface, nullptr);
+	if (!headless) {
+		vkDestroySwapchainKHR(device, swapchain, nullptr);
+		vkDestroySurfaceKHR(instance, surface, nullptr);
+	}
 
 	vkDestroyCommandPool(device, transferPool, nullptr);
 	vkDestroyCommandPool(device, graphicsPool, nullptr);
@@ -686,8 +1051,113 @@ void VulkanCTX::ResetCache() // clears internal cache
 	window = nullptr;
 	surface = VK_NULL_HANDLE;
 	swapchain = VK_NULL_HANDLE;
+	headless = false;
+
+	offscreenPass = VK_NULL_HANDLE;
+	offscreenPipeline = VK_NULL_HANDLE;
+	offscreenPipelineLayout = VK_NULL_HANDLE;
+	offscreenDescriptorLayout = VK_NULL_HANDLE;
+	offscreenDescriptorPool = VK_NULL_HANDLE;
+	offscreenSampler = VK_NULL_HANDLE;
+	offscreenConversion = VK_NULL_HANDLE;
+	offscreenInputFormat = VK_FORMAT_R8G8B8A8_SRGB;
+	offscreenOutputFormat = OFFSCREEN_FORMAT;
+	ycbcrSupported = false;
+
+	readbackMemoryFlags = 0;
+	readbackCoherent = true;
+	readbackNext = 0;
+	screenshotRequested = false;
+	screenshotReadback = -1;
+
+	textureImage = VK_NULL_HANDLE;
+	textureMemory = VK_NULL_HANDLE;
+	textureImageView = VK_NULL_HANDLE;
+	textureSampler = VK_NULL_HANDLE;
+	textureIndex = NO_TEXTURE_INDEX;
+	std::fill(textureFormats, textureFormats + 4, VK_FORMAT_R8G8B8A8_SRGB);
+	floatFormat = VK_FORMAT_R16G16B16A16_SFLOAT;
+	textureFormat = VK_FORMAT_UNDEFINED;
+	textureWidth = textureHeight = 0;
+	textureLevels = 1;
+	textureBytes = 0;
+	textureOwned = true;
+
+	compression = BC_NONE;
+	compressionJobs = nullptr;
+	bc1Supported = bc7Supported = false;
+	compressNs = compressPixels = 0;
+	compressedBytes = uncompressedBytes = 0;
+
+	galleryPipeline = VK_NULL_HANDLE;
+	galleryPipelineLayout = VK_NULL_HANDLE;
+	galleryDescriptorLayout = VK_NULL_HANDLE;
+	galleryDescriptorPool = VK_NULL_HANDLE;
+	galleryMaxTiles = 0;
+
+	virtualPipeline = VK_NULL_HANDLE;
+	virtualCacheIndex = virtualTableIndex = NO_TEXTURE_INDEX;
+	virtualWidth = virtualHeight = 0;
+	std::fill(virtualView, virtualView + 4, 0.0f);
+	virtualView[2] = virtualView[3] = 1.0f;
+	virtualLevel = 0.0f;
+	virtualCacheTexels = 0.0f;
+
+	std::fill(viewRect, viewRect + 4, 0.0f);
+	viewRect[2] = viewRect[3] = 1.0f;
+	viewLevel = 0;
+	filterPass = VK_NULL_HANDLE;
+	filterPipeline = VK_NULL_HANDLE;
+	filterFramebuffer = VK_NULL_HANDLE;
+	filterCache = filterTable = VulkanTexture();
+	filterFresh = false;
+	filterSlots.clear();
+	filterSlotUsed.clear();
+	filterTiles.clear();
+	filterLevel = 0;
+	filterOrigin[0] = filterOrigin[1] = filterGrid[0] = filterGrid[1] = 0;
+	filterTableValid = false;
+	filteredTiles = reusedTiles = directFrames = viewFrames = 0;
+
+	frameBudget = 0.0f;
+	renderScale = 1.0f;
+	gpuTime = 0.0;
+	timestampPeriod = 0.0f;
+	timestampPool = VK_NULL_HANDLE;
+	timestampScales.clear();
+	scaledTarget = VulkanTexture();
+	scaledFramebuffer = VK_NULL_HANDLE;
+	upscalePipeline = VK_NULL_HANDLE;
+	scaledFresh = false;
+	scaledFrames = timedFrames = scaleChanges = 0;
+	gpuTimeTotal = renderScaleTotal = 0.0;
+
+	textureSetLayout = VK_NULL_HANDLE;
+	texturePool = VK_NULL_HANDLE;
+	textureSet = VK_NULL_HANDLE;
+	textureCapacity = 0;
+	freeTextureIndices.clear();
+	compareIndex = NO_TEXTURE_INDEX;
+	compareSplit = 0.5f;
+
+	bindless = false;
+	singleLayout = VK_NULL_HANDLE;
+	singlePipelineLayout = VK_NULL_HANDLE;
+	singlePool = VK_NULL_HANDLE;
+	singleSets.clear();
+	singlePipeline = VK_NULL_HANDLE;
+
+	residents.clear();
+	residentBytes = 0;
+	memoryBudget = 0;
+	localHeap = 0;
+	memoryBudgetSupported = false;
+	evictCount = allocRetries = 0;
+	evictedBytes = 0;
 
 	currentImage = 0;
+	frameCount = 0;
+	redrawUntil = 0;
 }
 
 void VulkanCTX::Present() // presents to screen
@@ -705,6 +1175,7 @@ void VulkanCTX::Present() // presents to screen
 	submitInfo.pSignalSemaphores = &presentSemaphores[currentImage]; // when done, signal present semaphore.
 
 	VK_ASSERT(vkQueueSubmit(graphicsQueues[0], 1, &submitInfo, fences[currentImage]), "Failed to submit to presentation command buffer")
+	frameCount++;
 
 	VkPresentInfoKHR presentInfo = {};
 	presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
@@ -729,7 +1200,8 @@ void VulkanCTX::Present() // presents to screen
 
 void VulkanCTX::Update() // updates swapchain
 {
-	vkWaitForFences(device, 1, &fences[currentImage], VK_TRUE, UINT64_MAX);
+	WaitFrame();
+
 	VkResult res = vkAcquireNextImageKHR(device, swapchain, UINT64_MAX, acquireSemaphores[currentImage], VK_NULL_HANDLE, &imageIndex);
 
 	if (res == VK_ERROR_OUT_OF_DATE_KHR || res == VK_SUBOPTIMAL_KHR) {		
@@ -744,6 +1216,32 @@ void VulkanCTX::Update() // updates swapchain
 	vkResetFences(device, 1, &fences[currentImage]);
 }
 
+void VulkanCTX::WaitFrame()
+{
+	// Signaled until the next Update() acquires an image for this slot, so waiting again is free
+	vkWaitForFences(device, 1, &fences[currentImage], VK_TRUE, UINT64_MAX);
+
+	// The last frame drawn with this image is done, and so are its timestamps
+	if (timestampPool != VK_NULL_HANDLE && timestampScales[currentImage] > 0.0f) {
+		uint64_t timestamps[2];
+		if (vkGetQueryPoolResults(device, timestampPool, 2 * currentImage, 2, sizeof(timestamps), timestamps, sizeof(uint64_t), VK_QUERY_RESULT_64_BIT) == VK_SUCCESS)
+			UpdateRenderScale(double(timestamps[1] - timestamps[0]) * timestampPeriod / 1e6, timestampScales[currentImage]);
+		timestampScales[currentImage] = 0.0f;
+	}
+
+	// A texture swapped out at frame F is still bound by every set until each slot got re-recorded,
+	// which takes one trip around the swapchain, and those frames retire one trip later.
+	for (size_t i = 0; i < retiredTextures.size();) {
+		if (isFrameRetired(retiredTextures[i].frame)) {
+			ReleaseTexture(retiredTextures[i].texture);
+			retiredTextures[i] = retiredTextures.back();
+			retiredTextures.pop_back();
+		} else {
+			i++;
+		}
+	}
+}
+
 void VulkanCTX::ClearCurrentImage()
 {
 	VkClearValue clearColor = {0.0f, 0.5f, 0.4f, 1.0f};
@@ -767,11 +1265,53 @@ void VulkanCTX::ClearCurrentImage()
 }
 
 void VulkanCTX::SetupGraphics(uint32_t width, uint32_t height)
+{
+	// The view's shaders index the bindless array, without it the window only gets the plain filter
+	if (!bindless) {
+		if (singleSets.size() != swapchainImages.size())
+			SetupSingleSets();
+		singlePipeline = CreatePipeline(renderPass, singlePipelineLayout, width, height, SHADERS_FILTER);
+		return;
+	}
+
+	pipeline = CreatePipeline(renderPass, pipelineLayout, width, height, SHADERS_VIEW);
+	virtualPipeline = CreatePipeline(renderPass, pipelineLayout, width, height, SHADERS_VIRTUAL);
+
+	// The filter cache doesn't follow the swapchain, it only needs a window to show up in
+	if (filterPass == VK_NULL_HANDLE)
+		SetupFilterCache();
+
+	// The scaled target does, at the window's full size so the scale never has to reallocate it
+	upscalePipeline = CreatePipeline(renderPass, pipelineLayout, width, height, SHADERS_UPSCALE);
+	SetupScaledTarget(width, height);
+
+	// The gallery's pipeline goes with the render pass, its instance buffers with the swapchain images
+	if (galleryPipelineLayout != VK_NULL_HANDLE) {
+		if (galleryFrames.size() != swapchainImages.size())
+			SetupGalleryFrames();
+		galleryPipeline = CreatePipeline(renderPass, galleryPipelineLayout, width, height, SHADERS_GALLERY);
+	}
+}
+
+VkPipeline VulkanCTX::CreatePipeline(VkRenderPass pass, VkPipelineLayout layout, uint32_t width, uint32_t height, PipelineShaders shaders)
 {
 	// Feed shaders into pipeline
 
-	VkShaderModule vsShader = createShaderModule(device, vsSpv, sizeof(vsSpv));
-	VkShaderModule fsShader = createShaderModule(device, fsSpv, sizeof(fsSpv));
+	VkShaderModule vsShader, fsShader;
+	if (shaders == SHADERS_GALLERY) {
+		vsShader = createShaderModule(device, galleryVsSpv, sizeof(galleryVsSpv));
+		fsShader = createShaderModule(device, galleryFsSpv, sizeof(galleryFsSpv));
+	} else {
+		vsShader = createShaderModule(device, vsSpv, sizeof(vsSpv));
+		if (shaders == SHADERS_VIEW)
+			fsShader = createShaderModule(device, viewFsSpv, sizeof(viewFsSpv));
+		else if (shaders == SHADERS_VIRTUAL)
+			fsShader = createShaderModule(device, virtualFsSpv, sizeof(virtualFsSpv));
+		else if (shaders == SHADERS_UPSCALE)
+			fsShader = createShaderModule(device, upscaleFsSpv, sizeof(upscaleFsSpv));
+		else
+			fsShader = createShaderModule(device, fsSpv, sizeof(fsSpv));
+	}
 
 	VkPipelineShaderStageCreateInfo shaderStages[2];
 
@@ -842,6 +1382,14 @@ void VulkanCTX::SetupGraphics(uint32_t width, uint32_t height)
 	colorBlendState.attachmentCount = 1;
 	colorBlendState.pAttachments = &colorBlendAttachment;
 
+	// No size means the viewport changes per draw, like offscreen targets
+	VkDynamicState dynamicStates[2] = { VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR };
+
+	VkPipelineDynamicStateCreateInfo dynamicState = {};
+	dynamicState.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+	dynamicState.dynamicStateCount = 2;
+	dynamicState.pDynamicStates = dynamicStates;
+
 	VkGraphicsPipelineCreateInfo pipelineInfo = {};
 	pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
 	pipelineInfo.stageCount = 2;
@@ -852,13 +1400,17 @@ void VulkanCTX::SetupGraphics(uint32_t width, uint32_t height)
 	pipelineInfo.pRasterizationState = &rasterizerState;
 	pipelineInfo.pMultisampleState = &multisampleState;
 	pipelineInfo.pColorBlendState = &colorBlendState;
-	pipelineInfo.layout = pipelineLayout;
-	pipelineInfo.renderPass = renderPass;
+	pipelineInfo.pDynamicState = (width && height) ? nullptr : &dynamicState;
+	pipelineInfo.layout = layout;
+	pipelineInfo.renderPass = pass;
 	
-	VK_ASSERT(vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &pipeline), "Failed to create Graphics Pipeline")
+	VkPipeline newPipeline;
+	VK_ASSERT(vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &newPipeline), "Failed to create Graphics Pipeline")
 
 	vkDestroyShaderModule(device, vsShader, nullptr);
 	vkDestroyShaderModule(device, fsShader, nullptr);
+
+	return newPipeline;
 }
 
 void VulkanCTX::DrawGraphics()
@@ -878,118 +1430,1997 @@ void VulkanCTX::DrawGraphics()
 	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
 
 	vkBeginCommandBuffer(this->getCurrentCommandBuffer(), &beginInfo);
+
+	// Only the regular view goes through the scaled target, timed from here until it's drawn
+	bool view = galleryPipeline == VK_NULL_HANDLE && virtualCacheIndex == NO_TEXTURE_INDEX && textureIndex != NO_TEXTURE_INDEX;
+	bool scaled = view && scaledFramebuffer != VK_NULL_HANDLE;
+	if (scaled && timestampPool != VK_NULL_HANDLE) {
+		vkCmdResetQueryPool(this->getCurrentCommandBuffer(), timestampPool, 2 * currentImage, 2);
+		vkCmdWriteTimestamp(this->getCurrentCommandBuffer(), VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, timestampPool, 2 * currentImage);
+	}
+
+	// The view's tile table goes up with the other regions
+	bool tiled = view && UpdateFilterTiles();
+
+	// Textures finished on the transfer queue still need their shader read layout
+	for (auto &image : pendingTransitions)
+		transitionImageLayoutCmd(image, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, this->getCurrentCommandBuffer());
+	pendingTransitions.clear();
+
+	if (filterFresh) {
+		transitionImageLayoutCmd(filterCache.image, filterCache.format, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, this->getCurrentCommandBuffer());
+		transitionImageLayoutCmd(filterTable.image, filterTable.format, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, this->getCurrentCommandBuffer());
+		filterFresh = false;
+	}
+
+	if (scaledFresh) {
+		transitionImageLayoutCmd(scaledTarget.image, scaledTarget.format, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, this->getCurrentCommandBuffer());
+		scaledFresh = false;
+	}
+
+	RecordRegions(this->getCurrentCommandBuffer());
+
+	// Tiles new to the window get filtered before it's drawn, the rest is still in the cache
+	if (tiled)
+		RecordFilterTiles(this->getCurrentCommandBuffer());
+
+	VulkanPushConstants viewConstants = {};
+	if (view) {
+		viewConstants.textureIndex = textureIndex;
+		viewConstants.compareIndex = compareIndex;
+		viewConstants.split = compareSplit;
+		viewConstants.pageTable = tiled ? filterTable.index : NO_TEXTURE_INDEX;
+		std::copy(viewRect, viewRect + 4, viewConstants.view);
+		viewConstants.size[0] = float(textureWidth);
+		viewConstants.size[1] = float(textureHeight);
+		viewConstants.level = float(viewLevel);
+		viewConstants.pageTexels = float(FILTER_TILE_SIZE - 2);
+		viewConstants.cacheTexels = float(filterCache.width);
+		viewConstants.cacheIndex = filterCache.index;
+		viewConstants.tileOrigin[0] = float(filterOrigin[0]);
+		viewConstants.tileOrigin[1] = float(filterOrigin[1]);
+		viewConstants.tint = 1.0f;
+	}
+
+	// The view at the render scale into the top left of the scaled target, stretched over the window below
+	uint32_t scaledWidth = std::max(uint32_t(swapExtent.width * renderScale + 0.5f), 1u);
+	uint32_t scaledHeight = std::max(uint32_t(swapExtent.height * renderScale + 0.5f), 1u);
+	if (scaled) {
+		VkRenderPassBeginInfo scaledPassInfo = {};
+		scaledPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+		scaledPassInfo.renderPass = filterPass;
+		scaledPassInfo.framebuffer = scaledFramebuffer;
+		scaledPassInfo.renderArea.offset = {0, 0};
+		scaledPassInfo.renderArea.extent = {scaledWidth, scaledHeight};
+
+		VkViewport viewport = {0.0f, 0.0f, float(scaledWidth), float(scaledHeight), 0.0f, 1.0f};
+		VkRect2D scissor = {{0, 0}, {scaledWidth, scaledHeight}};
+		VkDescriptorSet sets[2] = { descriptorSet, textureSet };
+
+		vkCmdBeginRenderPass(this->getCurrentCommandBuffer(), &scaledPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+		vkCmdBindPipeline(this->getCurrentCommandBuffer(), VK_PIPELINE_BIND_POINT_GRAPHICS, filterPipeline);
+		vkCmdBindDescriptorSets(this->getCurrentCommandBuffer(), VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 2, sets, 0, nullptr);
+		vkCmdSetViewport(this->getCurrentCommandBuffer(), 0, 1, &viewport);
+		vkCmdSetScissor(this->getCurrentCommandBuffer(), 0, 1, &scissor);
+		vkCmdPushConstants(this->getCurrentCommandBuffer(), pipelineLayout, VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(viewConstants), &viewConstants);
+		vkCmdDraw(this->getCurrentCommandBuffer(), 6, 1, 0, 0);
+		vkCmdEndRenderPass(this->getCurrentCommandBuffer());
+
+		if (timestampPool != VK_NULL_HANDLE) {
+			vkCmdWriteTimestamp(this->getCurrentCommandBuffer(), VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, timestampPool, 2 * currentImage + 1);
+			timestampScales[currentImage] = renderScale;
+		}
+
+		scaledFrames++;
+		renderScaleTotal += renderScale;
+	}
+
 	vkCmdBeginRenderPass(this->getCurrentCommandBuffer(), &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
 
-	vkCmdBindPipeline(this->getCurrentCommandBuffer(), VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
-	vkCmdBindDescriptorSets(this->getCurrentCommandBuffer(), VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &descriptorSet, 0, nullptr);
-	vkCmdDraw(this->getCurrentCommandBuffer(), 6, 1, 0, 0);
+	if (galleryPipeline != VK_NULL_HANDLE) {
+		// Every thumbnail in one draw, the instance picks its rectangle and texture
+		GalleryFrame &frame = galleryFrames[currentImage];
+		VkDescriptorSet sets[2] = { frame.descriptorSet, textureSet };
+
+		if (frame.count) {
+			vkCmdBindPipeline(this->getCurrentCommandBuffer(), VK_PIPELINE_BIND_POINT_GRAPHICS, galleryPipeline);
+			vkCmdBindDescriptorSets(this->getCurrentCommandBuffer(), VK_PIPELINE_BIND_POINT_GRAPHICS, galleryPipelineLayout, 0, 2, sets, 0, nullptr);
+			vkCmdDraw(this->getCurrentCommandBuffer(), 6, frame.count, 0, 0);
+		}
+
+		// Tiles left over for the next trip around could point at slots freed since
+		frame.count = 0;
+	} else if (virtualCacheIndex != NO_TEXTURE_INDEX) {
+		// Same quad, the pixels come out of whatever pages are in
+		VkDescriptorSet sets[2] = { descriptorSet, textureSet };
+
+		VulkanPushConstants pushConstants = {};
+		pushConstants.textureIndex = virtualCacheIndex;
+		pushConstants.compareIndex = NO_TEXTURE_INDEX;
+		pushConstants.pageTable = virtualTableIndex;
+		std::copy(virtualView, virtualView + 4, pushConstants.view);
+		pushConstants.size[0] = float(virtualWidth);
+		pushConstants.size[1] = float(virtualHeight);
+		pushConstants.level = virtualLevel;
+		pushConstants.pageTexels = float(VIRTUAL_PAGE_SIZE - 2);
+		pushConstants.cacheTexels = virtualCacheTexels;
+
+		vkCmdBindPipeline(this->getCurrentCommandBuffer(), VK_PIPELINE_BIND_POINT_GRAPHICS, virtualPipeline);
+		vkCmdBindDescriptorSets(this->getCurrentCommandBuffer(), VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 2, sets, 0, nullptr);
+		vkCmdPushConstants(this->getCurrentCommandBuffer(), pipelineLayout, VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(pushConstants), &pushConstants);
+		vkCmdDraw(this->getCurrentCommandBuffer(), 6, 1, 0, 0);
+
+		TouchTexture(virtualCacheIndex);
+		TouchTexture(virtualTableIndex);
+	} else if (view) {
+		// Nothing to show until the first texture is up
+		VkDescriptorSet sets[2] = { descriptorSet, textureSet };
+
+		if (scaled) {
+			VulkanPushConstants pushConstants = {};
+			pushConstants.textureIndex = scaledTarget.index;
+			pushConstants.compareIndex = NO_TEXTURE_INDEX;
+			pushConstants.pageTable = NO_TEXTURE_INDEX;
+			pushConstants.view[2] = float(scaledWidth) / scaledTarget.width;
+			pushConstants.view[3] = float(scaledHeight) / scaledTarget.height;
+			pushConstants.size[0] = float(scaledTarget.width);
+			pushConstants.size[1] = float(scaledTarget.height);
+
+			vkCmdBindPipeline(this->getCurrentCommandBuffer(), VK_PIPELINE_BIND_POINT_GRAPHICS, upscalePipeline);
+			vkCmdBindDescriptorSets(this->getCurrentCommandBuffer(), VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 2, sets, 0, nullptr);
+			vkCmdPushConstants(this->getCurrentCommandBuffer(), pipelineLayout, VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(pushConstants), &pushConstants);
+		} else {
+			vkCmdBindPipeline(this->getCurrentCommandBuffer(), VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+			vkCmdBindDescriptorSets(this->getCurrentCommandBuffer(), VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 2, sets, 0, nullptr);
+			vkCmdPushConstants(this->getCurrentCommandBuffer(), pipelineLayout, VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(viewConstants), &viewConstants);
+		}
+		vkCmdDraw(this->getCurrentCommandBuffer(), 6, 1, 0, 0);
+
+		TouchTexture(textureIndex);
+		TouchTexture(compareIndex);
+	} else if (singlePipeline != VK_NULL_HANDLE && textureImageView != VK_NULL_HANDLE) {
+		// Update() waited for this set's last frame, so it can point at whatever is up now
+		VkDescriptorSet set = singleSets[currentImage];
+
+		VkDescriptorImageInfo imageInfo = {};
+		imageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+		imageInfo.imageView = textureImageView;
+		imageInfo.sampler = textureSampler;
+
+		VkWriteDescriptorSet descriptorWrite = {};
+		descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		descriptorWrite.dstSet = set;
+		descriptorWrite.dstBinding = 1;
+		descriptorWrite.descriptorCount = 1;
+		descriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+		descriptorWrite.pImageInfo = &imageInfo;
+
+		vkUpdateDescriptorSets(device, 1, &descriptorWrite, 0, nullptr);
+
+		vkCmdBindPipeline(this->getCurrentCommandBuffer(), VK_PIPELINE_BIND_POINT_GRAPHICS, singlePipeline);
+		vkCmdBindDescriptorSets(this->getCurrentCommandBuffer(), VK_PIPELINE_BIND_POINT_GRAPHICS, singlePipelineLayout, 0, 1, &set, 0, nullptr);
+		vkCmdDraw(this->getCurrentCommandBuffer(), 6, 1, 0, 0);
+	}
 
 	vkCmdEndRenderPass(this->getCurrentCommandBuffer());
+
+	// Copied out in the same command buffer, the CPU picks it up a few frames later
+	if (screenshotRequested && screenshotReadback < 0) {
+		VkImage image = swapchainImages[imageIndex];
+		transitionImageLayoutCmd(image, surfaceFormat.format, VK_IMAGE_LAYOUT_PRESENT_SRC_KHR, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, this->getCurrentCommandBuffer());
+		screenshotReadback = RecordReadback(this->getCurrentCommandBuffer(), image, surfaceFormat.format, swapExtent.width, swapExtent.height);
+		transitionImageLayoutCmd(image, surfaceFormat.format, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_IMAGE_LAYOUT_PRESENT_SRC_KHR, this->getCurrentCommandBuffer());
+		screenshotRequested = screenshotReadback < 0; // ring full, try again next frame
+	}
+
 	vkEndCommandBuffer(this->getCurrentCommandBuffer());
 }
 
-void VulkanCTX::SetupTexture(uint8_t *data, uint32_t width, uint32_t height)
+int32_t VulkanCTX::PollScreenshot()
+{
+	if (screenshotReadback < 0 || !PollReadback(screenshotReadback))
+		return -1;
+
+	int32_t index = screenshotReadback;
+	screenshotReadback = -1;
+	return index;
+}
+
+void VulkanCTX::SetupTexture(const void *data, uint32_t width, uint32_t height, uint32_t channels, PixelType type)
 {
 	if (!data)
 		return;
-	
-	VkDeviceSize dataSize = width * height * 4;
-	VkBuffer stagingBuffer;
-	VkDeviceMemory stagingBufferMemory;
-
-	uint32_t queueFamilies[2] = {
-		graphicsQueueFamily,
-		transferQueueFamily
-	};
 
-	createBuffer(device, physicalDev, dataSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &stagingBuffer, &stagingBufferMemory, queueFamilies, 2);
+	VulkanUpload upload;
+	if (PrepareUpload(data, width, height, upload, channels, type))
+		SetupTexture(upload);
+}
 
-	void *mappedData;
-	vkMapMemory(device, stagingBufferMemory, 0, dataSize, 0, &mappedData);
-	memcpy(mappedData, data, static_cast<size_t>(dataSize));
-	vkUnmapMemory(device, stagingBufferMemory);
+void VulkanCTX::SetupTexture(VulkanUpload &upload)
+{
+	if (!SubmitUpload(upload)) {
+		std::cout << "Out of device memory for a " << upload.texture.width << "x" << upload.texture.height << " texture :(" << std::endl;
+		CancelUpload(upload);
+		return;
+	}
 
-	// create image
-	createImage(device, physicalDev, width, height, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &textureImage, &textureMemory);
+	vkWaitForFences(device, 1, &upload.fence, VK_TRUE, UINT64_MAX);
+	PollUpload(upload);
 
-	// Prepare command buffer
-	VkCommandBufferAllocateInfo commandBufferInfo = {};
-	commandBufferInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-	commandBufferInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-	commandBufferInfo.commandPool = graphicsPool;
-	commandBufferInfo.commandBufferCount = 1;
+	SwapTexture(upload.texture);
+}
 
-	VkCommandBuffer commandBuffer;
-	VK_ASSERT(vkAllocateCommandBuffers(device, &commandBufferInfo, &commandBuffer), "Failed to allocate Command Buffer for transferring Texture2D to Device")
+void VulkanCTX::ReleaseTexture()
+{
+	for (auto &retired : retiredTextures)
+		ReleaseTexture(retired.texture);
+	retiredTextures.clear();
+	pendingTransitions.clear();
+	DropFilterTiles();
+
+	for (auto &staging : regionStaging) {
+		staging.copies.clear();
+		staging.used = 0;
+	}
 
-	VkCommandBufferBeginInfo beginInfo = {};
-	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
-	
-	vkBeginCommandBuffer(commandBuffer, &beginInfo);
+	if (textureOwned) {
+		VulkanTexture texture;
+		texture.image = textureImage;
+		texture.memory = textureMemory;
+		texture.view = textureImageView;
+		texture.index = textureIndex;
+		texture.size = textureBytes;
+		ReleaseTexture(texture);
+	}
 
-	transitionImageLayoutCmd(textureImage, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, commandBuffer);
-	copyBufferToImageCmd(width, height, stagingBuffer, textureImage, commandBuffer);
-	transitionImageLayoutCmd(textureImage, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, commandBuffer);
+	textureOwned = true;
+	textureIndex = NO_TEXTURE_INDEX;
+	compareIndex = NO_TEXTURE_INDEX;
+	textureImage = VK_NULL_HANDLE;
+	textureMemory = VK_NULL_HANDLE;
+	textureImageView = VK_NULL_HANDLE;
+	textureFormat = VK_FORMAT_UNDEFINED;
+	textureBytes = 0;
+}
 
-	vkEndCommandBuffer(commandBuffer);
+static uint32_t texelSize(VkFormat format)
+{
+	switch (format) {
+	case VK_FORMAT_R8_SRGB: return 1;
+	case VK_FORMAT_R8G8_SRGB: return 2;
+	case VK_FORMAT_R16G16B16A16_UNORM: return 8;
+	case VK_FORMAT_R16G16B16A16_SFLOAT: return 8;
+	case VK_FORMAT_R32G32B32A32_SFLOAT: return 16;
+	default: return 4;
+	}
+}
 
-	// Submit command buffer
+// Makes a 1 or 2 channel texture read like the RGBA image stb would have given us
+static VkComponentMapping formatSwizzle(VkFormat format)
+{
+	if (format == VK_FORMAT_R8_SRGB || format == VK_FORMAT_R8_UNORM || format == VK_FORMAT_R16_UNORM || format == VK_FORMAT_BC4_UNORM_BLOCK)
+		return { VK_COMPONENT_SWIZZLE_R, VK_COMPONENT_SWIZZLE_R, VK_COMPONENT_SWIZZLE_R, VK_COMPONENT_SWIZZLE_ONE };
+	if (format == VK_FORMAT_R8G8_SRGB)
+		return { VK_COMPONENT_SWIZZLE_R, VK_COMPONENT_SWIZZLE_R, VK_COMPONENT_SWIZZLE_R, VK_COMPONENT_SWIZZLE_G };
 
-	VkSubmitInfo submitInfo = {};
-	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-	submitInfo.commandBufferCount = 1;
-	submitInfo.pCommandBuffers = &commandBuffer;
+	return {};
+}
 
-	VkFence fence;
-	VkFenceCreateInfo fenceInfo = {};
-	fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
-	vkCreateFence(device, &fenceInfo, nullptr, &fence);
+VkFormat VulkanCTX::getTextureFormat(uint32_t channels, PixelType type)
+{
+	if (type == PIXEL_U16)
+		return VK_FORMAT_R16G16B16A16_UNORM;
+	if (type == PIXEL_F32)
+		return floatFormat;
 
-	vkQueueSubmit(graphicsQueues[0], 1, &submitInfo, fence);
-	vkWaitForFences(device, 1, &fence, VK_TRUE, UINT64_MAX);
+	return textureFormats[channels - 1];
+}
 
-	vkDestroyFence(device, fence, nullptr);
-	vkFreeCommandBuffers(device, graphicsPool, 1, &commandBuffer);
+uint32_t VulkanCTX::getTexelSize(uint32_t channels, PixelType type)
+{
+	return texelSize(getTextureFormat(channels, type));
+}
 
-	vkDestroyBuffer(device, stagingBuffer, nullptr);
-	vkFreeMemory(device, stagingBufferMemory, nullptr);
+VkDeviceSize VulkanCTX::getTextureSize(VkFormat format, uint32_t width, uint32_t height)
+{
+	VkDeviceSize size = getLevelSize(format, width, height);
+	return size ? size : VkDeviceSize(width) * height * texelSize(format);
+}
 
-	// Create Texture Image View
+bool VulkanCTX::canSample(VkFormat format)
+{
+	VkFormatProperties formatProps = {};
+	vkGetPhysicalDeviceFormatProperties(physicalDev, format, &formatProps);
 
-	VkImageViewCreateInfo viewInfo = {};
-	viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
-	viewInfo.image = textureImage;
-	viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
-	viewInfo.format = VK_FORMAT_R8G8B8A8_SRGB;
-	viewInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-	viewInfo.subresourceRange.baseMipLevel = 0;
-	viewInfo.subresourceRange.levelCount = 1;
-	viewInfo.subresourceRange.baseArrayLayer = 0;
-	viewInfo.subresourceRange.layerCount = 1;
+	VkFormatFeatureFlags needed = VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT | VK_FORMAT_FEATURE_TRANSFER_DST_BIT;
+	return (formatProps.optimalTilingFeatures & needed) == needed;
+}
 
-	VK_ASSERT(vkCreateImageView(device, &viewInfo, nullptr, &textureImageView), "Failed to create Texture2D view!");
+void VulkanCTX::SetCompression(BCFormat format, JobSystem *jobs)
+{
+	if (format == BC1 && !bc1Supported && bc7Supported)
+		format = BC7;
+	if ((format == BC1 && !bc1Supported) || (format == BC7 && !bc7Supported)) {
+		std::cout << "This device can't sample BC textures, uploading them uncompressed :(" << std::endl;
+		format = BC_NONE;
+	}
 
-	// Create Texture Sampler
+	compression = format;
+	compressionJobs = jobs;
+}
 
-	VkSamplerCreateInfo samplerInfo = {};
-	samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
-	samplerInfo.magFilter = VK_FILTER_LINEAR;
-	samplerInfo.minFilter = VK_FILTER_LINEAR;
-	samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_REPEAT;
-	samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_REPEAT;
-	samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_REPEAT;
-	samplerInfo.anisotropyEnable = VK_TRUE;
-	samplerInfo.maxAnisotropy = 16.0f;
-	samplerInfo.borderColor = VK_BORDER_COLOR_INT_OPAQUE_BLACK;
-	samplerInfo.unnormalizedCoordinates = VK_FALSE;
-	samplerInfo.compareEnable = VK_FALSE;
-	samplerInfo.compareOp = VK_COMPARE_OP_ALWAYS;
-	samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
+void VulkanCTX::PrintCompressionStats()
+{
+	if (!compressPixels)
+		return;
 
-	VK_ASSERT(vkCreateSampler(device, &samplerInfo, nullptr, &textureSampler), "Failed to create Texture2D sampler!")
+	double ms = compressNs / 1e6;
+	std::cout << "Block compression: " << compressPixels / 1e6 << " MP in " << ms << " ms"
+		<< " (" << compressPixels / 1e3 / ms << " MP/s)"
+		<< ", " << compressedBytes / 1048576.0 << " MB on the device instead of " << uncompressedBytes / 1048576.0 << " MB"
+		<< " (" << double(uncompressedBytes) / compressedBytes << "x smaller uploads)" << std::endl;
+}
+
+VkFormat VulkanCTX::getUploadFormat(const void *data, uint32_t width, uint32_t height, uint32_t channels, PixelType type)
+{
+	// BC1 has no alpha, images that use it go to BC7, or stay uncompressed without it
+	if (type == PIXEL_U8 && compression == BC1) {
+		if (isOpaque(static_cast<const uint8_t *>(data), width, height, channels))
+			return VK_FORMAT_BC1_RGB_SRGB_BLOCK;
+		return bc7Supported ? VK_FORMAT_BC7_SRGB_BLOCK : getTextureFormat(channels, type);
+	}
+	if (type == PIXEL_U8 && compression == BC7)
+		return VK_FORMAT_BC7_SRGB_BLOCK;
+
+	return getTextureFormat(channels, type);
+}
+
+void VulkanCTX::ConvertTexels(void *dst, const void *data, uint32_t width, uint32_t height, uint32_t channels, PixelType type, VkFormat format)
+{
+	size_t pixels = size_t(width) * height;
+
+	if (format == VK_FORMAT_BC1_RGB_SRGB_BLOCK || format == VK_FORMAT_BC7_SRGB_BLOCK) {
+		auto start = std::chrono::steady_clock::now();
+		EncodeBC(static_cast<uint8_t *>(dst), static_cast<const uint8_t *>(data), width, height, channels, format == VK_FORMAT_BC1_RGB_SRGB_BLOCK ? BC1 : BC7, compressionJobs);
+
+		compressNs += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+		compressPixels += pixels;
+		compressedBytes += getTextureSize(format, width, height);
+		uncompressedBytes += getTextureSize(getTextureFormat(channels, type), width, height);
+	} else if (format == VK_FORMAT_R16G16B16A16_UNORM) {
+		convertSRGB16ToLinear(static_cast<uint16_t *>(dst), static_cast<const uint16_t *>(data), pixels);
+	} else if (format == VK_FORMAT_R16G16B16A16_SFLOAT) {
+		convertF32ToF16(static_cast<uint16_t *>(dst), static_cast<const float *>(data), pixels * 4);
+	} else if (texelSize(format) == channels || format == VK_FORMAT_R32G32B32A32_SFLOAT) {
+		memcpy(dst, data, static_cast<size_t>(getTextureSize(format, width, height)));
+	} else {
+		// Expand to RGBA, gray goes to all three colour channels
+		const uint8_t *src = static_cast<const uint8_t *>(data);
+		uint8_t *out = static_cast<uint8_t *>(dst);
+
+		for (size_t i = 0; i < pixels; i++, src += channels, out += 4) {
+			out[0] = src[0];
+			out[1] = src[channels >= 3 ? 1 : 0];
+			out[2] = src[channels >= 3 ? 2 : 0];
+			out[3] = channels == 2 ? src[1] : channels == 4 ? src[3] : 255;
+		}
+	}
+}
+
+void *VulkanCTX::MapUpload(VulkanUpload &upload, VkDeviceSize size)
+{
+	// Only touches objects owned by this upload, so decode threads can fill their own staging buffers
+	createBuffer(device, physicalDev, size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &upload.stagingBuffer, &upload.stagingMemory, nullptr, 0);
+
+	void *mappedData;
+	if (vkMapMemory(device, upload.stagingMemory, 0, size, 0, &mappedData) != VK_SUCCESS) {
+		CancelUpload(upload);
+		return nullptr;
+	}
+
+	upload.stagingSize = size;
+	return mappedData;
+}
+
+bool VulkanCTX::PrepareUpload(const void *data, uint32_t width, uint32_t height, VulkanUpload &upload, uint32_t channels, PixelType type)
+{
+	if (channels < 1 || channels > 4 || (type != PIXEL_U8 && channels != 4))
+		return false;
+
+	VkFormat format = getUploadFormat(data, width, height, channels, type);
+	void *mappedData = MapUpload(upload, getTextureSize(format, width, height));
+	if (!mappedData)
+		return false;
+
+	// Any conversion happens on the way into staging memory, so the pixels are only touched once
+	ConvertTexels(mappedData, data, width, height, channels, type, format);
+
+	vkUnmapMemory(device, upload.stagingMemory);
+
+	upload.texture.width = width;
+	upload.texture.height = height;
+	upload.texture.format = format;
+
+	return true;
+}
+
+bool VulkanCTX::PrepareRawUpload(const void *texels, VkFormat format, uint32_t width, uint32_t height, VulkanUpload &upload)
+{
+	VkDeviceSize size = getTextureSize(format, width, height);
+	void *mappedData = MapUpload(upload, size);
+	if (!mappedData)
+		return false;
+
+	memcpy(mappedData, texels, static_cast<size_t>(size));
+
+	vkUnmapMemory(device, upload.stagingMemory);
+
+	upload.texture.width = width;
+	upload.texture.height = height;
+	upload.texture.format = format;
+
+	return true;
+}
+
+bool VulkanCTX::PrepareUpload(const uint8_t *file, const TextureFileInfo &info, VulkanUpload &upload)
+{
+	if (!canSample(info.format))
+		return false;
+
+	// Regions are packed one after another, each on a 16 byte boundary so every block size lines up
+	VkDeviceSize size = 0;
+	for (auto &region : info.regions)
+		size = ((size + 15) & ~VkDeviceSize(15)) + region.size;
+
+	uint8_t *mappedData = static_cast<uint8_t *>(MapUpload(upload, size));
+	if (!mappedData)
+		return false;
+
+	VkDeviceSize offset = 0;
+	upload.regions.clear();
+
+	for (auto &region : info.regions) {
+		offset = (offset + 15) & ~VkDeviceSize(15);
+		memcpy(mappedData + offset, file + region.offset, static_cast<size_t>(region.size));
+
+		VkBufferImageCopy regionCopy = {};
+		regionCopy.bufferOffset = offset;
+		regionCopy.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		regionCopy.imageSubresource.mipLevel = region.level;
+		regionCopy.imageSubresource.baseArrayLayer = region.layer;
+		regionCopy.imageSubresource.layerCount = 1;
+		regionCopy.imageExtent = { region.width, region.height, 1 };
+		upload.regions.push_back(regionCopy);
+
+		offset += region.size;
+	}
+
+	vkUnmapMemory(device, upload.stagingMemory);
+
+	upload.texture.width = info.width;
+	upload.texture.height = info.height;
+	upload.texture.format = info.format;
+	upload.texture.levels = info.levels;
+	upload.texture.layers = info.layers;
+
+	return true;
+}
+
+void VulkanCTX::SetFullFloat(bool enable)
+{
+	// Full float only if the device can filter it, half float is filterable everywhere
+	VkFormatProperties formatProps = {};
+	vkGetPhysicalDeviceFormatProperties(physicalDev, VK_FORMAT_R32G32B32A32_SFLOAT, &formatProps);
+
+	VkFormatFeatureFlags needed = VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT | VK_FORMAT_FEATURE_TRANSFER_DST_BIT;
+	floatFormat = enable && (formatProps.optimalTilingFeatures & needed) == needed ? VK_FORMAT_R32G32B32A32_SFLOAT : VK_FORMAT_R16G16B16A16_SFLOAT;
+}
+
+bool VulkanCTX::SubmitUpload(VulkanUpload &upload)
+{
+	if (!AllocateTexture(upload.texture))
+		return false;
+
+	SubmitCopy(upload, upload.texture.image);
+
+	// Views show the first layer with all of its levels
+	upload.texture.view = createImageView(device, upload.texture.image, upload.texture.format, nullptr, formatSwizzle(upload.texture.format));
+	BindTexture(upload.texture);
+
+	return true;
+}
+
+bool VulkanCTX::AllocateTexture(VulkanTexture &texture)
+{
+	uint32_t queueFamilies[2] = {
+		graphicsQueueFamily,
+		transferQueueFamily
+	};
+
+	texture.image = createImageHandle(device, texture.width, texture.height, texture.format, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, queueFamilies, 2, texture.levels, texture.layers);
+
+	VkMemoryRequirements memoryRequirements;
+	vkGetImageMemoryRequirements(device, texture.image, &memoryRequirements);
+
+	VkMemoryAllocateInfo allocInfo = {};
+	allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+	allocInfo.allocationSize = memoryRequirements.size;
+	allocInfo.memoryTypeIndex = memoryType(physicalDev, memoryRequirements.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+	// Make room before going over, retired textures are on their way out already
+	VkDeviceSize staying = residentBytes;
+	for (auto &retired : retiredTextures)
+		staying -= retired.texture.size;
+
+	VkDeviceSize budget = getMemoryBudget();
+	if (staying + memoryRequirements.size > budget)
+		Evict(staying + memoryRequirements.size - budget);
+
+	// Out of memory anyway, evicted textures only let go once no frame samples them so wait for that
+	VkResult result;
+	while ((result = vkAllocateMemory(device, &allocInfo, nullptr, &texture.memory)) != VK_SUCCESS) {
+		VK_FATAL(result != VK_ERROR_OUT_OF_DEVICE_MEMORY && result != VK_ERROR_OUT_OF_HOST_MEMORY, "Failed to allocate Texture2D memory!")
+
+		allocRetries++;
+		bool evicted = Evict(memoryRequirements.size);
+		if (!ReleaseRetired() && !evicted) {
+			vkDestroyImage(device, texture.image, nullptr);
+			texture.image = VK_NULL_HANDLE;
+			texture.memory = VK_NULL_HANDLE;
+			return false;
+		}
+	}
+
+	vkBindImageMemory(device, texture.image, texture.memory, 0);
+
+	texture.size = memoryRequirements.size;
+	residentBytes += texture.size;
+	return true;
+}
+
+void VulkanCTX::SubmitUpload(VulkanUpload &upload, const VulkanTexture &target)
+{
+	// The copy starts from an undefined layout, whatever the texture held last is thrown away
+	SubmitCopy(upload, target.image);
+}
+
+void VulkanCTX::SubmitCopy(VulkanUpload &upload, VkImage image)
+{
+	// Prepare command buffer
+	VkCommandBufferAllocateInfo commandBufferInfo = {};
+	commandBufferInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+	commandBufferInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+	commandBufferInfo.commandPool = transferPool;
+	commandBufferInfo.commandBufferCount = 1;
+
+	VK_ASSERT(vkAllocateCommandBuffers(device, &commandBufferInfo, &upload.commandBuffer), "Failed to allocate Command Buffer for transferring Texture2D to Device")
+
+	VkCommandBufferBeginInfo beginInfo = {};
+	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+	vkBeginCommandBuffer(upload.commandBuffer, &beginInfo);
+
+	// The transfer queue can't reach the fragment stage, SwapTexture() finishes the transition on the graphics queue
+	transitionImageLayoutCmd(image, upload.texture.format, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, upload.commandBuffer);
+	if (upload.regions.empty())
+		copyBufferToImageCmd(upload.texture.width, upload.texture.height, upload.stagingBuffer, image, upload.commandBuffer);
+	else
+		copyBufferToImageCmd(upload.regions, upload.stagingBuffer, image, upload.commandBuffer);
+
+	vkEndCommandBuffer(upload.commandBuffer);
+
+	// Submit command buffer
+
+	VkSubmitInfo submitInfo = {};
+	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+	submitInfo.commandBufferCount = 1;
+	submitInfo.pCommandBuffers = &upload.commandBuffer;
+
+	VkFenceCreateInfo fenceInfo = {};
+	fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+	vkCreateFence(device, &fenceInfo, nullptr, &upload.fence);
+
+	VK_ASSERT(vkQueueSubmit(transferQueues[0], 1, &submitInfo, upload.fence), "Failed to submit Texture2D upload")
+}
+
+bool VulkanCTX::PollUpload(VulkanUpload &upload)
+{
+	if (upload.fence == VK_NULL_HANDLE || vkGetFenceStatus(device, upload.fence) != VK_SUCCESS)
+		return false;
+
+	vkDestroyFence(device, upload.fence, nullptr);
+	vkFreeCommandBuffers(device, transferPool, 1, &upload.commandBuffer);
+	vkDestroyBuffer(device, upload.stagingBuffer, nullptr);
+	vkFreeMemory(device, upload.stagingMemory, nullptr);
+
+	upload.fence = VK_NULL_HANDLE;
+	upload.commandBuffer = VK_NULL_HANDLE;
+	upload.stagingBuffer = VK_NULL_HANDLE;
+	upload.stagingMemory = VK_NULL_HANDLE;
+
+	return true;
+}
+
+void VulkanCTX::CancelUpload(VulkanUpload &upload)
+{
+	if (upload.fence != VK_NULL_HANDLE) {
+		vkWaitForFences(device, 1, &upload.fence, VK_TRUE, UINT64_MAX);
+		vkDestroyFence(device, upload.fence, nullptr);
+	}
+
+	if (upload.commandBuffer != VK_NULL_HANDLE)
+		vkFreeCommandBuffers(device, transferPool, 1, &upload.commandBuffer);
+
+	vkDestroyBuffer(device, upload.stagingBuffer, nullptr);
+	vkFreeMemory(device, upload.stagingMemory, nullptr);
+	ReleaseTexture(upload.texture);
+
+	upload = VulkanUpload();
+}
+
+void VulkanCTX::SwapTexture(VulkanTexture &newTexture)
+{
+	ShowTexture(newTexture);
+	textureOwned = true;
+	newTexture = VulkanTexture();
+}
+
+void VulkanCTX::ShowTexture(const VulkanTexture &texture)
+{
+	// Regions staged for the old texture don't belong on the new one, neither do its filtered tiles
+	DropRegions(textureImage);
+	DropFilterTiles();
+
+	if (textureOwned && textureImage != VK_NULL_HANDLE) {
+		VulkanTexture current;
+		current.image = textureImage;
+		current.memory = textureMemory;
+		current.view = textureImageView;
+		current.index = textureIndex;
+		current.size = textureBytes;
+		RetireTexture(current);
+	}
+
+	textureImage = texture.image;
+	textureIndex = texture.index;
+	textureMemory = texture.memory;
+	textureImageView = texture.view;
+	textureFormat = texture.format;
+	textureWidth = texture.width;
+	textureHeight = texture.height;
+	textureLevels = texture.levels;
+	textureBytes = texture.size;
+	textureOwned = false;
+
+	// Whatever is on screen stays
+	if (textureIndex != NO_TEXTURE_INDEX)
+		residents[textureIndex].evict = nullptr;
+
+	pendingTransitions.push_back(textureImage);
+	RequestRedraw();
+}
+
+void VulkanCTX::RetireTexture(VulkanTexture &texture)
+{
+	// On its way out, the owner is done with it
+	if (texture.index < residents.size())
+		residents[texture.index].evict = nullptr;
+
+	RetiredTexture retired;
+	retired.texture = texture;
+	retired.frame = frameCount;
+	retiredTextures.push_back(retired);
+	RequestRedraw(); // it only goes once enough frames went by
+
+	texture = VulkanTexture();
+}
+
+void VulkanCTX::ReleaseTexture(VulkanTexture &texture)
+{
+	UnbindTexture(texture);
+	vkDestroyImageView(device, texture.view, nullptr);
+	vkDestroyImage(device, texture.image, nullptr);
+	vkFreeMemory(device, texture.memory, nullptr);
+	residentBytes -= texture.size;
+
+	texture = VulkanTexture();
+}
+
+uint32_t VulkanCTX::BindTexture(VulkanTexture &texture)
+{
+	if (textureSet == VK_NULL_HANDLE || texture.index != NO_TEXTURE_INDEX)
+		return texture.index;
+
+	if (freeTextureIndices.empty()) {
+		std::cout << "Out of bindless texture slots, " << textureCapacity << " textures are up already :(" << std::endl;
+		return NO_TEXTURE_INDEX;
+	}
+
+	texture.index = freeTextureIndices.back();
+	freeTextureIndices.pop_back();
+
+	// Counts as drawn now, so a texture isn't evicted before it had a chance to show up
+	residents[texture.index] = Resident();
+	residents[texture.index].size = texture.size;
+	residents[texture.index].lastUsed = frameCount;
+
+	// Update after bind, frames in flight never sample a free slot
+	VkDescriptorImageInfo imageInfo = {};
+	imageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	imageInfo.imageView = texture.view;
+	imageInfo.sampler = textureSampler;
+
+	VkWriteDescriptorSet descriptorWrite = {};
+	descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+	descriptorWrite.dstSet = textureSet;
+	descriptorWrite.dstBinding = 0;
+	descriptorWrite.dstArrayElement = texture.index;
+	descriptorWrite.descriptorCount = 1;
+	descriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	descriptorWrite.pImageInfo = &imageInfo;
+
+	vkUpdateDescriptorSets(device, 1, &descriptorWrite, 0, nullptr);
+	return texture.index;
+}
+
+void VulkanCTX::UnbindTexture(VulkanTexture &texture)
+{
+	if (texture.index == NO_TEXTURE_INDEX)
+		return;
+
+	// The stale descriptor stays behind, partially bound arrays don't mind as long as nothing samples it
+	residents[texture.index] = Resident();
+	freeTextureIndices.push_back(texture.index);
+	texture.index = NO_TEXTURE_INDEX;
+}
+
+void VulkanCTX::SetCompareTexture(const VulkanTexture &texture)
+{
+	compareIndex = texture.index;
+	if (compareIndex != NO_TEXTURE_INDEX)
+		residents[compareIndex].evict = nullptr;
+
+	if (texture.image != VK_NULL_HANDLE)
+		pendingTransitions.push_back(texture.image);
+	RequestRedraw();
+}
+
+void VulkanCTX::ShowVirtualTexture(const VulkanTexture &cache, const VulkanTexture &pageTable, uint32_t width, uint32_t height)
+{
+	virtualCacheIndex = pageTable.index != NO_TEXTURE_INDEX ? cache.index : NO_TEXTURE_INDEX;
+	virtualTableIndex = pageTable.index;
+	virtualWidth = width;
+	virtualHeight = height;
+	virtualCacheTexels = float(cache.width);
+
+	// Pages get swapped in and out by the owner, the textures themselves never go
+	if (cache.index != NO_TEXTURE_INDEX)
+		residents[cache.index].evict = nullptr;
+	if (pageTable.index != NO_TEXTURE_INDEX)
+		residents[pageTable.index].evict = nullptr;
+	RequestRedraw();
+}
+
+void VulkanCTX::TransitionTexture(const VulkanTexture &texture)
+{
+	if (texture.image != VK_NULL_HANDLE)
+		pendingTransitions.push_back(texture.image);
+}
+
+void VulkanCTX::SetEvictable(const VulkanTexture &texture, std::function<void()> evict)
+{
+	if (texture.index != NO_TEXTURE_INDEX && texture.index != textureIndex && texture.index != compareIndex)
+		residents[texture.index].evict = evict;
+}
+
+void VulkanCTX::SetMemoryBudget(VkDeviceSize budget)
+{
+	memoryBudget = budget;
+}
+
+VkDeviceSize VulkanCTX::getMemoryBudget()
+{
+	if (memoryBudget)
+		return memoryBudget;
+
+	VkPhysicalDeviceMemoryBudgetPropertiesEXT budgetProps = {};
+	budgetProps.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_BUDGET_PROPERTIES_EXT;
+
+	VkPhysicalDeviceMemoryProperties2 memoryProps = {};
+	memoryProps.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_PROPERTIES_2;
+	memoryProps.pNext = memoryBudgetSupported ? &budgetProps : nullptr;
+	vkGetPhysicalDeviceMemoryProperties2(physicalDev, &memoryProps);
+
+	// Other programs want some of the heap too
+	if (!memoryBudgetSupported)
+		return memoryProps.memoryProperties.memoryHeaps[localHeap].size / 4 * 3;
+
+	// The budget covers everything this process has on the heap, swapchain images and buffers too
+	VkDeviceSize resident = residentBytes;
+	VkDeviceSize other = budgetProps.heapUsage[localHeap] > resident ? budgetProps.heapUsage[localHeap] - resident : 0;
+	return budgetProps.heapBudget[localHeap] > other ? budgetProps.heapBudget[localHeap] - other : 0;
+}
+
+bool VulkanCTX::Evict(VkDeviceSize bytes)
+{
+	// Nothing the last frame drew, that's what's on screen
+	std::vector<uint32_t> candidates;
+	for (uint32_t i = 0; i < residents.size(); i++) {
+		if (residents[i].evict && residents[i].lastUsed + 1 < frameCount)
+			candidates.push_back(i);
+	}
+
+	std::sort(candidates.begin(), candidates.end(), [this](uint32_t a, uint32_t b) { return residents[a].lastUsed < residents[b].lastUsed; });
+
+	VkDeviceSize freed = 0;
+	for (uint32_t i = 0; i < candidates.size() && freed < bytes; i++) {
+		// The owner retires or releases it, which may clear the slot right here
+		std::function<void()> evict = std::move(residents[candidates[i]].evict);
+		residents[candidates[i]].evict = nullptr;
+		freed += residents[candidates[i]].size;
+		evictedBytes += residents[candidates[i]].size;
+		evictCount++;
+		evict();
+	}
+
+	return freed > 0;
+}
+
+bool VulkanCTX::ReleaseRetired()
+{
+	if (retiredTextures.empty())
+		return false;
+
+	// Everything submitted so far is done, only what the frame being put together draws has to stay
+	vkQueueWaitIdle(graphicsQueues[0]);
+
+	size_t count = retiredTextures.size();
+	for (size_t i = 0; i < retiredTextures.size();) {
+		VulkanTexture &texture = retiredTextures[i].texture;
+
+		if (texture.index == NO_TEXTURE_INDEX || residents[texture.index].lastUsed < frameCount) {
+			pendingTransitions.erase(std::remove(pendingTransitions.begin(), pendingTransitions.end(), texture.image), pendingTransitions.end());
+			ReleaseTexture(texture);
+			retiredTextures[i] = retiredTextures.back();
+			retiredTextures.pop_back();
+		} else {
+			i++;
+		}
+	}
+
+	return retiredTextures.size() < count;
+}
+
+void VulkanCTX::PrintResidencyStats()
+{
+	if (!evictCount && !allocRetries)
+		return;
+
+	std::cout << "Residency: " << evictCount << " textures evicted (" << (evictedBytes >> 20) << " MB), "
+		<< allocRetries << " allocations retried, budget " << (getMemoryBudget() >> 20) << " MB" << std::endl;
+}
+
+static bool regionContains(const VkBufferImageCopy &outer, const VkBufferImageCopy &inner)
+{
+	return inner.imageSubresource.mipLevel == outer.imageSubresource.mipLevel && inner.imageOffset.x >= outer.imageOffset.x && inner.imageOffset.y >= outer.imageOffset.y &&
+		inner.imageOffset.x + inner.imageExtent.width <= outer.imageOffset.x + outer.imageExtent.width &&
+		inner.imageOffset.y + inner.imageExtent.height <= outer.imageOffset.y + outer.imageExtent.height;
+}
+
+static bool regionsOverlap(const VkBufferImageCopy &a, const VkBufferImageCopy &b)
+{
+	return a.imageSubresource.mipLevel == b.imageSubresource.mipLevel && a.imageOffset.x < int32_t(b.imageOffset.x + b.imageExtent.width) && b.imageOffset.x < int32_t(a.imageOffset.x + a.imageExtent.width) &&
+		a.imageOffset.y < int32_t(b.imageOffset.y + b.imageExtent.height) && b.imageOffset.y < int32_t(a.imageOffset.y + a.imageExtent.height);
+}
+
+bool VulkanCTX::UpdateTextureRegion(uint32_t x, uint32_t y, uint32_t width, uint32_t height, const void *data, size_t stride, uint32_t channels, PixelType type)
+{
+	if (textureImage == VK_NULL_HANDLE || swapchainImages.empty() || !data || !width || !height)
+		return false;
+	if (x >= textureWidth || y >= textureHeight || width > textureWidth - x || height > textureHeight - y)
+		return false;
+	if (channels < 1 || channels > 4 || (type != PIXEL_U8 && channels != 4))
+		return false;
+
+	// The texels have to go in as they are, BC blocks and mip levels would need the whole image again.
+	// 8-bit input can always be expanded into an RGBA texture.
+	VkFormat format = getTextureFormat(channels, type);
+	if (textureLevels > 1 || (format != textureFormat && !(type == PIXEL_U8 && textureFormat == VK_FORMAT_R8G8B8A8_SRGB))) {
+		std::cout << "Can't update part of a compressed, mipmapped or differently formatted texture :(" << std::endl;
+		return false;
+	}
+
+	uint32_t texel = texelSize(textureFormat);
+	VkDeviceSize size = VkDeviceSize(width) * height * texel;
+	uint8_t *dst = static_cast<uint8_t *>(StageRegion(textureImage, 0, x, y, width, height, size));
+	const uint8_t *src = static_cast<const uint8_t *>(data);
+	for (uint32_t row = 0; row < height; row++)
+		ConvertTexels(dst + size_t(row) * width * texel, src + row * stride, width, 1, channels, type, textureFormat);
+
+	return true;
+}
+
+bool VulkanCTX::CopyToTexture(const VulkanTexture &texture, uint32_t level, uint32_t x, uint32_t y, uint32_t width, uint32_t height, const void *texels)
+{
+	if (texture.image == VK_NULL_HANDLE || swapchainImages.empty() || !texels || !width || !height || level >= texture.levels)
+		return false;
+
+	uint32_t levelWidth = std::max(texture.width >> level, 1u), levelHeight = std::max(texture.height >> level, 1u);
+	if (x >= levelWidth || y >= levelHeight || width > levelWidth - x || height > levelHeight - y)
+		return false;
+
+	uint32_t blockWidth, blockHeight, blockBytes;
+	if (!getFormatBlock(texture.format, blockWidth, blockHeight, blockBytes) || blockWidth != 1 || blockHeight != 1)
+		return false;
+
+	VkDeviceSize size = VkDeviceSize(width) * height * blockBytes;
+	memcpy(StageRegion(texture.image, level, x, y, width, height, size), texels, static_cast<size_t>(size));
+	return true;
+}
+
+void *VulkanCTX::StageRegion(VkImage image, uint32_t level, uint32_t x, uint32_t y, uint32_t width, uint32_t height, VkDeviceSize size)
+{
+	if (regionStaging.size() < swapchainImages.size())
+		regionStaging.resize(swapchainImages.size());
+
+	RegionStaging &staging = regionStaging[currentImage];
+	VkDeviceSize offset = (staging.used + 15) & ~VkDeviceSize(15); // fine for every texel size
+
+	// Update() waited for this frame's last use, so the buffer can grow and the old one go right away
+	if (offset + size > staging.size) {
+		VkDeviceSize newSize = std::max(offset + size, staging.size * 2);
+		VkBuffer buffer;
+		VkDeviceMemory memory;
+		void *mapped;
+
+		createBuffer(device, physicalDev, newSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &buffer, &memory, nullptr, 0);
+		VK_ASSERT(vkMapMemory(device, memory, 0, VK_WHOLE_SIZE, 0, &mapped), "Failed to map Region staging buffer")
+
+		if (staging.used)
+			memcpy(mapped, staging.data, static_cast<size_t>(staging.used));
+		if (staging.data)
+			vkUnmapMemory(device, staging.memory);
+		vkDestroyBuffer(device, staging.buffer, nullptr);
+		vkFreeMemory(device, staging.memory, nullptr);
+
+		staging.buffer = buffer;
+		staging.memory = memory;
+		staging.data = mapped;
+		staging.size = newSize;
+	}
+
+	staging.used = offset + size;
+	RequestRedraw();
+
+	// Tiles the filter cut from these texels are stale now
+	if (image == textureImage)
+		DropFilterTiles(x << level, y << level, width << level, height << level);
+
+	RegionCopy region = {};
+	region.image = image;
+	region.copy.bufferOffset = offset;
+	region.copy.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	region.copy.imageSubresource.mipLevel = level;
+	region.copy.imageSubresource.layerCount = 1;
+	region.copy.imageOffset = {int32_t(x), int32_t(y), 0};
+	region.copy.imageExtent = {width, height, 1};
+
+	// Copies the new one hides completely can go, ones it only overlaps have to land first.
+	// Redrawing the same spot several times a frame only copies it once.
+	for (auto it = staging.copies.begin(); it != staging.copies.end();) {
+		if (it->image != image) {
+			++it;
+		} else if (regionContains(region.copy, it->copy)) {
+			it = staging.copies.erase(it);
+		} else {
+			if (regionsOverlap(region.copy, it->copy))
+				region.batch = std::max(region.batch, it->batch + 1);
+			++it;
+		}
+	}
+
+	staging.copies.push_back(region);
+	return static_cast<uint8_t *>(staging.data) + offset;
+}
+
+void VulkanCTX::DropRegions(VkImage image)
+{
+	for (auto &staging : regionStaging) {
+		staging.copies.erase(std::remove_if(staging.copies.begin(), staging.copies.end(), [image](const RegionCopy &copy) { return copy.image == image; }), staging.copies.end());
+		if (staging.copies.empty())
+			staging.used = 0;
+	}
+}
+
+void VulkanCTX::RecordRegions(VkCommandBuffer commandBuffer)
+{
+	if (currentImage >= regionStaging.size() || regionStaging[currentImage].copies.empty())
+		return;
+
+	RegionStaging &staging = regionStaging[currentImage];
+	std::stable_sort(staging.copies.begin(), staging.copies.end(), [](const RegionCopy &a, const RegionCopy &b) {
+		return a.image != b.image ? a.image < b.image : a.batch < b.batch;
+	});
+
+	// One copy command per batch, with a barrier between batches that write the same texels
+	std::vector<VkBufferImageCopy> batch;
+	for (size_t i = 0; i < staging.copies.size();) {
+		VkImage image = staging.copies[i].image;
+		transitionImageLayoutCmd(image, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, commandBuffer);
+
+		for (bool first = true; i < staging.copies.size() && staging.copies[i].image == image; first = false) {
+			if (!first)
+				transitionImageLayoutCmd(image, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, commandBuffer);
+
+			uint32_t index = staging.copies[i].batch;
+			batch.clear();
+			for (; i < staging.copies.size() && staging.copies[i].image == image && staging.copies[i].batch == index; i++)
+				batch.push_back(staging.copies[i].copy);
+
+			copyBufferToImageCmd(batch, staging.buffer, image, commandBuffer);
+		}
+
+		transitionImageLayoutCmd(image, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, commandBuffer);
+	}
+
+	// The buffer stays busy until this frame's fence, Update() waits for that before it gets refilled
+	staging.copies.clear();
+	staging.used = 0;
+}
+
+void VulkanCTX::ReleaseRegions()
+{
+	for (auto &staging : regionStaging) {
+		if (staging.data)
+			vkUnmapMemory(device, staging.memory);
+		vkDestroyBuffer(device, staging.buffer, nullptr);
+		vkFreeMemory(device, staging.memory, nullptr);
+	}
+
+	regionStaging.clear();
+}
+
+bool VulkanCTX::SetupGallery(uint32_t maxTiles)
+{
+	if (textureSet == VK_NULL_HANDLE || !maxTiles) {
+		std::cout << "The gallery needs a window and bindless textures to draw in :(" << std::endl;
+		return false;
+	}
+
+	ReleaseGallery();
+
+	VkDescriptorSetLayoutBinding layoutBinding = {};
+	layoutBinding.binding = 0;
+	layoutBinding.descriptorCount = 1;
+	layoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	layoutBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+
+	VkDescriptorSetLayoutCreateInfo layoutInfo = {};
+	layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+	layoutInfo.bindingCount = 1;
+	layoutInfo.pBindings = &layoutBinding;
+
+	VK_ASSERT(vkCreateDescriptorSetLayout(device, &layoutInfo, nullptr, &galleryDescriptorLayout), "Failed to create Gallery Descriptor Layout!")
+
+	// Thumbnails come out of the same bindless array as the view's textures
+	VkDescriptorSetLayout setLayouts[2] = { galleryDescriptorLayout, textureSetLayout };
+
+	VkPipelineLayoutCreateInfo pipelineLayoutInfo = {};
+	pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+	pipelineLayoutInfo.setLayoutCount = 2;
+	pipelineLayoutInfo.pSetLayouts = setLayouts;
+
+	VK_ASSERT(vkCreatePipelineLayout(device, &pipelineLayoutInfo, nullptr, &galleryPipelineLayout), "Failed to create Gallery Pipeline Layout")
+
+	galleryMaxTiles = maxTiles;
+
+	// Otherwise the first Resize() does it
+	if (!swapchainImages.empty()) {
+		SetupGalleryFrames();
+		galleryPipeline = CreatePipeline(renderPass, galleryPipelineLayout, swapExtent.width, swapExtent.height, SHADERS_GALLERY);
+	}
+
+	return true;
+}
+
+void VulkanCTX::ReleaseGallery()
+{
+	ReleaseGalleryFrames();
+
+	vkDestroyPipeline(device, galleryPipeline, nullptr);
+	vkDestroyPipelineLayout(device, galleryPipelineLayout, nullptr);
+	vkDestroyDescriptorSetLayout(device, galleryDescriptorLayout, nullptr);
+
+	galleryPipeline = VK_NULL_HANDLE;
+	galleryPipelineLayout = VK_NULL_HANDLE;
+	galleryDescriptorLayout = VK_NULL_HANDLE;
+	galleryMaxTiles = 0;
+}
+
+void VulkanCTX::SetupGalleryFrames()
+{
+	ReleaseGalleryFrames();
+
+	uint32_t imageCount = static_cast<uint32_t>(swapchainImages.size());
+
+	VkDescriptorPoolSize poolSize = {};
+	poolSize.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	poolSize.descriptorCount = imageCount;
+
+	VkDescriptorPoolCreateInfo poolInfo = {};
+	poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+	poolInfo.poolSizeCount = 1;
+	poolInfo.pPoolSizes = &poolSize;
+	poolInfo.maxSets = imageCount;
+
+	VK_ASSERT(vkCreateDescriptorPool(device, &poolInfo, nullptr, &galleryDescriptorPool), "Failed to create Gallery Descriptor Pool!")
+
+	galleryFrames.resize(imageCount);
+	VkDeviceSize size = VkDeviceSize(galleryMaxTiles) * sizeof(VulkanTile);
+
+	// Written by the CPU every frame and read once by the vertex shader, no point in a device local copy
+	for (auto &frame : galleryFrames) {
+		createBuffer(device, physicalDev, size, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &frame.buffer, &frame.memory, nullptr, 0);
+		VK_ASSERT(vkMapMemory(device, frame.memory, 0, VK_WHOLE_SIZE, 0, &frame.data), "Failed to map Gallery tiles")
+
+		VkDescriptorSetAllocateInfo setAllocInfo = {};
+		setAllocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+		setAllocInfo.descriptorPool = galleryDescriptorPool;
+		setAllocInfo.descriptorSetCount = 1;
+		setAllocInfo.pSetLayouts = &galleryDescriptorLayout;
+
+		VK_ASSERT(vkAllocateDescriptorSets(device, &setAllocInfo, &frame.descriptorSet), "Failed to allocate Gallery Descriptor Set!")
+
+		VkDescriptorBufferInfo bufferInfo = {};
+		bufferInfo.buffer = frame.buffer;
+		bufferInfo.offset = 0;
+		bufferInfo.range = size;
+
+		VkWriteDescriptorSet descriptorWrite = {};
+		descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		descriptorWrite.dstSet = frame.descriptorSet;
+		descriptorWrite.dstBinding = 0;
+		descriptorWrite.descriptorCount = 1;
+		descriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		descriptorWrite.pBufferInfo = &bufferInfo;
+
+		vkUpdateDescriptorSets(device, 1, &descriptorWrite, 0, nullptr);
+	}
+}
+
+void VulkanCTX::ReleaseGalleryFrames()
+{
+	for (auto &frame : galleryFrames) {
+		if (frame.data)
+			vkUnmapMemory(device, frame.memory);
+		vkDestroyBuffer(device, frame.buffer, nullptr);
+		vkFreeMemory(device, frame.memory, nullptr);
+	}
+
+	galleryFrames.clear();
+
+	vkDestroyDescriptorPool(device, galleryDescriptorPool, nullptr);
+	galleryDescriptorPool = VK_NULL_HANDLE;
+}
+
+void VulkanCTX::SetupSingleSets()
+{
+	ReleaseSingleSets();
+
+	uint32_t imageCount = static_cast<uint32_t>(swapchainImages.size());
+
+	VkDescriptorPoolSize poolSizes[2] = {{}, {}};
+	poolSizes[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+	poolSizes[0].descriptorCount = imageCount;
+	poolSizes[1].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	poolSizes[1].descriptorCount = imageCount;
+
+	VkDescriptorPoolCreateInfo poolInfo = {};
+	poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+	poolInfo.poolSizeCount = 2;
+	poolInfo.pPoolSizes = poolSizes;
+	poolInfo.maxSets = imageCount;
+
+	VK_ASSERT(vkCreateDescriptorPool(device, &poolInfo, nullptr, &singlePool), "Failed to create Single Texture Pool!")
+
+	singleSets.resize(imageCount);
+	for (auto &set : singleSets) {
+		VkDescriptorSetAllocateInfo setAllocInfo = {};
+		setAllocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+		setAllocInfo.descriptorPool = singlePool;
+		setAllocInfo.descriptorSetCount = 1;
+		setAllocInfo.pSetLayouts = &singleLayout;
+
+		VK_ASSERT(vkAllocateDescriptorSets(device, &setAllocInfo, &set), "Failed to allocate Single Texture Set!")
+
+		// The texture is written in every frame that draws it
+		VkDescriptorBufferInfo bufferInfo = {};
+		bufferInfo.buffer = uniformBuffer;
+		bufferInfo.offset = 0;
+		bufferInfo.range = sizeof(VulkanUBO);
+
+		VkWriteDescriptorSet descriptorWrite = {};
+		descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		descriptorWrite.dstSet = set;
+		descriptorWrite.dstBinding = 0;
+		descriptorWrite.descriptorCount = 1;
+		descriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+		descriptorWrite.pBufferInfo = &bufferInfo;
+
+		vkUpdateDescriptorSets(device, 1, &descriptorWrite, 0, nullptr);
+	}
+}
+
+void VulkanCTX::ReleaseSingleSets()
+{
+	singleSets.clear();
+
+	vkDestroyDescriptorPool(device, singlePool, nullptr);
+	singlePool = VK_NULL_HANDLE;
+}
+
+uint32_t VulkanCTX::SetGalleryTiles(const VulkanTile *tiles, uint32_t count)
+{
+	if (currentImage >= galleryFrames.size())
+		return 0;
+
+	// Update() waited for this frame's last use of the buffer
+	GalleryFrame &frame = galleryFrames[currentImage];
+	frame.count = std::min(count, galleryMaxTiles);
+	memcpy(frame.data, tiles, frame.count * sizeof(VulkanTile));
+
+	for (uint32_t i = 0; i < frame.count; i++)
+		TouchTexture(tiles[i].textureIndex);
+
+	return frame.count;
+}
+
+static const uint32_t FILTER_TABLE_SIZE = 64; // most tiles across the window, more and it's filtered directly
+static const uint64_t NO_TILE = ~uint64_t(0);
+
+void VulkanCTX::SetupFilterCache()
+{
+	if (textureSet == VK_NULL_HANDLE)
+		return;
+
+	// Same as the swapchain pass, but the cache keeps what the other slots hold and stays shader readable
+	VkAttachmentDescription colorAttachment = {};
+	colorAttachment.finalLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	colorAttachment.format = VK_FORMAT_R16G16B16A16_SFLOAT; // the filter goes past 1 before the tint brings it down
+	colorAttachment.initialLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	colorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
+	colorAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
+	colorAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+	colorAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+	colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+
+	VkAttachmentReference colorAttachmentReference = {};
+	colorAttachmentReference.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+
+	VkSubpassDescription subpassDescription = {};
+	subpassDescription.colorAttachmentCount = 1;
+	subpassDescription.pColorAttachments = &colorAttachmentReference;
+	subpassDescription.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+
+	// Earlier frames may still sample a slot that gets a new tile, later draws sample the new ones
+	VkSubpassDependency subpassDependencies[2] = {{}, {}};
+	subpassDependencies[0].srcSubpass = VK_SUBPASS_EXTERNAL;
+	subpassDependencies[0].dstSubpass = 0;
+	subpassDependencies[0].srcStageMask = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+	subpassDependencies[0].dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+	subpassDependencies[0].srcAccessMask = 0;
+	subpassDependencies[0].dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+
+	subpassDependencies[1].srcSubpass = 0;
+	subpassDependencies[1].dstSubpass = VK_SUBPASS_EXTERNAL;
+	subpassDependencies[1].srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+	subpassDependencies[1].dstStageMask = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+	subpassDependencies[1].srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+	subpassDependencies[1].dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+
+	VkRenderPassCreateInfo renderPassCreateInfo = {};
+	renderPassCreateInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+	renderPassCreateInfo.attachmentCount = 1;
+	renderPassCreateInfo.pAttachments = &colorAttachment;
+	renderPassCreateInfo.subpassCount = 1;
+	renderPassCreateInfo.pSubpasses = &subpassDescription;
+	renderPassCreateInfo.dependencyCount = 2;
+	renderPassCreateInfo.pDependencies = subpassDependencies;
+
+	VK_ASSERT(vkCreateRenderPass(device, &renderPassCreateInfo, nullptr, &filterPass), "Failed to create Filter Cache Render Pass!")
+
+	filterPipeline = CreatePipeline(filterPass, pipelineLayout, 0, 0, SHADERS_VIEW);
+
+	// Neither counts against the memory budget, they're there for as long as the window is
+	filterCache.format = colorAttachment.format;
+	filterCache.width = filterCache.height = FILTER_CACHE_TILES * FILTER_TILE_SIZE;
+	createImage(device, physicalDev, filterCache.width, filterCache.height, filterCache.format, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &filterCache.image, &filterCache.memory);
+	filterCache.view = createImageView(device, filterCache.image, filterCache.format);
+
+	filterTable.format = VK_FORMAT_R8G8B8A8_UNORM;
+	filterTable.width = filterTable.height = FILTER_TABLE_SIZE;
+	createImage(device, physicalDev, filterTable.width, filterTable.height, filterTable.format, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &filterTable.image, &filterTable.memory);
+	filterTable.view = createImageView(device, filterTable.image, filterTable.format);
+
+	VkFramebufferCreateInfo framebufferInfo = {};
+	framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+	framebufferInfo.renderPass = filterPass;
+	framebufferInfo.attachmentCount = 1;
+	framebufferInfo.pAttachments = &filterCache.view;
+	framebufferInfo.width = filterCache.width;
+	framebufferInfo.height = filterCache.height;
+	framebufferInfo.layers = 1;
+
+	VK_ASSERT(vkCreateFramebuffer(device, &framebufferInfo, nullptr, &filterFramebuffer), "Failed to create Filter Cache Framebuffer")
+
+	// Without slots for both the window filters directly
+	BindTexture(filterCache);
+	BindTexture(filterTable);
+
+	filterSlots.assign(FILTER_CACHE_TILES * FILTER_CACHE_TILES, NO_TILE);
+	filterSlotUsed.assign(filterSlots.size(), 0);
+	filterTiles.clear();
+	filterTableValid = false;
+	filterFresh = true;
+}
+
+void VulkanCTX::ReleaseFilterCache()
+{
+	if (filterPass == VK_NULL_HANDLE)
+		return;
+
+	vkDestroyFramebuffer(device, filterFramebuffer, nullptr);
+	vkDestroyPipeline(device, filterPipeline, nullptr);
+	vkDestroyRenderPass(device, filterPass, nullptr);
+	ReleaseTexture(filterCache);
+	ReleaseTexture(filterTable);
+
+	filterFramebuffer = VK_NULL_HANDLE;
+	filterPipeline = VK_NULL_HANDLE;
+	filterPass = VK_NULL_HANDLE;
+	filterSlots.clear();
+	filterSlotUsed.clear();
+	filterTiles.clear();
+}
+
+void VulkanCTX::ZoomView(float factor, float x, float y)
+{
+	if (factor <= 0.0f || !swapExtent.width || !swapExtent.height)
+		return;
+
+	// The texel under x, y stays there
+	float u = viewRect[0] + x / swapExtent.width * viewRect[2];
+	float v = viewRect[1] + y / swapExtent.height * viewRect[3];
+
+	// From all of the texture to 256 times closer
+	float size = std::min(std::max(viewRect[2] / factor, 1.0f / 256.0f), 1.0f);
+	viewRect[0] = u - x / swapExtent.width * size;
+	viewRect[1] = v - y / swapExtent.height * size;
+	viewRect[2] = viewRect[3] = size;
+	PanView(0.0f, 0.0f);
+}
+
+void VulkanCTX::PanView(float dx, float dy)
+{
+	if (!swapExtent.width || !swapExtent.height)
+		return;
+
+	// Never past the texture's edges
+	viewRect[0] = std::min(std::max(viewRect[0] - dx / swapExtent.width * viewRect[2], 0.0f), 1.0f - viewRect[2]);
+	viewRect[1] = std::min(std::max(viewRect[1] - dy / swapExtent.height * viewRect[3], 0.0f), 1.0f - viewRect[3]);
+	RequestRedraw();
+}
+
+bool VulkanCTX::UpdateFilterTiles()
+{
+	filterDraws.clear();
+	if (!textureWidth || !textureHeight || !swapExtent.width || !swapExtent.height)
+		return false;
+
+	viewFrames++;
+
+	// About a texel per pixel, like the mip level the sampler would pick - fewer pixels at a lower render scale
+	double scale = std::max(double(viewRect[2]) * textureWidth / swapExtent.width, double(viewRect[3]) * textureHeight / swapExtent.height) / renderScale;
+	viewLevel = scale > 1.0 ? std::min(static_cast<uint32_t>(std::log2(scale)), 24u) : 0;
+
+	if (filterCache.index == NO_TEXTURE_INDEX || filterTable.index == NO_TEXTURE_INDEX) {
+		directFrames++;
+		return false;
+	}
+
+	// Every tile the window can land on, worked out like the shader does it
+	uint32_t levelWidth = std::max(textureWidth >> viewLevel, 1u), levelHeight = std::max(textureHeight >> viewLevel, 1u);
+	auto tileOf = [](double uv, uint32_t size) {
+		return static_cast<uint32_t>(std::min(std::min(std::max(uv, 0.0), 1.0) * size, size - 0.5) / (FILTER_TILE_SIZE - 2));
+	};
+
+	uint32_t x0 = tileOf(viewRect[0], levelWidth), x1 = tileOf(double(viewRect[0]) + viewRect[2], levelWidth);
+	uint32_t y0 = tileOf(viewRect[1], levelHeight), y1 = tileOf(double(viewRect[1]) + viewRect[3], levelHeight);
+	uint32_t gridWidth = x1 - x0 + 1, gridHeight = y1 - y0 + 1;
+
+	// A window bigger than the cache would throw out tiles it needs, filtering it directly is cheaper
+	if (gridWidth > FILTER_TABLE_SIZE || gridHeight > FILTER_TABLE_SIZE || gridWidth * gridHeight > filterSlots.size()) {
+		directFrames++;
+		return false;
+	}
+
+	bool changed = !filterTableValid || viewLevel != filterLevel || x0 != filterOrigin[0] || y0 != filterOrigin[1] || gridWidth != filterGrid[0] || gridHeight != filterGrid[1];
+	filterEntries.resize(size_t(gridWidth) * gridHeight);
+
+	for (uint32_t y = 0; y < gridHeight; y++) {
+		for (uint32_t x = 0; x < gridWidth; x++) {
+			uint64_t key = getTileKey(viewLevel, x0 + x, y0 + y);
+			auto it = filterTiles.find(key);
+			uint32_t slot;
+
+			if (it != filterTiles.end()) {
+				slot = it->second;
+				reusedTiles++;
+			} else {
+				// A free slot, or the one that was on screen the longest time ago - never one this frame shows
+				slot = 0;
+				for (uint32_t i = 0; i < filterSlots.size(); i++) {
+					if (filterSlots[i] == NO_TILE) {
+						slot = i;
+						break;
+					}
+					if (filterSlotUsed[i] < filterSlotUsed[slot])
+						slot = i;
+				}
+
+				if (filterSlots[slot] != NO_TILE)
+					filterTiles.erase(filterSlots[slot]);
+
+				filterSlots[slot] = key;
+				filterTiles[key] = slot;
+				filterDraws.push_back(slot);
+				changed = true;
+			}
+
+			filterSlotUsed[slot] = frameCount + 1; // ahead of every slot an earlier frame showed
+			filterEntries[size_t(y) * gridWidth + x] = (slot % FILTER_CACHE_TILES) | (slot / FILTER_CACHE_TILES) << 8 | 0xFF000000u;
+		}
+	}
+
+	if (changed) {
+		if (!CopyToTexture(filterTable, 0, 0, 0, gridWidth, gridHeight, filterEntries.data())) {
+			directFrames++;
+			return false;
+		}
+
+		filterLevel = viewLevel;
+		filterOrigin[0] = x0;
+		filterOrigin[1] = y0;
+		filterGrid[0] = gridWidth;
+		filterGrid[1] = gridHeight;
+		filterTableValid = true;
+	}
+
+	return true;
+}
+
+void VulkanCTX::RecordFilterTiles(VkCommandBuffer commandBuffer)
+{
+	if (filterDraws.empty())
+		return;
+
+	VkRenderPassBeginInfo renderPassInfo = {};
+	renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+	renderPassInfo.renderPass = filterPass;
+	renderPassInfo.framebuffer = filterFramebuffer;
+	renderPassInfo.renderArea.offset = {0, 0};
+	renderPassInfo.renderArea.extent = {filterCache.width, filterCache.height};
+
+	VkDescriptorSet sets[2] = { descriptorSet, textureSet };
+
+	vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, filterPipeline);
+	vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 2, sets, 0, nullptr);
+
+	uint32_t levelWidth = std::max(textureWidth >> viewLevel, 1u), levelHeight = std::max(textureHeight >> viewLevel, 1u);
+
+	for (uint32_t slot : filterDraws) {
+		uint64_t key = filterSlots[slot];
+		uint32_t x = key & 0xFFFFFF, y = (key >> 24) & 0xFFFFFF;
+
+		// The quad covers the slot, border and all, and the filter sees the tile's part of the texture
+		VkViewport viewport = {float(slot % FILTER_CACHE_TILES * FILTER_TILE_SIZE), float(slot / FILTER_CACHE_TILES * FILTER_TILE_SIZE), float(FILTER_TILE_SIZE), float(FILTER_TILE_SIZE), 0.0f, 1.0f};
+		VkRect2D scissor = {{int32_t(viewport.x), int32_t(viewport.y)}, {FILTER_TILE_SIZE, FILTER_TILE_SIZE}};
+
+		VulkanPushConstants pushConstants = {};
+		pushConstants.textureIndex = textureIndex;
+		pushConstants.compareIndex = NO_TEXTURE_INDEX;
+		pushConstants.pageTable = NO_TEXTURE_INDEX;
+		pushConstants.view[0] = (float(x) * (FILTER_TILE_SIZE - 2) - 1.0f) / levelWidth;
+		pushConstants.view[1] = (float(y) * (FILTER_TILE_SIZE - 2) - 1.0f) / levelHeight;
+		pushConstants.view[2] = float(FILTER_TILE_SIZE) / levelWidth;
+		pushConstants.view[3] = float(FILTER_TILE_SIZE) / levelHeight;
+		pushConstants.level = float(viewLevel);
+		pushConstants.tint = 0.0f;
+
+		vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+		vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+		vkCmdPushConstants(commandBuffer, pipelineLayout, VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(pushConstants), &pushConstants);
+		vkCmdDraw(commandBuffer, 6, 1, 0, 0);
+	}
+
+	vkCmdEndRenderPass(commandBuffer);
+	filteredTiles += filterDraws.size();
+}
+
+void VulkanCTX::DropFilterTiles(uint32_t x, uint32_t y, uint32_t width, uint32_t height)
+{
+	if (!textureWidth || !textureHeight)
+		return;
+
+	// The changed texels in texture coordinates, grown by the filter's reach. The sampler repeats,
+	// so taps off one edge read the other.
+	double u0 = double(x) / textureWidth - 1.0 / 300.0, u1 = double(x + width) / textureWidth + 1.0 / 300.0;
+	double v0 = double(y) / textureHeight - 1.0 / 200.0, v1 = double(y + height) / textureHeight + 1.0 / 200.0;
+
+	for (uint32_t slot = 0; slot < filterSlots.size(); slot++) {
+		uint64_t key = filterSlots[slot];
+		if (key == NO_TILE)
+			continue;
+
+		// Tile and border at its level, one more texel of it for the sampler's footprint
+		uint32_t level = static_cast<uint32_t>(key >> 48);
+		double levelWidth = std::max(textureWidth >> level, 1u), levelHeight = std::max(textureHeight >> level, 1u);
+		double tileX = double(key & 0xFFFFFF) * (FILTER_TILE_SIZE - 2), tileY = double((key >> 24) & 0xFFFFFF) * (FILTER_TILE_SIZE - 2);
+		double tu0 = (tileX - 2.0) / levelWidth, tu1 = (tileX + FILTER_TILE_SIZE) / levelWidth;
+		double tv0 = (tileY - 2.0) / levelHeight, tv1 = (tileY + FILTER_TILE_SIZE) / levelHeight;
+
+		bool stale = false;
+		for (int wrapY = -1; wrapY <= 1 && !stale; wrapY++) {
+			for (int wrapX = -1; wrapX <= 1 && !stale; wrapX++)
+				stale = u0 + wrapX < tu1 && tu0 < u1 + wrapX && v0 + wrapY < tv1 && tv0 < v1 + wrapY;
+		}
+
+		if (stale) {
+			filterTiles.erase(key);
+			filterSlots[slot] = NO_TILE;
+		}
+	}
+}
+
+void VulkanCTX::DropFilterTiles()
+{
+	std::fill(filterSlots.begin(), filterSlots.end(), NO_TILE);
+	filterTiles.clear();
+}
+
+void VulkanCTX::PrintFilterStats()
+{
+	if (!viewFrames)
+		return;
+
+	std::cout << "Filter cache: " << filteredTiles << " tiles filtered, " << reusedTiles << " reused, window filtered directly in "
+		<< directFrames << " of " << viewFrames << " frames" << std::endl;
+}
+
+void VulkanCTX::SetupScaledTarget(uint32_t width, uint32_t height)
+{
+	ReleaseScaledTarget();
+	if (frameBudget <= 0.0f || filterPass == VK_NULL_HANDLE)
+		return;
+
+	// Same format as the filter cache, so it's drawn through the same pass and pipeline
+	scaledTarget.format = filterCache.format;
+	scaledTarget.width = width;
+	scaledTarget.height = height;
+	createImage(device, physicalDev, width, height, scaledTarget.format, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &scaledTarget.image, &scaledTarget.memory);
+	scaledTarget.view = createImageView(device, scaledTarget.image, scaledTarget.format);
+
+	VkFramebufferCreateInfo framebufferInfo = {};
+	framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+	framebufferInfo.renderPass = filterPass;
+	framebufferInfo.attachmentCount = 1;
+	framebufferInfo.pAttachments = &scaledTarget.view;
+	framebufferInfo.width = width;
+	framebufferInfo.height = height;
+	framebufferInfo.layers = 1;
+
+	VK_ASSERT(vkCreateFramebuffer(device, &framebufferInfo, nullptr, &scaledFramebuffer), "Failed to create Scaled Target Framebuffer")
+
+	if (BindTexture(scaledTarget) == NO_TEXTURE_INDEX) {
+		std::cout << "No slot for the scaled target, drawing at full resolution :(" << std::endl;
+		ReleaseScaledTarget();
+		return;
+	}
+
+	scaledFresh = true;
+
+	// Without timestamps it's drawn the same way, the scale just stays where it is
+	if (timestampPeriod <= 0.0f) {
+		std::cout << "The GPU can't time the view, dynamic resolution stays at " << renderScale << " :(" << std::endl;
+		return;
+	}
+
+	VkQueryPoolCreateInfo queryPoolInfo = {};
+	queryPoolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+	queryPoolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+	queryPoolInfo.queryCount = 2 * static_cast<uint32_t>(swapchainImages.size());
+
+	VK_ASSERT(vkCreateQueryPool(device, &queryPoolInfo, nullptr, &timestampPool), "Failed to create Timestamp Query Pool")
+	timestampScales.assign(swapchainImages.size(), 0.0f);
+}
+
+void VulkanCTX::ReleaseScaledTarget()
+{
+	vkDestroyQueryPool(device, timestampPool, nullptr);
+	timestampPool = VK_NULL_HANDLE;
+	timestampScales.clear();
+
+	if (scaledFramebuffer == VK_NULL_HANDLE)
+		return;
+
+	vkDestroyFramebuffer(device, scaledFramebuffer, nullptr);
+	ReleaseTexture(scaledTarget);
+	scaledFramebuffer = VK_NULL_HANDLE;
+	scaledFresh = false;
+}
+
+void VulkanCTX::UpdateRenderScale(double ms, float scale)
+{
+	timedFrames++;
+	gpuTimeTotal += ms;
+
+	// The view costs about as much as it has pixels, so frames drawn before the last change count
+	// as if they had been drawn at this scale already
+	ms *= double(renderScale) * renderScale / (double(scale) * scale);
+	gpuTime = gpuTime > 0.0 ? gpuTime * 0.8 + ms * 0.2 : ms;
+
+	// A bit under the budget, straight down when over it but only creeping back up, or it would
+	// bounce between two scales. Steps of 1/32 of the window leave it alone for small changes.
+	float target = float(renderScale * std::sqrt(frameBudget * 0.9 / std::max(gpuTime, 0.001)));
+	float next = renderScale;
+	if (gpuTime > frameBudget)
+		next = target;
+	else if (gpuTime < frameBudget * 0.75)
+		next = std::min(target, renderScale + 1.0f / 32.0f);
+
+	next = std::min(std::max(std::floor(next * 32.0f) / 32.0f, MIN_RENDER_SCALE), 1.0f);
+	if (next != renderScale) {
+		renderScale = next;
+		scaleChanges++;
+	}
+}
+
+void VulkanCTX::PrintScaleStats()
+{
+	if (!scaledFrames)
+		return;
+
+	std::cout << "Dynamic resolution: " << scaledFrames << " frames at " << 100.0 * renderScaleTotal / scaledFrames << "% of the window on average, "
+		<< scaleChanges << " scale changes";
+	if (timedFrames)
+		std::cout << ", " << gpuTimeTotal / timedFrames << " ms of " << frameBudget << " ms GPU time per frame";
+	std::cout << std::endl;
+}
+
+void VulkanCTX::SetupOffscreen(uint32_t slotCount, VkFormat inputFormat, VkSamplerYcbcrModelConversion ycbcrModel)
+{
+	offscreenInputFormat = inputFormat;
+	offscreenOutputFormat = OFFSCREEN_FORMAT;
+	uint32_t descriptorsPerSampler = 1;
+
+	if (inputFormat == VK_FORMAT_G8_B8_R8_3PLANE_420_UNORM || inputFormat == VK_FORMAT_G8_B8R8_2PLANE_420_UNORM) {
+		VK_FATAL(!ycbcrSupported, "Device can't sample YUV images")
+
+		VkFormatProperties formatProps;
+		vkGetPhysicalDeviceFormatProperties(physicalDev, inputFormat, &formatProps);
+		VkFormatFeatureFlags features = formatProps.optimalTilingFeatures;
+		VK_FATAL(!(features & VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT), "YUV format can't be sampled on this device")
+
+		// Samplers with a conversion can only filter the way the conversion reconstructs chroma
+		VkFilter filter = (features & VK_FORMAT_FEATURE_SAMPLED_IMAGE_YCBCR_CONVERSION_LINEAR_FILTER_BIT) ? VK_FILTER_LINEAR : VK_FILTER_NEAREST;
+		VkChromaLocation xChroma = (features & VK_FORMAT_FEATURE_COSITED_CHROMA_SAMPLES_BIT) ? VK_CHROMA_LOCATION_COSITED_EVEN : VK_CHROMA_LOCATION_MIDPOINT;
+
+		VkSamplerYcbcrConversionCreateInfo conversionInfo = {};
+		conversionInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_YCBCR_CONVERSION_CREATE_INFO;
+		conversionInfo.format = inputFormat;
+		conversionInfo.ycbcrModel = ycbcrModel;
+		conversionInfo.ycbcrRange = VK_SAMPLER_YCBCR_RANGE_ITU_NARROW;
+		conversionInfo.components = { VK_COMPONENT_SWIZZLE_IDENTITY, VK_COMPONENT_SWIZZLE_IDENTITY, VK_COMPONENT_SWIZZLE_IDENTITY, VK_COMPONENT_SWIZZLE_IDENTITY };
+		conversionInfo.xChromaOffset = xChroma;
+		conversionInfo.yChromaOffset = VK_CHROMA_LOCATION_MIDPOINT;
+		conversionInfo.chromaFilter = filter;
+		conversionInfo.forceExplicitReconstruction = VK_FALSE;
+
+		VK_ASSERT(vkCreateSamplerYcbcrConversion(device, &conversionInfo, nullptr, &offscreenConversion), "Failed to create Y'CbCr conversion")
+
+		VkSamplerYcbcrConversionInfo samplerConversion = {};
+		samplerConversion.sType = VK_STRUCTURE_TYPE_SAMPLER_YCBCR_CONVERSION_INFO;
+		samplerConversion.conversion = offscreenConversion;
+
+		VkSamplerCreateInfo samplerInfo = {};
+		samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+		samplerInfo.pNext = &samplerConversion;
+		samplerInfo.magFilter = filter;
+		samplerInfo.minFilter = filter;
+		samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+		samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+		samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+		samplerInfo.anisotropyEnable = VK_FALSE;
+		samplerInfo.maxAnisotropy = 1.0f;
+		samplerInfo.borderColor = VK_BORDER_COLOR_INT_OPAQUE_BLACK;
+		samplerInfo.unnormalizedCoordinates = VK_FALSE;
+		samplerInfo.compareEnable = VK_FALSE;
+		samplerInfo.compareOp = VK_COMPARE_OP_ALWAYS;
+		samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+
+		VK_ASSERT(vkCreateSampler(device, &samplerInfo, nullptr, &offscreenSampler), "Failed to create Y'CbCr sampler!")
+
+		// The conversion spits out the video's own R'G'B', which must not be gamma encoded a second time
+		offscreenOutputFormat = VK_FORMAT_R8G8B8A8_UNORM;
+
+		// Some implementations spend several descriptors on one multi-planar image
+		VkPhysicalDeviceImageFormatInfo2 imageFormatInfo = {};
+		imageFormatInfo.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_IMAGE_FORMAT_INFO_2;
+		imageFormatInfo.format = inputFormat;
+		imageFormatInfo.type = VK_IMAGE_TYPE_2D;
+		imageFormatInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+		imageFormatInfo.usage = VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+
+		VkSamplerYcbcrConversionImageFormatProperties ycbcrProps = {};
+		ycbcrProps.sType = VK_STRUCTURE_TYPE_SAMPLER_YCBCR_CONVERSION_IMAGE_FORMAT_PROPERTIES;
+
+		VkImageFormatProperties2 imageFormatProps = {};
+		imageFormatProps.sType = VK_STRUCTURE_TYPE_IMAGE_FORMAT_PROPERTIES_2;
+		imageFormatProps.pNext = &ycbcrProps;
+
+		VK_ASSERT(vkGetPhysicalDeviceImageFormatProperties2(physicalDev, &imageFormatInfo, &imageFormatProps), "YUV format isn't supported for sampled images")
+		descriptorsPerSampler = std::max(1u, ycbcrProps.combinedImageSamplerDescriptorCount);
+	}
+
+	// Same bindings as Setup(), except that a Y'CbCr sampler has to be baked into the layout
+	VkDescriptorSetLayoutBinding layoutBindings[2] = {{}, {}};
+
+	layoutBindings[0].binding = 0;
+	layoutBindings[0].descriptorCount = 1;
+	layoutBindings[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+	layoutBindings[0].stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+
+	layoutBindings[1].binding = 1;
+	layoutBindings[1].descriptorCount = 1;
+	layoutBindings[1].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	layoutBindings[1].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+	layoutBindings[1].pImmutableSamplers = offscreenConversion != VK_NULL_HANDLE ? &offscreenSampler : nullptr;
+
+	VkDescriptorSetLayoutCreateInfo layoutInfo = {};
+	layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+	layoutInfo.bindingCount = 2;
+	layoutInfo.pBindings = layoutBindings;
+
+	VK_ASSERT(vkCreateDescriptorSetLayout(device, &layoutInfo, nullptr, &offscreenDescriptorLayout), "Failed to create Offscreen Descriptor Layout!")
+
+	VkPipelineLayoutCreateInfo pipelineLayoutInfo = {};
+	pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+	pipelineLayoutInfo.setLayoutCount = 1;
+	pipelineLayoutInfo.pSetLayouts = &offscreenDescriptorLayout;
+
+	VK_ASSERT(vkCreatePipelineLayout(device, &pipelineLayoutInfo, nullptr, &offscreenPipelineLayout), "Failed to create Offscreen Pipeline Layout")
+
+	// Same as the swapchain pass, but the result ends up as a copy source for readback
+
+	VkAttachmentDescription colorAttachment = {};
+	colorAttachment.finalLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+	colorAttachment.format = offscreenOutputFormat;
+	colorAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	colorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+	colorAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
+	colorAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+	colorAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+	colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+
+	VkAttachmentReference colorAttachmentReference = {};
+	colorAttachmentReference.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+
+	VkSubpassDescription subpassDescription = {};
+	subpassDescription.colorAttachmentCount = 1;
+	subpassDescription.pColorAttachments = &colorAttachmentReference;
+	subpassDescription.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+
+	VkSubpassDependency subpassDependencies[2] = {{}, {}};
+	subpassDependencies[0].srcSubpass = VK_SUBPASS_EXTERNAL;
+	subpassDependencies[0].dstSubpass = 0;
+	subpassDependencies[0].srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+	subpassDependencies[0].dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+	subpassDependencies[0].srcAccessMask = 0;
+	subpassDependencies[0].dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+
+	subpassDependencies[1].srcSubpass = 0;
+	subpassDependencies[1].dstSubpass = VK_SUBPASS_EXTERNAL;
+	subpassDependencies[1].srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+	subpassDependencies[1].dstStageMask = VK_PIPELINE_STAGE_TRANSFER_BIT;
+	subpassDependencies[1].srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+	subpassDependencies[1].dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+
+	VkRenderPassCreateInfo renderPassCreateInfo = {};
+	renderPassCreateInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+	renderPassCreateInfo.attachmentCount = 1;
+	renderPassCreateInfo.pAttachments = &colorAttachment;
+	renderPassCreateInfo.subpassCount = 1;
+	renderPassCreateInfo.pSubpasses = &subpassDescription;
+	renderPassCreateInfo.dependencyCount = 2;
+	renderPassCreateInfo.pDependencies = subpassDependencies;
+
+	VK_ASSERT(vkCreateRenderPass(device, &renderPassCreateInfo, nullptr, &offscreenPass), "Failed to create Offscreen Render Pass!")
+
+	offscreenPipeline = CreatePipeline(offscreenPass, offscreenPipelineLayout, 0, 0, SHADERS_FILTER);
+
+	// Every slot samples its own input, so each gets a descriptor set
+
+	VkDescriptorPoolSize poolSizes[2];
+
+	poolSizes[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+	poolSizes[0].descriptorCount = slotCount;
+
+	poolSizes[1].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	poolSizes[1].descriptorCount = slotCount * descriptorsPerSampler;
+
+	VkDescriptorPoolCreateInfo poolInfo = {};
+	poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+	poolInfo.poolSizeCount = 2;
+	poolInfo.pPoolSizes = poolSizes;
+	poolInfo.maxSets = slotCount;
+
+	VK_ASSERT(vkCreateDescriptorPool(device, &poolInfo, nullptr, &offscreenDescriptorPool), "Failed to create Offscreen Descriptor Pool!")
+
+	offscreenSlots.resize(slotCount);
+
+	VkFenceCreateInfo fenceInfo = {};
+	fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+	fenceInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
+
+	for (auto &slot : offscreenSlots) {
+		VkDescriptorSetAllocateInfo setAllocInfo = {};
+		setAllocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+		setAllocInfo.descriptorPool = offscreenDescriptorPool;
+		setAllocInfo.descriptorSetCount = 1;
+		setAllocInfo.pSetLayouts = &offscreenDescriptorLayout;
+
+		VK_ASSERT(vkAllocateDescriptorSets(device, &setAllocInfo, &slot.descriptorSet), "Failed to allocate Offscreen Descriptor Set!")
+
+		VkCommandBufferAllocateInfo commandBufferInfo = {};
+		commandBufferInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+		commandBufferInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+		commandBufferInfo.commandPool = graphicsPool;
+		commandBufferInfo.commandBufferCount = 1;
+
+		VK_ASSERT(vkAllocateCommandBuffers(device, &commandBufferInfo, &slot.commandBuffer), "Failed to allocate Offscreen Command Buffer")
+		VK_ASSERT(vkCreateFence(device, &fenceInfo, nullptr, &slot.fence), "Failed to create Offscreen Fence")
+	}
+}
+
+void VulkanCTX::ReleaseOffscreen()
+{
+	if (offscreenSlots.empty())
+		return;
+
+	for (auto &slot : offscreenSlots) {
+		vkWaitForFences(device, 1, &slot.fence, VK_TRUE, UINT64_MAX);
+		vkDestroyFence(device, slot.fence, nullptr);
+		vkFreeCommandBuffers(device, graphicsPool, 1, &slot.commandBuffer);
+
+		CancelUpload(slot.upload);
+		ReleaseTexture(slot.input);
+		ReleaseTexture(slot.output);
+		vkDestroyFramebuffer(device, slot.framebuffer, nullptr);
+
+		if (slot.stagingData)
+			vkUnmapMemory(device, slot.stagingMemory);
+		vkDestroyBuffer(device, slot.stagingBuffer, nullptr);
+		vkFreeMemory(device, slot.stagingMemory, nullptr);
+	}
+
+	offscreenSlots.clear();
+
+	vkDestroyDescriptorPool(device, offscreenDescriptorPool, nullptr);
+	vkDestroyPipeline(device, offscreenPipeline, nullptr);
+	vkDestroyPipelineLayout(device, offscreenPipelineLayout, nullptr);
+	vkDestroyDescriptorSetLayout(device, offscreenDescriptorLayout, nullptr);
+	vkDestroyRenderPass(device, offscreenPass, nullptr);
+	vkDestroySampler(device, offscreenSampler, nullptr);
+	vkDestroySamplerYcbcrConversion(device, offscreenConversion, nullptr);
+
+	offscreenDescriptorPool = VK_NULL_HANDLE;
+	offscreenPipeline = VK_NULL_HANDLE;
+	offscreenPipelineLayout = VK_NULL_HANDLE;
+	offscreenDescriptorLayout = VK_NULL_HANDLE;
+	offscreenPass = VK_NULL_HANDLE;
+	offscreenSampler = VK_NULL_HANDLE;
+	offscreenConversion = VK_NULL_HANDLE;
+}
+
+int32_t VulkanCTX::SubmitOffscreen(uint32_t index, VulkanUpload &input)
+{
+	OffscreenSlot &slot = offscreenSlots[index];
+	uint32_t width = input.texture.width;
+	uint32_t height = input.texture.height;
+
+	// The slot's fence was waited on in PollOffscreen(), so the previous staging buffer can go
+	CancelUpload(slot.upload);
+	slot.upload = input;
+	input = VulkanUpload();
+
+	return SubmitOffscreen(index, slot.upload.stagingBuffer, width, height);
+}
+
+VkDeviceSize VulkanCTX::getFrameSize(VkFormat format, uint32_t width, uint32_t height)
+{
+	// Planar 4:2:0 keeps Y, then U and V (or interleaved UV) at half resolution
+	if (format == VK_FORMAT_G8_B8_R8_3PLANE_420_UNORM || format == VK_FORMAT_G8_B8R8_2PLANE_420_UNORM)
+		return VkDeviceSize(width) * height + 2 * VkDeviceSize((width + 1) / 2) * ((height + 1) / 2);
+
+	return VkDeviceSize(width) * height * 4;
+}
+
+uint8_t *VulkanCTX::MapOffscreenInput(uint32_t index, uint32_t width, uint32_t height)
+{
+	OffscreenSlot &slot = offscreenSlots[index];
+	VkDeviceSize size = getFrameSize(offscreenInputFormat, width, height);
+
+	// Only this slot's submissions read it, and the slot is idle, so any thread may grow it
+	if (slot.stagingSize < size) {
+		if (slot.stagingData)
+			vkUnmapMemory(device, slot.stagingMemory);
+		vkDestroyBuffer(device, slot.stagingBuffer, nullptr);
+		vkFreeMemory(device, slot.stagingMemory, nullptr);
+
+		createBuffer(device, physicalDev, size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &slot.stagingBuffer, &slot.stagingMemory, nullptr, 0);
+		VK_ASSERT(vkMapMemory(device, slot.stagingMemory, 0, size, 0, &slot.stagingData), "Failed to map Offscreen staging buffer")
+		slot.stagingSize = size;
+	}
+
+	return static_cast<uint8_t *>(slot.stagingData);
+}
+
+int32_t VulkanCTX::SubmitOffscreen(uint32_t index, uint32_t width, uint32_t height)
+{
+	return SubmitOffscreen(index, offscreenSlots[index].stagingBuffer, width, height);
+}
+
+int32_t VulkanCTX::SubmitOffscreen(uint32_t index, VkBuffer staging, uint32_t width, uint32_t height)
+{
+	OffscreenSlot &slot = offscreenSlots[index];
+	bool yuv = offscreenInputFormat == VK_FORMAT_G8_B8_R8_3PLANE_420_UNORM || offscreenInputFormat == VK_FORMAT_G8_B8R8_2PLANE_420_UNORM;
+	VK_FATAL(yuv && (width % 2 || height % 2), "4:2:0 Offscreen input needs an even size")
+
+	// Textures are kept while the image size stays the same
+	if (slot.output.width != width || slot.output.height != height) {
+		ReleaseTexture(slot.input);
+		ReleaseTexture(slot.output);
+		vkDestroyFramebuffer(device, slot.framebuffer, nullptr);
+
+		// The input is only ever touched by graphics queue submissions, no need to share it
+		VkSamplerYcbcrConversionInfo conversionInfo = {};
+		conversionInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_YCBCR_CONVERSION_INFO;
+		conversionInfo.conversion = offscreenConversion;
+
+		createImage(device, physicalDev, width, height, offscreenInputFormat, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &slot.input.image, &slot.input.memory);
+		slot.input.view = createImageView(device, slot.input.image, offscreenInputFormat, offscreenConversion != VK_NULL_HANDLE ? &conversionInfo : nullptr);
+		slot.input.width = width;
+		slot.input.height = height;
+
+		createImage(device, physicalDev, width, height, offscreenOutputFormat, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &slot.output.image, &slot.output.memory);
+		slot.output.view = createImageView(device, slot.output.image, offscreenOutputFormat);
+		slot.output.width = width;
+		slot.output.height = height;
+
+		VkFramebufferCreateInfo framebufferInfo = {};
+		framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+		framebufferInfo.renderPass = offscreenPass;
+		framebufferInfo.attachmentCount = 1;
+		framebufferInfo.pAttachments = &slot.output.view;
+		framebufferInfo.width = width;
+		framebufferInfo.height = height;
+		framebufferInfo.layers = 1;
+
+		VK_ASSERT(vkCreateFramebuffer(device, &framebufferInfo, nullptr, &slot.framebuffer), "Failed to create Offscreen Framebuffer")
+	}
 
-	// Update descriptor set
 	VkDescriptorBufferInfo bufferInfo = {};
 	bufferInfo.buffer = uniformBuffer;
 	bufferInfo.offset = 0;
@@ -997,36 +3428,214 @@ void VulkanCTX::SetupTexture(uint8_t *data, uint32_t width, uint32_t height)
 
 	VkDescriptorImageInfo imageInfo = {};
 	imageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-	imageInfo.imageView = textureImageView;
-	imageInfo.sampler = textureSampler;
+	imageInfo.imageView = slot.input.view;
+	imageInfo.sampler = textureSampler; // ignored when the layout has the Y'CbCr sampler baked in
 
 	VkWriteDescriptorSet descriptorWrites[2] = {{}, {}};
 
 	descriptorWrites[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-	descriptorWrites[0].dstSet = descriptorSet;
+	descriptorWrites[0].dstSet = slot.descriptorSet;
 	descriptorWrites[0].dstBinding = 0;
-	descriptorWrites[0].dstArrayElement = 0;
 	descriptorWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
 	descriptorWrites[0].descriptorCount = 1;
 	descriptorWrites[0].pBufferInfo = &bufferInfo;
 
 	descriptorWrites[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-	descriptorWrites[1].dstSet = descriptorSet;
+	descriptorWrites[1].dstSet = slot.descriptorSet;
 	descriptorWrites[1].dstBinding = 1;
-	descriptorWrites[1].dstArrayElement = 0;
 	descriptorWrites[1].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
 	descriptorWrites[1].descriptorCount = 1;
 	descriptorWrites[1].pImageInfo = &imageInfo;
 
 	vkUpdateDescriptorSets(device, 2, descriptorWrites, 0, nullptr);
+
+	// Upload, filter and copy back in one submission
+
+	VkCommandBuffer commandBuffer = slot.commandBuffer;
+
+	VkCommandBufferBeginInfo beginInfo = {};
+	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+	vkBeginCommandBuffer(commandBuffer, &beginInfo);
+
+	transitionImageLayoutCmd(slot.input.image, offscreenInputFormat, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, commandBuffer);
+	copyBufferToPlanesCmd(width, height, offscreenInputFormat, staging, slot.input.image, commandBuffer);
+	transitionImageLayoutCmd(slot.input.image, offscreenInputFormat, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, commandBuffer);
+
+	VkClearValue clearColor = {0.0f, 0.0f, 0.0f, 1.0f};
+
+	VkRenderPassBeginInfo renderPassInfo = {};
+	renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+	renderPassInfo.renderPass = offscreenPass;
+	renderPassInfo.framebuffer = slot.framebuffer;
+	renderPassInfo.renderArea.offset = {0, 0};
+	renderPassInfo.renderArea.extent = {width, height};
+	renderPassInfo.clearValueCount = 1;
+	renderPassInfo.pClearValues = &clearColor;
+
+	VkViewport viewport = {0.0f, 0.0f, static_cast<float>(width), static_cast<float>(height), 0.0f, 1.0f};
+	VkRect2D scissor = {{0, 0}, {width, height}};
+
+	vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+	vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+	vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, offscreenPipeline);
+	vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, offscreenPipelineLayout, 0, 1, &slot.descriptorSet, 0, nullptr);
+	vkCmdDraw(commandBuffer, 6, 1, 0, 0);
+	vkCmdEndRenderPass(commandBuffer);
+
+	int32_t readback = RecordReadback(commandBuffer, slot.output.image, offscreenOutputFormat, width, height);
+	VK_FATAL(readback < 0, "Out of readback buffers, the ring needs an entry per slot and per image held downstream")
+
+	vkEndCommandBuffer(commandBuffer);
+
+	VkSubmitInfo submitInfo = {};
+	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+	submitInfo.commandBufferCount = 1;
+	submitInfo.pCommandBuffers = &commandBuffer;
+
+	vkResetFences(device, 1, &slot.fence);
+	VK_ASSERT(vkQueueSubmit(graphicsQueues[0], 1, &submitInfo, slot.fence), "Failed to submit Offscreen pass")
+
+	return readback;
 }
 
-void VulkanCTX::ReleaseTexture()
+bool VulkanCTX::PollOffscreen(uint32_t index, uint64_t timeout)
 {
-	vkDestroySampler(device, textureSampler, nullptr);
-	vkDestroyImageView(device, textureImageView, nullptr);
-	vkDestroyImage(device, textureImage, nullptr);
-	vkFreeMemory(device, textureMemory, nullptr);
+	return vkWaitForFences(device, 1, &offscreenSlots[index].fence, VK_TRUE, timeout) == VK_SUCCESS;
+}
+
+void VulkanCTX::SetupReadback(uint32_t count)
+{
+	// Cached memory makes the CPU side reads a lot faster, it just needs an invalidate before each read
+	readbackMemoryFlags = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_CACHED_BIT;
+	if (memoryType(physicalDev, ~0u, readbackMemoryFlags) == VK_MEMORY_PROPERTY_FLAG_BITS_MAX_ENUM)
+		readbackMemoryFlags = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+
+	VkPhysicalDeviceMemoryProperties memoryProps;
+	vkGetPhysicalDeviceMemoryProperties(physicalDev, &memoryProps);
+	readbackCoherent = memoryProps.memoryTypes[memoryType(physicalDev, ~0u, readbackMemoryFlags)].propertyFlags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+
+	VkEventCreateInfo eventInfo = {};
+	eventInfo.sType = VK_STRUCTURE_TYPE_EVENT_CREATE_INFO;
+
+	std::lock_guard<std::mutex> lock(readbackMutex);
+	readbacks.resize(count);
+
+	for (auto &readback : readbacks)
+		VK_ASSERT(vkCreateEvent(device, &eventInfo, nullptr, &readback.event), "Failed to create Readback Event")
+
+	readbackNext = 0;
+}
+
+void VulkanCTX::ReleaseReadback()
+{
+	std::lock_guard<std::mutex> lock(readbackMutex);
+
+	for (auto &readback : readbacks) {
+		if (readback.data)
+			vkUnmapMemory(device, readback.memory);
+		vkDestroyBuffer(device, readback.buffer, nullptr);
+		vkFreeMemory(device, readback.memory, nullptr);
+		vkDestroyEvent(device, readback.event, nullptr);
+	}
+
+	readbacks.clear();
+	screenshotReadback = -1;
+}
+
+int32_t VulkanCTX::RecordReadback(VkCommandBuffer commandBuffer, VkImage image, VkFormat format, uint32_t width, uint32_t height)
+{
+	int32_t index = -1;
+
+	{
+		std::lock_guard<std::mutex> lock(readbackMutex);
+
+		for (size_t i = 0; i < readbacks.size(); i++) {
+			uint32_t candidate = (readbackNext + i) % readbacks.size();
+			if (readbacks[candidate].state == READBACK_FREE) {
+				index = candidate;
+				break;
+			}
+		}
+
+		if (index < 0)
+			return -1;
+
+		readbacks[index].state = READBACK_RECORDED;
+		readbackNext = (index + 1) % readbacks.size();
+	}
+
+	// Free entries aren't touched by any other thread, so the buffer can grow outside the lock
+	Readback &readback = readbacks[index];
+	VkDeviceSize size = VkDeviceSize(width) * height * 4;
+
+	if (readback.size < size) {
+		if (readback.data)
+			vkUnmapMemory(device, readback.memory);
+		vkDestroyBuffer(device, readback.buffer, nullptr);
+		vkFreeMemory(device, readback.memory, nullptr);
+
+		createBuffer(device, physicalDev, size, VK_BUFFER_USAGE_TRANSFER_DST_BIT, readbackMemoryFlags, &readback.buffer, &readback.memory, nullptr, 0);
+		VK_ASSERT(vkMapMemory(device, readback.memory, 0, VK_WHOLE_SIZE, 0, &readback.data), "Failed to map Readback buffer")
+		readback.size = size;
+	}
+
+	readback.width = width;
+	readback.height = height;
+	readback.format = format;
+
+	VkBufferImageCopy regionCopy = {};
+	regionCopy.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	regionCopy.imageSubresource.layerCount = 1;
+	regionCopy.imageExtent = {width, height, 1};
+
+	vkCmdCopyImageToBuffer(commandBuffer, image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, readback.buffer, 1, &regionCopy);
+
+	// Make the copy visible to the host, then flag this entry. The event is per entry, so it doesn't
+	// matter when whoever owns the submission's fence resets it.
+	VkMemoryBarrier hostBarrier = {};
+	hostBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	hostBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	hostBarrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0, 1, &hostBarrier, 0, nullptr, 0, nullptr);
+	vkCmdSetEvent(commandBuffer, readback.event, VK_PIPELINE_STAGE_TRANSFER_BIT);
+
+	return index;
+}
+
+bool VulkanCTX::PollReadback(uint32_t index)
+{
+	Readback &readback = readbacks[index];
+
+	if (readback.state == READBACK_READY)
+		return true;
+
+	if (readback.state != READBACK_RECORDED || vkGetEventStatus(device, readback.event) != VK_EVENT_SET)
+		return false;
+
+	if (!readbackCoherent) {
+		VkMappedMemoryRange range = {};
+		range.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
+		range.memory = readback.memory;
+		range.offset = 0;
+		range.size = VK_WHOLE_SIZE;
+
+		vkInvalidateMappedMemoryRanges(device, 1, &range);
+	}
+
+	readback.state = READBACK_READY;
+	return true;
+}
+
+void VulkanCTX::FreeReadback(uint32_t index)
+{
+	std::lock_guard<std::mutex> lock(readbackMutex);
+
+	vkResetEvent(device, readbacks[index].event);
+	readbacks[index].state = READBACK_FREE;
 }
 
 void VulkanCTX::UpdateUniform(VulkanUBO newUBO)
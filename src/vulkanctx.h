@@ -1,8 +1,15 @@
 #pragma once
 
 #define GLFW_INCLUDE_VULKAN
+#include "bcenc.h"
+#include "pixelconv.h"
+#include "texfile.h"
+#include <atomic>
 #include <cstdlib>
+#include <functional>
 #include <iostream>
+#include <mutex>
+#include <unordered_map>
 #include <vector>
 #include <GLFW/glfw3.h>
 
@@ -21,16 +28,89 @@
 #define PRESENT_MODE VK_PRESENT_MODE_FIFO_KHR
 #endif
 
+#ifndef OFFSCREEN_FORMAT
+#define OFFSCREEN_FORMAT VK_FORMAT_R8G8B8A8_SRGB // batch output, read back as plain RGBA8
+#endif
+
+#ifndef MAX_TEXTURES
+#define MAX_TEXTURES 4096 // slots in the bindless texture array, fewer if the device can't take that many
+#endif
+
+#ifndef VIRTUAL_PAGE_SIZE
+#define VIRTUAL_PAGE_SIZE 256 // texels across a virtual texture page, with a 1 texel border for filtering
+#endif
+
+#ifndef FILTER_TILE_SIZE
+#define FILTER_TILE_SIZE 256 // texels across a tile of cached filter output, with a 1 texel border like virtual pages
+#endif
+
+#ifndef FILTER_CACHE_TILES
+#define FILTER_CACHE_TILES 12 // tiles across the filter cache, half float so 72 MB
+#endif
+
+#ifndef MIN_RENDER_SCALE
+#define MIN_RENDER_SCALE 0.25f // dynamic resolution never draws the view smaller than this, per side
+#endif
+
+static const uint32_t NO_TEXTURE_INDEX = 0xFFFFFFFF;
+
 struct VulkanUBO {
 	float time;
 };
 
+// Picks the textures the view shader samples from the bindless array, laid out like PushConstants
+// in view.frag.glsl and virtual.frag.glsl (std430). The view's filter cache is cut into tiles the
+// way virtual textures are cut into pages, so both read pageTable and the rest the same way.
+struct VulkanPushConstants {
+	uint32_t textureIndex; // the page cache for virtual textures
+	uint32_t compareIndex; // NO_TEXTURE_INDEX when not comparing
+	float split; // compareIndex shows right of this, 0 to 1 across the window
+	uint32_t pageTable; // or the view's tile table, NO_TEXTURE_INDEX filters the window directly
+	float view[4]; // x, y, width and height of the window in texture coordinates
+	float size[2]; // level 0 in texels
+	float level; // mip level the pages come from, or the filter samples
+	float pageTexels; // texels across a page or tile without its border
+	float cacheTexels; // texels across the page or filter cache
+	uint32_t cacheIndex; // the rest is for the view only, its filter cache
+	float tileOrigin[2]; // tile at the tile table's top left corner
+	float tint; // how much of the vertex color goes on, 0 while filling the cache
+};
+
+// One gallery thumbnail, laid out like Tile in gallery.vert.glsl (std430)
+struct VulkanTile {
+	float x, y, width, height; // top left corner and size in clip space
+	uint32_t textureIndex;
+	uint32_t padding[3];
+};
+
+struct VulkanTexture {
+	VkImage image = VK_NULL_HANDLE;
+	VkDeviceMemory memory = VK_NULL_HANDLE;
+	VkImageView view = VK_NULL_HANDLE;
+	VkFormat format = VK_FORMAT_R8G8B8A8_SRGB; // R8 and R8G8 views are swizzled to read as RGBA, 16-bit and float ones hold linear values
+	uint32_t width = 0, height = 0;
+	uint32_t levels = 1, layers = 1; // views show the first layer with all of its levels
+	uint32_t index = NO_TEXTURE_INDEX; // slot in the bindless texture array, none when headless or the array is full
+	VkDeviceSize size = 0; // device memory it holds, counted against the memory budget
+};
+
+// A texture on its way to the device through the transfer queue
+struct VulkanUpload {
+	VulkanTexture texture;
+	VkBuffer stagingBuffer = VK_NULL_HANDLE;
+	VkDeviceMemory stagingMemory = VK_NULL_HANDLE;
+	VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+	VkFence fence = VK_NULL_HANDLE;
+	VkDeviceSize stagingSize = 0;
+	std::vector<VkBufferImageCopy> regions; // every level and layer, empty for a single tightly packed level
+};
+
 class VulkanCTX {
 public:
 	VulkanCTX() { ResetCache(); }
 	virtual ~VulkanCTX() {}
 
-	bool Setup(int width, int height);  // initializes vulkanctx - false on failure
+	bool Setup(int width, int height, bool headless = false);  // initializes vulkanctx - false on failure, headless skips the window and swapchain
 	bool Resize(); // resizes swapchain - false on failure
 	void Release(); // destroys vulkanctx
 	void ResetCache(); // clears internal cache
@@ -41,19 +121,157 @@ public:
 	void SetupGraphics(uint32_t width, uint32_t height); // Sets up Material
 	void DrawGraphics(); // Draws material on quad
 
-	void SetupTexture(uint8_t *data, uint32_t width, uint32_t height);
+	void SetupTexture(const void *data, uint32_t width, uint32_t height, uint32_t channels = 4, PixelType type = PIXEL_U8);
+	void SetupTexture(VulkanUpload &upload); // waits for a prepared upload and shows it
 	void ReleaseTexture();
 
+	bool PrepareUpload(const void *data, uint32_t width, uint32_t height, VulkanUpload &upload, uint32_t channels = 4, PixelType type = PIXEL_U8); // fills a staging buffer - safe from any thread, 16-bit and float input must be RGBA
+	bool PrepareRawUpload(const void *texels, VkFormat format, uint32_t width, uint32_t height, VulkanUpload &upload); // same, texels are already in format
+	bool PrepareUpload(const uint8_t *file, const TextureFileInfo &info, VulkanUpload &upload); // every level and layer of a parsed KTX2 or DDS file, false if the device can't sample its format
+	bool canSample(VkFormat format); // filterable and a valid copy destination
+	VkFormat getUploadFormat(const void *data, uint32_t width, uint32_t height, uint32_t channels, PixelType type); // format PrepareUpload() picks for this image
+	void ConvertTexels(void *dst, const void *data, uint32_t width, uint32_t height, uint32_t channels, PixelType type, VkFormat format); // what PrepareUpload() writes to staging, getTextureSize() bytes
+	void SetFullFloat(bool enable); // keep float images as R32G32B32A32 instead of half float
+	VkFormat getTextureFormat(uint32_t channels, PixelType type);
+	uint32_t getTexelSize(uint32_t channels, PixelType type); // bytes per pixel on the device, uncompressed
+	static VkDeviceSize getTextureSize(VkFormat format, uint32_t width, uint32_t height); // bytes on the device, BC formats in whole blocks
+	void SetCompression(BCFormat format, JobSystem *jobs = nullptr); // BC1 compresses opaque 8-bit images and BC7 the rest, BC7 everything - falls back to plain textures without device support
+	void PrintCompressionStats();
+	inline BCFormat getCompression() { return compression; }
+	bool SubmitUpload(VulkanUpload &upload); // copies staging into a new texture on the transfer queue - false when device memory ran out even after evicting, the upload stays prepared
+	void SubmitUpload(VulkanUpload &upload, const VulkanTexture &target); // same, into an existing texture of the same size and format - no frame may still sample it, see isFrameRetired()
+	bool PollUpload(VulkanUpload &upload); // true once the copy finished, frees the staging buffer
+	void CancelUpload(VulkanUpload &upload);
+	void SwapTexture(VulkanTexture &newTexture); // displays newTexture and retires the old one once no frame uses it
+	void ShowTexture(const VulkanTexture &texture); // displays a freshly uploaded texture the caller keeps, like the frames of an animation ring
+	void RetireTexture(VulkanTexture &texture); // releases it once no frame in flight can sample it
+	void ReleaseTexture(VulkanTexture &texture);
+	uint32_t BindTexture(VulkanTexture &texture); // gives it a slot in the bindless array, SubmitUpload() does this for every new texture - NO_TEXTURE_INDEX when headless or full
+	void UnbindTexture(VulkanTexture &texture); // frees its slot right away, no frame in flight may still sample it - ReleaseTexture() does this
+	void SetCompareTexture(const VulkanTexture &texture); // freshly uploaded, shown right of the split next to the current texture and kept by the caller like ShowTexture() - an empty texture ends the comparison
+	inline void SetCompareSplit(float split) { if (split != compareSplit) RequestRedraw(); compareSplit = split; }
+	inline uint32_t getTextureCapacity() { return textureCapacity; }
+	inline bool hasBindless() { return bindless; } // false without descriptor indexing, the window then shows one texture with the plain filter
+	void TransitionTexture(const VulkanTexture &texture); // freshly uploaded and only sampled through its bindless slot, like gallery thumbnails - shader readable from the next frame on
+	bool UpdateTextureRegion(uint32_t x, uint32_t y, uint32_t width, uint32_t height, const void *data, size_t stride, uint32_t channels = 4, PixelType type = PIXEL_U8); // rewrites part of the displayed texture right before this frame draws, call between Update() or WaitFrame() and DrawGraphics() - stride in bytes, false if the texture can't take it
+	bool CopyToTexture(const VulkanTexture &texture, uint32_t level, uint32_t x, uint32_t y, uint32_t width, uint32_t height, const void *texels); // same for any shader readable texture, texels tightly packed in its format - false if it's compressed or the region doesn't fit
+	inline uint64_t getFrameCount() { return frameCount; } // frames submitted so far
+	inline bool isFrameRetired(uint64_t frame) { return frame + 2 * swapchainImages.size() <= frameCount; } // nothing recorded up to frame still runs or binds what it sampled
+
+	// Residency, uploads that would go over the memory budget first take memory back from textures
+	// that can be loaded again, least recently drawn first. So does a failed allocation, which then
+	// waits for the retired textures to go too and tries again.
+	void SetEvictable(const VulkanTexture &texture, std::function<void()> evict); // evict() has to retire or release texture, it's called from SubmitUpload() - bound textures only, shown ones never go
+	void SetMemoryBudget(VkDeviceSize budget); // bytes of textures, 0 = what VK_EXT_memory_budget leaves us or 3/4 of the device local heap
+	VkDeviceSize getMemoryBudget();
+	inline VkDeviceSize getResidentBytes() { return residentBytes; } // every texture from SubmitUpload() still around, retired ones too
+	void PrintResidencyStats();
+
+	// Virtual textures, the view samples an image too big for any texture through a page table. Pages
+	// and table entries are written with CopyToTexture(), so they change in step with the frame.
+	void ShowVirtualTexture(const VulkanTexture &cache, const VulkanTexture &pageTable, uint32_t width, uint32_t height); // shader readable, both stay with the caller - width and height of level 0, an empty cache goes back to the regular view
+	inline void SetVirtualView(float x, float y, float width, float height, float level) { if (x != virtualView[0] || y != virtualView[1] || width != virtualView[2] || height != virtualView[3] || level != virtualLevel) RequestRedraw(); virtualView[0] = x; virtualView[1] = y; virtualView[2] = width; virtualView[3] = height; virtualLevel = level; } // window in texture coordinates, pages come from level
+
+	// Zoom and pan, the window shows a rectangle of the texture and the filter runs at the mip level that
+	// matches. Its output is cut into tiles kept in a cache, so only tiles new to the window get filtered.
+	inline void SetView(float x, float y, float width, float height) { viewRect[0] = x; viewRect[1] = y; viewRect[2] = width; viewRect[3] = height; RequestRedraw(); } // window in texture coordinates
+	inline void ResetView() { SetView(0.0f, 0.0f, 1.0f, 1.0f); } // all of the texture
+	void ZoomView(float factor, float x, float y); // > 1 zooms in, the point at window pixel x, y stays put
+	void PanView(float dx, float dy); // by window pixels
+	void PrintFilterStats();
+
+	// Dynamic resolution, the view is drawn into a target the size of the window at a scale that follows
+	// the GPU time timestamps measured for it, then stretched over the window. Only the viewport changes.
+	inline void SetFrameBudget(float ms) { frameBudget = ms; } // GPU time the view may take, 0 = always full resolution - call before Resize()
+	inline float getRenderScale() { return renderScale; }
+	void PrintScaleStats();
+
+	// Offscreen filtering, each slot runs upload, draw and readback in one submission.
+	// 4:2:0 input formats (G8_B8_R8_3PLANE = I420, G8_B8R8_2PLANE = NV12) are converted to RGB by the sampler,
+	// their frames must have an even width and height.
+	void SetupOffscreen(uint32_t slotCount, VkFormat inputFormat = VK_FORMAT_R8G8B8A8_SRGB, VkSamplerYcbcrModelConversion ycbcrModel = VK_SAMPLER_YCBCR_MODEL_CONVERSION_YCBCR_709);
+	void ReleaseOffscreen();
+	int32_t SubmitOffscreen(uint32_t slot, VulkanUpload &input); // takes over a prepared upload, slot must be idle - returns the result's readback
+	uint8_t *MapOffscreenInput(uint32_t slot, uint32_t width, uint32_t height); // the slot's own staging memory, write a frame in the input format here while it's idle
+	int32_t SubmitOffscreen(uint32_t slot, uint32_t width, uint32_t height); // same, but filters whatever is in the slot's staging memory
+	bool PollOffscreen(uint32_t slot, uint64_t timeout = 0); // true once the slot is idle again
+	inline uint32_t getOffscreenSlotCount() { return static_cast<uint32_t>(offscreenSlots.size()); }
+	inline bool hasYcbcrSupport() { return ycbcrSupported; }
+	static VkDeviceSize getFrameSize(VkFormat format, uint32_t width, uint32_t height); // tightly packed, as MapOffscreenInput() expects it
+
+	// Gallery, all thumbnails in one instanced draw instead of the single view quad. Call
+	// SetupGallery() before the main loop, the instance buffers follow the swapchain around.
+	bool SetupGallery(uint32_t maxTiles); // false when headless
+	void ReleaseGallery(); // the device has to be idle
+	uint32_t SetGalleryTiles(const VulkanTile *tiles, uint32_t count); // what this frame draws, call between Update() and DrawGraphics() - returns how many fit
+	inline uint32_t getGalleryMaxTiles() { return galleryMaxTiles; }
+
+	// Readback ring, copies are recorded into the caller's command buffer and picked up
+	// whenever they land, so the CPU can chew on one frame while the next one renders
+	void SetupReadback(uint32_t count);
+	void ReleaseReadback();
+	int32_t RecordReadback(VkCommandBuffer commandBuffer, VkImage image, VkFormat format, uint32_t width, uint32_t height); // image in TRANSFER_SRC_OPTIMAL - -1 when the ring is full
+	bool PollReadback(uint32_t index); // true once the copy is visible to the host, call from the thread that recorded it
+	void FreeReadback(uint32_t index); // done with the view, safe from any thread
+	inline const uint8_t *getReadbackData(uint32_t index) { return static_cast<const uint8_t *>(readbacks[index].data); } // mapped memory, no copy
+	inline uint32_t getReadbackWidth(uint32_t index) { return readbacks[index].width; }
+	inline uint32_t getReadbackHeight(uint32_t index) { return readbacks[index].height; }
+	inline VkFormat getReadbackFormat(uint32_t index) { return readbacks[index].format; }
+
+	inline void RequestScreenshot() { screenshotRequested = true; RequestRedraw(); }
+	int32_t PollScreenshot(); // readback index of a finished screenshot, or -1
+
 	void UpdateUniform(VulkanUBO newUBO);
 
+	// On-demand drawing, everything that changes what the window shows asks for a redraw. A few frames
+	// follow each one, so whatever was retired on the way goes and rings waiting on isFrameRetired() move on.
+	inline void RequestRedraw() { redrawUntil = frameCount + 2 * swapchainImages.size(); }
+	inline bool NeedsRedraw() { return frameCount < redrawUntil; }
+	void WaitFrame(); // until this frame's command buffer and staging are free again, Update() does it first - for loops that don't draw every time around
+
 	inline int ShouldClose() { return glfwWindowShouldClose(window); }
 	inline void PollEvents() { glfwPollEvents(); }
+	inline void WaitEvents(double timeout) { glfwWaitEventsTimeout(timeout); }
 	inline GLFWwindow *getWindow() { return window; }
 
 	inline VkCommandBuffer getCurrentCommandBuffer() { return presentCommandBuffer[currentImage]; }
 	inline VkImage getCurrentImage() { return swapchainImages[currentImage]; }
 
 protected:
+	enum PipelineShaders {
+		SHADERS_FILTER, // fs.frag.glsl, offscreen filtering with its own sampler binding, and the window without bindless
+		SHADERS_VIEW, // picks from the bindless array by push constant
+		SHADERS_GALLERY, // instanced thumbnails
+		SHADERS_VIRTUAL, // the view's pipeline layout, samples through a page table
+		SHADERS_UPSCALE // same layout, stretches the scaled target over the window
+	};
+
+	VkPipeline CreatePipeline(VkRenderPass pass, VkPipelineLayout layout, uint32_t width, uint32_t height, PipelineShaders shaders = SHADERS_FILTER); // 0x0 = dynamic viewport
+	int32_t SubmitOffscreen(uint32_t slot, VkBuffer staging, uint32_t width, uint32_t height);
+	void *MapUpload(VulkanUpload &upload, VkDeviceSize size); // creates and maps the staging buffer, nullptr on failure
+	void SubmitCopy(VulkanUpload &upload, VkImage image);
+	bool AllocateTexture(VulkanTexture &texture); // image and memory, evicts and retries when the device runs out - false if nothing could be given back
+	bool Evict(VkDeviceSize bytes); // asks owners for at least bytes, least recently drawn first - false if nothing could go
+	bool ReleaseRetired(); // waits for the graphics queue, then frees retired textures this frame doesn't draw - false if there were none
+	inline void TouchTexture(uint32_t index) { if (index < residents.size()) residents[index].lastUsed = frameCount; }
+	void *StageRegion(VkImage image, uint32_t level, uint32_t x, uint32_t y, uint32_t width, uint32_t height, VkDeviceSize size); // room for size bytes of texels in this frame's staging buffer, copied before it draws
+	void DropRegions(VkImage image);
+	void RecordRegions(VkCommandBuffer commandBuffer);
+	void ReleaseRegions();
+	void SetupGalleryFrames();
+	void ReleaseGalleryFrames();
+	void SetupSingleSets(); // one per swapchain image, the uniform written in already
+	void ReleaseSingleSets();
+	void SetupFilterCache();
+	void ReleaseFilterCache();
+	bool UpdateFilterTiles(); // picks the window's tiles and stages the table, call before RecordRegions() - false filters the window directly
+	void RecordFilterTiles(VkCommandBuffer commandBuffer); // filters the tiles that weren't in the cache
+	void DropFilterTiles(uint32_t x, uint32_t y, uint32_t width, uint32_t height); // level 0 texels of the shown texture changed
+	void DropFilterTiles();
+	static inline uint64_t getTileKey(uint32_t level, uint32_t x, uint32_t y) { return uint64_t(level) << 48 | uint64_t(y) << 24 | x; }
+	void SetupScaledTarget(uint32_t width, uint32_t height);
+	void ReleaseScaledTarget();
+	void UpdateRenderScale(double ms, float scale); // GPU time of a frame that just finished, drawn at scale
 
 	// VulkanRenderer {
 	VkInstance instance;
@@ -63,6 +281,8 @@ protected:
 
 	std::vector<VkFramebuffer> framebuffers; // Rendertargets
 	VkRenderPass renderPass;		 // Global Renderpass
+	bool headless;
+	bool ycbcrSupported;
 	// }
 
 	// Material {
@@ -70,7 +290,7 @@ protected:
 	VkPipeline pipeline;
 	VkDescriptorSetLayout descriptorLayout;
 	VkDescriptorPool descriptorPool;
-	VkDescriptorSet descriptorSet;
+	VkDescriptorSet descriptorSet; // the uniform buffer
 	VkBuffer uniformBuffer;
 	VkDeviceMemory uniformBufferMemory;
 	// };
@@ -104,6 +324,8 @@ protected:
 	std::vector<VkFence> inFlightFences; // in flight
 	std::vector<VkSemaphore> acquireSemaphores; // available
 	std::vector<VkSemaphore> presentSemaphores; // finished
+	uint64_t frameCount;
+	uint64_t redrawUntil; // frameCount that's drawn enough since the last RequestRedraw()
 	// }
 
 	// Texture2D {
@@ -111,5 +333,199 @@ protected:
 	VkDeviceMemory textureMemory; // TODO: This is VERY bad! Use an allocator.
 	VkImageView textureImageView;
 	VkSampler textureSampler;
+	uint32_t textureIndex;
+	VkFormat textureFormats[4]; // 8-bit by channel count, RGBA where the device can't filter the small formats
+	VkFormat floatFormat;
+	VkFormat textureFormat;
+	uint32_t textureWidth, textureHeight, textureLevels;
+	VkDeviceSize textureBytes;
+	bool textureOwned; // false while ShowTexture()'s texture is up
+
+	BCFormat compression;
+	JobSystem *compressionJobs;
+	bool bc1Supported, bc7Supported;
+	std::atomic<uint64_t> compressNs, compressPixels;
+	std::atomic<uint64_t> compressedBytes, uncompressedBytes;
+
+	struct RetiredTexture {
+		VulkanTexture texture;
+		uint64_t frame; // frameCount when it was swapped out
+	};
+
+	std::vector<VkImage> pendingTransitions; // uploaded on the transfer queue, made shader readable in the next frame
+	std::vector<RetiredTexture> retiredTextures;
+
+	// Region updates are staged per frame in flight and copied in that frame's command buffer,
+	// so nothing gets recreated and only the changed texels travel
+	struct RegionCopy {
+		VkImage image;
+		VkBufferImageCopy copy;
+		uint32_t batch; // copies in one batch never overlap, later batches wait for earlier ones
+	};
+
+	struct RegionStaging {
+		VkBuffer buffer = VK_NULL_HANDLE;
+		VkDeviceMemory memory = VK_NULL_HANDLE;
+		VkDeviceSize size = 0, used = 0;
+		void *data = nullptr; // persistently mapped
+		std::vector<RegionCopy> copies;
+	};
+
+	std::vector<RegionStaging> regionStaging; // one per swapchain image, like presentCommandBuffer
+	// }
+
+	// Bindless {
+	// Every texture gets a slot in one big array, set once and updated after bind. Only slots a frame
+	// in flight samples have to stay put, so textures come and go without touching any pending set.
+	VkDescriptorSetLayout textureSetLayout;
+	VkDescriptorPool texturePool;
+	VkDescriptorSet textureSet;
+	uint32_t textureCapacity;
+	std::vector<uint32_t> freeTextureIndices;
+	uint32_t compareIndex;
+	float compareSplit;
+	// }
+
+	// Single texture {
+	// Without descriptor indexing the window draws the displayed texture like it always did, through one
+	// set with the uniform and the sampler. One per swapchain image, rewritten once its last frame is done.
+	bool bindless;
+	VkDescriptorSetLayout singleLayout;
+	VkPipelineLayout singlePipelineLayout;
+	VkDescriptorPool singlePool;
+	std::vector<VkDescriptorSet> singleSets;
+	VkPipeline singlePipeline;
+	// }
+
+	// Virtual texture {
+	VkPipeline virtualPipeline; // same layout as the view
+	uint32_t virtualCacheIndex, virtualTableIndex;
+	uint32_t virtualWidth, virtualHeight;
+	float virtualView[4];
+	float virtualLevel;
+	float virtualCacheTexels;
+	// }
+
+	// Filter cache {
+	// Tiles of the view's filter output at one level each, a slot per tile in one render target. The
+	// table says which slot holds each tile in the window, tiles that leave it stay until the slot is needed.
+	float viewRect[4];
+	uint32_t viewLevel;
+	VkRenderPass filterPass;
+	VkPipeline filterPipeline; // view.frag.glsl into the cache, dynamic viewport
+	VkFramebuffer filterFramebuffer;
+	VulkanTexture filterCache, filterTable;
+	bool filterFresh; // both still undefined, made shader readable in the next frame
+	std::vector<uint64_t> filterSlots; // tile key in each slot, ~0 when free
+	std::vector<uint64_t> filterSlotUsed; // frameCount of the last frame that showed it
+	std::unordered_map<uint64_t, uint32_t> filterTiles; // key to slot
+	std::vector<uint32_t> filterDraws; // slots filtered this frame
+	std::vector<uint32_t> filterEntries; // the table, grid of the window's tiles
+	uint32_t filterLevel, filterOrigin[2], filterGrid[2]; // what the table holds
+	bool filterTableValid;
+	uint64_t filteredTiles, reusedTiles, directFrames, viewFrames;
+	// }
+
+	// Dynamic resolution {
+	float frameBudget; // ms, 0 = off
+	float renderScale; // of the window, per side
+	double gpuTime; // ms, smoothed over the last few frames
+	float timestampPeriod; // ns per tick, 0 when the graphics queue can't take timestamps
+	VkQueryPool timestampPool; // two per swapchain image, around the view's offscreen part
+	std::vector<float> timestampScales; // render scale of the frame each swapchain image timed, 0 when it has no timestamps
+	VulkanTexture scaledTarget; // the swapchain's size, drawn through the filter cache's pass
+	VkFramebuffer scaledFramebuffer;
+	VkPipeline upscalePipeline;
+	bool scaledFresh; // still undefined, made shader readable in the next frame
+	uint64_t scaledFrames, timedFrames, scaleChanges;
+	double gpuTimeTotal, renderScaleTotal;
+	// }
+
+	// Residency {
+	struct Resident {
+		VkDeviceSize size = 0;
+		uint64_t lastUsed = 0; // frameCount of the last frame that drew it
+		std::function<void()> evict; // empty while it can't go
+	};
+
+	std::vector<Resident> residents; // by bindless slot
+	std::atomic<uint64_t> residentBytes;
+	VkDeviceSize memoryBudget; // 0 = ask the device
+	uint32_t localHeap; // the biggest device local heap, where textures go
+	bool memoryBudgetSupported;
+	uint32_t evictCount, allocRetries;
+	uint64_t evictedBytes;
+	// }
+
+	// Gallery {
+	struct GalleryFrame {
+		VkBuffer buffer = VK_NULL_HANDLE;
+		VkDeviceMemory memory = VK_NULL_HANDLE;
+		void *data = nullptr; // persistently mapped, galleryMaxTiles tiles
+		VkDescriptorSet descriptorSet = VK_NULL_HANDLE;
+		uint32_t count = 0; // tiles set for this frame, cleared once it's recorded
+	};
+
+	std::vector<GalleryFrame> galleryFrames; // one per swapchain image, like presentCommandBuffer
+	VkPipeline galleryPipeline;
+	VkPipelineLayout galleryPipelineLayout;
+	VkDescriptorSetLayout galleryDescriptorLayout;
+	VkDescriptorPool galleryDescriptorPool;
+	uint32_t galleryMaxTiles;
+	// }
+
+	// Offscreen {
+	struct OffscreenSlot {
+		VulkanUpload upload; // staging buffer of the image being filtered
+		VkBuffer stagingBuffer = VK_NULL_HANDLE; // persistent staging for MapOffscreenInput()
+		VkDeviceMemory stagingMemory = VK_NULL_HANDLE;
+		VkDeviceSize stagingSize = 0;
+		void *stagingData = nullptr;
+		VulkanTexture input;
+		VulkanTexture output;
+		VkFramebuffer framebuffer = VK_NULL_HANDLE;
+		VkDescriptorSet descriptorSet = VK_NULL_HANDLE;
+		VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+		VkFence fence = VK_NULL_HANDLE;
+	};
+
+	std::vector<OffscreenSlot> offscreenSlots;
+	VkRenderPass offscreenPass;
+	VkPipeline offscreenPipeline;
+	VkPipelineLayout offscreenPipelineLayout;
+	VkDescriptorSetLayout offscreenDescriptorLayout;
+	VkDescriptorPool offscreenDescriptorPool;
+	VkSampler offscreenSampler; // immutable, only with a Y'CbCr conversion
+	VkSamplerYcbcrConversion offscreenConversion;
+	VkFormat offscreenInputFormat;
+	VkFormat offscreenOutputFormat;
+	// }
+
+	// Readback {
+	enum ReadbackState {
+		READBACK_FREE,
+		READBACK_RECORDED, // copy recorded, waiting on the GPU
+		READBACK_READY // handed out until FreeReadback()
+	};
+
+	struct Readback {
+		VkBuffer buffer = VK_NULL_HANDLE;
+		VkDeviceMemory memory = VK_NULL_HANDLE;
+		VkDeviceSize size = 0;
+		void *data = nullptr; // persistently mapped
+		VkEvent event = VK_NULL_HANDLE; // set by the GPU right after the copy
+		VkFormat format = VK_FORMAT_UNDEFINED;
+		uint32_t width = 0, height = 0;
+		int state = READBACK_FREE;
+	};
+
+	std::vector<Readback> readbacks;
+	std::mutex readbackMutex; // guards entry states
+	VkMemoryPropertyFlags readbackMemoryFlags;
+	bool readbackCoherent;
+	uint32_t readbackNext;
+
+	bool screenshotRequested;
+	int32_t screenshotReadback;
 	// }
 };